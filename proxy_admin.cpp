@@ -0,0 +1,288 @@
+#include <vector>
+#include <format>
+#include <charconv>
+
+#include "proxy_admin.hpp"
+#include "proxy_logger.hpp"
+
+constexpr size_t ADMIN_RECV_BUFFER_SIZE = 4096;
+
+socket_t ProxyAdmin::admin_socket = INVALID_SOCKET;
+std::thread ProxyAdmin::admin_thread;
+
+bool ProxyAdmin::start(int port, ProxyContext &context)
+{
+    admin_socket = socket(AF_INET, SOCK_STREAM, IPPROTO_TCP);
+    if (admin_socket == INVALID_SOCKET)
+    {
+        log<LogLevel::Error, LogSubsystem::Server>("ADMIN|Socket creation failed: {}\n", getSocketError());
+        return false;
+    }
+
+    int exclusive = 1;
+    setsockopt(admin_socket, SOL_SOCKET, SO_REUSEADDR, (char *)&exclusive, sizeof(exclusive));
+
+    sockaddr_in admin_addr = {};
+    admin_addr.sin_family = AF_INET;
+    admin_addr.sin_port = htons(port);
+    admin_addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+
+    if (bind(admin_socket, (sockaddr *)&admin_addr, sizeof(admin_addr)) == SOCKET_ERROR ||
+        listen(admin_socket, 16) == SOCKET_ERROR)
+    {
+        log<LogLevel::Error, LogSubsystem::Server>("ADMIN|Cannot listen on 127.0.0.1:{}: {}\n", port, getSocketError());
+        closeSocket(admin_socket);
+        admin_socket = INVALID_SOCKET;
+        return false;
+    }
+
+    admin_thread = std::thread(serve, std::ref(context));
+    log<LogLevel::Info, LogSubsystem::Server>("ADMIN|Listening on 127.0.0.1:{}\n", port);
+    return true;
+}
+
+void ProxyAdmin::stop()
+{
+    if (admin_socket != INVALID_SOCKET)
+    {
+#ifdef _WIN32
+        closeSocket(admin_socket);
+#else
+        // close() alone does not wake a thread blocked in accept() on Linux.
+        shutdown(admin_socket, SHUT_RDWR);
+        closeSocket(admin_socket);
+#endif
+        admin_socket = INVALID_SOCKET;
+    }
+
+    if (admin_thread.joinable())
+        admin_thread.join();
+}
+
+void ProxyAdmin::serve(ProxyContext &context)
+{
+    socket_t listen_socket = admin_socket;
+
+    while (true)
+    {
+        socket_t client_socket = accept(listen_socket, nullptr, nullptr);
+        if (client_socket == INVALID_SOCKET)
+            break;
+
+        // Admin traffic is tiny and rare, so requests are served inline.
+        setSocketTimeout(client_socket, 5);
+        handleRequest(client_socket, context);
+        closeSocket(client_socket);
+    }
+}
+
+void ProxyAdmin::handleRequest(socket_t client_socket, ProxyContext &context)
+{
+    char buffer[ADMIN_RECV_BUFFER_SIZE];
+    int bytes_received = recv(client_socket, buffer, ADMIN_RECV_BUFFER_SIZE, 0);
+    if (bytes_received <= 0)
+        return;
+
+    std::string_view request(buffer, bytes_received);
+    std::string_view request_line = request.substr(0, request.find("\r\n"));
+
+    std::size_t target_start = request_line.find(' ');
+    std::size_t target_end = request_line.rfind(' ');
+    if (target_start == std::string_view::npos || target_end <= target_start)
+    {
+        sendResponse(client_socket, 400, "Bad Request", "bad request\n");
+        return;
+    }
+
+    std::string_view method = request_line.substr(0, target_start);
+    std::string_view target = request_line.substr(target_start + 1, target_end - target_start - 1);
+    std::string_view path = target.substr(0, target.find('?'));
+
+    if (method == "GET" && path == "/stats")
+        sendResponse(client_socket, 200, "OK", renderStats(context));
+    else if ((method == "GET" || method == "POST") && path == "/log")
+    {
+        std::string_view query = path.size() < target.size() ? target.substr(path.size() + 1) : std::string_view{};
+        if (method == "POST" && !applyLogLevels(query))
+            sendResponse(client_socket, 400, "Bad Request", "expected <subsystem|all>=<debug|info|warn|error|off> or sample_<subsystem|all>=<0..1>[&...]\n");
+        else
+            sendResponse(client_socket, 200, "OK", renderLogLevels());
+    }
+    else
+        sendResponse(client_socket, 404, "Not Found", "unknown admin endpoint\n");
+}
+
+void ProxyAdmin::sendResponse(socket_t client_socket, int status_code, std::string_view status, const std::string &body)
+{
+    std::string response = std::format("HTTP/1.1 {} {}\r\nContent-Type: text/plain\r\nContent-Length: {}\r\nConnection: close\r\n\r\n{}",
+                                       status_code, status, body.size(), body);
+
+    size_t sent = 0;
+    while (sent < response.size())
+    {
+        int n = send(client_socket, response.data() + sent, (int)(response.size() - sent), 0);
+        if (n == SOCKET_ERROR)
+            return;
+        sent += n;
+    }
+}
+
+bool ProxyAdmin::applyLogLevels(std::string_view query)
+{
+    struct Change
+    {
+        std::string_view name;
+        bool all;
+        LogSubsystem subsystem;
+        bool sample; // sample_<subsystem>=rate rather than <subsystem>=level
+        LogLevel level;
+        double rate;
+    };
+
+    // Validate everything first so a bad pair changes nothing.
+    std::vector<Change> changes;
+    while (!query.empty())
+    {
+        std::string_view pair = query.substr(0, query.find('&'));
+        query.remove_prefix(std::min(query.size(), pair.size() + 1));
+
+        std::size_t equals = pair.find('=');
+        if (equals == std::string_view::npos)
+            return false;
+        std::string_view name = pair.substr(0, equals);
+        std::string_view value = pair.substr(equals + 1);
+
+        Change change{name, false, LogSubsystem::Server, name.starts_with("sample_"), LogLevel::Info, 1.0};
+        std::string_view subsystem = change.sample ? name.substr(7) : name;
+        change.all = subsystem == "all";
+        if (!change.all && !parseLogSubsystem(subsystem, change.subsystem))
+            return false;
+        if (change.sample)
+        {
+            auto [ptr, ec] = std::from_chars(value.data(), value.data() + value.size(), change.rate);
+            if (ec != std::errc() || ptr != value.data() + value.size() || change.rate < 0.0 || change.rate > 1.0)
+                return false;
+        }
+        else if (!parseLogLevel(value, change.level))
+            return false;
+        changes.push_back(change);
+    }
+    if (changes.empty())
+        return false;
+
+    ProxyLogger &logger = ProxyLogger::getInstance();
+    for (const Change &change : changes)
+    {
+        for (std::size_t i = 0; i < LOG_SUBSYSTEM_COUNT; ++i)
+        {
+            if (!change.all && change.subsystem != static_cast<LogSubsystem>(i))
+                continue;
+            if (change.sample)
+                logger.set_sample_rate(static_cast<LogSubsystem>(i), change.rate);
+            else
+                logger.set_level(static_cast<LogSubsystem>(i), change.level);
+        }
+        if (change.sample)
+            log<LogLevel::Info, LogSubsystem::Server>("ADMIN|Log sampling for {} set to {}\n", change.name.substr(7), change.rate);
+        else
+            log<LogLevel::Info, LogSubsystem::Server>("ADMIN|Log level for {} set to {}\n", change.name, logLevelName(change.level));
+    }
+    return true;
+}
+
+std::string ProxyAdmin::renderLogLevels()
+{
+    std::string body;
+    for (std::size_t i = 0; i < LOG_SUBSYSTEM_COUNT; ++i)
+    {
+        LogSubsystem subsystem = static_cast<LogSubsystem>(i);
+        body += std::format("{}={} sample={:.3f}\n", logSubsystemName(subsystem), logLevelName(ProxyLogger::getInstance().level(subsystem)),
+                            ProxyLogger::getInstance().sample_rate(subsystem));
+    }
+    return body;
+}
+
+std::string ProxyAdmin::renderStats(ProxyContext &context)
+{
+    std::string body = std::format("cache eviction={}\n", proxy_cache::evictionPolicyName(context.cache_system.evictionPolicy()));
+
+    for (const proxy_cache::PartitionStats &p : context.cache_system.partitionStats())
+    {
+        body += std::format("partition {} priority={} quota_bytes={} bytes={} entries={} hits={} misses={} hit_ratio={:.3f}\n",
+                            p.name, p.priority, p.quota_bytes, p.bytes, p.entries, p.hits, p.misses, p.hitRatio());
+    }
+
+    proxy_cache::NegativeCacheStats negative = context.negative_cache.stats();
+    body += std::format("negative_cache entries={} bytes={} hits={} stores={}\n",
+                        negative.entries, negative.bytes, negative.hits, negative.stores);
+
+    for (const proxy_routing::PoolStats &pool : context.router.poolStats())
+    {
+        body += std::format("pool {} balance={} protocol={}\n", pool.name, proxy_routing::balancePolicyName(pool.balance), proxy_routing::upstreamProtocolName(pool.protocol));
+        for (const proxy_routing::BackendStats &b : pool.backends)
+        {
+            body += std::format("  backend {} state={} outstanding={} ewma_ms={:.2f} requests={} failures={} consecutive_failures={}\n",
+                                b.address, b.healthy ? "up" : "down", b.outstanding, b.ewma_ms, b.requests, b.failures, b.consecutive_failures);
+        }
+    }
+
+    for (const proxy_routing::ParentStats &parent : context.router.parentStats())
+    {
+        body += std::format("parent {} balance={} reused_connections={}\n", parent.name, proxy_routing::balancePolicyName(parent.balance), parent.reused);
+        for (std::size_t i = 0; i < parent.servers.size(); ++i)
+        {
+            const proxy_routing::BackendStats &b = parent.servers[i];
+            body += std::format("  server {} state={} outstanding={} ewma_ms={:.2f} requests={} failures={} idle_connections={}\n",
+                                b.address, b.healthy ? "up" : "down", b.outstanding, b.ewma_ms, b.requests, b.failures, parent.idle_connections[i]);
+        }
+    }
+
+    if (context.prefetcher.enabled())
+    {
+        proxy_cache::PrefetchStats prefetch = context.prefetcher.stats();
+        body += std::format("prefetch pages={} queued={} fetched={} already_cached={} dropped={} waiting={}\n",
+                            prefetch.pages, prefetch.queued, prefetch.fetched, prefetch.already_cached, prefetch.dropped, prefetch.waiting);
+    }
+
+    if (context.proxy_protocol.enabled())
+    {
+        proxy_http::ProxyProtocolStats pp = context.proxy_protocol.stats();
+        body += std::format("proxy_protocol headers={} local={} direct={} rejected={}\n", pp.headers, pp.local, pp.direct, pp.rejected);
+    }
+
+    if (context.interceptor.enabled())
+    {
+        proxy_tls::InterceptStats tls = context.interceptor.stats();
+        body += std::format("intercept client_sessions={} origin_sessions={} ktls={} bridged={} handshake_failures={} certificates={}\n",
+                            tls.client_sessions, tls.origin_sessions, tls.offloaded, tls.bridged, tls.handshake_failures, tls.certificates_issued);
+        body += std::format("  handshakes={} handshakes_per_sec={:.1f} client_resumed={} origin_resumed={} resumption_ratio={:.3f}\n",
+                            tls.handshakes, tls.handshake_rate, tls.client_resumed, tls.origin_resumed, tls.resumption_ratio);
+    }
+
+    LogStats log_stats = ProxyLogger::getInstance().stats();
+    body += std::format("log suppressed={} over_budget={} sampled_out={}\n", log_stats.suppressed, log_stats.over_budget, log_stats.sampled_out);
+    proxy_log::LogFileStats text_log = ProxyLogger::getInstance().text_stats();
+    body += std::format("text_log bytes_written={} dropped={} rotations={} reopens={}\n", text_log.bytes_written, text_log.dropped,
+                        text_log.rotations, text_log.reopens);
+
+    if (ProxyLogger::getInstance().binary())
+    {
+        proxy_log::BinaryLogStats binlog = ProxyLogger::getInstance().binary_stats();
+        body += std::format("binary_log events={} dropped={} bytes_written={} rotations={}\n", binlog.events, binlog.dropped,
+                            binlog.bytes_written, binlog.rotations);
+    }
+
+    for (const proxy_http::H2UpstreamStats &session : context.h2_upstreams.stats())
+        body += std::format("h2_upstream {} active_streams={} streams={}\n", session.origin, session.active_streams, session.streams);
+
+    for (const proxy_cluster::PeerStats &peer : context.cluster.stats())
+    {
+        body += std::format("peer {}{} state={} idle_connections={} forwarded={} failures={}\n",
+                            peer.address, peer.self ? " (self)" : "", peer.up ? "up" : "down",
+                            peer.idle_connections, peer.forwarded, peer.failures);
+        if (context.cluster.mode() == proxy_cluster::ClusterMode::Siblings && !peer.self)
+            body += std::format("  probes={} probe_hits={} digest_skips={} digest_entries={}\n",
+                                peer.probes, peer.probe_hits, peer.digest_skips, peer.digest_entries);
+    }
+    return body;
+}
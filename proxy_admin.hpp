@@ -0,0 +1,37 @@
+#pragma once
+
+#include <string>
+#include <string_view>
+#include <thread>
+
+#include "proxy_utils.hpp"
+#include "proxy_context.hpp"
+
+// Loopback-only HTTP endpoint for operators: GET /stats returns plain-text counters;
+// GET /log lists the per-subsystem log levels and sample rates; POST
+// /log?remote=debug&sample_cache=0.1 (or all=..., sample_all=...) changes them.
+class ProxyAdmin
+{
+private:
+    static socket_t admin_socket;
+    static std::thread admin_thread;
+
+    static void serve(ProxyContext &context);
+
+    static void handleRequest(socket_t client_socket, ProxyContext &context);
+
+    static void sendResponse(socket_t client_socket, int status_code, std::string_view status, const std::string &body);
+
+    static std::string renderStats(ProxyContext &context);
+
+    // "subsystem=level" and "sample_subsystem=rate" pairs joined by '&'; false (nothing
+    // applied) on any bad pair.
+    static bool applyLogLevels(std::string_view query);
+
+    static std::string renderLogLevels();
+
+public:
+    static bool start(int port, ProxyContext &context);
+
+    static void stop();
+};
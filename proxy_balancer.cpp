@@ -0,0 +1,313 @@
+#include <algorithm>
+#include <cmath>
+
+#include "proxy_balancer.hpp"
+#include "proxy_cache_key.hpp"
+#include "proxy_logger.hpp"
+
+using namespace proxy_routing;
+
+// Peak-EWMA decay window and the latency charged for a failed attempt, so a backend that
+// refuses connections instantly does not look like the fastest one.
+constexpr double EWMA_DECAY_NS = 10e9;
+constexpr double FAILURE_PENALTY_NS = 1e9;
+
+namespace
+{
+    std::uint64_t splitMix(std::uint64_t x)
+    {
+        x += 0x9e3779b97f4a7c15ULL;
+        x = (x ^ (x >> 30)) * 0xbf58476d1ce4e5b9ULL;
+        x = (x ^ (x >> 27)) * 0x94d049bb133111ebULL;
+        return x ^ (x >> 31);
+    }
+}
+
+const char *proxy_routing::balancePolicyName(BalancePolicy policy)
+{
+    switch (policy)
+    {
+    case BalancePolicy::RoundRobin:
+        return "round-robin";
+    case BalancePolicy::LeastOutstanding:
+        return "least-outstanding";
+    case BalancePolicy::PeakEwma:
+        return "peak-ewma";
+    case BalancePolicy::ConsistentHash:
+        return "consistent-hash";
+    }
+    return "unknown";
+}
+
+bool proxy_routing::parseBalancePolicy(std::string_view name, BalancePolicy &out)
+{
+    for (BalancePolicy policy : {BalancePolicy::RoundRobin, BalancePolicy::LeastOutstanding, BalancePolicy::PeakEwma, BalancePolicy::ConsistentHash})
+    {
+        if (name == balancePolicyName(policy))
+        {
+            out = policy;
+            return true;
+        }
+    }
+    return false;
+}
+
+UpstreamLease::UpstreamLease(UpstreamLease &&other) noexcept
+    : set(other.set), index(other.index), started(other.started), first_byte(other.first_byte)
+{
+    other.set = nullptr;
+}
+
+UpstreamLease &UpstreamLease::operator=(UpstreamLease &&other) noexcept
+{
+    if (this != &other)
+    {
+        release();
+        set = other.set;
+        index = other.index;
+        started = other.started;
+        first_byte = other.first_byte;
+        other.set = nullptr;
+    }
+    return *this;
+}
+
+const Backend &UpstreamLease::backend() const
+{
+    return set->backends[index]->backend;
+}
+
+void UpstreamLease::release()
+{
+    if (set)
+    {
+        set->backends[index]->outstanding.fetch_sub(1, std::memory_order_relaxed);
+        set = nullptr;
+    }
+}
+
+void UpstreamLease::firstByte()
+{
+    if (first_byte.count() < 0)
+        first_byte = std::chrono::steady_clock::now() - started;
+}
+
+void UpstreamLease::finish(bool success)
+{
+    if (!set)
+        return;
+
+    std::chrono::nanoseconds latency = first_byte.count() >= 0 ? first_byte : std::chrono::steady_clock::now() - started;
+    set->recordOutcome(index, success, latency);
+    release();
+}
+
+BackendSet::BackendSet(std::vector<Backend> pool_backends, BalancePolicy policy, HealthConfig health)
+    : policy(policy), health(health)
+{
+    for (Backend &backend : pool_backends)
+    {
+        auto state = std::make_unique<backend_state>();
+        state->backend = std::move(backend);
+        backends.push_back(std::move(state));
+    }
+
+    if (policy == BalancePolicy::ConsistentHash)
+    {
+        ring.reserve(backends.size() * VIRTUAL_NODES);
+        for (std::uint32_t i = 0; i < backends.size(); ++i)
+        {
+            std::string point = backends[i]->backend.host + ":" + backends[i]->backend.port + "#";
+            std::size_t prefix = point.size();
+            for (std::size_t v = 0; v < VIRTUAL_NODES; ++v)
+            {
+                point.resize(prefix);
+                point += std::to_string(v);
+                ring.emplace_back(proxy_cache::hashCacheKey(point), i);
+            }
+        }
+        std::sort(ring.begin(), ring.end());
+    }
+}
+
+std::int64_t BackendSet::nowTicks()
+{
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(clock::now().time_since_epoch()).count();
+}
+
+bool BackendSet::isHealthy(const backend_state &state, std::int64_t now) const
+{
+    return state.down_until.load(std::memory_order_relaxed) <= now;
+}
+
+double BackendSet::cost(const backend_state &state) const
+{
+    double ewma = state.ewma_ns.load(std::memory_order_relaxed);
+    std::uint32_t outstanding = state.outstanding.load(std::memory_order_relaxed);
+    return std::max(ewma, 1.0) * (outstanding + 1);
+}
+
+std::size_t BackendSet::pick(std::uint64_t key_hash, std::int64_t now, std::size_t avoid) const
+{
+    const std::size_t n = backends.size();
+
+    // Strict pass: healthy and not the one that just failed. Then relax health, then take
+    // anything, so a pool never refuses outright.
+    for (int level = 0; level < 3; ++level)
+    {
+        auto eligible = [&](std::size_t i)
+        {
+            if (level < 2 && i == avoid)
+                return false;
+            return level > 0 || isHealthy(*backends[i], now);
+        };
+
+        switch (policy)
+        {
+        case BalancePolicy::RoundRobin:
+        {
+            std::size_t start = next.fetch_add(1, std::memory_order_relaxed);
+            for (std::size_t k = 0; k < n; ++k)
+            {
+                if (eligible((start + k) % n))
+                    return (start + k) % n;
+            }
+            break;
+        }
+        case BalancePolicy::LeastOutstanding:
+        {
+            std::size_t start = next.fetch_add(1, std::memory_order_relaxed);
+            std::size_t best = NO_BACKEND;
+            std::uint32_t best_outstanding = 0;
+            for (std::size_t k = 0; k < n; ++k)
+            {
+                std::size_t i = (start + k) % n;
+                if (!eligible(i))
+                    continue;
+                std::uint32_t outstanding = backends[i]->outstanding.load(std::memory_order_relaxed);
+                if (best == NO_BACKEND || outstanding < best_outstanding)
+                {
+                    best = i;
+                    best_outstanding = outstanding;
+                }
+            }
+            if (best != NO_BACKEND)
+                return best;
+            break;
+        }
+        case BalancePolicy::PeakEwma:
+        {
+            // Power of two choices: two distinct random backends, keep the cheaper one.
+            if (n > 1)
+            {
+                std::uint64_t r = splitMix(next.fetch_add(1, std::memory_order_relaxed));
+                std::size_t a = r % n;
+                std::size_t b = (a + 1 + (r >> 32) % (n - 1)) % n;
+                if (eligible(a) && eligible(b))
+                    return cost(*backends[b]) < cost(*backends[a]) ? b : a;
+            }
+
+            // The pair hit an ineligible backend: fall back to the cheapest eligible one.
+            std::size_t best = NO_BACKEND;
+            for (std::size_t i = 0; i < n; ++i)
+            {
+                if (eligible(i) && (best == NO_BACKEND || cost(*backends[i]) < cost(*backends[best])))
+                    best = i;
+            }
+            if (best != NO_BACKEND)
+                return best;
+            break;
+        }
+        case BalancePolicy::ConsistentHash:
+        {
+            auto it = std::lower_bound(ring.begin(), ring.end(), std::make_pair(key_hash, std::uint32_t{0}));
+            for (std::size_t k = 0; k < ring.size(); ++k, ++it)
+            {
+                if (it == ring.end())
+                    it = ring.begin();
+                if (eligible(it->second))
+                    return it->second;
+            }
+            break;
+        }
+        }
+    }
+    return 0;
+}
+
+UpstreamLease BackendSet::acquire(std::uint64_t key_hash, std::size_t avoid)
+{
+    UpstreamLease lease;
+    if (backends.empty())
+        return lease;
+
+    std::size_t index = pick(key_hash, nowTicks(), avoid);
+    backends[index]->outstanding.fetch_add(1, std::memory_order_relaxed);
+    backends[index]->requests.fetch_add(1, std::memory_order_relaxed);
+
+    lease.set = this;
+    lease.index = index;
+    lease.started = clock::now();
+    return lease;
+}
+
+void BackendSet::recordOutcome(std::size_t index, bool success, std::chrono::nanoseconds latency)
+{
+    backend_state &state = *backends[index];
+    std::int64_t now = nowTicks();
+
+    double sample = static_cast<double>(latency.count());
+    if (success)
+    {
+        state.consecutive_failures.store(0, std::memory_order_relaxed);
+    }
+    else
+    {
+        sample = std::max(sample, FAILURE_PENALTY_NS);
+        state.failures.fetch_add(1, std::memory_order_relaxed);
+
+        std::uint32_t failures = state.consecutive_failures.fetch_add(1, std::memory_order_relaxed) + 1;
+        if (failures >= health.max_fails)
+        {
+            bool was_healthy = isHealthy(state, now);
+            state.down_until.store(now + std::chrono::duration_cast<std::chrono::nanoseconds>(health.fail_timeout).count(),
+                                   std::memory_order_relaxed);
+            if (was_healthy)
+                log<LogLevel::Warn, LogSubsystem::Remote>("{}:{} marked down after {} consecutive failures.\n",
+                    state.backend.host, state.backend.port, failures);
+        }
+    }
+
+    // Peak-sensitive EWMA: a slower sample takes over immediately, faster ones decay in.
+    std::lock_guard<std::mutex> lock(state.ewma_mutex);
+    double ewma = state.ewma_ns.load(std::memory_order_relaxed);
+    if (ewma == 0.0 || sample > ewma)
+    {
+        ewma = sample;
+    }
+    else
+    {
+        double weight = std::exp(-static_cast<double>(now - state.ewma_stamp) / EWMA_DECAY_NS);
+        ewma = ewma * weight + sample * (1.0 - weight);
+    }
+    state.ewma_stamp = now;
+    state.ewma_ns.store(ewma, std::memory_order_relaxed);
+}
+
+std::vector<BackendStats> BackendSet::stats() const
+{
+    std::vector<BackendStats> result;
+    std::int64_t now = nowTicks();
+
+    for (const auto &state : backends)
+    {
+        result.push_back(BackendStats{state->backend.host + ":" + state->backend.port,
+                                      state->outstanding.load(std::memory_order_relaxed),
+                                      state->ewma_ns.load(std::memory_order_relaxed) / 1e6,
+                                      state->consecutive_failures.load(std::memory_order_relaxed),
+                                      isHealthy(*state, now),
+                                      state->requests.load(std::memory_order_relaxed),
+                                      state->failures.load(std::memory_order_relaxed)});
+    }
+    return result;
+}
@@ -0,0 +1,140 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <vector>
+
+namespace proxy_routing
+{
+
+    struct Backend
+    {
+        std::string host;
+        std::string port;
+    };
+
+    enum class BalancePolicy
+    {
+        RoundRobin,
+        LeastOutstanding, // fewest in-flight requests, rotating tie-break
+        PeakEwma,         // power-of-two choices on latency EWMA x (outstanding + 1)
+        ConsistentHash    // URL hash on a ring of virtual nodes, for cache affinity
+    };
+
+    const char *balancePolicyName(BalancePolicy policy);
+    bool parseBalancePolicy(std::string_view name, BalancePolicy &out);
+
+    // Passive health: after max_fails consecutive failures a backend is skipped for
+    // fail_timeout, then gets traffic again; one more failure takes it straight back out.
+    struct HealthConfig
+    {
+        std::uint32_t max_fails = 3;
+        std::chrono::milliseconds fail_timeout{std::chrono::seconds(10)};
+    };
+
+    struct BackendStats
+    {
+        std::string address;
+        std::uint32_t outstanding;
+        double ewma_ms;
+        std::uint32_t consecutive_failures;
+        bool healthy;
+        std::uint64_t requests;
+        std::uint64_t failures;
+    };
+
+    class BackendSet;
+
+    // One request's claim on a backend. Counts as in flight until finish() or destruction;
+    // dropping it without finish() releases the slot without a health verdict.
+    class UpstreamLease
+    {
+    private:
+        friend class BackendSet;
+
+        BackendSet *set = nullptr;
+        std::size_t index = 0;
+        std::chrono::steady_clock::time_point started;
+        std::chrono::nanoseconds first_byte{-1};
+
+        void release();
+
+    public:
+        UpstreamLease() = default;
+        UpstreamLease(const UpstreamLease &) = delete;
+        UpstreamLease &operator=(const UpstreamLease &) = delete;
+        UpstreamLease(UpstreamLease &&other) noexcept;
+        UpstreamLease &operator=(UpstreamLease &&other) noexcept;
+        ~UpstreamLease() { release(); }
+
+        explicit operator bool() const { return set != nullptr; }
+        const Backend &backend() const;
+        std::size_t backendIndex() const { return index; }
+
+        // Latency sample for EWMA: time to the first response byte.
+        void firstByte();
+
+        // Records the outcome (connect/relay success or failure) and releases the slot.
+        void finish(bool success);
+    };
+
+    class BackendSet
+    {
+    private:
+        friend class UpstreamLease;
+
+        using clock = std::chrono::steady_clock;
+
+        struct backend_state
+        {
+            Backend backend;
+            std::atomic<std::uint32_t> outstanding{0};
+            std::atomic<std::uint32_t> consecutive_failures{0};
+            std::atomic<std::int64_t> down_until{0};
+            std::atomic<std::uint64_t> requests{0};
+            std::atomic<std::uint64_t> failures{0};
+
+            std::atomic<double> ewma_ns{0.0};
+            std::mutex ewma_mutex;
+            std::int64_t ewma_stamp = 0;
+        };
+
+        static constexpr std::size_t VIRTUAL_NODES = 64;
+
+        BalancePolicy policy;
+        HealthConfig health;
+        std::vector<std::unique_ptr<backend_state>> backends;
+        std::vector<std::pair<std::uint64_t, std::uint32_t>> ring;
+        mutable std::atomic<std::size_t> next{0};
+
+        static std::int64_t nowTicks();
+        bool isHealthy(const backend_state &state, std::int64_t now) const;
+        double cost(const backend_state &state) const;
+        std::size_t pick(std::uint64_t key_hash, std::int64_t now, std::size_t avoid) const;
+
+        void recordOutcome(std::size_t index, bool success, std::chrono::nanoseconds latency);
+
+    public:
+        BackendSet(std::vector<Backend> backends, BalancePolicy policy, HealthConfig health);
+
+        BackendSet(const BackendSet &) = delete;
+        BackendSet &operator=(const BackendSet &) = delete;
+
+        std::size_t size() const { return backends.size(); }
+        BalancePolicy balancePolicy() const { return policy; }
+
+        static constexpr std::size_t NO_BACKEND = static_cast<std::size_t>(-1);
+
+        // key_hash only matters for ConsistentHash. Unhealthy backends are skipped unless every
+        // backend is down; avoid names a backend that just failed this request (retry elsewhere).
+        UpstreamLease acquire(std::uint64_t key_hash, std::size_t avoid = NO_BACKEND);
+
+        std::vector<BackendStats> stats() const;
+    };
+}
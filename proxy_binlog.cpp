@@ -0,0 +1,394 @@
+#include <charconv>
+
+#include "proxy_binlog.hpp"
+
+using namespace proxy_log;
+
+namespace
+{
+    std::int64_t nanosecondsSinceEpoch(auto time_point)
+    {
+        return std::chrono::duration_cast<std::chrono::nanoseconds>(time_point.time_since_epoch()).count();
+    }
+
+    void appendBytes(std::vector<char> &out, const void *bytes, std::size_t length)
+    {
+        const char *begin = static_cast<const char *>(bytes);
+        out.insert(out.end(), begin, begin + length);
+    }
+
+    void appendFormatRecord(std::vector<char> &out, std::uint32_t id, std::string_view format)
+    {
+        std::uint32_t length = static_cast<std::uint32_t>(format.size());
+        out.push_back(static_cast<char>(RECORD_FORMAT));
+        appendBytes(out, &id, sizeof(id));
+        appendBytes(out, &length, sizeof(length));
+        appendBytes(out, format.data(), format.size());
+    }
+
+    // One replacement field, "{}" or "{:spec}", applied to a single decoded value.
+    std::string formatValue(const LogValue &value, std::string_view spec)
+    {
+        std::string field = spec.empty() ? std::string("{}") : std::format("{{:{}}}", spec);
+        try
+        {
+            return std::visit([&](const auto &v)
+                              { return std::vformat(field, std::make_format_args(v)); }, value);
+        }
+        catch (const std::format_error &)
+        {
+            // A value that was stored as text (a type without a raw encoding) under a numeric spec.
+            return std::visit([](const auto &v)
+                              { return std::format("{}", v); }, value);
+        }
+    }
+
+    void appendJsonString(std::string &out, std::string_view text)
+    {
+        out += '"';
+        for (char c : text)
+        {
+            switch (c)
+            {
+            case '"':
+                out += "\\\"";
+                break;
+            case '\\':
+                out += "\\\\";
+                break;
+            case '\n':
+                out += "\\n";
+                break;
+            case '\r':
+                out += "\\r";
+                break;
+            case '\t':
+                out += "\\t";
+                break;
+            default:
+                if (static_cast<unsigned char>(c) < 0x20)
+                    out += std::format("\\u{:04x}", static_cast<unsigned>(c));
+                else
+                    out += c;
+            }
+        }
+        out += '"';
+    }
+}
+
+BinaryLogWriter::~BinaryLogWriter()
+{
+    close();
+}
+
+std::string BinaryLogWriter::prologue()
+{
+    std::int64_t wall = nanosecondsSinceEpoch(std::chrono::system_clock::now());
+    std::int64_t steady = nanosecondsSinceEpoch(std::chrono::steady_clock::now());
+    std::vector<char> bytes;
+    appendBytes(bytes, BINLOG_MAGIC.data(), BINLOG_MAGIC.size());
+    appendBytes(bytes, &wall, sizeof(wall));
+    appendBytes(bytes, &steady, sizeof(steady));
+
+    std::lock_guard<std::mutex> lock(format_mutex);
+    for (std::size_t id = 0; id < formats.size(); ++id)
+        appendFormatRecord(bytes, static_cast<std::uint32_t>(id), formats[id]);
+    return std::string(bytes.begin(), bytes.end());
+}
+
+bool BinaryLogWriter::open(const BinaryLogConfig &config)
+{
+    return file.open(config.path, config.buffer_size, true, [this]
+                     { return prologue(); }, config.preallocate);
+}
+
+void BinaryLogWriter::close()
+{
+    file.close();
+}
+
+std::uint32_t BinaryLogWriter::formatId(std::string_view format)
+{
+    // Registration and its record happen under one lock: no thread can use the id before
+    // the record is queued ahead of its event. The record ignores the buffer limit.
+    std::lock_guard<std::mutex> lock(format_mutex);
+    auto [it, inserted] = format_ids.try_emplace(std::string(format), static_cast<std::uint32_t>(formats.size()));
+    if (inserted)
+    {
+        formats.emplace_back(format);
+        std::vector<char> record;
+        appendFormatRecord(record, it->second, format);
+        file.append(record.data(), record.size(), true);
+    }
+    return it->second;
+}
+
+void BinaryLogWriter::append(const char *record, std::size_t length)
+{
+    if (file.append(record, length))
+        events.fetch_add(1, std::memory_order_relaxed);
+}
+
+BinaryLogStats BinaryLogWriter::stats() const
+{
+    LogFileStats file_stats = file.stats();
+    return {events.load(std::memory_order_relaxed), file_stats.dropped, file_stats.bytes_written, file_stats.rotations};
+}
+
+BinaryLogReader::~BinaryLogReader()
+{
+    if (file)
+        std::fclose(file);
+}
+
+bool BinaryLogReader::read(void *out, std::size_t length)
+{
+    if (std::fread(out, 1, length, file) == length)
+        return true;
+    truncated = true;
+    return false;
+}
+
+bool BinaryLogReader::open(const std::string &path)
+{
+    file = std::fopen(path.c_str(), "rb");
+    if (!file)
+        return false;
+
+    char magic[BINLOG_MAGIC.size()];
+    return std::fread(magic, 1, sizeof(magic), file) == sizeof(magic) &&
+           std::string_view(magic, sizeof(magic)) == BINLOG_MAGIC &&
+           read(&wall_at_open, sizeof(wall_at_open)) && read(&steady_at_open, sizeof(steady_at_open));
+}
+
+bool BinaryLogReader::next(LogEvent &event)
+{
+    std::uint8_t kind = 0;
+    while (std::fread(&kind, 1, 1, file) == 1)
+    {
+        if (kind == RECORD_FORMAT)
+        {
+            std::uint32_t id = 0, length = 0;
+            if (!read(&id, sizeof(id)) || !read(&length, sizeof(length)))
+                return false;
+            std::string format(length, '\0');
+            if (!read(format.data(), length))
+                return false;
+            // A new segment restates earlier formats; only the next id is new.
+            if (id < formats.size())
+                continue;
+            if (id != formats.size())
+            {
+                truncated = true;
+                return false;
+            }
+            formats.push_back(std::move(format));
+            continue;
+        }
+        if (kind != RECORD_EVENT)
+        {
+            truncated = true;
+            return false;
+        }
+
+        std::uint32_t id = 0;
+        std::int64_t timestamp = 0;
+        std::uint8_t count = 0;
+        if (!read(&id, sizeof(id)) || !read(&timestamp, sizeof(timestamp)) || !read(&count, sizeof(count)))
+            return false;
+        if (id >= formats.size())
+        {
+            truncated = true;
+            return false;
+        }
+
+        event.format = formats[id];
+        event.time = std::chrono::system_clock::time_point(std::chrono::duration_cast<std::chrono::system_clock::duration>(
+            std::chrono::nanoseconds(wall_at_open + (timestamp - steady_at_open))));
+        event.args.clear();
+        for (std::uint8_t i = 0; i < count; ++i)
+        {
+            ArgType type{};
+            if (!read(&type, sizeof(type)))
+                return false;
+            switch (type)
+            {
+            case ArgType::Int:
+            {
+                std::int64_t value;
+                if (!read(&value, sizeof(value)))
+                    return false;
+                event.args.emplace_back(std::in_place_type<std::int64_t>, value);
+                break;
+            }
+            case ArgType::Unsigned:
+            {
+                std::uint64_t value;
+                if (!read(&value, sizeof(value)))
+                    return false;
+                event.args.emplace_back(std::in_place_type<std::uint64_t>, value);
+                break;
+            }
+            case ArgType::Double:
+            {
+                double value;
+                if (!read(&value, sizeof(value)))
+                    return false;
+                event.args.emplace_back(std::in_place_type<double>, value);
+                break;
+            }
+            case ArgType::Bool:
+            {
+                std::uint8_t value;
+                if (!read(&value, sizeof(value)))
+                    return false;
+                event.args.emplace_back(std::in_place_type<bool>, value != 0);
+                break;
+            }
+            case ArgType::Char:
+            {
+                char value;
+                if (!read(&value, sizeof(value)))
+                    return false;
+                event.args.emplace_back(std::in_place_type<char>, value);
+                break;
+            }
+            case ArgType::String:
+            {
+                std::uint32_t length;
+                if (!read(&length, sizeof(length)))
+                    return false;
+                std::string value(length, '\0');
+                if (!read(value.data(), length))
+                    return false;
+                event.args.emplace_back(std::in_place_type<std::string>, std::move(value));
+                break;
+            }
+            default:
+                truncated = true;
+                return false;
+            }
+        }
+        return true;
+    }
+    return false;
+}
+
+std::string proxy_log::formatMessage(const LogEvent &event)
+{
+    std::string out;
+    std::string_view format = event.format;
+    std::size_t next_arg = 0;
+    for (std::size_t i = 0; i < format.size(); ++i)
+    {
+        char c = format[i];
+        if ((c == '{' || c == '}') && i + 1 < format.size() && format[i + 1] == c)
+        {
+            out += c;
+            ++i;
+            continue;
+        }
+        std::size_t close = c == '{' ? format.find('}', i) : std::string_view::npos;
+        if (close == std::string_view::npos)
+        {
+            out += c;
+            continue;
+        }
+
+        // "{}", "{:spec}", "{N}" or "{N:spec}"
+        std::string_view field = format.substr(i + 1, close - i - 1);
+        std::size_t colon = field.find(':');
+        std::string_view id = field.substr(0, colon);
+        std::string_view spec = colon == std::string_view::npos ? std::string_view{} : field.substr(colon + 1);
+        std::size_t index = next_arg++;
+        if (!id.empty())
+            std::from_chars(id.data(), id.data() + id.size(), index);
+
+        if (index < event.args.size())
+            out += formatValue(event.args[index], spec);
+        else
+            out.append(format.substr(i, close - i + 1));
+        i = close;
+    }
+    return out;
+}
+
+void TimestampFormatter::append(std::string &out, std::chrono::system_clock::time_point time)
+{
+    using fraction = std::chrono::hh_mm_ss<std::chrono::system_clock::duration>;
+
+    auto whole = std::chrono::floor<std::chrono::seconds>(time);
+    if (whole != second || prefix.empty())
+    {
+        second = whole;
+        prefix = std::format("[{:%Y-%m-%d %H:%M:%S}", std::chrono::zoned_time{zone, whole});
+    }
+    out += prefix;
+
+    if constexpr (fraction::fractional_width > 0)
+    {
+        char digits[fraction::fractional_width + 1];
+        digits[0] = '.';
+        auto ticks = std::chrono::duration_cast<fraction::precision>(time - whole).count();
+        for (unsigned i = fraction::fractional_width; i > 0; --i, ticks /= 10)
+            digits[i] = static_cast<char>('0' + ticks % 10);
+        out.append(digits, sizeof(digits));
+    }
+    out += "] ";
+}
+
+std::string proxy_log::formatTextLine(const LogEvent &event)
+{
+    thread_local TimestampFormatter timestamps;
+    std::string line;
+    timestamps.append(line, event.time);
+    return line + formatMessage(event);
+}
+
+std::string proxy_log::formatJsonLine(const LogEvent &event)
+{
+    std::string message = formatMessage(event);
+    if (!message.empty() && message.back() == '\n')
+        message.pop_back();
+
+    // "LEVEL|SUBSYS|rest"
+    std::string_view rest = message;
+    std::size_t bar = rest.find('|');
+    std::string_view level = bar == std::string_view::npos ? std::string_view{} : rest.substr(0, bar);
+    std::string_view subsystem;
+    if (bar != std::string_view::npos)
+    {
+        std::size_t second = rest.find('|', bar + 1);
+        if (second != std::string_view::npos)
+            subsystem = rest.substr(bar + 1, second - bar - 1);
+    }
+
+    std::string out = "{\"time\":";
+    appendJsonString(out, std::format("{:%Y-%m-%dT%H:%M:%S}Z", event.time));
+    out += ",\"level\":";
+    appendJsonString(out, level);
+    out += ",\"subsystem\":";
+    appendJsonString(out, subsystem);
+    out += ",\"message\":";
+    appendJsonString(out, message);
+    out += ",\"args\":[";
+    for (std::size_t i = 0; i < event.args.size(); ++i)
+    {
+        if (i > 0)
+            out += ',';
+        std::visit([&](const auto &v)
+                   {
+                       using T = std::decay_t<decltype(v)>;
+                       if constexpr (std::same_as<T, std::string>)
+                           appendJsonString(out, v);
+                       else if constexpr (std::same_as<T, char>)
+                           appendJsonString(out, std::string_view(&v, 1));
+                       else if constexpr (std::same_as<T, bool>)
+                           out += v ? "true" : "false";
+                       else
+                           out += std::format("{}", v); },
+                   event.args[i]);
+    }
+    out += "]}";
+    return out;
+}
@@ -0,0 +1,261 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <concepts>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <deque>
+#include <format>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <type_traits>
+#include <unordered_map>
+#include <variant>
+#include <vector>
+
+#include "proxy_log_file.hpp"
+
+namespace proxy_log
+{
+
+    // Binary event log. A file is a header followed by records in host byte order:
+    //
+    //   header  "PXBLOG1\n", u64 wall clock (ns since the epoch), u64 steady clock (ns) at open
+    //   format  u8 RECORD_FORMAT, u32 id, u32 length, format string bytes
+    //   event   u8 RECORD_EVENT, u32 format id, u64 steady clock (ns), u8 argument count,
+    //           then per argument a u8 type and its raw value (strings: u32 length + bytes)
+    //
+    // A format record always precedes the first event that uses it; a format may be
+    // repeated (a new segment restates them all). Timestamps are converted to wall time
+    // offline, from the pair in the header.
+    constexpr std::string_view BINLOG_MAGIC = "PXBLOG1\n";
+    constexpr std::size_t BINLOG_HEADER_SIZE = 24;
+
+    constexpr std::uint8_t RECORD_FORMAT = 1;
+    constexpr std::uint8_t RECORD_EVENT = 2;
+
+    enum class ArgType : std::uint8_t
+    {
+        Int = 1,
+        Unsigned = 2,
+        Double = 3,
+        Bool = 4,
+        Char = 5,
+        String = 6
+    };
+
+    // Largest event record; longer string arguments are cut to fit.
+    constexpr std::size_t MAX_EVENT_SIZE = 8192;
+
+    // Encodes one event into a fixed buffer without formatting anything. Arithmetic types
+    // and strings are stored raw; any other formattable type is formatted to a string here.
+    class EventEncoder
+    {
+    private:
+        char *data;
+        std::size_t size = 0;
+        std::size_t capacity;
+        std::size_t count_offset = 0;
+        std::uint8_t count = 0;
+
+        void put(const void *bytes, std::size_t length)
+        {
+            std::memcpy(data + size, bytes, length);
+            size += length;
+        }
+
+        template <typename T>
+        void putValue(ArgType type, T value)
+        {
+            if (size + 1 + sizeof(T) > capacity || count == UINT8_MAX)
+                return;
+            data[size++] = static_cast<char>(type);
+            put(&value, sizeof(T));
+            ++count;
+        }
+
+        void putString(std::string_view text)
+        {
+            if (size + 1 + sizeof(std::uint32_t) > capacity || count == UINT8_MAX)
+                return;
+            std::uint32_t length = static_cast<std::uint32_t>(std::min(text.size(), capacity - size - 1 - sizeof(std::uint32_t)));
+            data[size++] = static_cast<char>(ArgType::String);
+            put(&length, sizeof(length));
+            put(text.data(), length);
+            ++count;
+        }
+
+    public:
+        // capacity must be at least MAX_EVENT_SIZE.
+        EventEncoder(char *data, std::size_t capacity) : data(data), capacity(capacity) {}
+
+        void begin(std::uint32_t format_id, std::uint64_t timestamp)
+        {
+            data[size++] = static_cast<char>(RECORD_EVENT);
+            put(&format_id, sizeof(format_id));
+            put(&timestamp, sizeof(timestamp));
+            count_offset = size++;
+        }
+
+        template <typename Arg>
+        void add(const Arg &arg)
+        {
+            using T = std::remove_cvref_t<Arg>;
+            if constexpr (std::same_as<T, bool>)
+                putValue(ArgType::Bool, static_cast<std::uint8_t>(arg));
+            else if constexpr (std::same_as<T, char>)
+                putValue(ArgType::Char, arg);
+            else if constexpr (std::signed_integral<T>)
+                putValue(ArgType::Int, static_cast<std::int64_t>(arg));
+            else if constexpr (std::unsigned_integral<T>)
+                putValue(ArgType::Unsigned, static_cast<std::uint64_t>(arg));
+            else if constexpr (std::floating_point<T>)
+                putValue(ArgType::Double, static_cast<double>(arg));
+            else if constexpr (std::convertible_to<const T &, std::string_view>)
+                putString(std::string_view(arg));
+            else
+                putString(std::format("{}", arg));
+        }
+
+        // Record length. Arguments that did not fit are left out; the decoder shows their
+        // fields unfilled.
+        std::size_t finish()
+        {
+            data[count_offset] = static_cast<char>(count);
+            return size;
+        }
+    };
+
+    struct BinaryLogConfig
+    {
+        std::string path = "proxy.blog";
+        // Bytes buffered between writer passes; events beyond this are dropped, never waited for.
+        std::size_t buffer_size = 1 << 20;
+        // Disk space reserved up front (Linux, without changing the file size).
+        std::size_t preallocate = 64 << 20;
+    };
+
+    struct BinaryLogStats
+    {
+        std::uint64_t events;
+        std::uint64_t dropped;
+        std::uint64_t bytes_written;
+        std::uint64_t rotations;
+    };
+
+    // Encoded events from any thread go through a LogFile, so request threads only copy
+    // bytes under a short lock. Every segment starts with the header and every format
+    // registered so far, which keeps rotated segments decodable on their own.
+    class BinaryLogWriter
+    {
+    private:
+        LogFile file;
+
+        // Registered format strings, by content; ids index formats.
+        std::mutex format_mutex;
+        std::unordered_map<std::string, std::uint32_t> format_ids;
+        std::vector<std::string> formats;
+
+        std::atomic<std::uint64_t> events{0};
+
+        std::string prologue();
+
+    public:
+        BinaryLogWriter() = default;
+        ~BinaryLogWriter();
+
+        BinaryLogWriter(const BinaryLogWriter &) = delete;
+        BinaryLogWriter &operator=(const BinaryLogWriter &) = delete;
+
+        // Creates (truncates) the file, writes the header and starts the writer thread.
+        bool open(const BinaryLogConfig &config);
+        // Writes what is buffered and closes the file.
+        void close();
+
+        void setRotation(const RotationConfig &config) { file.setRotation(config); }
+
+        // Id for a format string, registering it on first use. Callers cache the result per
+        // call site, so this is off the hot path.
+        std::uint32_t formatId(std::string_view format);
+
+        void append(const char *record, std::size_t length);
+
+        BinaryLogStats stats() const;
+    };
+
+    // Steady clock reading stored in events.
+    inline std::uint64_t eventTimestamp()
+    {
+        return static_cast<std::uint64_t>(
+            std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count());
+    }
+
+    using LogValue = std::variant<std::int64_t, std::uint64_t, double, bool, char, std::string>;
+
+    struct LogEvent
+    {
+        std::chrono::system_clock::time_point time;
+        std::string_view format;
+        std::vector<LogValue> args;
+    };
+
+    // Reads a binary log written by BinaryLogWriter.
+    class BinaryLogReader
+    {
+    private:
+        std::FILE *file = nullptr;
+        std::int64_t wall_at_open = 0;
+        std::int64_t steady_at_open = 0;
+        std::deque<std::string> formats; // events point into these
+        bool truncated = false;
+
+        bool read(void *out, std::size_t length);
+
+    public:
+        BinaryLogReader() = default;
+        ~BinaryLogReader();
+
+        BinaryLogReader(const BinaryLogReader &) = delete;
+        BinaryLogReader &operator=(const BinaryLogReader &) = delete;
+
+        // False when the file is missing or does not start with a binary log header.
+        bool open(const std::string &path);
+
+        // Next event; false at the end of the file. event.format stays valid until the
+        // reader is destroyed.
+        bool next(LogEvent &event);
+
+        // The file ended inside a record (the proxy stopped mid-write) or held garbage.
+        bool wasTruncated() const { return truncated; }
+    };
+
+    // The event's message, formatted as log() would have: "LEVEL|SUBSYS|...\n".
+    std::string formatMessage(const LogEvent &event);
+
+    // Renders the text log's "[YYYY-mm-dd HH:MM:SS.fffffffff] " prefix in local time, the
+    // fraction at the system clock's precision. The zone is looked up once and the date and
+    // time are formatted once per second; other lines only render their sub-second digits.
+    // Not thread-safe: keep one per thread.
+    class TimestampFormatter
+    {
+    private:
+        const std::chrono::time_zone *zone;
+        std::chrono::sys_seconds second{};
+        std::string prefix; // "[YYYY-mm-dd HH:MM:SS" for second
+
+    public:
+        explicit TimestampFormatter(const std::chrono::time_zone *zone = std::chrono::current_zone()) : zone(zone) {}
+
+        void append(std::string &out, std::chrono::system_clock::time_point time);
+    };
+
+    // The line the text log would have held: timestamp prefix + message, local time.
+    std::string formatTextLine(const LogEvent &event);
+
+    // One JSON object per event: time, level, subsystem, message and the raw arguments.
+    std::string formatJsonLine(const LogEvent &event);
+}
@@ -1,150 +1,333 @@
 #include <iostream>
 #include <string>
+#include <functional>
+#include <thread>
 
 #include "proxy_cache.hpp"
 #include "proxy_logger.hpp"
 
 using namespace proxy_cache;
 
-Cache::Cache() : head(nullptr), tail(nullptr), current_size(0) {}
+Cache::Cache() : Cache(CacheConfig{}) {}
 
-void Cache::detachUnlockednode(std::shared_ptr<Cache::cache_node> &node)
+Cache::Cache(CacheConfig config)
+    : node_chunks(new std::atomic<cache_node *>[MAX_NODE_CHUNKS]), node_count(0), current_size(0),
+      capacity_bytes(config.capacity_bytes), cache_index(epochs), key_rules(std::move(config.key_rules)),
+      eviction_policy(config.eviction), hit_needs_lock(false)
 {
-    if (!node)
-        return;
+    for (std::size_t i = 0; i < MAX_NODE_CHUNKS; ++i)
+        node_chunks[i].store(nullptr, std::memory_order_relaxed);
 
-    std::shared_ptr<Cache::cache_node> prev_node = node->prev.lock();
-    std::shared_ptr<Cache::cache_node> next_node = node->next;
+    CachePartitionRule default_rule;
+    default_rule.name = "default";
+    config.partitions.insert(config.partitions.begin(), default_rule);
 
-    if (prev_node)
-        prev_node->next = next_node;
-    else
-        head = next_node;
+    for (CachePartitionRule &rule : config.partitions)
+    {
+        auto partition = std::make_unique<partition_state>();
+        std::size_t engine_capacity = rule.quota_bytes ? std::min(rule.quota_bytes, capacity_bytes) : capacity_bytes;
 
-    if (next_node)
-        next_node->prev = prev_node;
-    else
-        tail = prev_node;
+        partition->eviction = makeEvictionEngine(eviction_policy, *this, engine_capacity);
+        partition->rule = std::move(rule);
+        partitions.push_back(std::move(partition));
+    }
 
-    node->prev.reset();
-    node->next.reset();
+    hit_needs_lock = partitions.front()->eviction->hitNeedsLock();
 }
 
-void Cache::removeUnlockednode(const std::size_t &required_space)
+Cache::~Cache()
 {
-    while (tail && (current_size + required_space > MAX_CACHE_BYTES))
+    for (std::size_t i = 0; i < MAX_NODE_CHUNKS; ++i)
     {
+        cache_node *chunk = node_chunks[i].load(std::memory_order_relaxed);
+        if (!chunk)
+            break;
 
-        std::shared_ptr<Cache::cache_node> old_node = tail;
+        for (std::size_t j = 0; j < NODE_CHUNK; ++j)
+            delete chunk[j].entry.load(std::memory_order_relaxed);
+        delete[] chunk;
+    }
+}
 
-        detachUnlockednode(old_node);
+Cache::cache_node &Cache::nodeAt(std::uint32_t node) const
+{
+    return node_chunks[node / NODE_CHUNK].load(std::memory_order_acquire)[node % NODE_CHUNK];
+}
 
-        current_size -= old_node->data_ptr->size();
-        cache_map.erase(old_node->url);
-    }
+void Cache::striped_counter::add()
+{
+    thread_local std::size_t stripe_index = std::hash<std::thread::id>{}(std::this_thread::get_id()) % STRIPES;
+    stripes[stripe_index].value.fetch_add(1, std::memory_order_relaxed);
 }
 
-void Cache::cacheAdd(const std::string &url, const std::vector<char> &data)
+std::uint64_t Cache::striped_counter::load() const
 {
+    std::uint64_t total = 0;
+    for (const stripe &s : stripes)
+        total += s.value.load(std::memory_order_relaxed);
+    return total;
+}
 
-    if (url.empty() || data.empty() || data.size() > MAX_CACHE_BYTES)
+std::atomic<std::uint8_t> &Cache::counter(std::uint32_t node)
+{
+    return nodeAt(node).frequency;
+}
+
+std::uint32_t Cache::partitionFor(std::string_view host, std::string_view path) const
+{
+    for (std::uint32_t i = 1; i < partitions.size(); ++i)
     {
-        log("ERROR|CACHE|Invalid URL or Data for caching.\n");
-        return;
+        const CachePartitionRule &rule = partitions[i]->rule;
+
+        if (hostMatchesPattern(rule.host_pattern, host) && path.starts_with(rule.path_prefix))
+            return i;
     }
+    return 0;
+}
 
-    std::size_t data_size = data.size();
+std::uint32_t Cache::partitionForKey(std::string_view key) const
+{
+    if (partitions.size() == 1)
+        return 0;
 
-    std::shared_ptr<std::vector<char>> data_ptr = std::make_shared<std::vector<char>>(data);
+    std::string_view host, path;
+    if (!splitCacheKey(key, host, path))
+        return 0;
+    return partitionFor(host, path);
+}
 
-    std::lock_guard<std::mutex> lock(cache_mutex);
+std::uint32_t Cache::findNode(const CacheKey &key) const
+{
+    return cache_index.find(key.hash, [&](std::uint32_t node)
+                            {
+                                const cache_entry *entry = nodeAt(node).entry.load(std::memory_order_acquire);
+                                return entry && entry->hash == key.hash && entry->url == key.key; });
+}
+
+std::uint32_t Cache::allocateUnlockednode()
+{
+    if (free_nodes.empty() && node_count == NODE_CHUNK * MAX_NODE_CHUNKS)
+        evictUnlockednode();
 
-    auto it = cache_map.find(url);
+    if (!free_nodes.empty())
+    {
+        std::uint32_t node = free_nodes.back();
+        free_nodes.pop_back();
+        return node;
+    }
 
-    if (it != cache_map.end())
+    if (node_count % NODE_CHUNK == 0)
     {
-        std::shared_ptr<Cache::cache_node> existing_node = it->second;
+        if (node_count / NODE_CHUNK >= MAX_NODE_CHUNKS)
+            return NIL;
+        node_chunks[node_count / NODE_CHUNK].store(new cache_node[NODE_CHUNK], std::memory_order_release);
+    }
+
+    return node_count++;
+}
+
+void Cache::releaseUnlockednode(std::uint32_t node)
+{
+    cache_node &released = nodeAt(node);
+    cache_entry *entry = released.entry.load(std::memory_order_relaxed);
 
-        detachUnlockednode(existing_node);
+    cache_index.erase(entry->hash, node);
+    released.entry.store(nullptr, std::memory_order_release);
+    current_size -= entry->data.size();
+    partitions[entry->partition]->bytes -= entry->data.size();
+    --partitions[entry->partition]->entries;
+    free_nodes.push_back(node);
 
-        if (existing_node->data_ptr)
-            current_size -= existing_node->data_ptr->size();
+    epochs.retire(entry);
+}
 
-        removeUnlockednode(data_size);
+// Over-quota partitions go first (lowest priority, then largest overage). Otherwise the
+// lowest priority class gives up space, starting with its largest partition.
+Cache::partition_state *Cache::selectVictimPartition() const
+{
+    partition_state *best = nullptr;
+    bool best_over = false;
+    std::size_t best_weight = 0;
 
-        existing_node->data_ptr = data_ptr;
-        existing_node->next = head;
-        existing_node->prev.reset();
+    for (const auto &partition : partitions)
+    {
+        if (partition->entries == 0)
+            continue;
 
-        if (head)
-        {
-            head->prev = existing_node;
-        }
-        else
+        bool over = partition->rule.quota_bytes && partition->bytes > partition->rule.quota_bytes;
+        std::size_t weight = over ? partition->bytes - partition->rule.quota_bytes : partition->bytes;
+
+        bool better = !best ||
+                      (over && !best_over) ||
+                      (over == best_over && partition->rule.priority < best->rule.priority) ||
+                      (over == best_over && partition->rule.priority == best->rule.priority && weight > best_weight);
+        if (better)
         {
-            tail = existing_node;
+            best = partition.get();
+            best_over = over;
+            best_weight = weight;
         }
-        head = existing_node;
-        current_size += data_size;
     }
-    else
+    return best;
+}
+
+bool Cache::evictUnlockednode()
+{
+    partition_state *partition = selectVictimPartition();
+    if (!partition)
+        return false;
+
+    std::uint32_t victim = partition->eviction->selectVictim();
+    if (victim == NIL)
+        return false;
+
+    releaseUnlockednode(victim);
+    return true;
+}
+
+void Cache::removeUnlockednode(const std::size_t &required_space)
+{
+    while (current_size + required_space > capacity_bytes)
     {
-        std::shared_ptr<Cache::cache_node> new_node = std::make_shared<Cache::cache_node>(url, data_ptr);
+        if (!evictUnlockednode())
+            break;
+    }
+}
 
-        removeUnlockednode(data_size);
+void Cache::cacheAdd(std::string_view url, const std::vector<char> &data)
+{
 
-        new_node->next = head;
-        new_node->prev.reset();
+    if (url.empty() || data.empty() || data.size() > capacity_bytes)
+    {
+        log<LogLevel::Error, LogSubsystem::Cache>("Invalid URL or Data for caching.\n");
+        return;
+    }
 
-        if (head)
-        {
-            head->prev = new_node;
-        }
-        else
-        {
-            tail = new_node;
-        }
+    std::size_t data_size = data.size();
+
+    CacheKey key = makeCacheKey(url);
+    std::uint32_t partition = partitionForKey(url);
+    cache_entry *fresh = new cache_entry{std::string(url), key.hash, partition, data};
+
+    std::lock_guard<std::mutex> lock(cache_mutex);
 
-        head = new_node;
-        cache_map[url] = new_node;
-        current_size += data_size;
+    std::uint32_t existing_node = findNode(key);
+    if (existing_node != NIL)
+    {
+        partitions[nodeAt(existing_node).entry.load(std::memory_order_relaxed)->partition]->eviction->onRemove(existing_node);
+        releaseUnlockednode(existing_node);
     }
+
+    removeUnlockednode(data_size);
+
+    std::uint32_t new_node = allocateUnlockednode();
+    if (new_node == NIL)
+    {
+        // Nothing evictable and no node left: serve the response uncached.
+        delete fresh;
+        return;
+    }
+    cache_node &node = nodeAt(new_node);
+
+    node.frequency.store(0, std::memory_order_relaxed);
+    node.entry.store(fresh, std::memory_order_release);
+    cache_index.insert(key.hash, new_node);
+    partitions[partition]->eviction->onInsert(new_node, key.hash, data_size);
+    partitions[partition]->bytes += data_size;
+    ++partitions[partition]->entries;
+    current_size += data_size;
 }
 
-std::vector<char> Cache::cacheFind(const std::string &url)
+std::vector<char> Cache::cacheFind(std::string_view url)
 {
-    if (url.empty())
+    return cacheFind(makeCacheKey(url));
+}
+
+std::vector<char> Cache::cacheFind(const CacheKey &key)
+{
+    if (key.key.empty())
         return {};
 
-    std::shared_ptr<std::vector<char>> data_read_ptr;
+    EpochManager::Guard guard = epochs.pin();
+
+    std::uint32_t node = findNode(key);
+    const cache_entry *entry = node != NIL ? nodeAt(node).entry.load(std::memory_order_acquire) : nullptr;
 
+    if (!entry || entry->url != key.key)
+    {
+        partitions[partitionForKey(key.key)]->misses.add();
+        return {};
+    }
+
+    cache_node &found = nodeAt(node);
+    partitions[entry->partition]->hits.add();
+
+    if (hit_needs_lock)
     {
         std::lock_guard<std::mutex> lock(cache_mutex);
+        if (found.entry.load(std::memory_order_relaxed) == entry)
+            partitions[entry->partition]->eviction->onHit(node);
+    }
+    else
+    {
+        // Saturating and racy on purpose: a lost increment only makes eviction slightly less
+        // precise, and skipping the store once saturated keeps hot lines from bouncing.
+        std::uint8_t count = found.frequency.load(std::memory_order_relaxed);
+        if (count < MAX_COUNT)
+            found.frequency.store(count + 1, std::memory_order_relaxed);
+    }
 
-        auto it = cache_map.find(url);
-        if (it == cache_map.end())
-            return {};
+    return entry->data;
+}
 
-        std::shared_ptr<Cache::cache_node> node = it->second;
+void Cache::cacheRemove(const CacheKey &key)
+{
+    if (key.key.empty())
+        return;
 
-        if (node != head)
-        {
+    std::lock_guard<std::mutex> lock(cache_mutex);
+
+    std::uint32_t node = findNode(key);
+    if (node == NIL)
+        return;
 
-            detachUnlockednode(node);
+    partitions[nodeAt(node).entry.load(std::memory_order_relaxed)->partition]->eviction->onRemove(node);
+    releaseUnlockednode(node);
+}
 
-            if (!head)
-                tail = node;
-            else
-                head->prev = node;
+bool Cache::cacheContains(const CacheKey &key) const
+{
+    if (key.key.empty())
+        return false;
 
-            node->next = head;
-            node->prev.reset();
-            head = node;
-        }
-        data_read_ptr = node->data_ptr;
+    EpochManager::Guard guard = epochs.pin();
+    return findNode(key) != NIL;
+}
+
+std::vector<std::uint64_t> Cache::keyHashes() const
+{
+    std::vector<std::uint64_t> hashes;
+    std::lock_guard<std::mutex> lock(cache_mutex);
+
+    hashes.reserve(node_count - free_nodes.size());
+    for (std::uint32_t node = 0; node < node_count; ++node)
+    {
+        const cache_entry *entry = nodeAt(node).entry.load(std::memory_order_relaxed);
+        if (entry)
+            hashes.push_back(entry->hash);
     }
+    return hashes;
+}
 
-    if (data_read_ptr)
-        return *data_read_ptr;
-    return {};
-}
\ No newline at end of file
+std::vector<PartitionStats> Cache::partitionStats() const
+{
+    std::vector<PartitionStats> stats;
+    std::lock_guard<std::mutex> lock(cache_mutex);
+
+    for (const auto &partition : partitions)
+    {
+        stats.push_back(PartitionStats{partition->rule.name, partition->rule.quota_bytes, partition->rule.priority,
+                                       partition->bytes, partition->entries, partition->hits.load(), partition->misses.load()});
+    }
+    return stats;
+}
@@ -1,51 +1,170 @@
 #pragma once
 
+#include <atomic>
 #include <memory>
 #include <string>
+#include <string_view>
+#include <vector>
 #include <chrono>
 #include <mutex>
 #include <cstddef>
-#include <unordered_map>
+#include <cstdint>
+
+#include "proxy_cache_key.hpp"
+#include "proxy_epoch.hpp"
+#include "proxy_eviction.hpp"
+#include "proxy_flat_index.hpp"
 
 namespace proxy_cache
 {
 
     constexpr std::size_t MAX_CACHE_BYTES = 100 * 1024 * 1024;
 
-    class Cache
+    // Routes entries into a partition by host and path. Host patterns are exact names,
+    // "*.domain" (the domain and its subdomains) or "*"; an empty path prefix matches all.
+    // A quota of 0 means the partition only competes for shared capacity. Partitions with a
+    // higher priority are evicted only after every lower class is empty or within quota.
+    struct CachePartitionRule
+    {
+        std::string name;
+        std::string host_pattern = "*";
+        std::string path_prefix;
+        std::size_t quota_bytes = 0;
+        int priority = 0;
+    };
+
+    struct CacheConfig
+    {
+        CacheKeyRules key_rules;
+        EvictionPolicy eviction = EvictionPolicy::Clock;
+        std::size_t capacity_bytes = MAX_CACHE_BYTES;
+        std::vector<CachePartitionRule> partitions;
+    };
+
+    struct PartitionStats
+    {
+        std::string name;
+        std::size_t quota_bytes;
+        int priority;
+        std::size_t bytes;
+        std::size_t entries;
+        std::uint64_t hits;
+        std::uint64_t misses;
+
+        double hitRatio() const { return hits + misses ? static_cast<double>(hits) / (hits + misses) : 0.0; }
+    };
+
+    class Cache : private AccessCounters
     {
     private:
-        struct cache_node
+        static constexpr std::uint32_t NIL = FlatIndex::npos;
+        static constexpr std::size_t NODE_CHUNK = 4096;
+        static constexpr std::size_t MAX_NODE_CHUNKS = 1024;
+
+        // Immutable once published; replaced or evicted entries are retired through the
+        // epoch manager, so a reader that found one can keep using it until it unpins.
+        struct cache_entry
         {
-           std::shared_ptr<std::vector<char>> data_ptr;
             std::string url;
+            std::uint64_t hash;
+            std::uint32_t partition;
+            std::vector<char> data;
+        };
+
+        // Hit/miss counts are bumped from the lock-free read path, so they are spread over
+        // cache lines to keep readers from contending on one counter.
+        struct striped_counter
+        {
+            static constexpr std::size_t STRIPES = 16;
 
-            std::shared_ptr<cache_node> next;
-            std::weak_ptr<cache_node> prev;
+            struct alignas(64) stripe
+            {
+                std::atomic<std::uint64_t> value{0};
+            };
+            stripe stripes[STRIPES];
 
-            cache_node(const std::string &url_c,std::shared_ptr<std::vector<char>> &data_c) : data_ptr(std::move(data_c)), url(url_c), next(nullptr), prev() {}
+            void add();
+            std::uint64_t load() const;
         };
-        std::shared_ptr<cache_node> head;
-        std::shared_ptr<cache_node> tail;
+
+        // Byte/entry counts and the engine are only touched under the writer lock.
+        struct partition_state
+        {
+            CachePartitionRule rule;
+            std::unique_ptr<EvictionEngine> eviction;
+            std::size_t bytes = 0;
+            std::size_t entries = 0;
+            striped_counter hits;
+            striped_counter misses;
+        };
+
+        // Node ids are what the index stores and what the eviction engine tracks. Nodes
+        // never move: they are allocated in fixed chunks.
+        struct cache_node
+        {
+            std::atomic<cache_entry *> entry{nullptr};
+            std::atomic<std::uint8_t> frequency{0};
+        };
+        std::unique_ptr<std::atomic<cache_node *>[]> node_chunks;
+        std::uint32_t node_count;
+        std::vector<std::uint32_t> free_nodes;
 
         std::size_t current_size;
+        std::size_t capacity_bytes;
+
+        mutable EpochManager epochs;
+        FlatIndex cache_index;
 
-        std::unordered_map<std::string, std::shared_ptr<cache_node>> cache_map;
+        CacheKeyRules key_rules;
+        EvictionPolicy eviction_policy;
+        bool hit_needs_lock;
+
+        // Index 0 is the default partition for anything no rule matches.
+        std::vector<std::unique_ptr<partition_state>> partitions;
 
         mutable std::mutex cache_mutex;
 
-        void detachUnlockednode(std::shared_ptr<cache_node> &node);
+        std::atomic<std::uint8_t> &counter(std::uint32_t node) override;
+
+        cache_node &nodeAt(std::uint32_t node) const;
+        std::uint32_t findNode(const CacheKey &key) const;
+        // NIL when every node is in use and none could be evicted.
+        std::uint32_t allocateUnlockednode();
+        void releaseUnlockednode(std::uint32_t node);
+        std::uint32_t partitionForKey(std::string_view key) const;
+        partition_state *selectVictimPartition() const;
+        bool evictUnlockednode();
         void removeUnlockednode(const std::size_t &required_space);
 
     public:
         Cache();
-        ~Cache() = default;
+        explicit Cache(CacheConfig config);
+        ~Cache();
 
         Cache(const Cache &) = delete;
         Cache &operator=(const Cache &) = delete;
 
-        void cacheAdd(const std::string &url, const std::vector<char> &data);
+        const CacheKeyRules &keyRules() const { return key_rules; }
+        EvictionPolicy evictionPolicy() const { return eviction_policy; }
+
+        // First matching rule wins; 0 (the default partition) when none match.
+        std::uint32_t partitionFor(std::string_view host, std::string_view path) const;
+        std::vector<PartitionStats> partitionStats() const;
+
+        void cacheAdd(std::string_view url, const std::vector<char> &data);
+
+        // Lock-free unless the eviction engine needs ordered hits (strict LRU): readers pin
+        // an epoch and bump the entry's access counter.
+        std::vector<char> cacheFind(std::string_view url);
+        std::vector<char> cacheFind(const CacheKey &key);
+
+        // Drops the entry for key, if any (invalidation after an unsafe request).
+        void cacheRemove(const CacheKey &key);
+
+        // Presence check for sibling probes: no copy, no hit/miss accounting, no promotion.
+        bool cacheContains(const CacheKey &key) const;
 
-        std::vector<char> cacheFind(const std::string &url);
+        // Hashes of every stored key, for building the cache digest peers fetch.
+        std::vector<std::uint64_t> keyHashes() const;
     };
 }
\ No newline at end of file
@@ -0,0 +1,287 @@
+#include <iostream>
+#include <string>
+#include <vector>
+#include <memory>
+#include <chrono>
+#include <random>
+#include <unordered_map>
+#include <algorithm>
+#include <thread>
+#include <atomic>
+#include <cmath>
+#include <format>
+
+#include "proxy_cache.hpp"
+#include "proxy_cache_key.hpp"
+#include "proxy_flat_index.hpp"
+#include "proxy_binlog.hpp"
+
+// Index microbenchmark: the previous unordered_map<string, shared_ptr<node>> layout
+// against FlatIndex + contiguous entries, both holding the same URL keys. The second
+// part measures Cache hit throughput as reader threads are added, and the third replays
+// a synthetic trace through every eviction engine to compare hit ratio and ops/s. The
+// last part times the text log's per-line timestamp.
+
+using namespace proxy_cache;
+
+namespace
+{
+    constexpr std::size_t DEFAULT_ENTRIES = 1'000'000;
+    constexpr std::size_t LOOKUPS = 4'000'000;
+    constexpr std::size_t HOT_SET = 1024;
+    constexpr std::size_t HOT_OBJECT_BYTES = 512;
+    constexpr auto SCALING_DURATION = std::chrono::milliseconds(500);
+
+    constexpr std::size_t SIM_OBJECTS = 50'000;
+    constexpr std::size_t SIM_REQUESTS = 1'000'000;
+    constexpr double SIM_ZIPF_ALPHA = 0.9;
+    constexpr double SIM_ONE_HIT_SHARE = 0.2;
+    constexpr std::size_t SIM_CAPACITY = 64 * 1024 * 1024;
+
+    constexpr std::size_t LOG_LINES = 1'000'000;
+
+    struct sim_request
+    {
+        std::uint32_t object;
+        bool one_hit;
+    };
+
+    // Zipf-popular objects mixed with one-hit wonders that are never requested again.
+    std::vector<sim_request> makeTrace(std::mt19937_64 &rng)
+    {
+        std::vector<double> cdf(SIM_OBJECTS);
+        double total = 0;
+        for (std::size_t i = 0; i < SIM_OBJECTS; ++i)
+        {
+            total += 1.0 / std::pow(static_cast<double>(i + 1), SIM_ZIPF_ALPHA);
+            cdf[i] = total;
+        }
+
+        std::uniform_real_distribution<double> uniform(0.0, 1.0);
+        std::vector<sim_request> trace(SIM_REQUESTS);
+        std::uint32_t next_one_hit = 0;
+
+        for (sim_request &r : trace)
+        {
+            if (uniform(rng) < SIM_ONE_HIT_SHARE)
+            {
+                r = sim_request{next_one_hit++, true};
+                continue;
+            }
+            double pick = uniform(rng) * total;
+            r = sim_request{static_cast<std::uint32_t>(std::lower_bound(cdf.begin(), cdf.end(), pick) - cdf.begin()), false};
+        }
+        return trace;
+    }
+
+    std::size_t objectBytes(std::uint32_t object)
+    {
+        // 1 KiB .. 128 KiB, fixed per object so every engine sees the same sizes.
+        return 1024u << ((object * 2654435761u) >> 29);
+    }
+
+    struct map_node
+    {
+        std::shared_ptr<std::vector<char>> data_ptr;
+        std::string url;
+    };
+
+    struct flat_node
+    {
+        std::shared_ptr<std::vector<char>> data_ptr;
+        std::string url;
+        std::uint64_t hash;
+    };
+
+    using bench_clock = std::chrono::steady_clock;
+
+    double nsPerOp(bench_clock::time_point start, std::size_t ops)
+    {
+        return std::chrono::duration<double, std::nano>(bench_clock::now() - start).count() / ops;
+    }
+
+    void report(const char *name, const char *phase, double ns)
+    {
+        std::cout << name << "\t" << phase << "\t" << ns << " ns/op\n";
+    }
+}
+
+int main(int argc, char *argv[])
+{
+    std::size_t entries = DEFAULT_ENTRIES;
+    if (argc > 1)
+        entries = std::stoul(argv[1]);
+
+    std::vector<std::string> keys;
+    std::vector<std::string> missing;
+    keys.reserve(entries);
+    missing.reserve(entries);
+    for (std::size_t i = 0; i < entries; ++i)
+    {
+        keys.push_back("http://host" + std::to_string(i % 4096) + ".example.com/assets/" + std::to_string(i) + ".js");
+        missing.push_back("http://host" + std::to_string(i % 4096) + ".example.com/missing/" + std::to_string(i) + ".js");
+    }
+
+    std::mt19937_64 rng(42);
+    std::vector<std::uint32_t> order(LOOKUPS);
+    for (auto &o : order)
+        o = static_cast<std::uint32_t>(rng() % entries);
+
+    std::size_t found = 0;
+
+    // --- unordered_map baseline ---
+    {
+        std::unordered_map<std::string, std::shared_ptr<map_node>> map;
+
+        auto start = bench_clock::now();
+        for (const std::string &key : keys)
+            map[key] = std::make_shared<map_node>(map_node{nullptr, key});
+        report("unordered_map", "insert", nsPerOp(start, entries));
+
+        start = bench_clock::now();
+        for (std::uint32_t i : order)
+            found += map.find(keys[i]) != map.end();
+        report("unordered_map", "hit", nsPerOp(start, LOOKUPS));
+
+        start = bench_clock::now();
+        for (std::uint32_t i : order)
+            found += map.find(missing[i]) != map.end();
+        report("unordered_map", "miss", nsPerOp(start, LOOKUPS));
+    }
+
+    // --- FlatIndex ---
+    {
+        EpochManager epochs;
+        FlatIndex index(epochs);
+        std::vector<flat_node> nodes;
+        nodes.reserve(entries);
+
+        auto start = bench_clock::now();
+        for (const std::string &key : keys)
+        {
+            std::uint64_t hash = hashCacheKey(key);
+            nodes.push_back(flat_node{nullptr, key, hash});
+            index.insert(hash, static_cast<std::uint32_t>(nodes.size() - 1));
+        }
+        report("flat_index", "insert", nsPerOp(start, entries));
+
+        auto lookup = [&](std::string_view key)
+        {
+            return index.find(hashCacheKey(key), [&](std::uint32_t node)
+                              { return nodes[node].url == key; });
+        };
+
+        start = bench_clock::now();
+        for (std::uint32_t i : order)
+            found += lookup(keys[i]) != FlatIndex::npos;
+        report("flat_index", "hit", nsPerOp(start, LOOKUPS));
+
+        start = bench_clock::now();
+        for (std::uint32_t i : order)
+            found += lookup(missing[i]) != FlatIndex::npos;
+        report("flat_index", "miss", nsPerOp(start, LOOKUPS));
+    }
+
+    // --- Cache hit scaling over a small hot set ---
+    {
+        Cache cache;
+        std::vector<char> body(HOT_OBJECT_BYTES, 'x');
+        for (std::size_t i = 0; i < HOT_SET; ++i)
+            cache.cacheAdd(keys[i], body);
+
+        unsigned max_threads = std::max(1u, std::thread::hardware_concurrency());
+        for (unsigned threads = 1; threads <= max_threads; threads *= 2)
+        {
+            std::atomic<bool> stop{false};
+            std::atomic<std::size_t> hits{0};
+            std::vector<std::thread> readers;
+
+            for (unsigned t = 0; t < threads; ++t)
+            {
+                readers.emplace_back([&, t]()
+                                     {
+                                         std::size_t local = 0;
+                                         for (std::size_t i = t; !stop.load(std::memory_order_relaxed); ++i)
+                                             local += !cache.cacheFind(keys[i % HOT_SET]).empty();
+                                         hits += local; });
+            }
+
+            std::this_thread::sleep_for(SCALING_DURATION);
+            stop = true;
+            for (auto &r : readers)
+                r.join();
+
+            double seconds = std::chrono::duration<double>(SCALING_DURATION).count();
+            std::cout << "cache_hits\t" << threads << " threads\t" << hits / seconds / 1e6 << " Mops/s\n";
+            found += hits;
+        }
+    }
+
+    // --- Eviction engine simulation ---
+    {
+        std::vector<sim_request> trace = makeTrace(rng);
+        std::vector<char> body(128 * 1024, 'x');
+
+        for (EvictionPolicy policy : {EvictionPolicy::Lru, EvictionPolicy::Clock, EvictionPolicy::ClockPro, EvictionPolicy::S3Fifo})
+        {
+            CacheConfig config;
+            config.eviction = policy;
+            config.capacity_bytes = SIM_CAPACITY;
+            Cache cache(config);
+
+            std::size_t hits = 0, hit_bytes = 0, total_bytes = 0;
+            std::vector<char> object;
+
+            auto start = bench_clock::now();
+            for (const sim_request &r : trace)
+            {
+                std::string url = (r.one_hit ? "http://once.example.com/" : "http://hot.example.com/") + std::to_string(r.object);
+                std::size_t bytes = objectBytes(r.object);
+                total_bytes += bytes;
+
+                if (!cache.cacheFind(url).empty())
+                {
+                    ++hits;
+                    hit_bytes += bytes;
+                    continue;
+                }
+                object.assign(body.begin(), body.begin() + bytes);
+                cache.cacheAdd(url, object);
+            }
+            double seconds = std::chrono::duration<double>(bench_clock::now() - start).count();
+
+            std::cout << "sim_" << evictionPolicyName(policy)
+                      << "\thit_ratio " << static_cast<double>(hits) / trace.size()
+                      << "\tbyte_hit_ratio " << static_cast<double>(hit_bytes) / total_bytes
+                      << "\t" << trace.size() / seconds / 1e6 << " Mops/s\n";
+            found += hits;
+        }
+    }
+
+    // --- Log line timestamp ---
+    // A zone lookup and a full zoned format per line, as ProxyLogger used to do, against
+    // the per-second memoized prefix it uses now.
+    {
+        std::string line;
+        auto start = bench_clock::now();
+        for (std::size_t i = 0; i < LOG_LINES; ++i)
+        {
+            const auto local_time = std::chrono::zoned_time{std::chrono::current_zone(), std::chrono::system_clock::now()};
+            line = std::format("[{:%Y-%m-%d %H:%M:%S}] ", local_time);
+        }
+        report("log_timestamp", "zoned_format", nsPerOp(start, LOG_LINES));
+
+        proxy_log::TimestampFormatter timestamps;
+        start = bench_clock::now();
+        for (std::size_t i = 0; i < LOG_LINES; ++i)
+        {
+            line.clear();
+            timestamps.append(line, std::chrono::system_clock::now());
+        }
+        report("log_timestamp", "cached", nsPerOp(start, LOG_LINES));
+    }
+
+    // Keeps the lookups observable so they are not optimized away.
+    std::cout << "found " << found << "\n";
+    return 0;
+}
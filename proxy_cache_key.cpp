@@ -0,0 +1,293 @@
+#include <algorithm>
+#include <bit>
+#include <cctype>
+#include <cstring>
+
+#include "proxy_cache_key.hpp"
+
+namespace
+{
+    // Appends to the key lazily: while the output matches the input byte for byte nothing
+    // is copied, so an already canonical URL never touches the scratch buffer.
+    struct KeyWriter
+    {
+        std::string_view source;
+        std::string &scratch;
+        std::size_t matched = 0;
+        bool diverged = false;
+
+        void put(char c)
+        {
+            if (!diverged)
+            {
+                if (matched < source.size() && source[matched] == c)
+                {
+                    ++matched;
+                    return;
+                }
+                scratch.assign(source.substr(0, matched));
+                diverged = true;
+            }
+            scratch.push_back(c);
+        }
+
+        void put(std::string_view s)
+        {
+            for (char c : s)
+                put(c);
+        }
+
+        std::string_view result() const
+        {
+            if (!diverged)
+                return source.substr(0, matched);
+            return scratch;
+        }
+    };
+
+    char toLowerAscii(char c)
+    {
+        return (c >= 'A' && c <= 'Z') ? static_cast<char>(c - 'A' + 'a') : c;
+    }
+
+    int hexValue(char c)
+    {
+        if (c >= '0' && c <= '9')
+            return c - '0';
+        if (c >= 'a' && c <= 'f')
+            return c - 'a' + 10;
+        if (c >= 'A' && c <= 'F')
+            return c - 'A' + 10;
+        return -1;
+    }
+
+    bool isUnreserved(unsigned char c)
+    {
+        return std::isalnum(c) || c == '-' || c == '.' || c == '_' || c == '~';
+    }
+
+    // RFC 3986 6.2.2: uppercase hex digits and decode octets of unreserved characters.
+    void putPercentNormalized(KeyWriter &writer, std::string_view s)
+    {
+        constexpr char HEX_DIGITS[] = "0123456789ABCDEF";
+
+        for (std::size_t i = 0; i < s.size(); ++i)
+        {
+            if (s[i] == '%' && i + 2 < s.size() && hexValue(s[i + 1]) >= 0 && hexValue(s[i + 2]) >= 0)
+            {
+                unsigned char value = static_cast<unsigned char>(hexValue(s[i + 1]) * 16 + hexValue(s[i + 2]));
+                if (isUnreserved(value))
+                {
+                    writer.put(static_cast<char>(value));
+                }
+                else
+                {
+                    writer.put('%');
+                    writer.put(HEX_DIGITS[value >> 4]);
+                    writer.put(HEX_DIGITS[value & 0x0F]);
+                }
+                i += 2;
+            }
+            else
+            {
+                writer.put(s[i]);
+            }
+        }
+    }
+
+    std::string_view paramName(std::string_view param)
+    {
+        return param.substr(0, param.find('='));
+    }
+
+    bool isDroppedParam(std::string_view param, const proxy_cache::CacheKeyRules &rules)
+    {
+        std::string_view name = paramName(param);
+
+        for (const std::string &rule : rules.drop_query_params)
+        {
+            if (!rule.empty() && rule.back() == '*')
+            {
+                if (name.starts_with(std::string_view(rule).substr(0, rule.size() - 1)))
+                    return true;
+            }
+            else if (name == rule)
+            {
+                return true;
+            }
+        }
+        return false;
+    }
+
+    void putQuery(KeyWriter &writer, std::string_view query, const proxy_cache::CacheKeyRules &rules)
+    {
+        std::vector<std::string_view> params;
+        bool first = true;
+
+        auto emit = [&](std::string_view param)
+        {
+            writer.put(first ? '?' : '&');
+            putPercentNormalized(writer, param);
+            first = false;
+        };
+
+        std::size_t start = 0;
+        while (start <= query.size())
+        {
+            std::size_t end = query.find('&', start);
+            if (end == std::string_view::npos)
+                end = query.size();
+
+            std::string_view param = query.substr(start, end - start);
+            if (!param.empty() && !isDroppedParam(param, rules))
+            {
+                if (rules.sort_query)
+                    params.push_back(param);
+                else
+                    emit(param);
+            }
+            start = end + 1;
+        }
+
+        if (rules.sort_query)
+        {
+            std::stable_sort(params.begin(), params.end(), [](std::string_view a, std::string_view b)
+                             { return paramName(a) < paramName(b); });
+            for (std::string_view param : params)
+                emit(param);
+        }
+    }
+}
+
+std::uint64_t proxy_cache::hashCacheKey(std::string_view key)
+{
+    // Word-at-a-time multiply/rotate mixing with a murmur3 finalizer, so the low bits are
+    // usable as a fingerprint and the high bits as a bucket selector.
+    constexpr std::uint64_t MULTIPLIER = 0x9E3779B97F4A7C15ULL;
+
+    std::uint64_t hash = key.size() * MULTIPLIER;
+    std::size_t i = 0;
+
+    for (; i + 8 <= key.size(); i += 8)
+    {
+        std::uint64_t word;
+        std::memcpy(&word, key.data() + i, sizeof(word));
+        hash = std::rotl((hash ^ word) * MULTIPLIER, 29);
+    }
+
+    std::uint64_t tail = 0;
+    for (std::size_t shift = 0; i < key.size(); ++i, shift += 8)
+        tail |= static_cast<std::uint64_t>(static_cast<unsigned char>(key[i])) << shift;
+    hash = std::rotl((hash ^ tail) * MULTIPLIER, 29);
+
+    hash ^= hash >> 33;
+    hash *= 0xff51afd7ed558ccdULL;
+    hash ^= hash >> 33;
+    hash *= 0xc4ceb9fe1a85ec53ULL;
+    hash ^= hash >> 33;
+    return hash;
+}
+
+std::string_view proxy_cache::normalizeCacheKey(std::string_view url, const CacheKeyRules &rules, std::string &scratch)
+{
+    std::size_t scheme_end = url.find("://");
+    if (scheme_end == std::string_view::npos)
+        return url;
+
+    KeyWriter writer{url, scratch};
+
+    std::string_view scheme = url.substr(0, scheme_end);
+    for (char c : scheme)
+        writer.put(toLowerAscii(c));
+    writer.put("://");
+
+    std::size_t authority_start = scheme_end + 3;
+    std::size_t authority_end = url.find_first_of("/?#", authority_start);
+    if (authority_end == std::string_view::npos)
+        authority_end = url.size();
+
+    std::string_view authority = url.substr(authority_start, authority_end - authority_start);
+    std::string_view host = authority;
+    std::string_view port;
+
+    std::size_t port_pos = authority.rfind(':');
+    std::size_t bracket_pos = authority.rfind(']');
+    if (port_pos != std::string_view::npos && (bracket_pos == std::string_view::npos || bracket_pos < port_pos))
+    {
+        host = authority.substr(0, port_pos);
+        port = authority.substr(port_pos + 1);
+    }
+
+    for (char c : host)
+        writer.put(toLowerAscii(c));
+
+    bool is_default_port = port.empty() ||
+                           (port == "80" && writer.result().starts_with("http:")) ||
+                           (port == "443" && writer.result().starts_with("https:"));
+    if (!is_default_port)
+    {
+        writer.put(':');
+        writer.put(port);
+    }
+
+    std::string_view rest = url.substr(authority_end);
+
+    std::size_t fragment_pos = rest.find('#');
+    if (fragment_pos != std::string_view::npos)
+        rest = rest.substr(0, fragment_pos);
+
+    std::string_view path = rest;
+    std::string_view query;
+
+    std::size_t query_pos = rest.find('?');
+    if (query_pos != std::string_view::npos)
+    {
+        path = rest.substr(0, query_pos);
+        query = rest.substr(query_pos + 1);
+    }
+
+    if (path.empty())
+        writer.put('/');
+    else
+        putPercentNormalized(writer, path);
+
+    if (!query.empty())
+        putQuery(writer, query, rules);
+
+    return writer.result();
+}
+
+bool proxy_cache::splitCacheKey(std::string_view key, std::string_view &host, std::string_view &path)
+{
+    std::size_t scheme_end = key.find("://");
+    if (scheme_end == std::string_view::npos)
+        return false;
+
+    std::size_t authority_start = scheme_end + 3;
+    std::size_t authority_end = key.find_first_of("/?", authority_start);
+    if (authority_end == std::string_view::npos)
+        authority_end = key.size();
+
+    host = key.substr(authority_start, authority_end - authority_start);
+    std::size_t port_pos = host.rfind(':');
+    std::size_t bracket_pos = host.rfind(']');
+    if (port_pos != std::string_view::npos && (bracket_pos == std::string_view::npos || bracket_pos < port_pos))
+        host = host.substr(0, port_pos);
+
+    path = key.substr(authority_end);
+    return true;
+}
+
+bool proxy_cache::hostMatchesPattern(std::string_view pattern, std::string_view host)
+{
+    if (pattern.empty() || pattern == "*")
+        return true;
+
+    if (pattern.starts_with("*."))
+    {
+        std::string_view domain = pattern.substr(2);
+        return host == domain || (host.size() > domain.size() && host.ends_with(domain) &&
+                                  host[host.size() - domain.size() - 1] == '.');
+    }
+    return host == pattern;
+}
@@ -0,0 +1,60 @@
+#pragma once
+
+#include <string>
+#include <string_view>
+#include <vector>
+#include <cstddef>
+#include <cstdint>
+
+namespace proxy_cache
+{
+
+    // Rules applied to the query string while building a cache key.
+    // A drop entry ending in '*' matches every parameter with that prefix (e.g. "utm_*").
+    struct CacheKeyRules
+    {
+        bool sort_query = false;
+        std::vector<std::string> drop_query_params;
+    };
+
+    // A key plus its precomputed hash, so probing the cache never re-hashes or allocates.
+    struct CacheKey
+    {
+        std::string_view key;
+        std::uint64_t hash;
+    };
+
+    std::uint64_t hashCacheKey(std::string_view key);
+
+    inline CacheKey makeCacheKey(std::string_view key) { return CacheKey{key, hashCacheKey(key)}; }
+
+    // Canonicalizes an absolute-form URL: lowercase scheme and host, default port dropped,
+    // percent-encoding normalized, fragment removed and query filtered/sorted by the rules.
+    // Returns the input itself when it is already canonical, otherwise a view into scratch.
+    std::string_view normalizeCacheKey(std::string_view url, const CacheKeyRules &rules, std::string &scratch);
+
+    // Splits a canonical key into host (without port) and path (with query). False if the
+    // key is not an absolute URL.
+    bool splitCacheKey(std::string_view key, std::string_view &host, std::string_view &path);
+
+    // Host patterns used by partition and routing rules: an exact name, "*.domain" (the
+    // domain and its subdomains), or "*"/empty for any host.
+    bool hostMatchesPattern(std::string_view pattern, std::string_view host);
+
+    struct CacheKeyHash
+    {
+        using is_transparent = void;
+
+        std::size_t operator()(std::string_view key) const { return static_cast<std::size_t>(hashCacheKey(key)); }
+        std::size_t operator()(const CacheKey &key) const { return static_cast<std::size_t>(key.hash); }
+    };
+
+    struct CacheKeyEqual
+    {
+        using is_transparent = void;
+
+        bool operator()(std::string_view a, std::string_view b) const { return a == b; }
+        bool operator()(const CacheKey &a, std::string_view b) const { return a.key == b; }
+        bool operator()(std::string_view a, const CacheKey &b) const { return a == b.key; }
+    };
+}
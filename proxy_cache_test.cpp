@@ -3,7 +3,22 @@
 #include <thread>
 #include <vector>
 #include <memory>
+#include <atomic>
+#include <chrono>
+#include <filesystem>
+#include <fstream>
 #include "proxy_cache.hpp"
+#include "proxy_negative_cache.hpp"
+#include "proxy_routing.hpp"
+#include "proxy_cluster.hpp"
+#include "proxy_framing.hpp"
+#include "proxy_headers.hpp"
+#include "proxy_hpack.hpp"
+#include "proxy_h2.hpp"
+#include "proxy_proxy_protocol.hpp"
+#include "proxy_prefetch.hpp"
+#include "proxy_binlog.hpp"
+#include "proxy_logger.hpp"
 
 using namespace proxy_cache;
 
@@ -173,4 +188,1218 @@ TEST_F(CacheTest, EvictsMultipleItemsToMakeSpace) {
     EXPECT_TRUE(cache->cache_find("http://a.com").empty());
     EXPECT_TRUE(cache->cache_find("http://b.com").empty());
     EXPECT_FALSE(cache->cache_find("http://big.com").empty());
-}
\ No newline at end of file
+}
+
+//TEST CASE 12: Canonical Keys Ignore Case And Default Port
+TEST(CacheKeyTest, NormalizesSchemeHostAndDefaultPort) {
+    CacheKeyRules rules;
+    std::string scratch;
+
+    EXPECT_EQ(normalizeCacheKey("HTTP://Example.COM:80/a", rules, scratch), "http://example.com/a");
+    EXPECT_EQ(normalizeCacheKey("https://example.com:443", rules, scratch), "https://example.com/");
+    EXPECT_EQ(normalizeCacheKey("http://example.com:8080/a", rules, scratch), "http://example.com:8080/a");
+    EXPECT_EQ(normalizeCacheKey("http://example.com/a#frag", rules, scratch), "http://example.com/a");
+}
+
+//TEST CASE 13: Percent-Encoding Normalization
+TEST(CacheKeyTest, NormalizesPercentEncoding) {
+    CacheKeyRules rules;
+    std::string scratch;
+
+    EXPECT_EQ(normalizeCacheKey("http://e.com/%7euser/%2f%41", rules, scratch), "http://e.com/~user/%2FA");
+}
+
+//TEST CASE 14: Query Rules Drop And Sort Parameters
+TEST(CacheKeyTest, AppliesQueryRules) {
+    CacheKeyRules rules;
+    rules.sort_query = true;
+    rules.drop_query_params = {"utm_*", "sid"};
+    std::string scratch;
+
+    EXPECT_EQ(normalizeCacheKey("http://e.com/p?b=2&utm_source=x&a=1&sid=9", rules, scratch), "http://e.com/p?a=1&b=2");
+    EXPECT_EQ(normalizeCacheKey("http://e.com/p?utm_medium=y", rules, scratch), "http://e.com/p");
+}
+
+//TEST CASE 15: Canonical URL Is Returned Without Copying
+TEST(CacheKeyTest, CanonicalUrlIsNotCopied) {
+    CacheKeyRules rules;
+    std::string scratch;
+    std::string_view url = "http://example.com/a?x=1";
+
+    std::string_view key = normalizeCacheKey(url, rules, scratch);
+
+    EXPECT_EQ(key.data(), url.data());
+    EXPECT_TRUE(scratch.empty());
+}
+
+//TEST CASE 16: Lookup By Precomputed Key
+TEST_F(CacheTest, FindsByPrecomputedKey) {
+    std::vector<char> data = {'k', 'e', 'y'};
+    cache->cacheAdd("http://example.com/", data);
+
+    EXPECT_EQ(cache->cacheFind(makeCacheKey("http://example.com/")), data);
+    EXPECT_TRUE(cache->cacheFind(makeCacheKey("http://example.com/other")).empty());
+}
+
+//TEST CASE 17: Lock-Free Readers Alongside Evicting Writer
+TEST_F(CacheTest, ReadersSurviveConcurrentEviction) {
+    const int NUM_READERS = 4;
+    const int NUM_URLS = 32;
+    const std::size_t OBJECT_BYTES = MAX_CACHE_BYTES / 8;
+    std::atomic<bool> stop{false};
+    std::vector<std::thread> readers;
+
+    for (int i = 0; i < NUM_READERS; ++i) {
+        readers.emplace_back([this, &stop]() {
+            while (!stop) {
+                for (int j = 0; j < NUM_URLS; ++j) {
+                    std::vector<char> found = cache->cacheFind("http://evict/" + std::to_string(j));
+                    if (!found.empty()) {
+                        ASSERT_EQ(found.front(), static_cast<char>('a' + j % 26));
+                        ASSERT_EQ(found.back(), static_cast<char>('a' + j % 26));
+                    }
+                }
+            }
+        });
+    }
+
+    for (int round = 0; round < 4; ++round) {
+        for (int j = 0; j < NUM_URLS; ++j) {
+            std::vector<char> data(OBJECT_BYTES, static_cast<char>('a' + j % 26));
+            cache->cacheAdd("http://evict/" + std::to_string(j), data);
+        }
+    }
+
+    stop = true;
+    for (auto& t : readers) {
+        t.join();
+    }
+
+    EXPECT_FALSE(cache->cacheFind("http://evict/" + std::to_string(NUM_URLS - 1)).empty());
+}
+
+//TEST CASE 18: Strict LRU Engine With Small Capacity
+TEST(EvictionEngineTest, LruEvictsLeastRecentlyUsed) {
+    CacheConfig config;
+    config.eviction = EvictionPolicy::Lru;
+    config.capacity_bytes = 100;
+    Cache lru(config);
+
+    lru.cacheAdd("http://1.com", std::vector<char>(30, 'A'));
+    lru.cacheAdd("http://2.com", std::vector<char>(30, 'B'));
+    lru.cacheAdd("http://3.com", std::vector<char>(30, 'C'));
+
+    EXPECT_FALSE(lru.cacheFind("http://1.com").empty());
+    lru.cacheAdd("http://4.com", std::vector<char>(30, 'D'));
+
+    EXPECT_TRUE(lru.cacheFind("http://2.com").empty());
+    EXPECT_FALSE(lru.cacheFind("http://1.com").empty());
+    EXPECT_FALSE(lru.cacheFind("http://3.com").empty());
+    EXPECT_FALSE(lru.cacheFind("http://4.com").empty());
+}
+
+//TEST CASE 19: S3-FIFO Keeps Reused Entries Through A Scan Of One-Hit Wonders
+TEST(EvictionEngineTest, S3FifoFiltersOneHitWonders) {
+    CacheConfig config;
+    config.eviction = EvictionPolicy::S3Fifo;
+    config.capacity_bytes = 1000;
+    Cache s3(config);
+
+    s3.cacheAdd("http://hot.com", std::vector<char>(50, 'H'));
+    EXPECT_FALSE(s3.cacheFind("http://hot.com").empty());
+
+    for (int i = 0; i < 100; ++i) {
+        s3.cacheAdd("http://scan/" + std::to_string(i), std::vector<char>(50, 'S'));
+    }
+
+    EXPECT_FALSE(s3.cacheFind("http://hot.com").empty());
+    EXPECT_TRUE(s3.cacheFind("http://scan/0").empty());
+}
+
+//TEST CASE 20: Every Engine Respects Capacity And Keeps Data Intact
+TEST(EvictionEngineTest, AllEnginesStayWithinCapacity) {
+    for (EvictionPolicy policy : {EvictionPolicy::Lru, EvictionPolicy::Clock, EvictionPolicy::ClockPro, EvictionPolicy::S3Fifo}) {
+        CacheConfig config;
+        config.eviction = policy;
+        config.capacity_bytes = 1000;
+        Cache engine_cache(config);
+
+        for (int i = 0; i < 500; ++i) {
+            std::string url = "http://e/" + std::to_string(i % 60);
+            std::vector<char> data(10 + i % 90, static_cast<char>('a' + i % 60 % 26));
+            if (engine_cache.cacheFind(url).empty()) {
+                engine_cache.cacheAdd(url, data);
+            }
+        }
+
+        std::size_t resident_bytes = 0;
+        for (int j = 0; j < 60; ++j) {
+            std::vector<char> found = engine_cache.cacheFind("http://e/" + std::to_string(j));
+            if (!found.empty()) {
+                EXPECT_EQ(found.front(), static_cast<char>('a' + j % 26)) << evictionPolicyName(policy);
+                resident_bytes += found.size();
+            }
+        }
+        EXPECT_LE(resident_bytes, config.capacity_bytes) << evictionPolicyName(policy);
+        EXPECT_GT(resident_bytes, 0u) << evictionPolicyName(policy);
+    }
+}
+
+//TEST CASE 21: Low-Priority Partition Over Quota Is Evicted Before A High-Priority One
+TEST(CachePartitionTest, QuotaAndPriorityDecideVictims) {
+    CacheConfig config;
+    config.capacity_bytes = 1000;
+    config.partitions.push_back({"media", "*.cdn.com", "", 300, 0});
+    config.partitions.push_back({"api", "api.example.com", "/v1/", 0, 10});
+    Cache partitioned_cache(config);
+
+    EXPECT_EQ(partitioned_cache.partitionFor("img.cdn.com", "/a.png"), 1u);
+    EXPECT_EQ(partitioned_cache.partitionFor("cdn.com", "/"), 1u);
+    EXPECT_EQ(partitioned_cache.partitionFor("api.example.com", "/v1/users"), 2u);
+    EXPECT_EQ(partitioned_cache.partitionFor("api.example.com", "/v2/users"), 0u);
+
+    for (int i = 0; i < 5; ++i) {
+        partitioned_cache.cacheAdd("http://api.example.com/v1/" + std::to_string(i), std::vector<char>(100, 'A'));
+    }
+    for (int i = 0; i < 10; ++i) {
+        partitioned_cache.cacheAdd("http://img.cdn.com/" + std::to_string(i), std::vector<char>(100, 'M'));
+    }
+
+    for (int i = 0; i < 5; ++i) {
+        EXPECT_FALSE(partitioned_cache.cacheFind("http://api.example.com/v1/" + std::to_string(i)).empty());
+    }
+
+    // Unused capacity is shared, so media may borrow past its quota until space runs out.
+    std::vector<PartitionStats> stats = partitioned_cache.partitionStats();
+    ASSERT_EQ(stats.size(), 3u);
+    EXPECT_EQ(stats[1].name, "media");
+    EXPECT_EQ(stats[1].bytes, 500u);
+    EXPECT_EQ(stats[2].bytes, 500u);
+
+    // Once full, the over-quota partition pays for new default-partition entries.
+    partitioned_cache.cacheAdd("http://other.com/page", std::vector<char>(200, 'D'));
+    stats = partitioned_cache.partitionStats();
+    EXPECT_EQ(stats[0].bytes, 200u);
+    EXPECT_EQ(stats[1].bytes, 300u);
+    EXPECT_EQ(stats[2].bytes, 500u);
+}
+
+//TEST CASE 22: Partition Stats Count Hits And Misses Per Partition
+TEST(CachePartitionTest, StatsTrackHitsAndMisses) {
+    CacheConfig config;
+    config.partitions.push_back({"static", "*", "/static/", 0, 0});
+    Cache partitioned_cache(config);
+
+    partitioned_cache.cacheAdd("http://site.com/static/app.js", {'j', 's'});
+    EXPECT_FALSE(partitioned_cache.cacheFind("http://site.com/static/app.js").empty());
+    EXPECT_TRUE(partitioned_cache.cacheFind("http://site.com/static/missing.js").empty());
+    EXPECT_TRUE(partitioned_cache.cacheFind("http://site.com/index.html").empty());
+
+    std::vector<PartitionStats> stats = partitioned_cache.partitionStats();
+    ASSERT_EQ(stats.size(), 2u);
+    EXPECT_EQ(stats[0].name, "default");
+    EXPECT_EQ(stats[0].hits, 0u);
+    EXPECT_EQ(stats[0].misses, 1u);
+    EXPECT_EQ(stats[1].hits, 1u);
+    EXPECT_EQ(stats[1].misses, 1u);
+    EXPECT_EQ(stats[1].entries, 1u);
+    EXPECT_DOUBLE_EQ(stats[1].hitRatio(), 0.5);
+}
+
+//TEST CASE 23: Negative Cache Entries Expire After Their TTL
+TEST(NegativeCacheTest, EntriesExpire) {
+    NegativeCacheConfig config;
+    config.connect_ttl = std::chrono::milliseconds(50);
+    NegativeCache negative_cache(config);
+
+    std::string key = NegativeCache::endpointKey("dead.example.com", "80");
+    negative_cache.store(key, NegativeEntry{NegativeKind::ConnectFailure, 504, {}});
+
+    NegativeEntry found;
+    ASSERT_TRUE(negative_cache.find(key, found));
+    EXPECT_EQ(found.status_code, 504);
+    EXPECT_FALSE(negative_cache.find(NegativeCache::hostKey("dead.example.com"), found));
+
+    std::this_thread::sleep_for(std::chrono::milliseconds(80));
+    EXPECT_FALSE(negative_cache.find(key, found));
+    EXPECT_EQ(negative_cache.stats().entries, 0u);
+}
+
+//TEST CASE 24: Negative Cache Stays Within Its Entry And Byte Bounds
+TEST(NegativeCacheTest, BoundedByEntriesAndBytes) {
+    NegativeCacheConfig config;
+    config.max_entries = 3;
+    config.max_bytes = 250;
+    config.max_response_bytes = 200;
+    NegativeCache negative_cache(config);
+
+    for (int i = 0; i < 5; ++i) {
+        negative_cache.store("http://x.com/" + std::to_string(i), NegativeEntry{NegativeKind::ErrorStatus, 404, std::vector<char>(10, 'n')});
+    }
+    NegativeEntry found;
+    EXPECT_EQ(negative_cache.stats().entries, 3u);
+    EXPECT_FALSE(negative_cache.find("http://x.com/0", found));
+    EXPECT_TRUE(negative_cache.find("http://x.com/4", found));
+    EXPECT_EQ(found.response.size(), 10u);
+
+    negative_cache.store("http://x.com/big", NegativeEntry{NegativeKind::ErrorStatus, 404, std::vector<char>(201, 'n')});
+    EXPECT_FALSE(negative_cache.find("http://x.com/big", found));
+
+    negative_cache.store("http://x.com/large", NegativeEntry{NegativeKind::ErrorStatus, 410, std::vector<char>(200, 'n')});
+    EXPECT_TRUE(negative_cache.find("http://x.com/large", found));
+    EXPECT_LE(negative_cache.stats().bytes, 250u);
+
+    EXPECT_TRUE(NegativeCache::isCacheableStatus(404));
+    EXPECT_FALSE(NegativeCache::isCacheableStatus(503));
+}
+
+//TEST CASE 25: Router Matches Host And Path Rules And Rotates Through The Pool
+TEST(RouterTest, RoutesToPoolBackends) {
+    proxy_routing::RoutingConfig config;
+    proxy_routing::Backend a, b;
+    ASSERT_TRUE(proxy_routing::parseBackend("10.0.0.1:8080", a));
+    ASSERT_TRUE(proxy_routing::parseBackend("app2.internal", b));
+    EXPECT_EQ(b.port, "80");
+    EXPECT_FALSE(proxy_routing::parseBackend("bad:port", b));
+    ASSERT_TRUE(proxy_routing::parseBackend("app2.internal", b));
+
+    config.pools.push_back({"app", {a, b}});
+    config.pools.push_back({"static", {a}});
+    config.routes.push_back({"assets", "*.example.com", "/static/", "static"});
+    config.routes.push_back({"site", "www.example.com", "", "app"});
+    ASSERT_TRUE(proxy_routing::validateRoutingConfig(config));
+    proxy_routing::Router router(config);
+
+    std::string_view pool;
+    proxy_routing::BackendSet *set = router.route("cdn.example.com", "/static/app.js", pool);
+    ASSERT_NE(set, nullptr);
+    EXPECT_EQ(pool, "static");
+
+    set = router.route("www.example.com", "/index.html", pool);
+    ASSERT_NE(set, nullptr);
+    std::string first = set->acquire(0).backend().host;
+    EXPECT_NE(set->acquire(0).backend().host, first);
+
+    EXPECT_EQ(router.route("other.com", "/", pool), nullptr);
+
+    config.routes.push_back({"broken", "*", "", "missing"});
+    EXPECT_FALSE(proxy_routing::validateRoutingConfig(config));
+}
+
+//TEST CASE 26: Balancer Policies Track Load, Latency And Passive Health
+TEST(BalancerTest, PoliciesAndPassiveHealth) {
+    std::vector<proxy_routing::Backend> backends = {{"a", "80"}, {"b", "80"}, {"c", "80"}};
+    proxy_routing::HealthConfig health;
+    health.max_fails = 2;
+    health.fail_timeout = std::chrono::milliseconds(50);
+
+    // Least-outstanding avoids the backend that is still busy.
+    proxy_routing::BackendSet least(backends, proxy_routing::BalancePolicy::LeastOutstanding, health);
+    proxy_routing::UpstreamLease busy = least.acquire(0);
+    for (int i = 0; i < 4; ++i) {
+        EXPECT_NE(least.acquire(0).backendIndex(), busy.backendIndex());
+    }
+
+    // Consistent hashing keeps a key on one backend and moves it only while that one is down.
+    proxy_routing::BackendSet ring(backends, proxy_routing::BalancePolicy::ConsistentHash, health);
+    std::uint64_t key = hashCacheKey("http://example.com/logo.png");
+    std::size_t home = ring.acquire(key).backendIndex();
+    EXPECT_EQ(ring.acquire(key).backendIndex(), home);
+
+    for (std::uint32_t i = 0; i < health.max_fails; ++i) {
+        proxy_routing::UpstreamLease failing = ring.acquire(key);
+        ASSERT_EQ(failing.backendIndex(), home);
+        failing.finish(false);
+    }
+    EXPECT_FALSE(ring.stats()[home].healthy);
+    EXPECT_NE(ring.acquire(key).backendIndex(), home);
+
+    std::this_thread::sleep_for(std::chrono::milliseconds(80));
+    EXPECT_EQ(ring.acquire(key).backendIndex(), home);
+
+    // Peak-EWMA steers away from a backend that just answered slowly.
+    proxy_routing::BackendSet ewma({{"fast", "80"}, {"slow", "80"}}, proxy_routing::BalancePolicy::PeakEwma, health);
+    for (int i = 0; i < 4; ++i) {
+        proxy_routing::UpstreamLease lease = ewma.acquire(0);
+        if (lease.backend().host == "slow") {
+            std::this_thread::sleep_for(std::chrono::milliseconds(20));
+        }
+        lease.firstByte();
+        lease.finish(true);
+    }
+    int fast_picks = 0;
+    for (int i = 0; i < 20; ++i) {
+        fast_picks += ewma.acquire(0).backend().host == "fast";
+    }
+    EXPECT_EQ(fast_picks, 20);
+}
+
+//TEST CASE 27: Rendezvous Ownership Agrees Across Nodes And Moves Few Keys On Membership Change
+TEST(ClusterTest, RendezvousOwnershipIsStable) {
+    proxy_cluster::ClusterConfig a_config{"10.0.0.1:8080", {"10.0.0.1:8080", "10.0.0.2:8080", "10.0.0.3:8080"}};
+    proxy_cluster::ClusterConfig b_config{"10.0.0.2:8080", {"10.0.0.3:8080", "10.0.0.2:8080", "10.0.0.1:8080"}};
+    ASSERT_TRUE(proxy_cluster::validateClusterConfig(a_config));
+    ASSERT_TRUE(proxy_cluster::validateClusterConfig(b_config));
+    proxy_cluster::Cluster node_a(a_config);
+    proxy_cluster::Cluster node_b(b_config);
+
+    proxy_cluster::ClusterConfig grown{"10.0.0.1:8080", {"10.0.0.1:8080", "10.0.0.2:8080", "10.0.0.3:8080", "10.0.0.4:8080"}};
+    proxy_cluster::Cluster node_grown(grown);
+
+    int owned_by_a = 0, moved = 0;
+    for (int i = 0; i < 3000; ++i) {
+        std::uint64_t hash = hashCacheKey("http://example.com/object/" + std::to_string(i));
+        const std::string &owner = node_a.peerAddress(node_a.ownerOf(hash));
+        EXPECT_EQ(owner, node_b.peerAddress(node_b.ownerOf(hash)));
+        owned_by_a += node_a.isSelf(node_a.ownerOf(hash));
+
+        const std::string &new_owner = node_grown.peerAddress(node_grown.ownerOf(hash));
+        if (new_owner != owner) {
+            EXPECT_EQ(new_owner, "10.0.0.4:8080");
+            ++moved;
+        }
+    }
+    EXPECT_GT(owned_by_a, 800);
+    EXPECT_LT(owned_by_a, 1200);
+    EXPECT_GT(moved, 550);
+    EXPECT_LT(moved, 950);
+
+    proxy_cluster::ClusterConfig missing_self{"", {"10.0.0.1:8080", "10.0.0.2:8080"}};
+    EXPECT_FALSE(proxy_cluster::validateClusterConfig(missing_self));
+
+    // Only the other peers may open a peer link; self and ordinary clients may not.
+    EXPECT_TRUE(node_a.isPeerHost("10.0.0.2"));
+    EXPECT_TRUE(node_a.isPeerHost("10.0.0.3"));
+    EXPECT_FALSE(node_a.isPeerHost("10.0.0.1"));
+    EXPECT_FALSE(node_a.isPeerHost("192.168.1.20"));
+}
+
+//TEST CASE 28: Sibling Probe Messages Round-Trip And Cache Digests Have No False Negatives
+TEST(ClusterTest, IcpMessagesAndCacheDigest) {
+    std::vector<char> query = proxy_cluster::encodeIcp(proxy_cluster::IcpOpcode::Query, 42, "http://example.com/a");
+    proxy_cluster::IcpMessage decoded;
+    ASSERT_TRUE(proxy_cluster::decodeIcp(query.data(), query.size(), decoded));
+    EXPECT_EQ(decoded.opcode, proxy_cluster::IcpOpcode::Query);
+    EXPECT_EQ(decoded.request_number, 42u);
+    EXPECT_EQ(decoded.url, "http://example.com/a");
+
+    std::vector<char> hit = proxy_cluster::encodeIcp(proxy_cluster::IcpOpcode::Hit, 7, "http://example.com/b");
+    ASSERT_TRUE(proxy_cluster::decodeIcp(hit.data(), hit.size(), decoded));
+    EXPECT_EQ(decoded.opcode, proxy_cluster::IcpOpcode::Hit);
+    EXPECT_EQ(decoded.url, "http://example.com/b");
+    EXPECT_FALSE(proxy_cluster::decodeIcp(hit.data(), hit.size() - 1, decoded));
+
+    std::vector<std::uint64_t> stored;
+    for (int i = 0; i < 2000; ++i) {
+        stored.push_back(hashCacheKey("http://example.com/stored/" + std::to_string(i)));
+    }
+    proxy_cluster::CacheDigest built(stored);
+    proxy_cluster::CacheDigest digest;
+    ASSERT_TRUE(proxy_cluster::CacheDigest::parse(built.serialize(), digest));
+    EXPECT_EQ(digest.size(), 2000u);
+
+    for (std::uint64_t hash : stored) {
+        EXPECT_TRUE(digest.mayContain(hash));
+    }
+    int false_positives = 0;
+    for (int i = 0; i < 2000; ++i) {
+        false_positives += digest.mayContain(hashCacheKey("http://example.com/absent/" + std::to_string(i)));
+    }
+    EXPECT_LT(false_positives, 100);
+
+    EXPECT_FALSE(proxy_cluster::CacheDigest().mayContain(stored.front()));
+    EXPECT_FALSE(proxy_cluster::CacheDigest::parse(std::vector<char>(5), digest));
+}
+
+//TEST CASE 29: Message Framer Finds The End Of Length, Chunked And Close-Delimited Responses
+TEST(FramingTest, FindsEndOfResponse) {
+    using proxy_http::MessageFramer;
+
+    std::string sized = "HTTP/1.1 200 OK\r\nContent-Length: 5\r\n\r\nhelloHTTP/1.1";
+    MessageFramer by_length(MessageFramer::Kind::Response);
+    EXPECT_EQ(by_length.feed(sized.data(), sized.size()), sized.size() - 8);
+    EXPECT_TRUE(by_length.complete());
+    EXPECT_TRUE(by_length.reusable());
+
+    // Chunked body delivered one byte at a time, after an interim 100 Continue.
+    std::string chunked = "HTTP/1.1 100 Continue\r\n\r\nHTTP/1.1 200 OK\r\nTransfer-Encoding: chunked\r\n\r\n"
+                          "4;ext=1\r\nwiki\r\n5\r\npedia\r\n0\r\nX-Trailer: 1\r\n\r\n";
+    MessageFramer by_chunks(MessageFramer::Kind::Response);
+    for (std::size_t i = 0; i < chunked.size(); ++i) {
+        EXPECT_FALSE(by_chunks.complete());
+        EXPECT_EQ(by_chunks.feed(chunked.data() + i, 1), 1u);
+    }
+    EXPECT_TRUE(by_chunks.complete());
+    EXPECT_EQ(by_chunks.statusCode(), 200);
+
+    std::string until_close = "HTTP/1.0 200 OK\r\n\r\nbody";
+    MessageFramer by_close(MessageFramer::Kind::Response);
+    by_close.feed(until_close.data(), until_close.size());
+    EXPECT_FALSE(by_close.complete());
+    by_close.finishOnClose();
+    EXPECT_TRUE(by_close.complete());
+    EXPECT_FALSE(by_close.reusable());
+
+    std::string not_modified = "HTTP/1.1 304 Not Modified\r\nConnection: close\r\n\r\n";
+    MessageFramer no_body(MessageFramer::Kind::Response);
+    no_body.feed(not_modified.data(), not_modified.size());
+    EXPECT_TRUE(no_body.complete());
+    EXPECT_FALSE(no_body.reusable());
+
+    std::string truncated = "HTTP/1.1 200 OK\r\nContent-Length: 10\r\n\r\nshort";
+    MessageFramer cut(MessageFramer::Kind::Response);
+    cut.feed(truncated.data(), truncated.size());
+    cut.finishOnClose();
+    EXPECT_TRUE(cut.failed());
+
+    std::string conflicting = "HTTP/1.1 200 OK\r\nContent-Length: 3\r\nContent-Length: 4\r\n\r\n";
+    MessageFramer smuggled(MessageFramer::Kind::Response);
+    smuggled.feed(conflicting.data(), conflicting.size());
+    EXPECT_TRUE(smuggled.failed());
+}
+
+//TEST CASE 30: Parent Rules Match Domains In Order
+TEST(RoutingTest, ParentRulesMatchDomains) {
+    proxy_routing::RoutingConfig config;
+    config.parents.push_back(proxy_routing::ParentRule{"corp", {"*.corp.example", "intranet"}, {{"10.0.0.1", "3128"}, {"10.0.0.2", "3128"}}});
+    config.parents.push_back(proxy_routing::ParentRule{"egress", {}, {{"10.0.1.1", "3128"}}});
+    ASSERT_TRUE(proxy_routing::validateRoutingConfig(config));
+
+    proxy_routing::Router router(config);
+    ASSERT_NE(router.parentFor("wiki.corp.example"), nullptr);
+    EXPECT_EQ(router.parentFor("wiki.corp.example")->name(), "corp");
+    EXPECT_EQ(router.parentFor("intranet")->name(), "corp");
+    EXPECT_EQ(router.parentFor("example.com")->name(), "egress");
+
+    // The same URL hash keeps choosing the same parent while it is healthy.
+    proxy_routing::BackendSet &corp = router.parentFor("intranet")->backends();
+    std::uint64_t url_hash = hashCacheKey("http://intranet/report");
+    std::string first = corp.acquire(url_hash).backend().host;
+    for (int i = 0; i < 10; ++i) {
+        EXPECT_EQ(corp.acquire(url_hash).backend().host, first);
+    }
+
+    EXPECT_EQ(router.parentFor("intranet")->takeIdle(0), INVALID_SOCKET);
+
+    proxy_routing::RoutingConfig empty_parent;
+    empty_parent.parents.push_back(proxy_routing::ParentRule{"none"});
+    EXPECT_FALSE(proxy_routing::validateRoutingConfig(empty_parent));
+}
+
+//TEST CASE 31: Removing An Entry Frees Its Space And Leaves Others In Place
+TEST(CacheRemoveTest, RemoveDropsOnlyTheTarget) {
+    Cache cache;
+    std::vector<char> body(1000, 'x');
+    cache.cacheAdd("http://example.com/a", body);
+    cache.cacheAdd("http://example.com/b", body);
+
+    cache.cacheRemove(makeCacheKey("http://example.com/a"));
+    EXPECT_TRUE(cache.cacheFind("http://example.com/a").empty());
+    EXPECT_FALSE(cache.cacheContains(makeCacheKey("http://example.com/a")));
+    EXPECT_EQ(cache.cacheFind("http://example.com/b"), body);
+
+    cache.cacheRemove(makeCacheKey("http://example.com/missing"));
+    EXPECT_EQ(cache.partitionStats().front().entries, 1u);
+    EXPECT_EQ(cache.partitionStats().front().bytes, body.size());
+
+    cache.cacheAdd("http://example.com/a", body);
+    EXPECT_EQ(cache.cacheFind("http://example.com/a"), body);
+}
+
+//TEST CASE 32: Header Rewriting Keeps Untouched Lines As Spans Of The Request Buffer
+TEST(HeaderRewriteTest, RewritesWithoutCopyingKeptLines) {
+    std::string head = "GET http://example.com/a HTTP/1.1\r\n"
+                       "Host: example.com\r\n"
+                       "Accept: */*\r\n"
+                       "User-Agent: test\r\n"
+                       "Connection: keep-alive, X-Trace\r\n"
+                       "X-Trace: 1\r\n"
+                       "Via: 1.0 edge\r\n"
+                       "Cookie: a=b\r\n"
+                       "X-Secret: s\r\n"
+                       "\r\n";
+    std::vector<char> request(head.begin(), head.end());
+
+    proxy_http::HeaderRules rules;
+    rules.remove = {"x-secret"};
+    rules.set = {"User-Agent: proxy"};
+    rules.add = {"X-Added: 1"};
+
+    proxy_http::RequestHead plan;
+    plan.build("GET /a HTTP/1.1\r\nHost: example.com\r\nConnection: close\r\n", request, rules, "10.0.0.1");
+
+    std::string sent;
+    std::size_t spans = 0;
+    for (const proxy_http::Segment &segment : plan.segments()) {
+        if (segment.data >= request.data() && segment.data < request.data() + request.size())
+            ++spans;
+        sent.append(segment.data, segment.size);
+    }
+    EXPECT_EQ(sent.size(), plan.size());
+    EXPECT_EQ(sent, "GET /a HTTP/1.1\r\nHost: example.com\r\nConnection: close\r\n"
+                    "Accept: */*\r\n"
+                    "Via: 1.0 edge, 1.1 proxy_main\r\n"
+                    "Cookie: a=b\r\n"
+                    "User-Agent: proxy\r\n"
+                    "X-Added: 1\r\n"
+                    "X-Forwarded-For: 10.0.0.1\r\n"
+                    "\r\n");
+    EXPECT_EQ(spans, 3u);
+
+    proxy_http::HeaderRules off;
+    off.via = false;
+    off.forwarded_for = false;
+    std::string plain_head = "GET / HTTP/1.1\r\nHost: h\r\nA: 1\r\nB: 2\r\n\r\n";
+    std::vector<char> plain(plain_head.begin(), plain_head.end());
+    plan.build("GET / HTTP/1.1\r\n", plain, off, "");
+    ASSERT_EQ(plan.segments().size(), 3u);
+    EXPECT_EQ(std::string(plan.segments()[1].data, plan.segments()[1].size), "A: 1\r\nB: 2\r\n");
+}
+
+//TEST CASE 33: HPACK Decodes The RFC 7541 Huffman Examples And Round-Trips Its Own Output
+TEST(HpackTest, DecodesRfcExamplesAndRoundTrips) {
+    auto bytes = [](const std::string &hex) {
+        std::vector<std::uint8_t> out;
+        for (std::size_t i = 0; i + 1 < hex.size(); i += 2)
+            out.push_back(static_cast<std::uint8_t>(std::stoi(hex.substr(i, 2), nullptr, 16)));
+        return out;
+    };
+
+    // RFC 7541 C.4.1 and C.4.2: the second block refers to the dynamic table the first filled.
+    proxy_http::HpackDecoder decoder;
+    proxy_http::HeaderList first;
+    std::vector<std::uint8_t> block = bytes("828684418cf1e3c2e5f23a6ba0ab90f4ff");
+    ASSERT_TRUE(decoder.decode(block.data(), block.size(), first, 4096));
+    ASSERT_EQ(first.size(), 4u);
+    EXPECT_EQ(first[3], std::make_pair(std::string(":authority"), std::string("www.example.com")));
+    EXPECT_EQ(decoder.tableSize(), 57u);
+
+    proxy_http::HeaderList second;
+    block = bytes("828684be5886a8eb10649cbf");
+    ASSERT_TRUE(decoder.decode(block.data(), block.size(), second, 4096));
+    ASSERT_EQ(second.size(), 5u);
+    EXPECT_EQ(second[3].second, "www.example.com");
+    EXPECT_EQ(second[4], std::make_pair(std::string("cache-control"), std::string("no-cache")));
+
+    // An index past both tables is a decoding error.
+    proxy_http::HeaderList bad;
+    block = bytes("ff00");
+    EXPECT_FALSE(proxy_http::HpackDecoder().decode(block.data(), block.size(), bad, 4096));
+
+    proxy_http::HeaderList headers{{":status", "200"}, {":status", "502"}, {"content-type", "text/html"}, {"x-custom", std::string(300, 'v')}};
+    std::string encoded;
+    proxy_http::hpackEncode(headers, encoded);
+    proxy_http::HeaderList decoded;
+    proxy_http::HpackDecoder fresh;
+    ASSERT_TRUE(fresh.decode(reinterpret_cast<const std::uint8_t *>(encoded.data()), encoded.size(), decoded, 4096));
+    EXPECT_EQ(decoded, headers);
+    EXPECT_EQ(fresh.tableSize(), 0u);
+}
+
+//TEST CASE 34: HTTP/2 Requests Map Onto Absolute-Form HTTP/1.1 Requests
+TEST(Http2Test, RequestsBecomeHttp1) {
+    proxy_http::H2Request request;
+    request.headers = {{":method", "POST"}, {":scheme", "http"}, {":authority", "example.com:8080"}, {":path", "/upload?x=1"},
+                       {"cookie", "a=1"}, {"te", "trailers"}, {"cookie", "b=2"}, {"content-type", "text/plain"}};
+    request.body = {'h', 'i'};
+
+    std::vector<char> out;
+    ASSERT_TRUE(proxy_http::toHttp1Request(request, out));
+    EXPECT_EQ(std::string(out.begin(), out.end()), "POST http://example.com:8080/upload?x=1 HTTP/1.1\r\n"
+                                                   "Host: example.com:8080\r\n"
+                                                   "content-type: text/plain\r\n"
+                                                   "cookie: a=1; b=2\r\n"
+                                                   "Content-Length: 2\r\n"
+                                                   "\r\n"
+                                                   "hi");
+
+    proxy_http::H2Request tunnel;
+    tunnel.headers = {{":method", "CONNECT"}, {":authority", "example.com:443"}};
+    EXPECT_FALSE(proxy_http::toHttp1Request(tunnel, out));
+
+    std::string frame;
+    proxy_http::appendFrameHeader(frame, 0x12345, proxy_http::H2FrameType::Data, 0x1, 7);
+    ASSERT_EQ(frame.size(), proxy_http::H2_FRAME_HEADER_SIZE);
+    proxy_http::H2FrameHeader parsed = proxy_http::parseFrameHeader(reinterpret_cast<const std::uint8_t *>(frame.data()));
+    EXPECT_EQ(parsed.length, 0x12345u);
+    EXPECT_EQ(parsed.type, proxy_http::H2FrameType::Data);
+    EXPECT_EQ(parsed.flags, 0x1);
+    EXPECT_EQ(parsed.stream_id, 7u);
+}
+
+#ifndef _WIN32
+//TEST CASE 35: Concurrent Fetches Share One Upstream h2c Session
+TEST(Http2Test, UpstreamStreamsAreMultiplexed) {
+    int fds[2];
+    ASSERT_EQ(socketpair(AF_UNIX, SOCK_STREAM, 0, fds), 0);
+
+    // The proxy's own h2c frontend plays the origin: a sized body and one without a length.
+    std::thread origin([fd = fds[1]]() {
+        proxy_http::Http2Session session(fd, 0, [](proxy_http::Http2Session &s, std::uint32_t id, const proxy_http::H2Request &request) {
+            if (request.header(":path") == "/sized")
+            {
+                s.sendHeaders(id, {{":status", "200"}, {"content-length", "5"}}, false);
+                s.sendData(id, "sized", 5, true);
+            }
+            else
+            {
+                s.sendHeaders(id, {{":status", "404"}, {"x-via", std::string(request.header("x-test"))}}, false);
+                s.sendData(id, "gone", 4, true);
+            }
+        });
+        session.run({});
+        close(fd);
+    });
+
+    {
+        proxy_http::H2UpstreamSession upstream(fds[0], "origin.test:80");
+        ASSERT_TRUE(upstream.start());
+
+        // Host and hop-by-hop fields do not survive the move to HTTP/2.
+        proxy_http::HeaderList fields;
+        proxy_http::appendHttp1Fields("GET / HTTP/1.1\r\nHost: origin.test\r\nConnection: close\r\nX-Test: yes\r\n", fields);
+        ASSERT_EQ(fields.size(), 1u);
+        EXPECT_EQ(fields[0].first, "x-test");
+
+        std::string sized, unsized;
+        auto fetch = [&](const char *path, std::string &out) {
+            proxy_http::HeaderList headers{{":method", "GET"}, {":scheme", "http"}, {":authority", "origin.test"}, {":path", path}};
+            headers.insert(headers.end(), fields.begin(), fields.end());
+            return upstream.fetch(headers, nullptr, 0, false, [&](const char *data, std::size_t size) {
+                out.append(data, size);
+                return true;
+            });
+        };
+
+        using FetchResult = proxy_http::H2UpstreamSession::FetchResult;
+        FetchResult first = FetchResult::Broken;
+        std::thread other([&]() { first = fetch("/sized", sized); });
+        EXPECT_EQ(fetch("/missing", unsized), FetchResult::Complete);
+        other.join();
+
+        EXPECT_EQ(first, FetchResult::Complete);
+        EXPECT_EQ(sized, "HTTP/1.1 200 OK\r\ncontent-length: 5\r\n\r\nsized");
+        EXPECT_EQ(unsized, "HTTP/1.1 404 Not Found\r\nx-via: yes\r\nTransfer-Encoding: chunked\r\n\r\n4\r\ngone\r\n0\r\n\r\n");
+        EXPECT_EQ(upstream.streamsOpened(), 2u);
+        EXPECT_EQ(upstream.activeStreams(), 0u);
+        EXPECT_TRUE(upstream.usable());
+    }
+
+    origin.join();
+}
+#endif
+
+#ifdef PROXY_TLS_INTERCEPT
+#include "proxy_tls.hpp"
+
+//TEST CASE 36: Intercepted TLS Legs Carry Plaintext
+TEST(TlsTest, InterceptedChannelsCarryPlaintext) {
+    proxy_tls::InterceptConfig config;
+    config.hosts = {"*.example.test"};
+    config.ca_cert = testing::TempDir() + "intercept_ca.pem";
+    config.ca_key = testing::TempDir() + "intercept_ca.key";
+    config.verify_upstream = false;
+    std::remove(config.ca_cert.c_str());
+    std::remove(config.ca_key.c_str());
+
+    proxy_tls::Interceptor interceptor(config);
+    ASSERT_TRUE(interceptor.enabled());
+    EXPECT_TRUE(interceptor.intercepts("api.example.test"));
+    EXPECT_FALSE(interceptor.intercepts("example.org"));
+
+    int fds[2];
+    ASSERT_EQ(socketpair(AF_UNIX, SOCK_STREAM, 0, fds), 0);
+
+    std::unique_ptr<proxy_tls::TlsChannel> server;
+    std::thread accepting([&]() { server = interceptor.acceptClient(fds[0], "api.example.test"); });
+    std::unique_ptr<proxy_tls::TlsChannel> client = interceptor.connectOrigin(fds[1], "api.example.test", "443");
+    accepting.join();
+
+    ASSERT_TRUE(client);
+    ASSERT_TRUE(server);
+
+    const std::string request = "GET / HTTP/1.1\r\n\r\n";
+    ASSERT_EQ(send(client->socket(), request.data(), request.size(), 0), (ssize_t)request.size());
+    std::string received(request.size(), '\0');
+    ASSERT_EQ(recv(server->socket(), received.data(), received.size(), MSG_WAITALL), (ssize_t)request.size());
+    EXPECT_EQ(received, request);
+
+    proxy_tls::InterceptStats stats = interceptor.stats();
+    EXPECT_EQ(stats.client_sessions, 1u);
+    EXPECT_EQ(stats.origin_sessions, 1u);
+    EXPECT_EQ(stats.certificates_issued, 1u);
+    EXPECT_EQ(stats.handshake_failures, 0u);
+
+    client.reset();
+    server.reset();
+    close(fds[0]);
+    close(fds[1]);
+}
+
+//TEST CASE 37: Second Connections Resume On Both Legs
+TEST(TlsTest, SecondHandshakesResume) {
+    proxy_tls::InterceptConfig config;
+    config.hosts = {"*.example.test"};
+    config.ca_cert = testing::TempDir() + "resume_ca.pem";
+    config.ca_key = testing::TempDir() + "resume_ca.key";
+    config.verify_upstream = false;
+    config.handshake_threads = 2;
+    std::remove(config.ca_cert.c_str());
+    std::remove(config.ca_key.c_str());
+
+    proxy_tls::Interceptor interceptor(config);
+    ASSERT_TRUE(interceptor.enabled());
+
+    // A full round trip, so a TLS 1.3 ticket sent after the handshake has been read by the origin leg.
+    auto connectAndExchange = [&]() {
+        int fds[2];
+        ASSERT_EQ(socketpair(AF_UNIX, SOCK_STREAM, 0, fds), 0);
+
+        std::unique_ptr<proxy_tls::TlsChannel> server;
+        std::thread accepting([&]() { server = interceptor.acceptClient(fds[0], "api.example.test"); });
+        std::unique_ptr<proxy_tls::TlsChannel> client = interceptor.connectOrigin(fds[1], "api.example.test", "443");
+        accepting.join();
+        ASSERT_TRUE(client);
+        ASSERT_TRUE(server);
+
+        char byte = 'q';
+        ASSERT_EQ(send(client->socket(), &byte, 1, 0), 1);
+        ASSERT_EQ(recv(server->socket(), &byte, 1, 0), 1);
+        ASSERT_EQ(send(server->socket(), &byte, 1, 0), 1);
+        ASSERT_EQ(recv(client->socket(), &byte, 1, 0), 1);
+
+        client.reset();
+        server.reset();
+        close(fds[0]);
+        close(fds[1]);
+    };
+
+    connectAndExchange();
+    connectAndExchange();
+
+    proxy_tls::InterceptStats stats = interceptor.stats();
+    EXPECT_EQ(stats.handshakes, 4u);
+    EXPECT_EQ(stats.client_resumed, 1u);
+    EXPECT_EQ(stats.origin_resumed, 1u);
+    EXPECT_DOUBLE_EQ(stats.resumption_ratio, 0.5);
+    EXPECT_GT(stats.handshake_rate, 0.0);
+}
+#endif
+
+//TEST CASE 38: PROXY Protocol v1 And v2 Headers Yield The Client Address
+TEST(ProxyProtocolTest, ParsesTextAndBinaryHeaders) {
+    using proxy_http::ProxyHeaderStatus;
+    proxy_http::ClientAddress source;
+    std::size_t consumed = 0;
+
+    std::string v1 = "PROXY TCP4 203.0.113.7 10.0.0.1 51234 8080\r\nGET / HTTP/1.1\r\n";
+    ASSERT_EQ(proxy_http::parseProxyHeader(v1.data(), v1.size(), source, consumed), ProxyHeaderStatus::Complete);
+    EXPECT_EQ(source.host, "203.0.113.7");
+    EXPECT_EQ(source.port, 51234);
+    EXPECT_EQ(v1.substr(consumed), "GET / HTTP/1.1\r\n");
+
+    std::string v1_six = "PROXY TCP6 2001:db8::1 2001:db8::2 443 8080\r\n";
+    ASSERT_EQ(proxy_http::parseProxyHeader(v1_six.data(), v1_six.size(), source, consumed), ProxyHeaderStatus::Complete);
+    EXPECT_EQ(source.host, "2001:db8::1");
+
+    std::string unknown = "PROXY UNKNOWN\r\n";
+    ASSERT_EQ(proxy_http::parseProxyHeader(unknown.data(), unknown.size(), source, consumed), ProxyHeaderStatus::Complete);
+    EXPECT_TRUE(source.host.empty());
+    EXPECT_EQ(consumed, unknown.size());
+
+    EXPECT_EQ(proxy_http::parseProxyHeader(v1.data(), 20, source, consumed), ProxyHeaderStatus::Incomplete);
+    EXPECT_EQ(proxy_http::parseProxyHeader("PRO", 3, source, consumed), ProxyHeaderStatus::Incomplete);
+    std::string bad_port = "PROXY TCP4 203.0.113.7 10.0.0.1 70000 8080\r\n";
+    EXPECT_EQ(proxy_http::parseProxyHeader(bad_port.data(), bad_port.size(), source, consumed), ProxyHeaderStatus::Invalid);
+    std::string plain = "GET / HTTP/1.1\r\n";
+    EXPECT_EQ(proxy_http::parseProxyHeader(plain.data(), plain.size(), source, consumed), ProxyHeaderStatus::Invalid);
+
+    // v2, PROXY over TCP4, with a 3-byte TLV after the addresses.
+    std::string v2("\r\n\r\n\0\r\nQUIT\n", 12);
+    v2 += std::string{'\x21', '\x11', '\x00', '\x0f'};
+    v2 += std::string{'\xc6', '\x33', '\x64', '\x09', '\x0a', '\x00', '\x00', '\x01', '\x1f', '\x90', '\x00', '\x50'};
+    v2 += std::string{'\x04', '\x00', '\x00'};
+    v2 += "GET";
+    ASSERT_EQ(proxy_http::parseProxyHeader(v2.data(), v2.size(), source, consumed), ProxyHeaderStatus::Complete);
+    EXPECT_EQ(source.host, "198.51.100.9");
+    EXPECT_EQ(source.port, 8080);
+    EXPECT_EQ(v2.substr(consumed), "GET");
+
+    EXPECT_EQ(proxy_http::parseProxyHeader(v2.data(), 20, source, consumed), ProxyHeaderStatus::Incomplete);
+    EXPECT_EQ(proxy_http::parseProxyHeader(v2.data(), 8, source, consumed), ProxyHeaderStatus::Incomplete);
+
+    // LOCAL: a balancer health check, no client address.
+    std::string local = v2.substr(0, 16);
+    local[12] = '\x20';
+    local[13] = '\x00';
+    local[15] = '\x00';
+    ASSERT_EQ(proxy_http::parseProxyHeader(local.data(), local.size(), source, consumed), ProxyHeaderStatus::Complete);
+    EXPECT_TRUE(source.host.empty());
+    EXPECT_EQ(consumed, 16u);
+
+    std::string wrong_version = v2;
+    wrong_version[12] = '\x11';
+    EXPECT_EQ(proxy_http::parseProxyHeader(wrong_version.data(), wrong_version.size(), source, consumed), ProxyHeaderStatus::Invalid);
+}
+
+//TEST CASE 39: Prefetch Scanner Finds Same-Origin Subresources Across Chunk Boundaries
+TEST(PrefetchTest, ScansHtmlAndResolvesSameOrigin) {
+    std::string html =
+        "<html><head><link rel=\"stylesheet\" href=\"/css/site.css\"><link rel=canonical href=\"/page\">"
+        "<!-- <script src=\"/commented.js\"></script> -->"
+        "<script src='app.js?v=1&amp;x=2'></script><LINK REL=\"shortcut icon\" HREF=\"../favicon.ico\"></head>"
+        "<body><img alt=\"a > b\" src=\"/img/b.png\"><img src=\"//cdn.example.com/logo.png\"><img src=\"http://www.example.com/img/a.png#top\">"
+        "<img src=\"data:image/png;base64,AAAA\"><img src=\"https://www.example.com/secure.png\"></body></html>";
+
+    // Fed one byte at a time, every tag and comment straddles a chunk boundary.
+    proxy_cache::SubresourceScanner scanner(16);
+    for (char c : html)
+        scanner.feed(&c, 1);
+
+    const std::string page = "http://www.example.com/blog/post.html?id=3";
+    std::vector<std::string> urls;
+    for (const std::string &reference : scanner.references())
+    {
+        std::string url;
+        if (proxy_cache::resolveSameOrigin(page, reference, url))
+            urls.push_back(url);
+    }
+
+    EXPECT_EQ(urls, (std::vector<std::string>{"http://www.example.com/css/site.css",
+                                              "http://www.example.com/blog/app.js?v=1&x=2",
+                                              "http://www.example.com/favicon.ico",
+                                              "http://www.example.com/img/b.png",
+                                              "http://www.example.com/img/a.png"}));
+
+    proxy_cache::SubresourceScanner limited(1);
+    limited.feed(html.data(), html.size());
+    EXPECT_EQ(limited.references().size(), 1u);
+
+    std::string url;
+    EXPECT_TRUE(proxy_cache::resolveSameOrigin("http://h.test:8080/a/b/", "./c/../d.js", url));
+    EXPECT_EQ(url, "http://h.test:8080/a/b/d.js");
+    EXPECT_FALSE(proxy_cache::resolveSameOrigin("http://h.test:8080/", "http://h.test/x.js", url));
+    EXPECT_FALSE(proxy_cache::resolveSameOrigin("http://h.test/", "javascript:void(0)", url));
+}
+
+
+//TEST CASE 40: Binary Log Events Decode To The Text Log Format
+TEST(BinaryLogTest, EventsDecodeToTextFormat) {
+    const std::string path = "binlog_test.blog";
+    proxy_log::BinaryLogConfig config;
+    config.path = path;
+    config.buffer_size = 64 * 1024;
+    config.preallocate = 0;
+
+    proxy_log::BinaryLogWriter writer;
+    ASSERT_TRUE(writer.open(config));
+
+    auto append = [&writer](std::string_view format, const auto &...args)
+    {
+        char record[proxy_log::MAX_EVENT_SIZE];
+        proxy_log::EventEncoder encoder(record, sizeof(record));
+        encoder.begin(writer.formatId(format), proxy_log::eventTimestamp());
+        (encoder.add(args), ...);
+        writer.append(record, encoder.finish());
+    };
+
+    std::string url = "http://www.example.com/";
+    append("INFO|CLIENT|{}|CACHE_STORE|{} ({} bytes)\n", 7, url, std::size_t{715});
+    append("INFO|ADMIN|ratio={:.3f} ok={} c={} {{literal}}\n", 0.5, true, 'x');
+    append("WARN|CLIENT|{}|{}\n", -1, std::string(proxy_log::MAX_EVENT_SIZE * 2, 'a'));
+    append("INFO|CLIENT|{}|CACHE_STORE|{} ({} bytes)\n", 8, std::string_view("http://b/"), std::size_t{1});
+    writer.close();
+    EXPECT_EQ(writer.stats().events, 4u);
+
+    proxy_log::BinaryLogReader reader;
+    ASSERT_TRUE(reader.open(path));
+    std::vector<std::string> messages;
+    proxy_log::LogEvent event;
+    while (reader.next(event))
+        messages.push_back(proxy_log::formatMessage(event));
+    EXPECT_FALSE(reader.wasTruncated());
+
+    ASSERT_EQ(messages.size(), 4u);
+    EXPECT_EQ(messages[0], "INFO|CLIENT|7|CACHE_STORE|http://www.example.com/ (715 bytes)\n");
+    EXPECT_EQ(messages[1], "INFO|ADMIN|ratio=0.500 ok=true c=x {literal}\n");
+    // The oversized argument is cut to fit the record, the rest of the format survives.
+    EXPECT_TRUE(messages[2].starts_with("WARN|CLIENT|-1|aaaa"));
+    EXPECT_LT(messages[2].size(), proxy_log::MAX_EVENT_SIZE);
+    EXPECT_EQ(messages[3], "INFO|CLIENT|8|CACHE_STORE|http://b/ (1 bytes)\n");
+
+    std::remove(path.c_str());
+}
+
+
+//TEST CASE 41: Per-Subsystem Log Levels Filter At Runtime
+TEST(LogLevelTest, SubsystemLevelsFilterIndependently) {
+    LogLevel level;
+    LogSubsystem subsystem;
+    EXPECT_TRUE(parseLogLevel("debug", level));
+    EXPECT_EQ(level, LogLevel::Debug);
+    EXPECT_FALSE(parseLogLevel("verbose", level));
+    EXPECT_TRUE(parseLogSubsystem("remote", subsystem));
+    EXPECT_EQ(subsystem, LogSubsystem::Remote);
+    EXPECT_FALSE(parseLogSubsystem("dns", subsystem));
+    EXPECT_EQ(logSubsystemName(LogSubsystem::Connect), "connect");
+
+    ProxyLogger &logger = ProxyLogger::getInstance();
+    logger.set_level(LogSubsystem::Remote, LogLevel::Debug);
+    logger.set_level(LogSubsystem::Cache, LogLevel::Warn);
+
+    EXPECT_TRUE(logger.enabled(LogLevel::Debug, LogSubsystem::Remote));
+    EXPECT_FALSE(logger.enabled(LogLevel::Info, LogSubsystem::Cache));
+    EXPECT_TRUE(logger.enabled(LogLevel::Error, LogSubsystem::Cache));
+    EXPECT_FALSE(logger.enabled(LogLevel::Debug, LogSubsystem::Client));
+
+    logger.set_level(LogSubsystem::Remote, LogLevel::Off);
+    EXPECT_FALSE(logger.enabled(LogLevel::Error, LogSubsystem::Remote));
+
+    for (std::size_t i = 0; i < LOG_SUBSYSTEM_COUNT; ++i)
+        logger.set_level(static_cast<LogSubsystem>(i), LogLevel::Info);
+}
+
+
+//TEST CASE 42: Repeated Errors Are Rate Limited And Info Lines Sampled
+TEST(LogLevelTest, RateLimitsSimilarErrorsAndSamplesInfo) {
+    ProxyLogger &logger = ProxyLogger::getInstance();
+    LogConfig config;
+    config.rate_limit = 3;
+    config.rate_interval = std::chrono::milliseconds(50);
+    config.error_budget = 0;
+    config.sample_rates[static_cast<std::size_t>(LogSubsystem::Cache)] = 0.0;
+    logger.configure(config);
+
+    const std::string_view fmt = "ERROR|REMOTE|Failed to resolve host: {}\n";
+    std::uint64_t dead = logSimilarityKey(fmt, std::string("dead.example"), 7);
+    EXPECT_EQ(dead, logSimilarityKey(fmt, std::string_view("dead.example"), 8)); // numbers do not count
+    std::uint64_t other = logSimilarityKey(fmt, std::string("other.example"), 7);
+    EXPECT_NE(dead, other);
+
+    std::uint64_t suppressed_before = logger.stats().suppressed;
+    int admitted = 0;
+    for (int i = 0; i < 10; ++i)
+        admitted += logger.admit(dead, fmt);
+    EXPECT_EQ(admitted, 3);
+    EXPECT_EQ(logger.stats().suppressed - suppressed_before, 7u);
+    // A different host is a different message: its first occurrence gets through.
+    EXPECT_TRUE(logger.admit(other, fmt));
+
+    std::this_thread::sleep_for(std::chrono::milliseconds(60));
+    EXPECT_TRUE(logger.admit(dead, fmt));
+
+    EXPECT_FALSE(logger.sampled(LogSubsystem::Cache));
+    EXPECT_TRUE(logger.sampled(LogSubsystem::Remote));
+    logger.set_sample_rate(LogSubsystem::Cache, 0.5);
+    int kept = 0;
+    for (int i = 0; i < 10000; ++i)
+        kept += logger.sampled(LogSubsystem::Cache);
+    EXPECT_GT(kept, 4000);
+    EXPECT_LT(kept, 6000);
+
+    logger.configure(LogConfig{});
+}
+
+//TEST CASE 43: Log Files Rotate By Size, Prune Old Segments And Reopen On Request
+TEST(LogFileTest, RotatesPrunesAndReopens) {
+    namespace fs = std::filesystem;
+    const fs::path dir = "logfile_test";
+    fs::remove_all(dir);
+    fs::create_directories(dir);
+    const std::string path = (dir / "test.log").string();
+
+    auto readFile = [](const fs::path &name)
+    {
+        std::ifstream in(name, std::ios::binary);
+        return std::string(std::istreambuf_iterator<char>(in), {});
+    };
+    auto rotatedSegments = [&dir]
+    {
+        std::vector<fs::path> names;
+        for (const auto &entry : fs::directory_iterator(dir))
+            if (entry.path().filename().string().starts_with("test.log.2"))
+                names.push_back(entry.path());
+        return names;
+    };
+
+    proxy_log::LogFile file;
+    ASSERT_TRUE(file.open(path, 64 * 1024, true, [] { return std::string("HEAD\n"); }));
+    proxy_log::RotationConfig rotation;
+    rotation.max_size = 1000;
+    rotation.keep = 2;
+    file.setRotation(rotation);
+
+    const std::string chunk(299, 'x');
+    for (int round = 0; round < 4; ++round)
+    {
+        for (int i = 0; i < 4; ++i)
+            EXPECT_TRUE(file.append((chunk + "\n").data(), chunk.size() + 1));
+        std::this_thread::sleep_for(std::chrono::milliseconds(250));
+    }
+    EXPECT_GE(file.stats().rotations, 3u);
+
+    // An external rotation moves the file away; the next pass reopens the configured path.
+    fs::rename(path, path + ".moved");
+    proxy_log::requestReopen();
+    EXPECT_TRUE(file.append("after\n", 6));
+    file.close();
+
+    EXPECT_GE(file.stats().reopens, 1u);
+    EXPECT_EQ(readFile(path), "HEAD\nafter\n");
+
+    // Only the newest two rotated segments survive, each starting with the prologue.
+    std::vector<fs::path> segments = rotatedSegments();
+    ASSERT_EQ(segments.size(), 2u);
+    for (const fs::path &segment : segments)
+        EXPECT_TRUE(readFile(segment).starts_with("HEAD\n"));
+
+    fs::remove_all(dir);
+}
+
+//TEST CASE 44: Cached Timestamp Prefix Matches A Full Format And Renders Sub-Seconds
+TEST(TimestampFormatterTest, ReusesPrefixWithinASecond) {
+    using namespace std::chrono;
+    using fraction = hh_mm_ss<system_clock::duration>;
+    const time_zone *zone = current_zone();
+    proxy_log::TimestampFormatter timestamps(zone);
+
+    auto expected = [zone](sys_seconds second, system_clock::duration offset)
+    {
+        std::string text = std::format("[{:%Y-%m-%d %H:%M:%S}", zoned_time{zone, second});
+        if (fraction::fractional_width > 0)
+            text += std::format(".{:0{}}", duration_cast<fraction::precision>(offset).count(), fraction::fractional_width);
+        return text + "] ";
+    };
+
+    const sys_seconds base = floor<seconds>(system_clock::now());
+    for (auto [second, offset] : {std::pair{base, system_clock::duration(0)},
+                                  std::pair{base, duration_cast<system_clock::duration>(milliseconds(123))},
+                                  std::pair{base, duration_cast<system_clock::duration>(milliseconds(999))},
+                                  std::pair{base + seconds(1), duration_cast<system_clock::duration>(milliseconds(5))},
+                                  std::pair{base + hours(24 * 40), system_clock::duration(1)}})
+    {
+        std::string line = "prefix:";
+        timestamps.append(line, second + offset);
+        EXPECT_EQ(line, "prefix:" + expected(second, offset));
+    }
+}
+
+//TEST CASE 45: Typed Log Lines Take Their Prefix From Level And Subsystem
+TEST(LogLevelTest, PrefixComesFromTemplateParameters) {
+    static_assert(LogPrefix<LogLevel::Warn, LogSubsystem::Remote>::value == "WARN|REMOTE|");
+    EXPECT_EQ((LogPrefix<LogLevel::Info, LogSubsystem::Cache>::value), "INFO|CACHE|");
+    EXPECT_EQ((LogPrefix<LogLevel::Debug, LogSubsystem::Connect>::value), "DEBUG|CONNECT|");
+
+    // Literals hold only what follows the prefix; one with a level tag would not compile.
+    constexpr LogFormat fmt("{}|CACHE_HIT|{}\n");
+    EXPECT_EQ(fmt.text, "{}|CACHE_HIT|{}\n");
+    for (std::size_t i = 0; i < LOG_SUBSYSTEM_COUNT; ++i)
+        EXPECT_EQ(LOG_SUBSYSTEM_TAGS[i], [&] {
+            std::string upper(logSubsystemName(static_cast<LogSubsystem>(i)));
+            for (char &c : upper) c = static_cast<char>(std::toupper(static_cast<unsigned char>(c)));
+            return upper;
+        }());
+}
+
+//TEST CASE 46: First Occurrences Past The Error Budget Are Capped, Even When Keys Collide
+TEST(LogLevelTest, FirstOccurrencesCannotBypassErrorBudget) {
+    ProxyLogger &logger = ProxyLogger::getInstance();
+    LogConfig config;
+    config.rate_limit = 1000;
+    config.error_budget = 5;
+    config.first_budget = 3;
+    logger.configure(config);
+
+    // Each burst starts just after a budget second begins, so it is counted against one second.
+    auto nextSecond = [] {
+        auto ms = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+        std::this_thread::sleep_for(std::chrono::milliseconds(1000 - ms % 1000 + 5));
+    };
+    const std::string_view fmt = "ERROR|REMOTE|Failed to resolve host: {}\n";
+
+    nextSecond();
+    std::uint64_t over_before = logger.stats().over_budget;
+    int admitted = 0;
+    for (std::uint64_t key = 1; key <= 100; ++key)
+        admitted += logger.admit(key * 7919, fmt);
+    EXPECT_EQ(admitted, 8);
+    EXPECT_EQ(logger.stats().over_budget - over_before, 92u);
+
+    // Two keys sharing a rate slot take it back from each other on every line.
+    nextSecond();
+    admitted = 0;
+    for (int i = 0; i < 100; ++i)
+        admitted += logger.admit(i % 2 ? 42 : 42 + 1024, fmt);
+    EXPECT_EQ(admitted, 8);
+
+    logger.configure(LogConfig{});
+}
+
+//TEST CASE 47: CLOCK-Pro Evicts The Only Entry Of A Ring Even After It Was Hit
+TEST(EvictionEngineTest, ClockProHandlesSingleEntryRing) {
+    struct Counters final : AccessCounters {
+        std::atomic<std::uint8_t> counts[4] = {};
+        std::atomic<std::uint8_t> &counter(std::uint32_t node) override { return counts[node]; }
+    } counters;
+    std::unique_ptr<EvictionEngine> engine = makeEvictionEngine(EvictionPolicy::ClockPro, counters, 1000);
+
+    engine->onInsert(0, 42, 10);
+    counters.counts[0] = 1;
+    EXPECT_EQ(engine->selectVictim(), 0u);
+    EXPECT_EQ(engine->selectVictim(), EvictionEngine::NONE);
+
+    // A hot entry left alone on the ring goes through the hot hand's demotion first.
+    engine->onInsert(1, 7, 10);
+    engine->onInsert(2, 8, 10);
+    counters.counts[1] = 1;
+    counters.counts[2] = 1;
+    std::uint32_t first = engine->selectVictim();
+    EXPECT_NE(first, EvictionEngine::NONE);
+    counters.counts[first == 1 ? 2 : 1] = AccessCounters::MAX_COUNT;
+    EXPECT_EQ(engine->selectVictim(), first == 1 ? 2u : 1u);
+    EXPECT_EQ(engine->selectVictim(), EvictionEngine::NONE);
+}
+
+//TEST CASE 48: Header List Tokens Match Whole Entries Only
+TEST(HeaderRewriteTest, MatchesWholeListTokens) {
+    using proxy_http::hasListToken;
+    EXPECT_TRUE(hasListToken("no-store", "no-store"));
+    EXPECT_TRUE(hasListToken("private, No-Store ,max-age=0", "no-store"));
+    EXPECT_TRUE(hasListToken("max-age=60,only-if-cached", "only-if-cached"));
+    EXPECT_TRUE(hasListToken("max-age = 60", "max-age"));
+    EXPECT_FALSE(hasListToken("", "no-store"));
+    EXPECT_FALSE(hasListToken("no-store-ish, x-no-store", "no-store"));
+    EXPECT_FALSE(hasListToken("no-cache=\"no-store\"", "no-store"));
+}
+
+//TEST CASE 49: Suppressed Lines Are Reported When A Storm Stops Or Loses Its Rate Slot
+TEST(LogLevelTest, ReportsSuppressedLinesWithoutALaterLine) {
+    ProxyLogger &logger = ProxyLogger::getInstance();
+    LogConfig config;
+    config.rate_limit = 2;
+    config.rate_interval = std::chrono::milliseconds(50);
+    config.error_budget = 0;
+    logger.configure(config);
+
+    const std::uintmax_t log_start = std::filesystem::file_size("proxy.log");
+    const std::string_view stops = "ERROR|REMOTE|Storm that stops: {}\n";
+    const std::string_view evicted = "ERROR|REMOTE|Storm that loses its slot: {}\n";
+    const std::uint64_t key = 0x5eed0400;
+
+    for (int i = 0; i < 7; ++i)
+        logger.admit(key, stops);
+    for (int i = 0; i < 4; ++i)
+        logger.admit(key + 1, evicted);
+    // A colliding key takes the second slot over before its window is out.
+    EXPECT_TRUE(logger.admit(key + 1 + 1024, stops));
+
+    // Neither message comes back; the writer's passes (every 100 ms) still report both.
+    std::this_thread::sleep_for(std::chrono::milliseconds(400));
+    std::ifstream in("proxy.log", std::ios::binary);
+    in.seekg(static_cast<std::streamoff>(log_start));
+    std::string written((std::istreambuf_iterator<char>(in)), std::istreambuf_iterator<char>());
+    EXPECT_NE(written.find("Suppressed 5 similar message(s): ERROR|REMOTE|Storm that stops: {}\n"), std::string::npos);
+    EXPECT_NE(written.find("Suppressed 2 similar message(s): ERROR|REMOTE|Storm that loses its slot: {}\n"), std::string::npos);
+
+    logger.configure(LogConfig{});
+}
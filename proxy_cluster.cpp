@@ -0,0 +1,882 @@
+#include <algorithm>
+#include <charconv>
+#include <cstring>
+
+#ifndef _WIN32
+#include <netinet/tcp.h>
+#endif
+
+#include "proxy_cluster.hpp"
+#include "proxy_cache_key.hpp"
+#include "proxy_logger.hpp"
+
+using namespace proxy_cluster;
+
+constexpr std::string_view PEER_REQUEST = "PEERGET ";
+constexpr std::string_view PEER_DIGEST = "PEERDIGEST ";
+constexpr std::string_view PEER_DATA = "PEERDATA ";
+constexpr std::string_view FRAME_END = "\r\n";
+
+constexpr std::size_t MAX_FRAME_LINE = 64;
+constexpr std::size_t MAX_PEER_REQUEST = 64 * 1024;
+constexpr std::size_t PEER_RECV_BUFFER_SIZE = 16 * 1024;
+constexpr int PEER_IO_TIMEOUT_SECONDS = 30;
+
+// Pooled links idle longer than this are dropped before the owner's own 30 s idle timeout
+// can close them under us.
+constexpr auto PEER_IDLE_LIMIT = std::chrono::seconds(20);
+constexpr auto PEER_DOWN_BACKOFF = std::chrono::seconds(5);
+
+constexpr std::uint8_t ICP_VERSION = 2;
+constexpr std::size_t ICP_HEADER_SIZE = 20;
+constexpr std::size_t ICP_MAX_MESSAGE = 16 * 1024;
+constexpr std::size_t MAX_DIGEST_BYTES = 32 * 1024 * 1024;
+
+namespace
+{
+    std::int64_t nowTicks()
+    {
+        return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+    }
+
+    bool sendAll(socket_t s, const char *data, std::size_t size)
+    {
+        std::size_t sent = 0;
+        while (sent < size)
+        {
+            int n = send(s, data + sent, (int)(size - sent), 0);
+            if (n == SOCKET_ERROR || n == 0)
+                return false;
+            sent += n;
+        }
+        return true;
+    }
+
+    // Pulls one "<verb> <n>\r\n" line out of buffer, reading more as needed. verb keeps its
+    // trailing space.
+    bool readFrameLine(socket_t s, std::vector<char> &buffer, std::string &verb, std::size_t &length)
+    {
+        while (true)
+        {
+            auto line_end = std::search(buffer.begin(), buffer.end(), FRAME_END.begin(), FRAME_END.end());
+            if (line_end != buffer.end())
+            {
+                std::string_view line(buffer.data(), line_end - buffer.begin());
+                std::size_t space = line.find(' ');
+                if (space == std::string_view::npos)
+                    return false;
+
+                std::string_view digits = line.substr(space + 1);
+                auto [ptr, ec] = std::from_chars(digits.data(), digits.data() + digits.size(), length);
+                if (ec != std::errc() || ptr != digits.data() + digits.size())
+                    return false;
+
+                verb.assign(line.substr(0, space + 1));
+                buffer.erase(buffer.begin(), line_end + FRAME_END.size());
+                return true;
+            }
+
+            if (buffer.size() > MAX_FRAME_LINE)
+                return false;
+
+            char temp[MAX_FRAME_LINE];
+            int n = recv(s, temp, sizeof(temp), 0);
+            if (n <= 0)
+                return false;
+            buffer.insert(buffer.end(), temp, temp + n);
+        }
+    }
+
+    bool readFrameLine(socket_t s, std::vector<char> &buffer, std::string_view expected, std::size_t &length)
+    {
+        std::string verb;
+        return readFrameLine(s, buffer, verb, length) && verb == expected;
+    }
+
+    void putBigEndian(std::vector<char> &out, std::uint32_t value, std::size_t bytes)
+    {
+        for (std::size_t i = bytes; i-- > 0;)
+            out.push_back(static_cast<char>((value >> (i * 8)) & 0xff));
+    }
+
+    std::uint32_t getBigEndian(const char *data, std::size_t bytes)
+    {
+        std::uint32_t value = 0;
+        for (std::size_t i = 0; i < bytes; ++i)
+            value = (value << 8) | static_cast<std::uint8_t>(data[i]);
+        return value;
+    }
+
+    // Second bloom hash derived from the key hash, forced odd so the probe sequence visits
+    // distinct bits in a power-of-two table.
+    std::uint64_t digestStep(std::uint64_t key_hash)
+    {
+        std::uint64_t x = key_hash + 0x9e3779b97f4a7c15ULL;
+        x = (x ^ (x >> 30)) * 0xbf58476d1ce4e5b9ULL;
+        x = (x ^ (x >> 27)) * 0x94d049bb133111ebULL;
+        return (x ^ (x >> 31)) | 1;
+    }
+
+    socket_t dialPeer(const std::string &host, const std::string &port)
+    {
+        struct addrinfo hints = {}, *result = nullptr;
+        hints.ai_family = AF_INET;
+        hints.ai_socktype = SOCK_STREAM;
+        hints.ai_protocol = IPPROTO_TCP;
+
+        if (getaddrinfo(host.c_str(), port.c_str(), &hints, &result) != 0)
+            return INVALID_SOCKET;
+
+        socket_t s = socket(result->ai_family, result->ai_socktype, result->ai_protocol);
+        if (s != INVALID_SOCKET)
+        {
+            setSocketTimeout(s, PEER_IO_TIMEOUT_SECONDS);
+            if (connect(s, result->ai_addr, (int)result->ai_addrlen) == SOCKET_ERROR)
+            {
+                closeSocket(s);
+                s = INVALID_SOCKET;
+            }
+        }
+
+        freeaddrinfo(result);
+        if (s != INVALID_SOCKET)
+            setNoDelay(s);
+        return s;
+    }
+
+    // Every numeric address host resolves to, for matching accepted connections.
+    void appendNumericAddresses(const std::string &host, std::vector<std::string> &out)
+    {
+        struct addrinfo hints = {}, *result = nullptr;
+        hints.ai_family = AF_UNSPEC;
+        hints.ai_socktype = SOCK_STREAM;
+
+        if (getaddrinfo(host.c_str(), nullptr, &hints, &result) != 0)
+        {
+            log<LogLevel::Warn, LogSubsystem::Cluster>("Cannot resolve peer {}; its peer links will be refused.\n", host);
+            return;
+        }
+        for (const struct addrinfo *ai = result; ai; ai = ai->ai_next)
+        {
+            char text[INET6_ADDRSTRLEN];
+            const void *address = ai->ai_family == AF_INET6
+                                      ? static_cast<const void *>(&reinterpret_cast<const sockaddr_in6 *>(ai->ai_addr)->sin6_addr)
+                                      : static_cast<const void *>(&reinterpret_cast<const sockaddr_in *>(ai->ai_addr)->sin_addr);
+            if (inet_ntop(ai->ai_family, address, text, sizeof(text)) && std::find(out.begin(), out.end(), text) == out.end())
+                out.emplace_back(text);
+        }
+        freeaddrinfo(result);
+    }
+}
+
+const char *proxy_cluster::clusterModeName(ClusterMode mode)
+{
+    return mode == ClusterMode::Siblings ? "siblings" : "hash";
+}
+
+bool proxy_cluster::parseClusterMode(std::string_view name, ClusterMode &out)
+{
+    for (ClusterMode mode : {ClusterMode::Hash, ClusterMode::Siblings})
+    {
+        if (name == clusterModeName(mode))
+        {
+            out = mode;
+            return true;
+        }
+    }
+    return false;
+}
+
+std::vector<char> proxy_cluster::encodeIcp(IcpOpcode opcode, std::uint32_t request_number, std::string_view url)
+{
+    // Queries carry a 4-byte requester address ahead of the URL.
+    std::size_t payload = (opcode == IcpOpcode::Query ? 4 : 0) + url.size() + 1;
+
+    std::vector<char> message;
+    message.reserve(ICP_HEADER_SIZE + payload);
+    message.push_back(static_cast<char>(opcode));
+    message.push_back(static_cast<char>(ICP_VERSION));
+    putBigEndian(message, static_cast<std::uint32_t>(ICP_HEADER_SIZE + payload), 2);
+    putBigEndian(message, request_number, 4);
+    message.resize(ICP_HEADER_SIZE + (opcode == IcpOpcode::Query ? 4 : 0), 0);
+    message.insert(message.end(), url.begin(), url.end());
+    message.push_back('\0');
+    return message;
+}
+
+bool proxy_cluster::decodeIcp(const char *data, std::size_t size, IcpMessage &out)
+{
+    if (size < ICP_HEADER_SIZE + 1 || static_cast<std::uint8_t>(data[1]) != ICP_VERSION)
+        return false;
+
+    std::size_t length = getBigEndian(data + 2, 2);
+    if (length > size || length < ICP_HEADER_SIZE + 1)
+        return false;
+
+    out.opcode = static_cast<IcpOpcode>(data[0]);
+    out.request_number = getBigEndian(data + 4, 4);
+
+    std::size_t url_start = ICP_HEADER_SIZE + (out.opcode == IcpOpcode::Query ? 4 : 0);
+    if (url_start >= length)
+        return false;
+
+    const char *url = data + url_start;
+    const char *terminator = std::find(url, data + length, '\0');
+    if (terminator == data + length)
+        return false;
+
+    out.url.assign(url, terminator);
+    return true;
+}
+
+CacheDigest::CacheDigest(const std::vector<std::uint64_t> &key_hashes) : entries(key_hashes.size())
+{
+    std::size_t bit_count = MIN_BITS;
+    while (bit_count < key_hashes.size() * BITS_PER_ENTRY && bit_count < MAX_BITS)
+        bit_count <<= 1;
+    bits.assign(bit_count / 8, 0);
+
+    for (std::uint64_t key_hash : key_hashes)
+    {
+        std::uint64_t step = digestStep(key_hash);
+        for (std::uint32_t i = 0; i < HASHES; ++i)
+        {
+            std::size_t bit = (key_hash + i * step) & (bit_count - 1);
+            bits[bit / 8] |= static_cast<std::uint8_t>(1u << (bit % 8));
+        }
+    }
+}
+
+bool CacheDigest::mayContain(std::uint64_t key_hash) const
+{
+    if (bits.empty())
+        return false;
+
+    std::size_t bit_count = bits.size() * 8;
+    std::uint64_t step = digestStep(key_hash);
+    for (std::uint32_t i = 0; i < HASHES; ++i)
+    {
+        std::size_t bit = (key_hash + i * step) & (bit_count - 1);
+        if (!(bits[bit / 8] & (1u << (bit % 8))))
+            return false;
+    }
+    return true;
+}
+
+std::vector<char> CacheDigest::serialize() const
+{
+    std::vector<char> out;
+    out.reserve(8 + bits.size());
+    putBigEndian(out, static_cast<std::uint32_t>(bits.size() * 8), 4);
+    putBigEndian(out, static_cast<std::uint32_t>(entries), 4);
+    out.insert(out.end(), bits.begin(), bits.end());
+    return out;
+}
+
+bool CacheDigest::parse(const std::vector<char> &data, CacheDigest &out)
+{
+    if (data.size() < 8)
+        return false;
+
+    std::size_t bit_count = getBigEndian(data.data(), 4);
+    if (bit_count < MIN_BITS || bit_count > MAX_BITS || (bit_count & (bit_count - 1)) != 0 || data.size() != 8 + bit_count / 8)
+        return false;
+
+    out.entries = getBigEndian(data.data() + 4, 4);
+    out.bits.assign(data.begin() + 8, data.end());
+    return true;
+}
+
+void proxy_cluster::setNoDelay(socket_t s)
+{
+    int enabled = 1;
+    setsockopt(s, IPPROTO_TCP, TCP_NODELAY, (char *)&enabled, sizeof(enabled));
+}
+
+bool ResponseWriter::write(const char *data, std::size_t size) const
+{
+    if (size == 0)
+        return true;
+
+    if (sink)
+        return (*sink)(data, size);
+
+    if (peer_framed)
+    {
+        char header[MAX_FRAME_LINE];
+        int header_len = std::snprintf(header, sizeof(header), "PEERDATA %zu\r\n", size);
+        if (!sendAll(socket, header, header_len))
+            return false;
+    }
+    return sendAll(socket, data, size);
+}
+
+bool ResponseWriter::finish() const
+{
+    if (!peer_framed)
+        return true;
+
+    constexpr std::string_view END_FRAME = "PEERDATA 0\r\n";
+    return sendAll(socket, END_FRAME.data(), END_FRAME.size());
+}
+
+bool proxy_cluster::readPeerRequest(socket_t peer_socket, std::vector<char> &pending, std::vector<char> &request, PeerRequestKind &kind)
+{
+    std::string verb;
+    std::size_t length = 0;
+    if (!readFrameLine(peer_socket, pending, verb, length))
+        return false;
+
+    if (verb == PEER_DIGEST)
+    {
+        kind = PeerRequestKind::Digest;
+        request.clear();
+        return length == 0;
+    }
+
+    kind = PeerRequestKind::Get;
+    if (verb != PEER_REQUEST || length == 0 || length > MAX_PEER_REQUEST)
+        return false;
+
+    while (pending.size() < length)
+    {
+        char temp[PEER_RECV_BUFFER_SIZE];
+        int n = recv(peer_socket, temp, sizeof(temp), 0);
+        if (n <= 0)
+            return false;
+        pending.insert(pending.end(), temp, temp + n);
+    }
+
+    request.assign(pending.begin(), pending.begin() + length);
+    pending.erase(pending.begin(), pending.begin() + length);
+    return true;
+}
+
+bool proxy_cluster::validateClusterConfig(ClusterConfig &config)
+{
+    if (config.peers.empty())
+        return true;
+
+    if (config.self.empty())
+    {
+        log<LogLevel::Error, LogSubsystem::Config>("[cluster] peers are set but self is not.\n");
+        return false;
+    }
+
+    if (std::find(config.peers.begin(), config.peers.end(), config.self) == config.peers.end())
+        config.peers.push_back(config.self);
+
+    std::vector<std::string> sorted = config.peers;
+    std::sort(sorted.begin(), sorted.end());
+    if (std::adjacent_find(sorted.begin(), sorted.end()) != sorted.end())
+    {
+        log<LogLevel::Error, LogSubsystem::Config>("[cluster] peers contain duplicates.\n");
+        return false;
+    }
+
+    for (const std::string &peer : config.peers)
+    {
+        std::size_t colon = peer.rfind(':');
+        if (colon == std::string::npos || colon == 0 || colon + 1 == peer.size())
+        {
+            log<LogLevel::Error, LogSubsystem::Config>("[cluster] peer '{}' is not host:port.\n", peer);
+            return false;
+        }
+    }
+    return true;
+}
+
+Cluster::Cluster() : Cluster(ClusterConfig{}) {}
+
+Cluster::Cluster(const ClusterConfig &config)
+    : self_index(0), max_idle(config.max_idle_per_peer), cluster_mode(config.mode),
+      probe_timeout(config.probe_timeout), digest_interval(config.digest_interval)
+{
+    for (const std::string &address : config.peers)
+    {
+        auto peer = std::make_unique<peer_state>();
+        std::size_t colon = address.rfind(':');
+        peer->address = address;
+        peer->host = address.substr(0, colon);
+        peer->port = address.substr(colon + 1);
+        peer->id_hash = proxy_cache::hashCacheKey(address);
+        peer->self = address == config.self;
+        if (peer->self)
+            self_index = peers.size();
+        else
+            appendNumericAddresses(peer->host, peer_hosts);
+        peers.push_back(std::move(peer));
+    }
+}
+
+bool Cluster::isPeerHost(std::string_view host) const
+{
+    return std::find(peer_hosts.begin(), peer_hosts.end(), host) != peer_hosts.end();
+}
+
+Cluster::~Cluster()
+{
+    stop();
+
+    for (auto &peer : peers)
+    {
+        for (idle_connection &idle : peer->idle)
+            closeSocket(idle.socket);
+    }
+}
+
+std::size_t Cluster::ownerOf(std::uint64_t key_hash) const
+{
+    // Rendezvous hashing: adding or removing a node only moves the keys it wins or loses.
+    std::size_t owner = self_index;
+    std::uint64_t best = 0;
+
+    for (std::size_t i = 0; i < peers.size(); ++i)
+    {
+        std::uint64_t score = key_hash ^ peers[i]->id_hash;
+        score = (score ^ (score >> 33)) * 0xff51afd7ed558ccdULL;
+        score = (score ^ (score >> 33)) * 0xc4ceb9fe1a85ec53ULL;
+        score ^= score >> 33;
+
+        if (i == 0 || score > best)
+        {
+            best = score;
+            owner = i;
+        }
+    }
+    return owner;
+}
+
+socket_t Cluster::acquireConnection(peer_state &peer, bool &reused)
+{
+    {
+        std::lock_guard<std::mutex> lock(peer.idle_mutex);
+        clock::time_point now = clock::now();
+
+        while (!peer.idle.empty())
+        {
+            idle_connection idle = peer.idle.back();
+            peer.idle.pop_back();
+
+            if (now - idle.since < PEER_IDLE_LIMIT)
+            {
+                reused = true;
+                return idle.socket;
+            }
+            closeSocket(idle.socket);
+        }
+    }
+
+    reused = false;
+    if (peer.down_until.load(std::memory_order_relaxed) > nowTicks())
+        return INVALID_SOCKET;
+
+    socket_t s = dialPeer(peer.host, peer.port);
+    if (s == INVALID_SOCKET)
+        markDown(peer);
+    return s;
+}
+
+void Cluster::releaseConnection(peer_state &peer, socket_t s)
+{
+    std::lock_guard<std::mutex> lock(peer.idle_mutex);
+    if (peer.idle.size() < max_idle)
+        peer.idle.push_back(idle_connection{s, clock::now()});
+    else
+        closeSocket(s);
+}
+
+void Cluster::markDown(peer_state &peer)
+{
+    peer.failures.fetch_add(1, std::memory_order_relaxed);
+    peer.down_until.store(nowTicks() + std::chrono::duration_cast<std::chrono::nanoseconds>(PEER_DOWN_BACKOFF).count(),
+                          std::memory_order_relaxed);
+    log<LogLevel::Warn, LogSubsystem::Cluster>("Peer {} unreachable, serving its keys locally for a while.\n", peer.address);
+}
+
+Cluster::exchange_result Cluster::exchange(peer_state &peer, const std::string &frame, const sink_fn &sink, std::size_t &relayed)
+{
+    // A pooled link may have been closed by the peer since its last use; that shows up before
+    // any byte reaches the sink, so one retry on a fresh connection is safe.
+    for (int attempt = 0; attempt < 2; ++attempt)
+    {
+        bool reused = false;
+        socket_t s = acquireConnection(peer, reused);
+        if (s == INVALID_SOCKET)
+            return exchange_result::Unreachable;
+
+        if (!sendAll(s, frame.data(), frame.size()))
+        {
+            closeSocket(s);
+            if (reused)
+                continue;
+            markDown(peer);
+            return exchange_result::Unreachable;
+        }
+
+        std::vector<char> buffer;
+        bool complete = false;
+        relayed = 0;
+
+        while (true)
+        {
+            std::size_t length = 0;
+            if (!readFrameLine(s, buffer, PEER_DATA, length))
+                break;
+
+            if (length == 0)
+            {
+                complete = true;
+                break;
+            }
+
+            while (length > 0)
+            {
+                if (buffer.empty())
+                {
+                    char temp[PEER_RECV_BUFFER_SIZE];
+                    int n = recv(s, temp, (int)std::min(sizeof(temp), length), 0);
+                    if (n <= 0)
+                        break;
+                    buffer.insert(buffer.end(), temp, temp + n);
+                }
+
+                std::size_t chunk = std::min(buffer.size(), length);
+                if (!sink(buffer.data(), chunk))
+                {
+                    // The link is mid-frame and cannot be reused.
+                    closeSocket(s);
+                    return exchange_result::SinkRefused;
+                }
+                buffer.erase(buffer.begin(), buffer.begin() + chunk);
+                length -= chunk;
+                relayed += chunk;
+            }
+
+            if (length > 0)
+                break;
+        }
+
+        if (complete)
+        {
+            releaseConnection(peer, s);
+            return exchange_result::Complete;
+        }
+
+        closeSocket(s);
+        if (relayed > 0)
+        {
+            peer.failures.fetch_add(1, std::memory_order_relaxed);
+            return exchange_result::Broken;
+        }
+        if (!reused)
+        {
+            markDown(peer);
+            return exchange_result::Unreachable;
+        }
+    }
+    return exchange_result::Unreachable;
+}
+
+bool Cluster::forward(std::size_t peer_index, const std::vector<char> &request_head, const ResponseWriter &writer, int client_id)
+{
+    peer_state &peer = *peers[peer_index];
+
+    std::string frame = "PEERGET " + std::to_string(request_head.size()) + "\r\n";
+    frame.append(request_head.begin(), request_head.end());
+
+    std::size_t relayed = 0;
+    auto to_client = [&](const char *data, std::size_t size)
+    { return writer.write(data, size); };
+
+    switch (exchange(peer, frame, to_client, relayed))
+    {
+    case exchange_result::Complete:
+        if (relayed == 0)
+            return false;
+        peer.forwarded.fetch_add(1, std::memory_order_relaxed);
+        log<LogLevel::Info, LogSubsystem::Cluster>("{}|CLUSTER|Served {} bytes via owner {}\n", client_id, relayed, peer.address);
+        return true;
+    case exchange_result::Broken:
+        log<LogLevel::Warn, LogSubsystem::Cluster>("{}|CLUSTER|Owner {} dropped the link mid-response.\n", client_id, peer.address);
+        return true;
+    case exchange_result::SinkRefused:
+        // Client went away.
+        return true;
+    case exchange_result::Unreachable:
+        break;
+    }
+    return false;
+}
+
+bool Cluster::fetch(std::size_t peer_index, const std::vector<char> &request_head, std::vector<char> &response, std::size_t max_bytes)
+{
+    peer_state &peer = *peers[peer_index];
+
+    std::string frame = "PEERGET " + std::to_string(request_head.size()) + "\r\n";
+    frame.append(request_head.begin(), request_head.end());
+
+    response.clear();
+    std::size_t relayed = 0;
+    auto collect = [&](const char *data, std::size_t size)
+    {
+        if (response.size() + size > max_bytes)
+            return false;
+        response.insert(response.end(), data, data + size);
+        return true;
+    };
+
+    if (exchange(peer, frame, collect, relayed) != exchange_result::Complete || response.empty())
+        return false;
+
+    peer.forwarded.fetch_add(1, std::memory_order_relaxed);
+    return true;
+}
+
+bool Cluster::probe(std::string_view key, std::uint64_t key_hash, std::size_t &sibling)
+{
+    socket_t s = socket(AF_INET, SOCK_DGRAM, IPPROTO_UDP);
+    if (s == INVALID_SOCKET)
+        return false;
+
+    std::uint32_t request_number = next_probe.fetch_add(1, std::memory_order_relaxed);
+    std::vector<char> query = encodeIcp(IcpOpcode::Query, request_number, key);
+    std::int64_t now = nowTicks();
+    std::size_t outstanding = 0;
+
+    for (std::size_t i = 0; i < peers.size(); ++i)
+    {
+        peer_state &peer = *peers[i];
+        if (peer.self || !peer.probe_resolved || peer.down_until.load(std::memory_order_relaxed) > now)
+            continue;
+
+        std::shared_ptr<const CacheDigest> digest;
+        {
+            std::lock_guard<std::mutex> lock(peer.digest_mutex);
+            digest = peer.digest;
+        }
+        if (digest && !digest->mayContain(key_hash))
+        {
+            peer.digest_skips.fetch_add(1, std::memory_order_relaxed);
+            continue;
+        }
+
+        if (sendto(s, query.data(), (int)query.size(), 0, (sockaddr *)&peer.probe_address, sizeof(peer.probe_address)) != SOCKET_ERROR)
+        {
+            peer.probes.fetch_add(1, std::memory_order_relaxed);
+            ++outstanding;
+        }
+    }
+
+    // Wait for the first HIT; every sibling answering MISS ends the wait early.
+    auto deadline = clock::now() + probe_timeout;
+    bool hit = false;
+
+    while (outstanding > 0 && !hit)
+    {
+        auto remaining = std::chrono::duration_cast<std::chrono::microseconds>(deadline - clock::now());
+        if (remaining.count() <= 0)
+            break;
+
+        fd_set read_fds;
+        FD_ZERO(&read_fds);
+        FD_SET(s, &read_fds);
+        struct timeval wait;
+        wait.tv_sec = static_cast<long>(remaining.count() / 1000000);
+        wait.tv_usec = static_cast<long>(remaining.count() % 1000000);
+        if (select((int)s + 1, &read_fds, nullptr, nullptr, &wait) <= 0)
+            break;
+
+        char datagram[ICP_MAX_MESSAGE];
+        sockaddr_in from{};
+        socklen_t from_len = sizeof(from);
+        int n = recvfrom(s, datagram, sizeof(datagram), 0, (sockaddr *)&from, &from_len);
+
+        IcpMessage reply;
+        if (n <= 0 || !decodeIcp(datagram, n, reply) || reply.request_number != request_number || reply.url != key)
+            continue;
+
+        for (std::size_t i = 0; i < peers.size(); ++i)
+        {
+            const sockaddr_in &address = peers[i]->probe_address;
+            if (peers[i]->self || address.sin_addr.s_addr != from.sin_addr.s_addr || address.sin_port != from.sin_port)
+                continue;
+
+            --outstanding;
+            if (reply.opcode == IcpOpcode::Hit)
+            {
+                peers[i]->probe_hits.fetch_add(1, std::memory_order_relaxed);
+                sibling = i;
+                hit = true;
+            }
+            break;
+        }
+    }
+
+    closeSocket(s);
+    return hit;
+}
+
+bool Cluster::start(std::function<bool(std::string_view)> has_object)
+{
+    if (cluster_mode != ClusterMode::Siblings || !enabled())
+        return true;
+
+    for (auto &peer : peers)
+    {
+        struct addrinfo hints = {}, *result = nullptr;
+        hints.ai_family = AF_INET;
+        hints.ai_socktype = SOCK_DGRAM;
+        hints.ai_protocol = IPPROTO_UDP;
+
+        if (getaddrinfo(peer->host.c_str(), peer->port.c_str(), &hints, &result) != 0)
+        {
+            log<LogLevel::Warn, LogSubsystem::Cluster>("Cannot resolve sibling {}; it will not be probed.\n", peer->address);
+            continue;
+        }
+        std::memcpy(&peer->probe_address, result->ai_addr, sizeof(peer->probe_address));
+        peer->probe_resolved = true;
+        freeaddrinfo(result);
+    }
+
+    probe_socket = socket(AF_INET, SOCK_DGRAM, IPPROTO_UDP);
+    if (probe_socket == INVALID_SOCKET)
+        return false;
+
+    const std::string &self_port = peers[self_index]->port;
+    std::uint16_t port = 0;
+    std::from_chars(self_port.data(), self_port.data() + self_port.size(), port);
+
+    sockaddr_in address{};
+    address.sin_family = AF_INET;
+    address.sin_addr.s_addr = INADDR_ANY;
+    address.sin_port = htons(port);
+
+    if (bind(probe_socket, (sockaddr *)&address, sizeof(address)) == SOCKET_ERROR)
+    {
+        log<LogLevel::Error, LogSubsystem::Cluster>("Cannot bind UDP probe port {}: {}\n", peers[self_index]->port, getSocketError());
+        closeSocket(probe_socket);
+        probe_socket = INVALID_SOCKET;
+        return false;
+    }
+
+    // Short receive timeout so the responder notices stop() promptly.
+    setSocketTimeout(probe_socket, 1);
+
+    running.store(true);
+    responder_thread = std::thread(&Cluster::answerProbes, this, std::move(has_object));
+    digest_thread = std::thread(&Cluster::refreshDigests, this);
+    log<LogLevel::Info, LogSubsystem::Cluster>("Answering sibling probes on UDP port {}.\n", peers[self_index]->port);
+    return true;
+}
+
+void Cluster::stop()
+{
+    if (!running.exchange(false))
+        return;
+
+    {
+        std::lock_guard<std::mutex> lock(stop_mutex);
+    }
+    stop_signal.notify_all();
+
+    if (responder_thread.joinable())
+        responder_thread.join();
+    if (digest_thread.joinable())
+        digest_thread.join();
+
+    closeSocket(probe_socket);
+    probe_socket = INVALID_SOCKET;
+}
+
+void Cluster::answerProbes(std::function<bool(std::string_view)> has_object)
+{
+    while (running.load(std::memory_order_relaxed))
+    {
+        char datagram[ICP_MAX_MESSAGE];
+        sockaddr_in from{};
+        socklen_t from_len = sizeof(from);
+        int n = recvfrom(probe_socket, datagram, sizeof(datagram), 0, (sockaddr *)&from, &from_len);
+        if (n <= 0)
+            continue;
+
+        // Only members may ask; anyone else learns nothing about what is cached here.
+        bool member = std::any_of(peers.begin(), peers.end(), [&](const std::unique_ptr<peer_state> &peer)
+                                  { return peer->probe_resolved && peer->probe_address.sin_addr.s_addr == from.sin_addr.s_addr; });
+
+        IcpMessage query;
+        if (!member || !decodeIcp(datagram, n, query) || query.opcode != IcpOpcode::Query)
+            continue;
+
+        IcpOpcode answer = has_object(query.url) ? IcpOpcode::Hit : IcpOpcode::Miss;
+        std::vector<char> reply = encodeIcp(answer, query.request_number, query.url);
+        sendto(probe_socket, reply.data(), (int)reply.size(), 0, (sockaddr *)&from, from_len);
+    }
+}
+
+void Cluster::refreshDigests()
+{
+    constexpr std::string_view DIGEST_REQUEST = "PEERDIGEST 0\r\n";
+    const std::string frame(DIGEST_REQUEST);
+
+    while (running.load(std::memory_order_relaxed))
+    {
+        for (auto &peer : peers)
+        {
+            if (peer->self)
+                continue;
+
+            std::vector<char> data;
+            std::size_t relayed = 0;
+            auto collect = [&](const char *chunk, std::size_t size)
+            {
+                if (data.size() + size > MAX_DIGEST_BYTES)
+                    return false;
+                data.insert(data.end(), chunk, chunk + size);
+                return true;
+            };
+
+            auto digest = std::make_shared<CacheDigest>();
+            if (exchange(*peer, frame, collect, relayed) != exchange_result::Complete || !CacheDigest::parse(data, *digest))
+            {
+                // Without a usable digest the sibling is probed for everything.
+                std::lock_guard<std::mutex> lock(peer->digest_mutex);
+                peer->digest.reset();
+                continue;
+            }
+
+            std::lock_guard<std::mutex> lock(peer->digest_mutex);
+            peer->digest = std::move(digest);
+        }
+
+        std::unique_lock<std::mutex> lock(stop_mutex);
+        stop_signal.wait_for(lock, digest_interval, [this]
+                             { return !running.load(std::memory_order_relaxed); });
+    }
+}
+
+std::vector<PeerStats> Cluster::stats() const
+{
+    std::vector<PeerStats> result;
+    std::int64_t now = nowTicks();
+
+    for (const auto &peer : peers)
+    {
+        std::size_t idle = 0;
+        {
+            std::lock_guard<std::mutex> lock(peer->idle_mutex);
+            idle = peer->idle.size();
+        }
+        std::size_t digest_entries = 0;
+        {
+            std::lock_guard<std::mutex> lock(peer->digest_mutex);
+            if (peer->digest)
+                digest_entries = peer->digest->size();
+        }
+        result.push_back(PeerStats{peer->address, peer->self, peer->down_until.load(std::memory_order_relaxed) <= now,
+                                   idle, peer->forwarded.load(std::memory_order_relaxed), peer->failures.load(std::memory_order_relaxed),
+                                   peer->probes.load(std::memory_order_relaxed), peer->probe_hits.load(std::memory_order_relaxed),
+                                   peer->digest_skips.load(std::memory_order_relaxed), digest_entries});
+    }
+    return result;
+}
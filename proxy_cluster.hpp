@@ -0,0 +1,250 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <condition_variable>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <vector>
+
+#include "proxy_utils.hpp"
+
+namespace proxy_cluster
+{
+
+    // Hash: each key has one owner node and misses are fetched through it.
+    // Siblings: every node caches what it fetches; misses first ask the other nodes whether
+    // they hold the object (UDP probe, filtered by their cache digests).
+    enum class ClusterMode
+    {
+        Hash,
+        Siblings
+    };
+
+    const char *clusterModeName(ClusterMode mode);
+    bool parseClusterMode(std::string_view name, ClusterMode &out);
+
+    // Static membership. Every node lists the same peers (itself included) under the same
+    // "host:port" names; those names are both the hash identities and the addresses dialled.
+    // In sibling mode each node also answers probes on UDP at its own port number.
+    struct ClusterConfig
+    {
+        std::string self;
+        std::vector<std::string> peers;
+        std::size_t max_idle_per_peer = 8;
+        ClusterMode mode = ClusterMode::Hash;
+        std::chrono::milliseconds probe_timeout{50};
+        std::chrono::milliseconds digest_interval{10000};
+    };
+
+    struct PeerStats
+    {
+        std::string address;
+        bool self;
+        bool up;
+        std::size_t idle_connections;
+        std::uint64_t forwarded;
+        std::uint64_t failures;
+        std::uint64_t probes;
+        std::uint64_t probe_hits;
+        std::uint64_t digest_skips;
+        std::size_t digest_entries;
+    };
+
+    // ICP v2 (RFC 2186) subset: QUERY is answered with HIT or MISS for the same URL and
+    // request number. Options and sender/requester addresses are sent as zero.
+    enum class IcpOpcode : std::uint8_t
+    {
+        Query = 1,
+        Hit = 2,
+        Miss = 3,
+        Error = 4
+    };
+
+    struct IcpMessage
+    {
+        IcpOpcode opcode;
+        std::uint32_t request_number;
+        std::string url;
+    };
+
+    std::vector<char> encodeIcp(IcpOpcode opcode, std::uint32_t request_number, std::string_view url);
+    bool decodeIcp(const char *data, std::size_t size, IcpMessage &out);
+
+    // Bloom filter of a node's cached keys. False positives cost a wasted probe; keys cached
+    // after the digest was built are missed until the next refresh.
+    class CacheDigest
+    {
+    private:
+        static constexpr std::uint32_t HASHES = 4;
+        static constexpr std::size_t BITS_PER_ENTRY = 8;
+        static constexpr std::size_t MIN_BITS = 8192;
+        static constexpr std::size_t MAX_BITS = std::size_t{1} << 27;
+
+        std::vector<std::uint8_t> bits;
+        std::size_t entries = 0;
+
+    public:
+        CacheDigest() = default;
+        explicit CacheDigest(const std::vector<std::uint64_t> &key_hashes);
+
+        bool mayContain(std::uint64_t key_hash) const;
+        std::size_t size() const { return entries; }
+
+        // "<bit count:u32><entries:u32>" big-endian, then the bit array.
+        std::vector<char> serialize() const;
+        static bool parse(const std::vector<char> &data, CacheDigest &out);
+    };
+
+    // Destination of response bytes: the client directly, framed back to the peer that
+    // forwarded the request, or a sink (an HTTP/2 stream) that re-frames them itself.
+    //
+    // Peer link framing, one exchange at a time on a persistent connection:
+    //   request   "PEERGET <n>\r\n" + n bytes of the client's request head
+    //   response  ("PEERDATA <n>\r\n" + n bytes)* then "PEERDATA 0\r\n"
+    // A "PEERDIGEST 0\r\n" request is answered the same way with the serialized CacheDigest.
+    struct ResponseWriter
+    {
+        socket_t socket;
+        bool peer_framed = false;
+        // When set, bytes go here instead of the socket; socket still names the client.
+        const std::function<bool(const char *, std::size_t)> *sink = nullptr;
+        // The client's address for X-Forwarded-For (the PROXY protocol source when there is
+        // one); empty falls back to the socket's peer.
+        std::string_view client_address;
+
+        bool write(const char *data, std::size_t size) const;
+
+        // End-of-response frame; no-op for direct clients and sinks.
+        bool finish() const;
+    };
+
+    enum class PeerRequestKind
+    {
+        Get,
+        Digest
+    };
+
+    // Reads one PEERGET or PEERDIGEST frame. pending holds bytes already received on the link
+    // and keeps anything read past the frame.
+    bool readPeerRequest(socket_t peer_socket, std::vector<char> &pending, std::vector<char> &request, PeerRequestKind &kind);
+
+    void setNoDelay(socket_t s);
+
+    // Each node owns the keys whose rendezvous (highest random weight) score is highest for
+    // it; a miss on a non-owned key is fetched through the owner, so each object is cached
+    // once per cluster. In sibling mode there is no owner: misses are probed across peers.
+    class Cluster
+    {
+    private:
+        using clock = std::chrono::steady_clock;
+        using sink_fn = std::function<bool(const char *, std::size_t)>;
+
+        enum class exchange_result
+        {
+            Unreachable, // nothing received; safe to serve locally
+            Complete,
+            Broken,      // link dropped after part of the response was passed on
+            SinkRefused
+        };
+
+        struct idle_connection
+        {
+            socket_t socket;
+            clock::time_point since;
+        };
+
+        struct peer_state
+        {
+            std::string address;
+            std::string host;
+            std::string port;
+            std::uint64_t id_hash;
+            bool self;
+
+            std::mutex idle_mutex;
+            std::vector<idle_connection> idle;
+            std::atomic<std::int64_t> down_until{0};
+            std::atomic<std::uint64_t> forwarded{0};
+            std::atomic<std::uint64_t> failures{0};
+
+            sockaddr_in probe_address{};
+            bool probe_resolved = false;
+            mutable std::mutex digest_mutex;
+            std::shared_ptr<const CacheDigest> digest;
+            std::atomic<std::uint64_t> probes{0};
+            std::atomic<std::uint64_t> probe_hits{0};
+            std::atomic<std::uint64_t> digest_skips{0};
+        };
+
+        std::vector<std::unique_ptr<peer_state>> peers;
+        std::vector<std::string> peer_hosts; // numeric addresses of the other peers
+        std::size_t self_index;
+        std::size_t max_idle;
+        ClusterMode cluster_mode;
+        std::chrono::milliseconds probe_timeout;
+        std::chrono::milliseconds digest_interval;
+
+        std::atomic<std::uint32_t> next_probe{1};
+        std::atomic<bool> running{false};
+        socket_t probe_socket = INVALID_SOCKET;
+        std::thread responder_thread;
+        std::thread digest_thread;
+        std::mutex stop_mutex;
+        std::condition_variable stop_signal;
+
+        socket_t acquireConnection(peer_state &peer, bool &reused);
+        void releaseConnection(peer_state &peer, socket_t s);
+        void markDown(peer_state &peer);
+        exchange_result exchange(peer_state &peer, const std::string &frame, const sink_fn &sink, std::size_t &relayed);
+
+        void answerProbes(std::function<bool(std::string_view)> has_object);
+        void refreshDigests();
+
+    public:
+        Cluster();
+        explicit Cluster(const ClusterConfig &config);
+        ~Cluster();
+
+        Cluster(const Cluster &) = delete;
+        Cluster &operator=(const Cluster &) = delete;
+
+        bool enabled() const { return peers.size() > 1; }
+        ClusterMode mode() const { return cluster_mode; }
+
+        // Sibling mode only: answers UDP probes on self's port using has_object (called with
+        // a normalized cache key) and keeps peer digests fresh. No-op in hash mode.
+        bool start(std::function<bool(std::string_view)> has_object);
+        void stop();
+
+        std::size_t ownerOf(std::uint64_t key_hash) const;
+        bool isSelf(std::size_t peer) const { return peer == self_index; }
+        const std::string &peerAddress(std::size_t peer) const { return peers[peer]->address; }
+        // Whether a connection from host (numeric) comes from another configured peer; only
+        // those may use the PEERGET/PEERDIGEST link.
+        bool isPeerHost(std::string_view host) const;
+
+        // Sends the request head to the owner and relays its framed response to writer.
+        // False when nothing reached the client (peer unreachable or empty answer), so the
+        // caller can serve the request itself.
+        bool forward(std::size_t peer, const std::vector<char> &request_head, const ResponseWriter &writer, int client_id);
+
+        // Asks every sibling whose digest may hold the key; true with the first one to answer
+        // HIT within the probe timeout.
+        bool probe(std::string_view key, std::uint64_t key_hash, std::size_t &sibling);
+
+        // Fetches a whole response from a sibling into response (at most max_bytes).
+        bool fetch(std::size_t peer, const std::vector<char> &request_head, std::vector<char> &response, std::size_t max_bytes);
+
+        std::vector<PeerStats> stats() const;
+    };
+
+    // Membership must include self and name distinct host:port peers.
+    bool validateClusterConfig(ClusterConfig &config);
+}
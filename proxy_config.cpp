@@ -0,0 +1,575 @@
+#include <fstream>
+#include <algorithm>
+#include <cctype>
+#include <charconv>
+#include <chrono>
+
+#include "proxy_config.hpp"
+#include "proxy_logger.hpp"
+
+using namespace proxy_config;
+
+namespace
+{
+    constexpr std::size_t BYTES_PER_MB = 1024 * 1024;
+
+    std::string_view trim(std::string_view s)
+    {
+        while (!s.empty() && std::isspace(static_cast<unsigned char>(s.front())))
+            s.remove_prefix(1);
+        while (!s.empty() && std::isspace(static_cast<unsigned char>(s.back())))
+            s.remove_suffix(1);
+        return s;
+    }
+
+    std::string toLower(std::string_view s)
+    {
+        std::string out(s);
+        std::transform(out.begin(), out.end(), out.begin(), [](unsigned char c)
+                       { return static_cast<char>(std::tolower(c)); });
+        return out;
+    }
+
+    template <typename T>
+    bool parseNumber(std::string_view value, T &out)
+    {
+        auto [ptr, ec] = std::from_chars(value.data(), value.data() + value.size(), out);
+        return ec == std::errc() && ptr == value.data() + value.size();
+    }
+
+    bool parseBool(std::string_view value, bool &out)
+    {
+        std::string v = toLower(value);
+        if (v == "true" || v == "on" || v == "yes" || v == "1")
+            out = true;
+        else if (v == "false" || v == "off" || v == "no" || v == "0")
+            out = false;
+        else
+            return false;
+        return true;
+    }
+
+    bool parseMegabytes(std::string_view value, std::size_t &out)
+    {
+        std::size_t mb = 0;
+        if (!parseNumber(value, mb))
+            return false;
+        out = mb * BYTES_PER_MB;
+        return true;
+    }
+
+    bool parseSeconds(std::string_view value, std::chrono::milliseconds &out)
+    {
+        long long seconds = 0;
+        if (!parseNumber(value, seconds) || seconds < 0)
+            return false;
+        out = std::chrono::seconds(seconds);
+        return true;
+    }
+
+    bool applyServer(ProxyConfig &config, std::string_view key, std::string_view value)
+    {
+        if (key == "admin_port")
+            return parseNumber(value, config.admin_port) && config.admin_port >= 0 && config.admin_port <= 65535;
+        if (key == "forward_proxy")
+            return parseBool(value, config.routing.forward_proxy);
+        if (key == "proxy_protocol")
+            return parseBool(value, config.proxy_protocol.enabled);
+        if (key == "proxy_protocol_from")
+        {
+            config.proxy_protocol.trusted = splitList(value);
+            return true;
+        }
+
+        log<LogLevel::Warn, LogSubsystem::Config>("Unknown [server] key: {}\n", key);
+        return true;
+    }
+
+    bool applyCache(ProxyConfig &config, std::string_view key, std::string_view value)
+    {
+        proxy_cache::CacheConfig &cache = config.cache;
+
+        if (key == "capacity_mb")
+            return parseMegabytes(value, cache.capacity_bytes) && cache.capacity_bytes > 0;
+        if (key == "eviction")
+            return proxy_cache::parseEvictionPolicy(toLower(value), cache.eviction);
+        if (key == "sort_query")
+            return parseBool(value, cache.key_rules.sort_query);
+        if (key == "drop_query_params")
+        {
+            cache.key_rules.drop_query_params = splitList(value);
+            return true;
+        }
+
+        log<LogLevel::Warn, LogSubsystem::Config>("Unknown [cache] key: {}\n", key);
+        return true;
+    }
+
+    bool applyPrefetch(proxy_cache::PrefetchConfig &prefetch, std::string_view key, std::string_view value)
+    {
+        if (key == "enabled")
+            return parseBool(value, prefetch.enabled);
+        if (key == "threads")
+            return parseNumber(value, prefetch.threads) && prefetch.threads > 0;
+        if (key == "max_per_page")
+            return parseNumber(value, prefetch.max_per_page);
+        if (key == "max_queue")
+            return parseNumber(value, prefetch.max_queue);
+
+        log<LogLevel::Warn, LogSubsystem::Config>("Unknown [prefetch] key: {}\n", key);
+        return true;
+    }
+
+    bool applyLog(LogConfig &logging, std::string_view key, std::string_view value)
+    {
+        if (key == "format")
+        {
+            std::string format = toLower(value);
+            if (format != "text" && format != "binary")
+                return false;
+            logging.binary = format == "binary";
+            return true;
+        }
+        if (key == "binary_file")
+        {
+            logging.binary_log.path = std::string(value);
+            return !value.empty();
+        }
+        if (key == "buffer_kb")
+        {
+            std::size_t kb = 0;
+            // Room for at least one record of the largest size.
+            if (!parseNumber(value, kb) || kb * 1024 < proxy_log::MAX_EVENT_SIZE)
+                return false;
+            logging.binary_log.buffer_size = kb * 1024;
+            return true;
+        }
+        if (key == "preallocate_mb")
+            return parseMegabytes(value, logging.binary_log.preallocate);
+        if (key == "rotate_size_mb")
+            return parseMegabytes(value, logging.rotation.max_size);
+        if (key == "rotate_interval")
+            return parseSeconds(value, logging.rotation.interval);
+        if (key == "keep")
+            return parseNumber(value, logging.rotation.keep);
+        if (key == "compress")
+        {
+            if (!parseBool(value, logging.rotation.compress))
+                return false;
+#ifndef PROXY_LOG_ZLIB
+            if (logging.rotation.compress)
+                log<LogLevel::Warn, LogSubsystem::Config>("Built without zlib; rotated logs are kept uncompressed\n");
+#endif
+            return true;
+        }
+        // "level" sets every subsystem; "level_<subsystem>" one of them.
+        if (key == "level")
+        {
+            LogLevel level;
+            if (!parseLogLevel(toLower(value), level))
+                return false;
+            logging.levels.fill(level);
+            return true;
+        }
+        if (key == "rate_limit")
+            return parseNumber(value, logging.rate_limit) && logging.rate_limit > 0;
+        if (key == "rate_interval")
+            return parseSeconds(value, logging.rate_interval) && logging.rate_interval.count() > 0;
+        if (key == "error_budget")
+            return parseNumber(value, logging.error_budget);
+        if (key == "first_budget")
+            return parseNumber(value, logging.first_budget);
+        // "sample" sets every subsystem's share of Debug/Info lines; "sample_<subsystem>" one.
+        if (key == "sample" || key.starts_with("sample_"))
+        {
+            double rate = 0;
+            if (!parseNumber(value, rate) || rate < 0.0 || rate > 1.0)
+                return false;
+            if (key == "sample")
+            {
+                logging.sample_rates.fill(rate);
+                return true;
+            }
+            LogSubsystem subsystem;
+            if (!parseLogSubsystem(key.substr(7), subsystem))
+                return false;
+            logging.sample_rates[static_cast<std::size_t>(subsystem)] = rate;
+            return true;
+        }
+        if (key.starts_with("level_"))
+        {
+            LogSubsystem subsystem;
+            LogLevel level;
+            if (!parseLogSubsystem(key.substr(6), subsystem) || !parseLogLevel(toLower(value), level))
+                return false;
+            logging.levels[static_cast<std::size_t>(subsystem)] = level;
+            return true;
+        }
+
+        log<LogLevel::Warn, LogSubsystem::Config>("Unknown [log] key: {}\n", key);
+        return true;
+    }
+
+    bool applyNegativeCache(ProxyConfig &config, std::string_view key, std::string_view value)
+    {
+        proxy_cache::NegativeCacheConfig &negative = config.negative_cache;
+
+        if (key == "max_entries")
+            return parseNumber(value, negative.max_entries);
+        if (key == "max_kb")
+        {
+            std::size_t kb = 0;
+            if (!parseNumber(value, kb))
+                return false;
+            negative.max_bytes = kb * 1024;
+            return true;
+        }
+        if (key == "dns_ttl")
+            return parseSeconds(value, negative.dns_ttl);
+        if (key == "connect_ttl")
+            return parseSeconds(value, negative.connect_ttl);
+        if (key == "status_ttl")
+            return parseSeconds(value, negative.status_ttl);
+
+        log<LogLevel::Warn, LogSubsystem::Config>("Unknown [negative_cache] key: {}\n", key);
+        return true;
+    }
+
+    bool applyPool(proxy_routing::BackendPool &pool, std::string_view key, std::string_view value)
+    {
+        if (key == "servers")
+        {
+            for (const std::string &spec : splitList(value))
+            {
+                proxy_routing::Backend backend;
+                if (!proxy_routing::parseBackend(spec, backend))
+                    return false;
+                pool.backends.push_back(std::move(backend));
+            }
+            return true;
+        }
+
+        if (key == "balance")
+            return proxy_routing::parseBalancePolicy(toLower(value), pool.balance);
+        if (key == "max_fails")
+            return parseNumber(value, pool.health.max_fails) && pool.health.max_fails > 0;
+        if (key == "fail_timeout")
+            return parseSeconds(value, pool.health.fail_timeout);
+        if (key == "protocol")
+            return proxy_routing::parseUpstreamProtocol(toLower(value), pool.protocol);
+
+        log<LogLevel::Warn, LogSubsystem::Config>("Unknown [pool] key: {}\n", key);
+        return true;
+    }
+
+    bool applyRoute(proxy_routing::RouteRule &rule, std::string_view key, std::string_view value)
+    {
+        if (key == "host")
+        {
+            rule.host_pattern = toLower(value);
+            return true;
+        }
+        if (key == "path")
+        {
+            rule.path_prefix = std::string(value);
+            return true;
+        }
+        if (key == "pool")
+        {
+            rule.pool = std::string(value);
+            return true;
+        }
+
+        log<LogLevel::Warn, LogSubsystem::Config>("Unknown [route] key: {}\n", key);
+        return true;
+    }
+
+    bool applyParent(proxy_routing::ParentRule &parent, std::string_view key, std::string_view value)
+    {
+        if (key == "servers")
+        {
+            for (const std::string &spec : splitList(value))
+            {
+                proxy_routing::Backend server;
+                if (!proxy_routing::parseBackend(spec, server))
+                    return false;
+                parent.servers.push_back(std::move(server));
+            }
+            return true;
+        }
+        if (key == "domains")
+        {
+            for (const std::string &domain : splitList(value))
+                parent.domains.push_back(toLower(domain));
+            return true;
+        }
+
+        if (key == "balance")
+            return proxy_routing::parseBalancePolicy(toLower(value), parent.balance);
+        if (key == "max_fails")
+            return parseNumber(value, parent.health.max_fails) && parent.health.max_fails > 0;
+        if (key == "fail_timeout")
+            return parseSeconds(value, parent.health.fail_timeout);
+        if (key == "max_idle")
+            return parseNumber(value, parent.max_idle_per_server);
+
+        log<LogLevel::Warn, LogSubsystem::Config>("Unknown [parent] key: {}\n", key);
+        return true;
+    }
+
+    bool applyCluster(ProxyConfig &config, std::string_view key, std::string_view value)
+    {
+        proxy_cluster::ClusterConfig &cluster = config.cluster;
+
+        if (key == "self")
+        {
+            cluster.self = std::string(value);
+            return !cluster.self.empty();
+        }
+        if (key == "peers")
+        {
+            cluster.peers = splitList(value);
+            return true;
+        }
+        if (key == "max_idle")
+            return parseNumber(value, cluster.max_idle_per_peer);
+        if (key == "mode")
+            return proxy_cluster::parseClusterMode(toLower(value), cluster.mode);
+        if (key == "probe_timeout_ms")
+        {
+            long long ms = 0;
+            if (!parseNumber(value, ms) || ms <= 0)
+                return false;
+            cluster.probe_timeout = std::chrono::milliseconds(ms);
+            return true;
+        }
+        if (key == "digest_interval")
+            return parseSeconds(value, cluster.digest_interval) && cluster.digest_interval.count() > 0;
+
+        log<LogLevel::Warn, LogSubsystem::Config>("Unknown [cluster] key: {}\n", key);
+        return true;
+    }
+
+    // set/add values are whole "Name: value" lines and may repeat.
+    bool applyHeaders(ProxyConfig &config, std::string_view key, std::string_view value)
+    {
+        proxy_http::HeaderRules &headers = config.headers;
+
+        if (key == "via")
+            return parseBool(value, headers.via);
+        if (key == "via_name")
+        {
+            headers.via_name = std::string(value);
+            return !headers.via_name.empty();
+        }
+        if (key == "forwarded_for")
+            return parseBool(value, headers.forwarded_for);
+        if (key == "remove")
+        {
+            for (const std::string &name : splitList(value))
+                headers.remove.push_back(toLower(name));
+            return true;
+        }
+        if (key == "set" || key == "add")
+        {
+            std::size_t colon = value.find(':');
+            if (colon == std::string_view::npos || colon == 0)
+                return false;
+            (key == "set" ? headers.set : headers.add).push_back(std::string(value));
+            return true;
+        }
+
+        log<LogLevel::Warn, LogSubsystem::Config>("Unknown [headers] key: {}\n", key);
+        return true;
+    }
+
+    bool applyIntercept(proxy_tls::InterceptConfig &intercept, std::string_view key, std::string_view value)
+    {
+        if (key == "hosts")
+        {
+            for (const std::string &pattern : splitList(value))
+                intercept.hosts.push_back(toLower(pattern));
+            return true;
+        }
+        if (key == "ca_cert" || key == "ca_key")
+        {
+            (key == "ca_cert" ? intercept.ca_cert : intercept.ca_key) = std::string(value);
+            return !value.empty();
+        }
+        if (key == "ktls")
+            return parseBool(value, intercept.ktls);
+        if (key == "verify_upstream")
+            return parseBool(value, intercept.verify_upstream);
+        if (key == "session_cache")
+            return parseBool(value, intercept.session_cache);
+        if (key == "session_lifetime")
+            return parseSeconds(value, intercept.session_lifetime) && intercept.session_lifetime.count() > 0;
+        if (key == "session_cache_size")
+            return parseNumber(value, intercept.session_cache_size);
+        if (key == "handshake_threads")
+            return parseNumber(value, intercept.handshake_threads);
+
+        log<LogLevel::Warn, LogSubsystem::Config>("Unknown [intercept] key: {}\n", key);
+        return true;
+    }
+
+    bool applyPartition(proxy_cache::CachePartitionRule &rule, std::string_view key, std::string_view value)
+    {
+        if (key == "host")
+        {
+            rule.host_pattern = toLower(value);
+            return true;
+        }
+        if (key == "path")
+        {
+            rule.path_prefix = std::string(value);
+            return true;
+        }
+        if (key == "quota_mb")
+            return parseMegabytes(value, rule.quota_bytes);
+        if (key == "priority")
+            return parseNumber(value, rule.priority);
+
+        log<LogLevel::Warn, LogSubsystem::Config>("Unknown [partition] key: {}\n", key);
+        return true;
+    }
+}
+
+std::vector<std::string> proxy_config::splitList(std::string_view value)
+{
+    std::vector<std::string> items;
+    std::size_t start = 0;
+
+    while (start <= value.size())
+    {
+        std::size_t end = value.find(',', start);
+        if (end == std::string_view::npos)
+            end = value.size();
+
+        std::string_view item = trim(value.substr(start, end - start));
+        if (!item.empty())
+            items.emplace_back(item);
+        start = end + 1;
+    }
+    return items;
+}
+
+bool proxy_config::loadConfig(const std::string &path, ProxyConfig &config)
+{
+    std::ifstream file(path);
+    if (!file.is_open())
+    {
+        log<LogLevel::Error, LogSubsystem::Config>("Cannot open config file {}\n", path);
+        return false;
+    }
+
+    std::string section;
+    std::string section_name;
+    std::string line;
+    int line_number = 0;
+
+    while (std::getline(file, line))
+    {
+        ++line_number;
+
+        std::string_view text = trim(line);
+        std::size_t comment = text.find_first_of("#;");
+        if (comment != std::string_view::npos)
+            text = trim(text.substr(0, comment));
+        if (text.empty())
+            continue;
+
+        if (text.front() == '[')
+        {
+            if (text.back() != ']')
+            {
+                log<LogLevel::Error, LogSubsystem::Config>("{}:{}|Malformed section header.\n", path, line_number);
+                return false;
+            }
+
+            std::string_view header = trim(text.substr(1, text.size() - 2));
+            std::size_t space = header.find(' ');
+            section = toLower(header.substr(0, space));
+            section_name = space == std::string_view::npos ? std::string() : std::string(trim(header.substr(space + 1)));
+
+            if (section == "partition")
+            {
+                proxy_cache::CachePartitionRule rule;
+                rule.name = section_name.empty() ? "partition" + std::to_string(config.cache.partitions.size() + 1) : section_name;
+                config.cache.partitions.push_back(rule);
+            }
+            else if (section == "pool")
+            {
+                if (section_name.empty())
+                {
+                    log<LogLevel::Error, LogSubsystem::Config>("{}:{}|[pool] needs a name.\n", path, line_number);
+                    return false;
+                }
+                config.routing.pools.push_back(proxy_routing::BackendPool{section_name, {}});
+            }
+            else if (section == "route")
+            {
+                proxy_routing::RouteRule rule;
+                rule.name = section_name.empty() ? "route" + std::to_string(config.routing.routes.size() + 1) : section_name;
+                config.routing.routes.push_back(rule);
+            }
+            else if (section == "parent")
+            {
+                proxy_routing::ParentRule parent;
+                parent.name = section_name.empty() ? "parent" + std::to_string(config.routing.parents.size() + 1) : section_name;
+                config.routing.parents.push_back(parent);
+            }
+            continue;
+        }
+
+        std::size_t equals = text.find('=');
+        if (equals == std::string_view::npos)
+        {
+            log<LogLevel::Error, LogSubsystem::Config>("{}:{}|Expected key = value.\n", path, line_number);
+            return false;
+        }
+
+        std::string key = toLower(trim(text.substr(0, equals)));
+        std::string_view value = trim(text.substr(equals + 1));
+
+        bool ok = true;
+        if (section == "server")
+            ok = applyServer(config, key, value);
+        else if (section == "cache")
+            ok = applyCache(config, key, value);
+        else if (section == "cluster")
+            ok = applyCluster(config, key, value);
+        else if (section == "headers")
+            ok = applyHeaders(config, key, value);
+        else if (section == "intercept")
+            ok = applyIntercept(config.intercept, key, value);
+        else if (section == "prefetch")
+            ok = applyPrefetch(config.prefetch, key, value);
+        else if (section == "log")
+            ok = applyLog(config.logging, key, value);
+        else if (section == "negative_cache")
+            ok = applyNegativeCache(config, key, value);
+        else if (section == "partition")
+            ok = applyPartition(config.cache.partitions.back(), key, value);
+        else if (section == "pool")
+            ok = applyPool(config.routing.pools.back(), key, value);
+        else if (section == "route")
+            ok = applyRoute(config.routing.routes.back(), key, value);
+        else if (section == "parent")
+            ok = applyParent(config.routing.parents.back(), key, value);
+        else
+            log<LogLevel::Warn, LogSubsystem::Config>("{}:{}|Setting outside a known section: {}\n", path, line_number, key);
+
+        if (!ok)
+        {
+            log<LogLevel::Error, LogSubsystem::Config>("{}:{}|Invalid value for {}: {}\n", path, line_number, key, value);
+            return false;
+        }
+    }
+
+    if (!proxy_routing::validateRoutingConfig(config.routing) || !proxy_cluster::validateClusterConfig(config.cluster))
+        return false;
+
+    log<LogLevel::Info, LogSubsystem::Config>("Loaded {}\n", path);
+    return true;
+}
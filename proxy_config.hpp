@@ -0,0 +1,69 @@
+#pragma once
+
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "proxy_cache.hpp"
+#include "proxy_negative_cache.hpp"
+#include "proxy_routing.hpp"
+#include "proxy_cluster.hpp"
+#include "proxy_headers.hpp"
+#include "proxy_tls.hpp"
+#include "proxy_proxy_protocol.hpp"
+#include "proxy_prefetch.hpp"
+#include "proxy_logger.hpp"
+
+namespace proxy_config
+{
+
+    struct ProxyConfig
+    {
+        // Loopback-only admin/stats listener; 0 disables it.
+        int admin_port = 0;
+
+        proxy_cache::CacheConfig cache;
+        proxy_cache::NegativeCacheConfig negative_cache;
+        proxy_routing::RoutingConfig routing;
+        proxy_cluster::ClusterConfig cluster;
+        proxy_http::HeaderRules headers;
+        proxy_tls::InterceptConfig intercept;
+        proxy_http::ProxyProtocolConfig proxy_protocol;
+        proxy_cache::PrefetchConfig prefetch;
+        LogConfig logging;
+    };
+
+    // Reads an INI-style file:
+    //
+    //   [server]             admin_port, forward_proxy, proxy_protocol,
+    //                        proxy_protocol_from (comma-separated balancer addresses)
+    //   [cache]              capacity_mb, eviction, sort_query, drop_query_params
+    //   [partition <name>]   host, path, quota_mb, priority
+    //   [pool <name>]        servers (comma-separated host[:port]), balance, max_fails,
+    //                        fail_timeout (seconds), protocol (http1 | h2c)
+    //   [route <name>]       host, path, pool
+    //   [parent <name>]      servers, domains (comma-separated patterns), balance,
+    //                        max_fails, fail_timeout, max_idle
+    //   [cluster]            self, peers (comma-separated host:port), max_idle, mode,
+    //                        probe_timeout_ms, digest_interval (seconds)
+    //   [headers]            via, via_name, forwarded_for, remove (comma-separated names),
+    //                        set, add ("Name: value"; repeatable)
+    //   [intercept]          hosts (comma-separated patterns), ca_cert, ca_key (paths),
+    //                        ktls, verify_upstream, session_cache, session_lifetime
+    //                        (seconds), session_cache_size, handshake_threads
+    //   [prefetch]           enabled, threads, max_per_page, max_queue
+    //   [log]                format (text | binary), binary_file, buffer_kb, preallocate_mb,
+    //                        level, level_<server|client|cache|remote|connect|cluster|config>
+    //                        (debug | info | warn | error | off), sample,
+    //                        sample_<subsystem> (0..1), rate_limit, rate_interval
+    //                        (seconds), error_budget (lines per second, 0 = no cap),
+    //                        first_budget (first occurrences per second past error_budget),
+    //                        rotate_size_mb, rotate_interval (seconds), keep, compress
+    //   [negative_cache]     max_entries, max_kb, dns_ttl, connect_ttl, status_ttl (seconds)
+    //
+    // '#' and ';' start comments. Unknown keys are logged and skipped; returns false when
+    // the file cannot be read or a value is malformed.
+    bool loadConfig(const std::string &path, ProxyConfig &config);
+
+    std::vector<std::string> splitList(std::string_view value);
+}
@@ -0,0 +1,25 @@
+#pragma once
+
+#include "proxy_cache.hpp"
+#include "proxy_negative_cache.hpp"
+#include "proxy_routing.hpp"
+#include "proxy_cluster.hpp"
+#include "proxy_headers.hpp"
+#include "proxy_h2.hpp"
+#include "proxy_tls.hpp"
+#include "proxy_proxy_protocol.hpp"
+#include "proxy_prefetch.hpp"
+
+// Long-lived state shared by every client thread and the admin listener.
+struct ProxyContext
+{
+    proxy_cache::Cache &cache_system;
+    proxy_cache::NegativeCache &negative_cache;
+    const proxy_routing::Router &router;
+    proxy_cluster::Cluster &cluster;
+    const proxy_http::HeaderRules &header_rules;
+    proxy_http::H2UpstreamPool &h2_upstreams;
+    proxy_tls::Interceptor &interceptor;
+    proxy_http::ProxyProtocol &proxy_protocol;
+    proxy_cache::Prefetcher &prefetcher;
+};
@@ -0,0 +1,80 @@
+#include <algorithm>
+#include <atomic>
+#include <functional>
+#include <thread>
+
+#include "proxy_epoch.hpp"
+
+using namespace proxy_cache;
+
+EpochManager::~EpochManager()
+{
+    for (const retired_object &r : retired)
+        r.deleter(r.object);
+}
+
+EpochManager::Guard EpochManager::pin()
+{
+    // Start where this thread found a free slot last time so readers spread out.
+    thread_local std::size_t hint = std::hash<std::thread::id>{}(std::this_thread::get_id()) % MAX_READERS;
+
+    while (true)
+    {
+        for (std::size_t i = 0; i < MAX_READERS; ++i)
+        {
+            std::size_t index = (hint + i) % MAX_READERS;
+            std::uint64_t expected = IDLE;
+
+            if (readers[index].epoch.load(std::memory_order_relaxed) == IDLE &&
+                readers[index].epoch.compare_exchange_strong(expected, global_epoch.load(std::memory_order_seq_cst), std::memory_order_seq_cst))
+            {
+                // Store-load barrier between publishing the epoch and the reader's first
+                // pointer load, paired with the one in collect(): either the collector sees
+                // this slot, or this reader sees every unlink that preceded the scan.
+                std::atomic_thread_fence(std::memory_order_seq_cst);
+                hint = index;
+                return Guard(&readers[index].epoch);
+            }
+        }
+        std::this_thread::yield();
+    }
+}
+
+void EpochManager::retire(void *object, void (*deleter)(void *))
+{
+    {
+        std::lock_guard<std::mutex> lock(retire_mutex);
+        retired.push_back(retired_object{object, deleter, global_epoch.fetch_add(1, std::memory_order_seq_cst)});
+    }
+    collect();
+}
+
+void EpochManager::collect()
+{
+    std::vector<retired_object> reclaimable;
+
+    {
+        std::lock_guard<std::mutex> lock(retire_mutex);
+        if (retired.empty())
+            return;
+
+        // Pairs with the fence in pin(); the unlinks behind retired come before it.
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        std::uint64_t oldest_pinned = IDLE;
+        for (const reader_slot &reader : readers)
+        {
+            std::uint64_t epoch = reader.epoch.load(std::memory_order_seq_cst);
+            if (epoch < oldest_pinned)
+                oldest_pinned = epoch;
+        }
+
+        // A reader pinned at epoch e may hold anything retired at e or later.
+        auto it = std::partition(retired.begin(), retired.end(), [&](const retired_object &r)
+                                 { return r.epoch >= oldest_pinned; });
+        reclaimable.assign(it, retired.end());
+        retired.erase(it, retired.end());
+    }
+
+    for (const retired_object &r : reclaimable)
+        r.deleter(r.object);
+}
@@ -0,0 +1,75 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+#include <vector>
+
+namespace proxy_cache
+{
+
+    // Epoch-based reclamation. Readers pin the current epoch for the duration of a lookup;
+    // writers retire unlinked objects, which are freed once every pinned reader has moved
+    // past the epoch they were retired in.
+    class EpochManager
+    {
+    public:
+        class Guard
+        {
+        public:
+            Guard(const Guard &) = delete;
+            Guard &operator=(const Guard &) = delete;
+            ~Guard() { slot->store(IDLE, std::memory_order_release); }
+
+        private:
+            friend class EpochManager;
+            explicit Guard(std::atomic<std::uint64_t> *s) : slot(s) {}
+
+            std::atomic<std::uint64_t> *slot;
+        };
+
+        EpochManager() = default;
+        ~EpochManager();
+
+        EpochManager(const EpochManager &) = delete;
+        EpochManager &operator=(const EpochManager &) = delete;
+
+        // Enters a read-side critical section; pointers loaded while the guard lives stay valid.
+        [[nodiscard]] Guard pin();
+
+        template <typename T>
+        void retire(T *object)
+        {
+            retire(object, [](void *p)
+                   { delete static_cast<T *>(p); });
+        }
+
+        void retire(void *object, void (*deleter)(void *));
+
+        // Frees every retired object no pinned reader can still observe.
+        void collect();
+
+    private:
+        static constexpr std::size_t MAX_READERS = 256;
+        static constexpr std::uint64_t IDLE = UINT64_MAX;
+
+        struct alignas(64) reader_slot
+        {
+            std::atomic<std::uint64_t> epoch{IDLE};
+        };
+
+        struct retired_object
+        {
+            void *object;
+            void (*deleter)(void *);
+            std::uint64_t epoch;
+        };
+
+        std::atomic<std::uint64_t> global_epoch{1};
+        reader_slot readers[MAX_READERS];
+
+        std::mutex retire_mutex;
+        std::vector<retired_object> retired;
+    };
+}
@@ -0,0 +1,575 @@
+#include <algorithm>
+#include <deque>
+#include <unordered_map>
+
+#include "proxy_eviction.hpp"
+
+using namespace proxy_cache;
+
+namespace
+{
+    constexpr std::uint32_t NONE = EvictionEngine::NONE;
+
+    // Intrusive doubly linked list over node ids. Only touched under the writer lock.
+    class NodeList
+    {
+    public:
+        std::size_t size() const { return count; }
+        bool empty() const { return count == 0; }
+        std::uint32_t front() const { return head; }
+        std::uint32_t back() const { return tail; }
+        bool contains(std::uint32_t node) const { return node < linked.size() && linked[node]; }
+
+        // Successor, wrapping around to the front so the list can be swept like a ring.
+        std::uint32_t nextWrap(std::uint32_t node) const
+        {
+            return next[node] != NONE ? next[node] : head;
+        }
+
+        void pushFront(std::uint32_t node) { insertBefore(head, node); }
+        void pushBack(std::uint32_t node) { insertBefore(NONE, node); }
+
+        // Inserts before `position`; NONE appends at the back.
+        void insertBefore(std::uint32_t position, std::uint32_t node)
+        {
+            ensure(node);
+
+            std::uint32_t before = position == NONE ? tail : prev[position];
+            prev[node] = before;
+            next[node] = position;
+
+            if (before != NONE)
+                next[before] = node;
+            else
+                head = node;
+
+            if (position != NONE)
+                prev[position] = node;
+            else
+                tail = node;
+
+            linked[node] = 1;
+            ++count;
+        }
+
+        void remove(std::uint32_t node)
+        {
+            if (!contains(node))
+                return;
+
+            if (prev[node] != NONE)
+                next[prev[node]] = next[node];
+            else
+                head = next[node];
+
+            if (next[node] != NONE)
+                prev[next[node]] = prev[node];
+            else
+                tail = prev[node];
+
+            prev[node] = NONE;
+            next[node] = NONE;
+            linked[node] = 0;
+            --count;
+        }
+
+    private:
+        std::vector<std::uint32_t> prev;
+        std::vector<std::uint32_t> next;
+        std::vector<std::uint8_t> linked;
+        std::uint32_t head = NONE;
+        std::uint32_t tail = NONE;
+        std::size_t count = 0;
+
+        void ensure(std::uint32_t node)
+        {
+            if (node < linked.size())
+                return;
+
+            std::size_t size = std::max<std::size_t>(node + 1, linked.size() * 2);
+            prev.resize(size, NONE);
+            next.resize(size, NONE);
+            linked.resize(size, 0);
+        }
+    };
+
+    // Bounded FIFO of key hashes for entries that were evicted recently.
+    class GhostQueue
+    {
+    public:
+        bool take(std::uint64_t hash)
+        {
+            auto it = members.find(hash);
+            if (it == members.end())
+                return false;
+
+            if (--it->second == 0)
+                members.erase(it);
+            // The stale queue slot is skipped when it reaches the front.
+            ++stale;
+            return true;
+        }
+
+        // Returns true when an older ghost had to be dropped to stay within the bound.
+        bool add(std::uint64_t hash, std::size_t limit)
+        {
+            order.push_back(hash);
+            ++members[hash];
+
+            bool expired = false;
+            while (!order.empty() && order.size() > stale + std::max<std::size_t>(limit, 1))
+                expired |= popFront();
+            if (order.empty())
+                stale = 0;
+            return expired;
+        }
+
+    private:
+        std::deque<std::uint64_t> order;
+        std::unordered_map<std::uint64_t, std::uint32_t> members;
+        std::size_t stale = 0;
+
+        bool popFront()
+        {
+            std::uint64_t hash = order.front();
+            order.pop_front();
+
+            auto it = members.find(hash);
+            if (it == members.end())
+            {
+                if (stale > 0)
+                    --stale;
+                return false;
+            }
+            if (--it->second == 0)
+                members.erase(it);
+            return true;
+        }
+    };
+
+    template <typename T>
+    void ensureSize(std::vector<T> &v, std::uint32_t node)
+    {
+        if (node >= v.size())
+            v.resize(std::max<std::size_t>(node + 1, v.size() * 2));
+    }
+
+    // Strict LRU: every hit splices the entry to the front, so hits need the writer lock.
+    class LruEngine final : public EvictionEngine
+    {
+    public:
+        void onInsert(std::uint32_t node, std::uint64_t, std::size_t) override { recency.pushFront(node); }
+        void onRemove(std::uint32_t node) override { recency.remove(node); }
+
+        std::uint32_t selectVictim() override
+        {
+            std::uint32_t victim = recency.back();
+            recency.remove(victim);
+            return victim;
+        }
+
+        bool hitNeedsLock() const override { return true; }
+
+        void onHit(std::uint32_t node) override
+        {
+            if (recency.contains(node) && recency.front() != node)
+            {
+                recency.remove(node);
+                recency.pushFront(node);
+            }
+        }
+
+    private:
+        NodeList recency;
+    };
+
+    // CLOCK: entries sit on a ring in insertion order; the hand clears access counters and
+    // evicts the first entry that was not touched since the last sweep.
+    class ClockEngine final : public EvictionEngine
+    {
+    public:
+        explicit ClockEngine(AccessCounters &c) : counters(c) {}
+
+        void onInsert(std::uint32_t node, std::uint64_t, std::size_t) override
+        {
+            // Just behind the hand, so a new entry gets a full revolution before it is examined.
+            ring.insertBefore(hand, node);
+        }
+
+        void onRemove(std::uint32_t node) override
+        {
+            if (hand == node)
+                advance();
+            ring.remove(node);
+            if (ring.empty())
+                hand = NONE;
+        }
+
+        std::uint32_t selectVictim() override
+        {
+            if (ring.empty())
+                return NONE;
+
+            while (true)
+            {
+                if (hand == NONE)
+                    hand = ring.front();
+
+                std::atomic<std::uint8_t> &count = counters.counter(hand);
+                if (count.load(std::memory_order_relaxed) == 0)
+                {
+                    std::uint32_t victim = hand;
+                    onRemove(victim);
+                    return victim;
+                }
+
+                count.store(0, std::memory_order_relaxed);
+                advance();
+            }
+        }
+
+    private:
+        AccessCounters &counters;
+        NodeList ring;
+        std::uint32_t hand = NONE;
+
+        void advance()
+        {
+            std::uint32_t next = ring.nextWrap(hand);
+            hand = next == hand ? NONE : next;
+        }
+    };
+
+    // CLOCK-Pro (Jiang et al.): resident entries are hot or cold, and cold entries carry a
+    // test period during which a reuse promotes them to hot. Recently evicted cold entries
+    // are remembered as non-resident ghosts; re-inserting one grows the cold target.
+    class ClockProEngine final : public EvictionEngine
+    {
+    public:
+        explicit ClockProEngine(AccessCounters &c) : counters(c) {}
+
+        void onInsert(std::uint32_t node, std::uint64_t hash, std::size_t) override
+        {
+            ensureSize(is_hot, node);
+            ensureSize(in_test, node);
+            ensureSize(hashes, node);
+
+            hashes[node] = hash;
+
+            if (ghosts.take(hash))
+            {
+                // Reuse distance shorter than the test period: the cold target was too small.
+                cold_target = std::min(cold_target + 1, std::max<std::size_t>(ring.size(), 1));
+                is_hot[node] = 1;
+                in_test[node] = 0;
+                ++hot_count;
+            }
+            else
+            {
+                is_hot[node] = 0;
+                in_test[node] = 1;
+                ++cold_count;
+            }
+
+            ring.insertBefore(hand_hot, node);
+            if (hand_hot == NONE)
+                hand_hot = node;
+            if (hand_cold == NONE)
+                hand_cold = node;
+        }
+
+        void onRemove(std::uint32_t node) override
+        {
+            if (!ring.contains(node))
+                return;
+
+            if (hand_hot == node)
+                hand_hot = advance(hand_hot);
+            if (hand_cold == node)
+                hand_cold = advance(hand_cold);
+
+            if (is_hot[node])
+                --hot_count;
+            else
+                --cold_count;
+
+            ring.remove(node);
+            if (ring.empty())
+            {
+                hand_hot = NONE;
+                hand_cold = NONE;
+            }
+        }
+
+        std::uint32_t selectVictim() override
+        {
+            if (ring.empty())
+                return NONE;
+
+            // Every pass either evicts, promotes or clears a counter, so this terminates.
+            for (std::size_t steps = 0; steps < 4 * ring.size() + 4; ++steps)
+            {
+                if (cold_count == 0)
+                {
+                    runHotHand();
+                    continue;
+                }
+
+                // advance() yields NONE on a one-entry ring; start over from the front.
+                if (hand_cold == NONE)
+                    hand_cold = ring.front();
+                while (is_hot[hand_cold])
+                {
+                    hand_cold = advance(hand_cold);
+                    if (hand_cold == NONE)
+                        hand_cold = ring.front();
+                }
+
+                std::uint32_t node = hand_cold;
+                std::atomic<std::uint8_t> &count = counters.counter(node);
+
+                if (count.load(std::memory_order_relaxed) == 0)
+                {
+                    if (in_test[node])
+                        expireGhost(ghosts.add(hashes[node], ring.size()));
+                    onRemove(node);
+                    return node;
+                }
+
+                count.store(0, std::memory_order_relaxed);
+                hand_cold = advance(hand_cold);
+
+                if (in_test[node])
+                {
+                    is_hot[node] = 1;
+                    in_test[node] = 0;
+                    --cold_count;
+                    ++hot_count;
+
+                    if (hot_count > hotTarget())
+                        runHotHand();
+                }
+                else
+                {
+                    in_test[node] = 1;
+                }
+            }
+
+            // Fallback that cannot loop: take whatever the cold hand points at.
+            if (hand_cold == NONE)
+                hand_cold = ring.front();
+            std::uint32_t node = hand_cold;
+            onRemove(node);
+            return node;
+        }
+
+    private:
+        AccessCounters &counters;
+        NodeList ring;
+        std::vector<std::uint8_t> is_hot;
+        std::vector<std::uint8_t> in_test;
+        std::vector<std::uint64_t> hashes;
+        GhostQueue ghosts;
+
+        std::uint32_t hand_hot = NONE;
+        std::uint32_t hand_cold = NONE;
+        std::size_t hot_count = 0;
+        std::size_t cold_count = 0;
+        std::size_t cold_target = 1;
+
+        std::size_t hotTarget() const
+        {
+            return ring.size() > cold_target ? ring.size() - cold_target : 1;
+        }
+
+        std::uint32_t advance(std::uint32_t hand) const
+        {
+            std::uint32_t next = ring.nextWrap(hand);
+            return next == hand ? NONE : next;
+        }
+
+        void expireGhost(bool expired)
+        {
+            if (expired && cold_target > 1)
+                --cold_target;
+        }
+
+        // Demotes the first hot entry not accessed since the hand last passed it. Cold
+        // entries the hand passes lose their test period.
+        void runHotHand()
+        {
+            for (std::size_t steps = 0; steps < 2 * ring.size() + 2; ++steps)
+            {
+                if (hand_hot == NONE)
+                    hand_hot = ring.front();
+
+                std::uint32_t node = hand_hot;
+                hand_hot = advance(hand_hot);
+
+                if (!is_hot[node])
+                {
+                    if (in_test[node])
+                    {
+                        in_test[node] = 0;
+                        expireGhost(true);
+                    }
+                    continue;
+                }
+
+                std::atomic<std::uint8_t> &count = counters.counter(node);
+                if (count.load(std::memory_order_relaxed) > 0)
+                {
+                    count.store(0, std::memory_order_relaxed);
+                    continue;
+                }
+
+                is_hot[node] = 0;
+                --hot_count;
+                ++cold_count;
+                return;
+            }
+        }
+    };
+
+    // S3-FIFO (Yang et al.): a small probationary FIFO (10% of bytes) filters one-hit
+    // wonders, a main FIFO holds the rest with lazy reinsertion, and a ghost FIFO lets
+    // recently evicted keys skip probation.
+    class S3FifoEngine final : public EvictionEngine
+    {
+    public:
+        S3FifoEngine(AccessCounters &c, std::size_t capacity) : counters(c), small_target(std::max<std::size_t>(capacity / 10, 1)) {}
+
+        void onInsert(std::uint32_t node, std::uint64_t hash, std::size_t bytes) override
+        {
+            ensureSize(sizes, node);
+            ensureSize(hashes, node);
+
+            sizes[node] = bytes;
+            hashes[node] = hash;
+
+            if (ghosts.take(hash))
+            {
+                main.pushBack(node);
+                main_bytes += bytes;
+            }
+            else
+            {
+                small.pushBack(node);
+                small_bytes += bytes;
+            }
+        }
+
+        void onRemove(std::uint32_t node) override
+        {
+            if (small.contains(node))
+            {
+                small.remove(node);
+                small_bytes -= sizes[node];
+            }
+            else if (main.contains(node))
+            {
+                main.remove(node);
+                main_bytes -= sizes[node];
+            }
+        }
+
+        std::uint32_t selectVictim() override
+        {
+            while (!small.empty() || !main.empty())
+            {
+                if (!small.empty() && (small_bytes >= small_target || main.empty()))
+                {
+                    std::uint32_t node = small.front();
+                    small.remove(node);
+                    small_bytes -= sizes[node];
+
+                    std::atomic<std::uint8_t> &count = counters.counter(node);
+                    if (count.load(std::memory_order_relaxed) > 0)
+                    {
+                        // Reused while on probation: promote instead of evicting.
+                        count.store(0, std::memory_order_relaxed);
+                        main.pushBack(node);
+                        main_bytes += sizes[node];
+                        continue;
+                    }
+
+                    ghosts.add(hashes[node], main.size());
+                    return node;
+                }
+
+                std::uint32_t node = main.front();
+                main.remove(node);
+
+                std::atomic<std::uint8_t> &count = counters.counter(node);
+                std::uint8_t value = count.load(std::memory_order_relaxed);
+                if (value > 0)
+                {
+                    count.store(value - 1, std::memory_order_relaxed);
+                    main.pushBack(node);
+                    continue;
+                }
+
+                main_bytes -= sizes[node];
+                return node;
+            }
+            return NONE;
+        }
+
+    private:
+        AccessCounters &counters;
+        NodeList small;
+        NodeList main;
+        std::vector<std::size_t> sizes;
+        std::vector<std::uint64_t> hashes;
+        GhostQueue ghosts;
+
+        std::size_t small_target;
+        std::size_t small_bytes = 0;
+        std::size_t main_bytes = 0;
+    };
+}
+
+const char *proxy_cache::evictionPolicyName(EvictionPolicy policy)
+{
+    switch (policy)
+    {
+    case EvictionPolicy::Lru:
+        return "lru";
+    case EvictionPolicy::Clock:
+        return "clock";
+    case EvictionPolicy::ClockPro:
+        return "clock-pro";
+    case EvictionPolicy::S3Fifo:
+        return "s3-fifo";
+    }
+    return "unknown";
+}
+
+bool proxy_cache::parseEvictionPolicy(std::string_view name, EvictionPolicy &policy)
+{
+    for (EvictionPolicy candidate : {EvictionPolicy::Lru, EvictionPolicy::Clock, EvictionPolicy::ClockPro, EvictionPolicy::S3Fifo})
+    {
+        if (name == evictionPolicyName(candidate))
+        {
+            policy = candidate;
+            return true;
+        }
+    }
+    return false;
+}
+
+std::unique_ptr<EvictionEngine> proxy_cache::makeEvictionEngine(EvictionPolicy policy, AccessCounters &counters, std::size_t capacity_bytes)
+{
+    switch (policy)
+    {
+    case EvictionPolicy::Lru:
+        return std::make_unique<LruEngine>();
+    case EvictionPolicy::ClockPro:
+        return std::make_unique<ClockProEngine>(counters);
+    case EvictionPolicy::S3Fifo:
+        return std::make_unique<S3FifoEngine>(counters, capacity_bytes);
+    case EvictionPolicy::Clock:
+    default:
+        return std::make_unique<ClockEngine>(counters);
+    }
+}
@@ -0,0 +1,59 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <string_view>
+#include <vector>
+
+namespace proxy_cache
+{
+
+    enum class EvictionPolicy
+    {
+        Lru,
+        Clock,
+        ClockPro,
+        S3Fifo
+    };
+
+    const char *evictionPolicyName(EvictionPolicy policy);
+    bool parseEvictionPolicy(std::string_view name, EvictionPolicy &policy);
+
+    // Per-entry access counter owned by the cache. Hits bump it without a lock; engines
+    // read and reset it on the write path.
+    class AccessCounters
+    {
+    public:
+        static constexpr std::uint8_t MAX_COUNT = 3;
+
+        virtual std::atomic<std::uint8_t> &counter(std::uint32_t node) = 0;
+
+    protected:
+        ~AccessCounters() = default;
+    };
+
+    // Decides which entry leaves the cache. Every call except onHit happens under the cache
+    // writer lock; onHit is only called (also under the lock) when hitNeedsLock() is true.
+    class EvictionEngine
+    {
+    public:
+        static constexpr std::uint32_t NONE = UINT32_MAX;
+
+        virtual ~EvictionEngine() = default;
+
+        virtual void onInsert(std::uint32_t node, std::uint64_t hash, std::size_t bytes) = 0;
+
+        // The entry is leaving for another reason (replaced or invalidated).
+        virtual void onRemove(std::uint32_t node) = 0;
+
+        // Detaches and returns the next victim, or NONE when nothing is tracked.
+        virtual std::uint32_t selectVictim() = 0;
+
+        virtual bool hitNeedsLock() const { return false; }
+        virtual void onHit(std::uint32_t) {}
+    };
+
+    std::unique_ptr<EvictionEngine> makeEvictionEngine(EvictionPolicy policy, AccessCounters &counters, std::size_t capacity_bytes);
+}
@@ -0,0 +1,272 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <bit>
+
+#include "proxy_epoch.hpp"
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define PROXY_FLAT_INDEX_SSE2 1
+#endif
+
+namespace proxy_cache
+{
+
+    // Open-addressing hash index (Swiss-table layout) mapping a 64-bit key hash to a
+    // compact entry index. Control bytes are probed 16 at a time; a slot holds the full
+    // hash so the caller's key compare only runs when both fingerprint and hash match.
+    //
+    // One writer at a time (the caller serializes insert/erase); find() may run concurrently
+    // from inside an epoch guard. Readers can observe a slot mid-update, so matches() must
+    // validate the entry itself. Replaced tables are retired through the epoch manager.
+    class FlatIndex
+    {
+    public:
+        static constexpr std::uint32_t npos = UINT32_MAX;
+
+        explicit FlatIndex(EpochManager &epoch_manager) : epochs(epoch_manager), current(new table(MIN_GROUPS)) {}
+        ~FlatIndex() { delete current.load(std::memory_order_relaxed); }
+
+        FlatIndex(const FlatIndex &) = delete;
+        FlatIndex &operator=(const FlatIndex &) = delete;
+
+        std::size_t size() const { return item_count; }
+
+        // Returns the entry index whose hash equals `hash` and for which matches(entry) holds.
+        template <typename Matches>
+        std::uint32_t find(std::uint64_t hash, Matches &&matches) const
+        {
+            const table *t = current.load(std::memory_order_acquire);
+            const std::int8_t fingerprint = fingerprintOf(hash);
+            std::size_t group = t->groupOf(hash);
+
+            for (std::size_t step = 1;; ++step)
+            {
+                control_group ctrl = t->loadGroup(group);
+
+                for (std::uint32_t bits = ctrl.match(fingerprint); bits; bits &= bits - 1)
+                {
+                    const slot &s = t->slots[group * GROUP_SIZE + std::countr_zero(bits)];
+                    std::uint32_t entry = s.entry.load(std::memory_order_relaxed);
+                    if (s.hash.load(std::memory_order_relaxed) == hash && matches(entry))
+                        return entry;
+                }
+
+                if (ctrl.match(CTRL_EMPTY))
+                    return npos;
+
+                group = (group + step) & t->group_mask;
+            }
+        }
+
+        // The caller guarantees the entry is not already present.
+        void insert(std::uint64_t hash, std::uint32_t entry)
+        {
+            table *t = current.load(std::memory_order_relaxed);
+
+            if ((item_count + tombstone_count + 1) * 8 > t->capacity() * 7)
+                t = rehash((item_count + 1) * 16 > t->capacity() * 7 ? t->group_count * 2 : t->group_count);
+
+            std::size_t index = t->findInsertSlot(hash);
+            if (t->controlAt(index) == CTRL_DELETED)
+                --tombstone_count;
+
+            t->slots[index].hash.store(hash, std::memory_order_relaxed);
+            t->slots[index].entry.store(entry, std::memory_order_relaxed);
+            t->setControl(index, fingerprintOf(hash));
+            ++item_count;
+        }
+
+        // Removes the slot that maps `hash` to `entry`.
+        bool erase(std::uint64_t hash, std::uint32_t entry)
+        {
+            table *t = current.load(std::memory_order_relaxed);
+            const std::int8_t fingerprint = fingerprintOf(hash);
+            std::size_t group = t->groupOf(hash);
+
+            for (std::size_t step = 1;; ++step)
+            {
+                control_group ctrl = t->loadGroup(group);
+
+                for (std::uint32_t bits = ctrl.match(fingerprint); bits; bits &= bits - 1)
+                {
+                    std::size_t index = group * GROUP_SIZE + std::countr_zero(bits);
+                    if (t->slots[index].hash.load(std::memory_order_relaxed) == hash &&
+                        t->slots[index].entry.load(std::memory_order_relaxed) == entry)
+                    {
+                        // A group that never filled up cannot be part of a longer probe chain.
+                        bool had_empty = ctrl.match(CTRL_EMPTY) != 0;
+                        t->setControl(index, had_empty ? CTRL_EMPTY : CTRL_DELETED);
+                        if (!had_empty)
+                            ++tombstone_count;
+                        --item_count;
+                        return true;
+                    }
+                }
+
+                if (ctrl.match(CTRL_EMPTY))
+                    return false;
+
+                group = (group + step) & t->group_mask;
+            }
+        }
+
+        void clear()
+        {
+            table *old = current.exchange(new table(MIN_GROUPS), std::memory_order_acq_rel);
+            epochs.retire(old);
+            item_count = 0;
+            tombstone_count = 0;
+        }
+
+    private:
+        static constexpr std::size_t GROUP_SIZE = 16;
+        static constexpr std::size_t MIN_GROUPS = 4;
+        static constexpr std::int8_t CTRL_EMPTY = -128;
+        static constexpr std::int8_t CTRL_DELETED = -2;
+
+        struct slot
+        {
+            std::atomic<std::uint64_t> hash{0};
+            std::atomic<std::uint32_t> entry{npos};
+        };
+
+        // Sixteen control bytes loaded as two atomic words.
+        struct control_group
+        {
+            std::uint64_t lo;
+            std::uint64_t hi;
+
+            std::uint32_t match(std::int8_t value) const
+            {
+#ifdef PROXY_FLAT_INDEX_SSE2
+                __m128i group = _mm_set_epi64x(static_cast<long long>(hi), static_cast<long long>(lo));
+                return static_cast<std::uint32_t>(_mm_movemask_epi8(_mm_cmpeq_epi8(group, _mm_set1_epi8(value))));
+#else
+                std::uint32_t bits = 0;
+                for (std::size_t i = 0; i < GROUP_SIZE; ++i)
+                {
+                    if (byteAt(i) == value)
+                        bits |= 1u << i;
+                }
+                return bits;
+#endif
+            }
+
+            // Empty and deleted are the only negative control values.
+            std::uint32_t matchFree() const
+            {
+#ifdef PROXY_FLAT_INDEX_SSE2
+                return static_cast<std::uint32_t>(_mm_movemask_epi8(_mm_set_epi64x(static_cast<long long>(hi), static_cast<long long>(lo))));
+#else
+                std::uint32_t bits = 0;
+                for (std::size_t i = 0; i < GROUP_SIZE; ++i)
+                {
+                    if (byteAt(i) < 0)
+                        bits |= 1u << i;
+                }
+                return bits;
+#endif
+            }
+
+            std::int8_t byteAt(std::size_t i) const
+            {
+                std::uint64_t word = i < 8 ? lo : hi;
+                return static_cast<std::int8_t>(word >> ((i % 8) * 8));
+            }
+        };
+
+        struct table
+        {
+            std::size_t group_count;
+            std::size_t group_mask;
+            std::unique_ptr<std::atomic<std::uint64_t>[]> control;
+            std::unique_ptr<slot[]> slots;
+
+            explicit table(std::size_t groups)
+                : group_count(groups), group_mask(groups - 1),
+                  control(new std::atomic<std::uint64_t>[groups * 2]), slots(new slot[groups * GROUP_SIZE])
+            {
+                for (std::size_t i = 0; i < groups * 2; ++i)
+                    control[i].store(EMPTY_WORD, std::memory_order_relaxed);
+            }
+
+            std::size_t capacity() const { return group_count * GROUP_SIZE; }
+
+            // Low 7 bits of the hash are the fingerprint, the rest select the home group.
+            std::size_t groupOf(std::uint64_t hash) const { return static_cast<std::size_t>(hash >> 7) & group_mask; }
+
+            control_group loadGroup(std::size_t group) const
+            {
+                return control_group{control[group * 2].load(std::memory_order_acquire),
+                                     control[group * 2 + 1].load(std::memory_order_acquire)};
+            }
+
+            std::int8_t controlAt(std::size_t index) const
+            {
+                std::uint64_t word = control[index / 8].load(std::memory_order_relaxed);
+                return static_cast<std::int8_t>(word >> ((index % 8) * 8));
+            }
+
+            // Single writer: a plain read-modify-write of the word, published with release.
+            void setControl(std::size_t index, std::int8_t value)
+            {
+                std::size_t shift = (index % 8) * 8;
+                std::uint64_t word = control[index / 8].load(std::memory_order_relaxed);
+                word = (word & ~(0xFFULL << shift)) | (static_cast<std::uint64_t>(static_cast<std::uint8_t>(value)) << shift);
+                control[index / 8].store(word, std::memory_order_release);
+            }
+
+            std::size_t findInsertSlot(std::uint64_t hash) const
+            {
+                std::size_t group = groupOf(hash);
+                for (std::size_t step = 1;; ++step)
+                {
+                    std::uint32_t bits = loadGroup(group).matchFree();
+                    if (bits)
+                        return group * GROUP_SIZE + std::countr_zero(bits);
+
+                    group = (group + step) & group_mask;
+                }
+            }
+        };
+
+        static constexpr std::uint64_t EMPTY_WORD = 0x8080808080808080ULL;
+
+        EpochManager &epochs;
+        std::atomic<table *> current;
+        std::size_t item_count = 0;
+        std::size_t tombstone_count = 0;
+
+        static std::int8_t fingerprintOf(std::uint64_t hash) { return static_cast<std::int8_t>(hash & 0x7F); }
+
+        // Builds the replacement off to the side and publishes it in one store.
+        table *rehash(std::size_t groups)
+        {
+            table *old = current.load(std::memory_order_relaxed);
+            table *fresh = new table(groups);
+
+            for (std::size_t i = 0; i < old->capacity(); ++i)
+            {
+                std::int8_t ctrl = old->controlAt(i);
+                if (ctrl >= 0)
+                {
+                    std::uint64_t hash = old->slots[i].hash.load(std::memory_order_relaxed);
+                    std::size_t index = fresh->findInsertSlot(hash);
+                    fresh->slots[index].hash.store(hash, std::memory_order_relaxed);
+                    fresh->slots[index].entry.store(old->slots[i].entry.load(std::memory_order_relaxed), std::memory_order_relaxed);
+                    fresh->setControl(index, ctrl);
+                }
+            }
+
+            tombstone_count = 0;
+            current.store(fresh, std::memory_order_release);
+            epochs.retire(old);
+            return fresh;
+        }
+    };
+}
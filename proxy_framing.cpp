@@ -0,0 +1,274 @@
+#include <algorithm>
+#include <cctype>
+#include <charconv>
+
+#include "proxy_framing.hpp"
+
+using namespace proxy_http;
+
+namespace
+{
+    bool equalsIgnoreCase(std::string_view a, std::string_view b)
+    {
+        return a.size() == b.size() && std::equal(a.begin(), a.end(), b.begin(), [](char x, char y)
+                                                  { return std::tolower(static_cast<unsigned char>(x)) == std::tolower(static_cast<unsigned char>(y)); });
+    }
+
+    bool containsToken(std::string_view value, std::string_view token)
+    {
+        while (!value.empty())
+        {
+            std::size_t comma = value.find(',');
+            std::string_view item = value.substr(0, comma);
+            while (!item.empty() && (item.front() == ' ' || item.front() == '\t'))
+                item.remove_prefix(1);
+            while (!item.empty() && (item.back() == ' ' || item.back() == '\t'))
+                item.remove_suffix(1);
+            if (equalsIgnoreCase(item, token))
+                return true;
+            if (comma == std::string_view::npos)
+                break;
+            value.remove_prefix(comma + 1);
+        }
+        return false;
+    }
+}
+
+MessageFramer::MessageFramer(Kind kind, bool head_request) : kind(kind), head_request(head_request) {}
+
+void MessageFramer::parseHead(std::string_view head)
+{
+    std::size_t line_end = head.find("\r\n");
+    std::string_view start_line = head.substr(0, line_end);
+
+    bool http10 = false;
+    if (kind == Kind::Response)
+    {
+        // "HTTP/1.x NNN reason"
+        if (start_line.size() < 12 || !start_line.starts_with("HTTP/1."))
+        {
+            current = state::Failed;
+            return;
+        }
+        http10 = start_line[7] == '0';
+        auto [ptr, ec] = std::from_chars(start_line.data() + 9, start_line.data() + 12, status_code);
+        if (ec != std::errc() || ptr != start_line.data() + 12)
+        {
+            current = state::Failed;
+            return;
+        }
+    }
+    else
+    {
+        http10 = start_line.ends_with("HTTP/1.0");
+    }
+
+    bool chunked = false;
+    bool has_length = false;
+    bool connection_close = false;
+    bool connection_keep_alive = false;
+    std::uint64_t content_length = 0;
+
+    std::size_t pos = line_end + 2;
+    while (pos < head.size())
+    {
+        std::size_t end = head.find("\r\n", pos);
+        if (end == std::string_view::npos || end == pos)
+            break;
+
+        std::string_view header = head.substr(pos, end - pos);
+        pos = end + 2;
+
+        std::size_t colon = header.find(':');
+        if (colon == std::string_view::npos)
+            continue;
+
+        std::string_view name = header.substr(0, colon);
+        std::string_view value = header.substr(colon + 1);
+        while (!value.empty() && (value.front() == ' ' || value.front() == '\t'))
+            value.remove_prefix(1);
+        while (!value.empty() && (value.back() == ' ' || value.back() == '\t'))
+            value.remove_suffix(1);
+
+        if (equalsIgnoreCase(name, "Content-Length"))
+        {
+            std::uint64_t length = 0;
+            auto [ptr, ec] = std::from_chars(value.data(), value.data() + value.size(), length);
+            // Conflicting lengths are a smuggling vector; refuse rather than pick one.
+            if (ec != std::errc() || ptr != value.data() + value.size() || (has_length && length != content_length))
+            {
+                current = state::Failed;
+                return;
+            }
+            has_length = true;
+            content_length = length;
+        }
+        else if (equalsIgnoreCase(name, "Transfer-Encoding"))
+        {
+            chunked = containsToken(value, "chunked");
+        }
+        else if (equalsIgnoreCase(name, "Connection"))
+        {
+            connection_close = connection_close || containsToken(value, "close");
+            connection_keep_alive = connection_keep_alive || containsToken(value, "keep-alive");
+        }
+    }
+
+    keep_alive = !connection_close && (!http10 || connection_keep_alive);
+
+    if (kind == Kind::Response)
+    {
+        // Interim responses are followed by the real one on the same connection.
+        if (status_code >= 100 && status_code < 200 && status_code != 101)
+        {
+            current = state::Head;
+            return;
+        }
+
+        if (status_code == 101)
+        {
+            keep_alive = false;
+            current = state::Done;
+            return;
+        }
+
+        if (head_request || status_code == 204 || status_code == 304)
+        {
+            current = state::Done;
+            return;
+        }
+    }
+
+    if (chunked)
+    {
+        current = state::ChunkSize;
+    }
+    else if (has_length)
+    {
+        remaining = content_length;
+        current = remaining ? state::Body : state::Done;
+    }
+    else if (kind == Kind::Response)
+    {
+        keep_alive = false;
+        current = state::UntilClose;
+    }
+    else
+    {
+        current = state::Done;
+    }
+}
+
+bool MessageFramer::takeLine(char c)
+{
+    if (c != '\n')
+    {
+        if (line.size() >= MAX_LINE)
+            current = state::Failed;
+        else
+            line.push_back(c);
+        return false;
+    }
+
+    if (!line.empty() && line.back() == '\r')
+        line.pop_back();
+    return true;
+}
+
+std::size_t MessageFramer::feed(const char *data, std::size_t size)
+{
+    std::size_t used = 0;
+
+    while (used < size && current != state::Done && current != state::Failed)
+    {
+        switch (current)
+        {
+        case state::Head:
+        {
+            std::string_view chunk(data + used, size - used);
+            std::size_t before = line.size();
+            line.append(chunk);
+
+            std::size_t end = line.find("\r\n\r\n", before >= 3 ? before - 3 : 0);
+            if (end == std::string::npos)
+            {
+                used = size;
+                if (line.size() > MAX_HEAD)
+                    current = state::Failed;
+                break;
+            }
+
+            std::size_t head_size = end + 4;
+            used += head_size - before;
+
+            std::string head = std::move(line);
+            head.resize(head_size);
+            line.clear();
+            parseHead(head);
+            break;
+        }
+        case state::Body:
+        case state::ChunkData:
+        {
+            std::size_t take = static_cast<std::size_t>(std::min<std::uint64_t>(remaining, size - used));
+            used += take;
+            remaining -= take;
+            if (remaining == 0)
+                current = current == state::Body ? state::Done : state::ChunkDataEnd;
+            break;
+        }
+        case state::ChunkSize:
+        {
+            if (!takeLine(data[used++]))
+                break;
+
+            std::string_view size_field(line);
+            size_field = size_field.substr(0, size_field.find(';'));
+            while (!size_field.empty() && (size_field.back() == ' ' || size_field.back() == '\t'))
+                size_field.remove_suffix(1);
+
+            auto [ptr, ec] = std::from_chars(size_field.data(), size_field.data() + size_field.size(), remaining, 16);
+            if (size_field.empty() || ec != std::errc() || ptr != size_field.data() + size_field.size())
+            {
+                current = state::Failed;
+                break;
+            }
+            line.clear();
+            current = remaining ? state::ChunkData : state::Trailer;
+            break;
+        }
+        case state::ChunkDataEnd:
+        {
+            if (!takeLine(data[used++]))
+                break;
+            current = line.empty() ? state::ChunkSize : state::Failed;
+            line.clear();
+            break;
+        }
+        case state::Trailer:
+        {
+            if (!takeLine(data[used++]))
+                break;
+            if (line.empty())
+                current = state::Done;
+            line.clear();
+            break;
+        }
+        case state::UntilClose:
+            used = size;
+            break;
+        case state::Done:
+        case state::Failed:
+            break;
+        }
+    }
+    return used;
+}
+
+void MessageFramer::finishOnClose()
+{
+    if (current == state::UntilClose)
+        current = state::Done;
+    else if (current != state::Done)
+        current = state::Failed;
+}
@@ -0,0 +1,70 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <string_view>
+
+namespace proxy_http
+{
+
+    // Tracks where an HTTP/1.x message ends as its bytes go by, without keeping them.
+    // Needed wherever a connection outlives one message (pooled upstream links): the body
+    // is delimited by Content-Length, chunked coding, or - for responses only - the close.
+    class MessageFramer
+    {
+    public:
+        enum class Kind
+        {
+            Request,
+            Response
+        };
+
+    private:
+        enum class state
+        {
+            Head,
+            Body,
+            ChunkSize,
+            ChunkData,
+            ChunkDataEnd,
+            Trailer,
+            UntilClose,
+            Done,
+            Failed
+        };
+
+        static constexpr std::size_t MAX_HEAD = 64 * 1024;
+        static constexpr std::size_t MAX_LINE = 4096;
+
+        Kind kind;
+        bool head_request;
+        state current = state::Head;
+        std::string line;
+        std::uint64_t remaining = 0;
+        int status_code = 0;
+        bool keep_alive = true;
+
+        void parseHead(std::string_view head);
+        bool takeLine(char c);
+
+    public:
+        // head_request: the response answers a HEAD, so it never has a body.
+        explicit MessageFramer(Kind kind, bool head_request = false);
+
+        // Consumes bytes of the message and returns how many belonged to it; anything after
+        // the end of the message is left to the caller.
+        std::size_t feed(const char *data, std::size_t size);
+
+        // The peer closed the connection; a close-delimited body ends here.
+        void finishOnClose();
+
+        bool headComplete() const { return current != state::Head && current != state::Failed; }
+        bool complete() const { return current == state::Done; }
+        bool failed() const { return current == state::Failed; }
+        int statusCode() const { return status_code; }
+
+        // The connection can carry another message once this one is complete.
+        bool reusable() const { return complete() && keep_alive; }
+    };
+}
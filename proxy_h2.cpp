@@ -0,0 +1,1647 @@
+#include <algorithm>
+#include <cctype>
+#include <chrono>
+#include <cstring>
+#include <format>
+#include <system_error>
+#include <thread>
+
+#include "proxy_h2.hpp"
+#include "proxy_headers.hpp"
+#include "proxy_logger.hpp"
+
+using namespace proxy_http;
+
+constexpr std::uint8_t FLAG_END_STREAM = 0x1;
+constexpr std::uint8_t FLAG_ACK = 0x1;
+constexpr std::uint8_t FLAG_END_HEADERS = 0x4;
+constexpr std::uint8_t FLAG_PADDED = 0x8;
+constexpr std::uint8_t FLAG_PRIORITY = 0x20;
+
+constexpr std::uint16_t SETTINGS_HEADER_TABLE_SIZE = 0x1;
+constexpr std::uint16_t SETTINGS_ENABLE_PUSH = 0x2;
+constexpr std::uint16_t SETTINGS_MAX_CONCURRENT_STREAMS = 0x3;
+constexpr std::uint16_t SETTINGS_INITIAL_WINDOW_SIZE = 0x4;
+constexpr std::uint16_t SETTINGS_MAX_FRAME_SIZE = 0x5;
+constexpr std::uint16_t SETTINGS_MAX_HEADER_LIST_SIZE = 0x6;
+
+// What we announce. The receive window is topped up after every DATA frame, so it only
+// bounds how far a client can run ahead of us, not the body size.
+constexpr std::uint32_t H2_MAX_CONCURRENT_STREAMS = 100;
+constexpr std::uint32_t H2_RECEIVE_WINDOW = 1024 * 1024;
+constexpr std::uint32_t H2_MAX_FRAME = 16384;
+constexpr std::uint32_t H2_MAX_HEADER_LIST = 64 * 1024;
+constexpr std::uint32_t H2_HEADER_TABLE_SIZE = 4096;
+
+constexpr std::int64_t H2_MAX_WINDOW = 0x7fffffff;
+constexpr std::size_t H2_DEFAULT_WINDOW = 65535;
+
+// Request bodies are collected before the stream is dispatched; larger ones get a 413.
+constexpr std::size_t H2_MAX_REQUEST_BODY = 16 * 1024 * 1024;
+
+// A stream whose window stays shut this long is given up on.
+constexpr auto H2_SEND_TIMEOUT = std::chrono::seconds(100);
+
+// Upstream sessions: the connection window is returned as soon as DATA arrives, so it only
+// needs to be large enough never to be the bottleneck. An origin silent this long on a
+// stream is given up on, matching the HTTP/1.1 path's socket timeout.
+constexpr std::uint32_t H2_UPSTREAM_CONNECTION_WINDOW = 16 * 1024 * 1024;
+constexpr auto H2_UPSTREAM_RESPONSE_TIMEOUT = std::chrono::seconds(30);
+constexpr std::uint32_t H2_MAX_STREAM_ID = 0x7fffffff;
+
+namespace
+{
+    std::uint32_t readBe32(const std::uint8_t *p)
+    {
+        return (static_cast<std::uint32_t>(p[0]) << 24) | (static_cast<std::uint32_t>(p[1]) << 16) |
+               (static_cast<std::uint32_t>(p[2]) << 8) | p[3];
+    }
+
+    void appendBe32(std::string &out, std::uint32_t value)
+    {
+        out.push_back(static_cast<char>(value >> 24));
+        out.push_back(static_cast<char>(value >> 16));
+        out.push_back(static_cast<char>(value >> 8));
+        out.push_back(static_cast<char>(value));
+    }
+
+    void appendSetting(std::string &out, std::uint16_t id, std::uint32_t value)
+    {
+        out.push_back(static_cast<char>(id >> 8));
+        out.push_back(static_cast<char>(id));
+        appendBe32(out, value);
+    }
+
+    bool isTimeout(int error)
+    {
+#ifdef _WIN32
+        return error == WSAETIMEDOUT;
+#else
+        return error == EAGAIN || error == EWOULDBLOCK;
+#endif
+    }
+
+    std::string lowercase(std::string_view text)
+    {
+        std::string result(text);
+        std::transform(result.begin(), result.end(), result.begin(), [](unsigned char c)
+                       { return static_cast<char>(std::tolower(c)); });
+        return result;
+    }
+
+    std::string_view trim(std::string_view value)
+    {
+        while (!value.empty() && (value.front() == ' ' || value.front() == '\t'))
+            value.remove_prefix(1);
+        while (!value.empty() && (value.back() == ' ' || value.back() == '\t' || value.back() == '\r'))
+            value.remove_suffix(1);
+        return value;
+    }
+
+    std::string_view reasonPhrase(std::string_view status)
+    {
+        static constexpr std::pair<std::string_view, std::string_view> phrases[] = {
+            {"200", "OK"}, {"201", "Created"}, {"204", "No Content"}, {"206", "Partial Content"},
+            {"301", "Moved Permanently"}, {"302", "Found"}, {"304", "Not Modified"}, {"307", "Temporary Redirect"},
+            {"308", "Permanent Redirect"}, {"400", "Bad Request"}, {"401", "Unauthorized"}, {"403", "Forbidden"},
+            {"404", "Not Found"}, {"405", "Method Not Allowed"}, {"410", "Gone"}, {"413", "Content Too Large"},
+            {"429", "Too Many Requests"}, {"500", "Internal Server Error"}, {"502", "Bad Gateway"},
+            {"503", "Service Unavailable"}, {"504", "Gateway Timeout"}};
+
+        for (const auto &[code, phrase] : phrases)
+        {
+            if (code == status)
+                return phrase;
+        }
+        return "";
+    }
+
+    // Connection-specific fields have no meaning in HTTP/2 (RFC 9113 8.2.2).
+    bool isConnectionSpecific(std::string_view name)
+    {
+        return name == "connection" || name == "keep-alive" || name == "proxy-connection" ||
+               name == "transfer-encoding" || name == "upgrade" || name == "te";
+    }
+}
+
+H2FrameHeader proxy_http::parseFrameHeader(const std::uint8_t *data)
+{
+    return H2FrameHeader{(static_cast<std::uint32_t>(data[0]) << 16) | (static_cast<std::uint32_t>(data[1]) << 8) | data[2],
+                         static_cast<H2FrameType>(data[3]), data[4], readBe32(data + 5) & 0x7fffffff};
+}
+
+void proxy_http::appendFrameHeader(std::string &out, std::uint32_t length, H2FrameType type, std::uint8_t flags, std::uint32_t stream_id)
+{
+    out.push_back(static_cast<char>(length >> 16));
+    out.push_back(static_cast<char>(length >> 8));
+    out.push_back(static_cast<char>(length));
+    out.push_back(static_cast<char>(type));
+    out.push_back(static_cast<char>(flags));
+    appendBe32(out, stream_id & 0x7fffffff);
+}
+
+std::string_view H2Request::header(std::string_view name) const
+{
+    for (const auto &[field, value] : headers)
+    {
+        if (field == name)
+            return value;
+    }
+    return {};
+}
+
+bool proxy_http::toHttp1Request(const H2Request &request, std::vector<char> &out)
+{
+    std::string_view method = request.header(":method");
+    std::string_view scheme = request.header(":scheme");
+    std::string_view authority = request.header(":authority");
+    std::string_view path = request.header(":path");
+
+    if (authority.empty())
+        authority = request.header("host");
+
+    if (method.empty() || method == "CONNECT" || scheme != "http" || authority.empty() || path.empty() || path.front() != '/')
+        return false;
+
+    std::string head;
+    head.reserve(256);
+    head.append(method).append(" http://").append(authority).append(path).append(" HTTP/1.1\r\n");
+    head.append("Host: ").append(authority).append("\r\n");
+
+    // Cookie may be split into crumbs; HTTP/1.1 wants them back on one line (RFC 9113 8.2.3).
+    std::string cookie;
+    for (const auto &[name, value] : request.headers)
+    {
+        if (name.empty() || name.front() == ':' || isConnectionSpecific(name) || name == "host" ||
+            name == "content-length" || name == "expect")
+            continue;
+
+        if (name == "cookie")
+        {
+            cookie.append(cookie.empty() ? "" : "; ").append(value);
+            continue;
+        }
+        head.append(name).append(": ").append(value).append("\r\n");
+    }
+    if (!cookie.empty())
+        head.append("cookie: ").append(cookie).append("\r\n");
+
+    if (!request.body.empty() || method == "POST" || method == "PUT" || method == "PATCH")
+        head.append("Content-Length: ").append(std::to_string(request.body.size())).append("\r\n");
+    head.append("\r\n");
+
+    out.assign(head.begin(), head.end());
+    out.insert(out.end(), request.body.begin(), request.body.end());
+    return true;
+}
+
+void proxy_http::appendHttp1Fields(std::string_view head, HeaderList &headers)
+{
+    std::size_t line_end = head.find("\r\n");
+    std::string_view rest = line_end == std::string_view::npos ? std::string_view() : head.substr(line_end + 2);
+
+    while (!rest.empty())
+    {
+        std::size_t end = rest.find("\r\n");
+        std::string_view line = rest.substr(0, end);
+        rest = end == std::string_view::npos ? std::string_view() : rest.substr(end + 2);
+
+        std::size_t colon = line.find(':');
+        if (colon == std::string_view::npos)
+            continue;
+
+        std::string name = lowercase(trim(line.substr(0, colon)));
+        if (!name.empty() && name != "host" && !isConnectionSpecific(name))
+            headers.emplace_back(std::move(name), std::string(trim(line.substr(colon + 1))));
+    }
+}
+
+bool H2Transport::readExact(std::size_t size, bool &timed_out)
+{
+    timed_out = false;
+    char temp_buffer[16384];
+
+    while (pending.size() < size)
+    {
+        int bytes_received = recv(socket, temp_buffer, sizeof(temp_buffer), 0);
+        if (bytes_received <= 0)
+        {
+            timed_out = bytes_received < 0 && isTimeout(getSocketError());
+            return false;
+        }
+        pending.insert(pending.end(), temp_buffer, temp_buffer + bytes_received);
+    }
+    return true;
+}
+
+void H2Transport::queueControl(std::string frames)
+{
+    std::lock_guard<std::mutex> lock(control_mutex);
+    control_queue.append(frames);
+}
+
+void H2Transport::flushControl()
+{
+    while (true)
+    {
+        std::unique_lock<std::mutex> write_lock(write_mutex, std::try_to_lock);
+        if (!write_lock.owns_lock())
+            return;
+
+        std::string frames;
+        {
+            std::lock_guard<std::mutex> lock(control_mutex);
+            frames.swap(control_queue);
+        }
+        if (frames.empty())
+            return;
+
+        sendSegments(socket, {Segment{frames.data(), frames.size()}});
+    }
+}
+
+bool H2Transport::writeFrame(const std::string &frame_header, const char *payload, std::size_t size)
+{
+    std::vector<Segment> segments{Segment{frame_header.data(), frame_header.size()}};
+    if (size > 0)
+        segments.push_back(Segment{payload, size});
+
+    bool sent;
+    {
+        std::lock_guard<std::mutex> write_lock(write_mutex);
+        sent = sendSegments(socket, segments);
+    }
+    flushControl();
+    return sent;
+}
+
+std::string H2Transport::headerFrames(std::uint32_t stream_id, const HeaderList &headers, bool end_stream, std::uint32_t max_frame)
+{
+    std::string block;
+    hpackEncode(headers, block);
+
+    // The block is split into HEADERS plus CONTINUATION frames that must go out back to back.
+    std::string frames;
+    std::size_t offset = 0;
+    do
+    {
+        std::size_t size = std::min<std::size_t>(block.size() - offset, max_frame);
+        bool first = offset == 0;
+        bool last = offset + size == block.size();
+        std::uint8_t flags = (last ? FLAG_END_HEADERS : 0) | (first && end_stream ? FLAG_END_STREAM : 0);
+
+        appendFrameHeader(frames, static_cast<std::uint32_t>(size), first ? H2FrameType::Headers : H2FrameType::Continuation, flags, stream_id);
+        frames.append(block, offset, size);
+        offset += size;
+    } while (offset < block.size());
+
+    return frames;
+}
+
+std::string H2Transport::windowUpdateFrame(std::uint32_t stream_id, std::uint32_t increment)
+{
+    std::string frame;
+    appendFrameHeader(frame, 4, H2FrameType::WindowUpdate, 0, stream_id);
+    appendBe32(frame, increment);
+    return frame;
+}
+
+std::string H2Transport::rstStreamFrame(std::uint32_t stream_id, H2Error error)
+{
+    std::string frame;
+    appendFrameHeader(frame, 4, H2FrameType::RstStream, 0, stream_id);
+    appendBe32(frame, static_cast<std::uint32_t>(error));
+    return frame;
+}
+
+std::string H2Transport::goAwayFrame(std::uint32_t last_stream_id, H2Error error)
+{
+    std::string frame;
+    appendFrameHeader(frame, 8, H2FrameType::GoAway, 0, 0);
+    appendBe32(frame, last_stream_id);
+    appendBe32(frame, static_cast<std::uint32_t>(error));
+    return frame;
+}
+
+Http2Session::Http2Session(socket_t client_socket, int client_id, StreamHandler handler)
+    : H2Transport(client_socket), client_id(client_id), handler(std::move(handler)), decoder(H2_HEADER_TABLE_SIZE)
+{
+}
+
+void Http2Session::dispatch(std::uint32_t stream_id, std::shared_ptr<stream_state> stream)
+{
+    stream->request_done = true;
+    ++active_workers;
+
+    try
+    {
+        std::thread([this, stream_id, stream]()
+                    {
+                        handler(*this, stream_id, stream->request);
+
+                        std::lock_guard<std::mutex> lock(state_mutex);
+                        streams.erase(stream_id);
+                        --active_workers;
+                        ++streams_served;
+                        state_changed.notify_all(); })
+            .detach();
+    }
+    catch (const std::system_error &)
+    {
+        --active_workers;
+        streams.erase(stream_id);
+        queueControl(rstStreamFrame(stream_id, H2Error::RefusedStream));
+    }
+}
+
+bool Http2Session::completeHeaders(std::uint32_t stream_id, H2Error &error)
+{
+    std::shared_ptr<stream_state> stream = streams[stream_id];
+
+    // Every block is decoded, even for streams about to be refused, to keep the table in sync.
+    HeaderList fields;
+    bool decoded = decoder.decode(reinterpret_cast<const std::uint8_t *>(stream->header_block.data()), stream->header_block.size(), fields, H2_MAX_HEADER_LIST);
+    std::string().swap(stream->header_block);
+    if (!decoded)
+    {
+        error = H2Error::CompressionError;
+        return false;
+    }
+
+    if (!stream->headers_done)
+    {
+        stream->headers_done = true;
+        stream->request.headers = std::move(fields);
+
+        if (going_away || streams.size() > H2_MAX_CONCURRENT_STREAMS)
+        {
+            streams.erase(stream_id);
+            queueControl(rstStreamFrame(stream_id, H2Error::RefusedStream));
+            return true;
+        }
+    }
+    else if (!stream->end_stream_pending)
+    {
+        // A second header block is only allowed as trailers, which end the stream.
+        error = H2Error::ProtocolError;
+        return false;
+    }
+
+    if (stream->end_stream_pending)
+        dispatch(stream_id, stream);
+    return true;
+}
+
+bool Http2Session::handleFrame(const H2FrameHeader &frame, const std::uint8_t *payload, H2Error &error)
+{
+    error = H2Error::ProtocolError;
+
+    // A header block may not be interleaved with any other frame.
+    if (continuation_stream != 0 && (frame.type != H2FrameType::Continuation || frame.stream_id != continuation_stream))
+        return false;
+
+    switch (frame.type)
+    {
+    case H2FrameType::Data:
+    {
+        if (frame.stream_id == 0)
+            return false;
+
+        const std::uint8_t *data = payload;
+        std::size_t size = frame.length;
+        if (frame.flags & FLAG_PADDED)
+        {
+            if (size < 1 || payload[0] >= size)
+                return false;
+            size -= 1 + payload[0];
+            ++data;
+        }
+
+        // Padding counts against flow control too; it is all handed back at once.
+        if (frame.length > 0)
+            queueControl(windowUpdateFrame(0, frame.length));
+
+        auto it = streams.find(frame.stream_id);
+        if (it == streams.end() || !it->second->headers_done || it->second->request_done)
+        {
+            if (frame.stream_id > last_stream_id)
+                return false;
+            queueControl(rstStreamFrame(frame.stream_id, H2Error::StreamClosed));
+            return true;
+        }
+
+        std::shared_ptr<stream_state> stream = it->second;
+        if (stream->request.body.size() + size > H2_MAX_REQUEST_BODY)
+        {
+            log<LogLevel::Warn, LogSubsystem::Client>("{}|H2|Stream {} request body over {} bytes.\n", client_id, frame.stream_id, H2_MAX_REQUEST_BODY);
+            queueControl(headerFrames(frame.stream_id, {{":status", "413"}}, true, peer_max_frame));
+            queueControl(rstStreamFrame(frame.stream_id, H2Error::NoError));
+            streams.erase(it);
+            return true;
+        }
+        stream->request.body.insert(stream->request.body.end(), data, data + size);
+
+        if (frame.flags & FLAG_END_STREAM)
+            dispatch(frame.stream_id, stream);
+        else if (frame.length > 0)
+            queueControl(windowUpdateFrame(frame.stream_id, frame.length));
+        return true;
+    }
+
+    case H2FrameType::Headers:
+    {
+        if (frame.stream_id == 0 || frame.stream_id % 2 == 0)
+            return false;
+
+        const std::uint8_t *block = payload;
+        std::size_t size = frame.length;
+        if (frame.flags & FLAG_PADDED)
+        {
+            if (size < 1 || payload[0] >= size)
+                return false;
+            size -= 1 + payload[0];
+            ++block;
+        }
+        if (frame.flags & FLAG_PRIORITY)
+        {
+            if (size < 5)
+                return false;
+            size -= 5;
+            block += 5;
+        }
+
+        auto it = streams.find(frame.stream_id);
+        if (it == streams.end())
+        {
+            if (frame.stream_id <= last_stream_id)
+            {
+                error = H2Error::StreamClosed;
+                return false;
+            }
+            last_stream_id = frame.stream_id;
+
+            auto stream = std::make_shared<stream_state>();
+            stream->send_window = peer_initial_window;
+            it = streams.emplace(frame.stream_id, std::move(stream)).first;
+        }
+        else if (it->second->request_done)
+            return false;
+
+        it->second->header_block.assign(reinterpret_cast<const char *>(block), size);
+        it->second->end_stream_pending = (frame.flags & FLAG_END_STREAM) != 0;
+
+        if (frame.flags & FLAG_END_HEADERS)
+            return completeHeaders(frame.stream_id, error);
+
+        continuation_stream = frame.stream_id;
+        return true;
+    }
+
+    case H2FrameType::Continuation:
+    {
+        if (continuation_stream == 0)
+            return false;
+
+        std::shared_ptr<stream_state> &stream = streams[frame.stream_id];
+        stream->header_block.append(reinterpret_cast<const char *>(payload), frame.length);
+        if (stream->header_block.size() > H2_MAX_HEADER_LIST)
+        {
+            error = H2Error::EnhanceYourCalm;
+            return false;
+        }
+
+        if (!(frame.flags & FLAG_END_HEADERS))
+            return true;
+
+        continuation_stream = 0;
+        return completeHeaders(frame.stream_id, error);
+    }
+
+    case H2FrameType::RstStream:
+    {
+        if (frame.length != 4)
+        {
+            error = H2Error::FrameSizeError;
+            return false;
+        }
+        if (frame.stream_id == 0)
+            return false;
+
+        auto it = streams.find(frame.stream_id);
+        if (it != streams.end())
+        {
+            it->second->reset = true;
+            if (!it->second->request_done)
+                streams.erase(it);
+            state_changed.notify_all();
+        }
+        return true;
+    }
+
+    case H2FrameType::Settings:
+    {
+        if (frame.stream_id != 0)
+            return false;
+        if (frame.flags & FLAG_ACK)
+        {
+            error = H2Error::FrameSizeError;
+            return frame.length == 0;
+        }
+        if (frame.length % 6 != 0)
+        {
+            error = H2Error::FrameSizeError;
+            return false;
+        }
+
+        for (std::size_t offset = 0; offset < frame.length; offset += 6)
+        {
+            std::uint16_t id = static_cast<std::uint16_t>((payload[offset] << 8) | payload[offset + 1]);
+            std::uint32_t value = readBe32(payload + offset + 2);
+
+            if (id == SETTINGS_INITIAL_WINDOW_SIZE)
+            {
+                if (value > H2_MAX_WINDOW)
+                {
+                    error = H2Error::FlowControlError;
+                    return false;
+                }
+                // The change applies to every open stream's window (RFC 9113 6.9.2).
+                std::int64_t delta = static_cast<std::int64_t>(value) - peer_initial_window;
+                peer_initial_window = value;
+                for (auto &[stream_id, stream] : streams)
+                    stream->send_window += delta;
+            }
+            else if (id == SETTINGS_MAX_FRAME_SIZE)
+            {
+                if (value < 16384 || value > 16777215)
+                    return false;
+                peer_max_frame = value;
+            }
+        }
+
+        std::string ack;
+        appendFrameHeader(ack, 0, H2FrameType::Settings, FLAG_ACK, 0);
+        queueControl(std::move(ack));
+        state_changed.notify_all();
+        return true;
+    }
+
+    case H2FrameType::Ping:
+    {
+        if (frame.length != 8)
+        {
+            error = H2Error::FrameSizeError;
+            return false;
+        }
+        if (frame.stream_id != 0)
+            return false;
+
+        if (!(frame.flags & FLAG_ACK))
+        {
+            std::string pong;
+            appendFrameHeader(pong, 8, H2FrameType::Ping, FLAG_ACK, 0);
+            pong.append(reinterpret_cast<const char *>(payload), 8);
+            queueControl(std::move(pong));
+        }
+        return true;
+    }
+
+    case H2FrameType::GoAway:
+        going_away = true;
+        return true;
+
+    case H2FrameType::WindowUpdate:
+    {
+        if (frame.length != 4)
+        {
+            error = H2Error::FrameSizeError;
+            return false;
+        }
+
+        std::uint32_t increment = readBe32(payload) & 0x7fffffff;
+        if (frame.stream_id == 0)
+        {
+            if (increment == 0)
+                return false;
+            connection_send_window += increment;
+            if (connection_send_window > H2_MAX_WINDOW)
+            {
+                error = H2Error::FlowControlError;
+                return false;
+            }
+        }
+        else
+        {
+            auto it = streams.find(frame.stream_id);
+            if (it != streams.end())
+            {
+                it->second->send_window += increment;
+                if (increment == 0 || it->second->send_window > H2_MAX_WINDOW)
+                {
+                    it->second->reset = true;
+                    queueControl(rstStreamFrame(frame.stream_id, increment == 0 ? H2Error::ProtocolError : H2Error::FlowControlError));
+                }
+            }
+        }
+        state_changed.notify_all();
+        return true;
+    }
+
+    case H2FrameType::PushPromise:
+        return false;
+
+    default:
+        // PRIORITY and unknown frame types are ignored (RFC 9113 5.5).
+        return true;
+    }
+}
+
+void Http2Session::run(std::vector<char> initial)
+{
+    pending = std::move(initial);
+    bool timed_out = false;
+
+    if (!readExact(H2_PREFACE.size(), timed_out) || std::memcmp(pending.data(), H2_PREFACE.data(), H2_PREFACE.size()) != 0)
+    {
+        log<LogLevel::Warn, LogSubsystem::Client>("{}|H2|Bad connection preface.\n", client_id);
+        return;
+    }
+    pending.erase(pending.begin(), pending.begin() + H2_PREFACE.size());
+
+    std::string settings;
+    appendFrameHeader(settings, 24, H2FrameType::Settings, 0, 0);
+    appendSetting(settings, SETTINGS_HEADER_TABLE_SIZE, H2_HEADER_TABLE_SIZE);
+    appendSetting(settings, SETTINGS_MAX_CONCURRENT_STREAMS, H2_MAX_CONCURRENT_STREAMS);
+    appendSetting(settings, SETTINGS_INITIAL_WINDOW_SIZE, H2_RECEIVE_WINDOW);
+    appendSetting(settings, SETTINGS_MAX_HEADER_LIST_SIZE, H2_MAX_HEADER_LIST);
+    queueControl(std::move(settings));
+    queueControl(windowUpdateFrame(0, H2_RECEIVE_WINDOW - H2_DEFAULT_WINDOW));
+    flushControl();
+
+    log<LogLevel::Info, LogSubsystem::Client>("{}|H2|Session started.\n", client_id);
+
+    H2Error error = H2Error::NoError;
+    bool failed = false;
+
+    while (!failed)
+    {
+        if (!readExact(H2_FRAME_HEADER_SIZE, timed_out))
+        {
+            std::lock_guard<std::mutex> lock(state_mutex);
+            // Idle with nothing in flight: close politely. Streams still being answered keep it open.
+            if (timed_out && active_workers > 0)
+                continue;
+            if (timed_out)
+                queueControl(goAwayFrame(last_stream_id, H2Error::NoError));
+            break;
+        }
+
+        H2FrameHeader frame = parseFrameHeader(reinterpret_cast<const std::uint8_t *>(pending.data()));
+        if (frame.length > H2_MAX_FRAME)
+        {
+            error = H2Error::FrameSizeError;
+            failed = true;
+            break;
+        }
+
+        // A client that stalls part-way through a frame is dropped.
+        if (!readExact(H2_FRAME_HEADER_SIZE + frame.length, timed_out))
+            break;
+
+        {
+            std::lock_guard<std::mutex> lock(state_mutex);
+            failed = !handleFrame(frame, reinterpret_cast<const std::uint8_t *>(pending.data()) + H2_FRAME_HEADER_SIZE, error);
+        }
+        pending.erase(pending.begin(), pending.begin() + H2_FRAME_HEADER_SIZE + frame.length);
+        flushControl();
+    }
+
+    std::unique_lock<std::mutex> lock(state_mutex);
+    if (failed)
+    {
+        log<LogLevel::Warn, LogSubsystem::Client>("{}|H2|Connection error {}, sending GOAWAY.\n", client_id, static_cast<std::uint32_t>(error));
+        queueControl(goAwayFrame(last_stream_id, error));
+    }
+    lock.unlock();
+    flushControl();
+    lock.lock();
+
+    // Wake writers waiting for window and make their sends fail fast, then wait them out:
+    // they run on this session.
+    closed = true;
+    state_changed.notify_all();
+    if (active_workers > 0)
+    {
+#ifdef _WIN32
+        shutdown(socket, SD_BOTH);
+#else
+        shutdown(socket, SHUT_RDWR);
+#endif
+    }
+    state_changed.wait(lock, [this]()
+                       { return active_workers == 0; });
+
+    log<LogLevel::Info, LogSubsystem::Client>("{}|H2|Session closed after {} stream(s).\n", client_id, streams_served);
+}
+
+bool Http2Session::sendHeaders(std::uint32_t stream_id, const HeaderList &headers, bool end_stream)
+{
+    std::string frames;
+    {
+        std::lock_guard<std::mutex> lock(state_mutex);
+        auto it = streams.find(stream_id);
+        if (closed || it == streams.end() || it->second->reset || it->second->response_done)
+            return false;
+        it->second->response_done = end_stream;
+        frames = headerFrames(stream_id, headers, end_stream, peer_max_frame);
+    }
+
+    return writeFrame(frames, nullptr, 0);
+}
+
+bool Http2Session::sendData(std::uint32_t stream_id, const char *data, std::size_t size, bool end_stream)
+{
+    if (size == 0 && !end_stream)
+        return true;
+
+    std::size_t offset = 0;
+    do
+    {
+        std::size_t chunk = 0;
+        bool last = false;
+        {
+            std::unique_lock<std::mutex> lock(state_mutex);
+            auto it = streams.find(stream_id);
+            if (it == streams.end())
+                return false;
+            std::shared_ptr<stream_state> stream = it->second;
+
+            bool ready = state_changed.wait_for(lock, H2_SEND_TIMEOUT, [&]()
+                                                { return closed || stream->reset || stream->response_done || offset == size ||
+                                                         (connection_send_window > 0 && stream->send_window > 0); });
+            if (!ready || closed || stream->reset || stream->response_done)
+                return false;
+
+            chunk = std::min<std::size_t>({size - offset, peer_max_frame,
+                                           static_cast<std::size_t>(std::max<std::int64_t>(connection_send_window, 0)),
+                                           static_cast<std::size_t>(std::max<std::int64_t>(stream->send_window, 0))});
+            connection_send_window -= static_cast<std::int64_t>(chunk);
+            stream->send_window -= static_cast<std::int64_t>(chunk);
+
+            last = offset + chunk == size;
+            stream->response_done = last && end_stream;
+        }
+
+        std::string frame_header;
+        appendFrameHeader(frame_header, static_cast<std::uint32_t>(chunk), H2FrameType::Data, last && end_stream ? FLAG_END_STREAM : 0, stream_id);
+
+        if (!writeFrame(frame_header, data + offset, chunk))
+            return false;
+
+        offset += chunk;
+    } while (offset < size);
+
+    return true;
+}
+
+void Http2Session::resetStream(std::uint32_t stream_id, H2Error error)
+{
+    {
+        std::lock_guard<std::mutex> lock(state_mutex);
+        auto it = streams.find(stream_id);
+        if (it == streams.end() || it->second->reset)
+            return;
+        it->second->reset = true;
+        queueControl(rstStreamFrame(stream_id, error));
+    }
+    flushControl();
+}
+
+H2ResponseTranslator::H2ResponseTranslator(Http2Session &session, std::uint32_t stream_id, bool head_request)
+    : session(session), stream_id(stream_id), head_request(head_request)
+{
+}
+
+bool H2ResponseTranslator::sendHead(std::string_view head, bool &interim)
+{
+    std::size_t line_end = head.find("\r\n");
+    std::string_view status_line = head.substr(0, line_end);
+    if (status_line.size() < 12 || status_line.substr(0, 5) != "HTTP/")
+        return false;
+
+    std::string_view status = status_line.substr(9, 3);
+    if (!std::all_of(status.begin(), status.end(), [](unsigned char c)
+                     { return std::isdigit(c); }))
+        return false;
+
+    // 1xx responses have no HTTP/2 equivalent here; the final response follows.
+    interim = status.front() == '1';
+    if (interim)
+        return true;
+
+    HeaderList headers{{":status", std::string(status)}};
+    bool chunked = false;
+    bool has_length = false;
+    std::uint64_t length = 0;
+
+    std::string_view rest = head.substr(line_end + 2);
+    while (!rest.empty())
+    {
+        std::size_t end = rest.find("\r\n");
+        std::string_view line = rest.substr(0, end);
+        rest = end == std::string_view::npos ? std::string_view() : rest.substr(end + 2);
+
+        std::size_t colon = line.find(':');
+        if (colon == std::string_view::npos)
+            continue;
+
+        std::string name = lowercase(trim(line.substr(0, colon)));
+        std::string_view value = trim(line.substr(colon + 1));
+
+        if (name == "transfer-encoding")
+            chunked = lowercase(value).find("chunked") != std::string::npos;
+        else if (name == "content-length")
+        {
+            has_length = true;
+            length = std::strtoull(std::string(value).c_str(), nullptr, 10);
+        }
+
+        if (!isConnectionSpecific(name))
+            headers.emplace_back(std::move(name), std::string(value));
+    }
+
+    if (chunked)
+    {
+        // A chunked length is whatever the chunks add up to; any Content-Length is wrong.
+        headers.erase(std::remove_if(headers.begin(), headers.end(), [](const auto &field)
+                                     { return field.first == "content-length"; }),
+                      headers.end());
+    }
+
+    if (head_request || status == "204" || status == "304")
+        current = state::Done;
+    else if (chunked)
+        current = state::ChunkSize;
+    else if (has_length)
+    {
+        remaining = length;
+        current = length == 0 ? state::Done : state::Body;
+    }
+    else
+        current = state::UntilClose;
+
+    return session.sendHeaders(stream_id, headers, current == state::Done);
+}
+
+bool H2ResponseTranslator::feedBody(const char *data, std::size_t size)
+{
+    std::size_t offset = 0;
+
+    while (offset < size && current != state::Done && current != state::Failed)
+    {
+        switch (current)
+        {
+        case state::Body:
+        case state::ChunkData:
+        {
+            std::size_t take = static_cast<std::size_t>(std::min<std::uint64_t>(remaining, size - offset));
+            remaining -= take;
+            bool body_end = current == state::Body && remaining == 0;
+            if (!session.sendData(stream_id, data + offset, take, body_end))
+                current = state::Failed;
+            else if (remaining == 0)
+                current = current == state::Body ? state::Done : state::ChunkDataEnd;
+            offset += take;
+            break;
+        }
+
+        case state::UntilClose:
+            if (!session.sendData(stream_id, data + offset, size - offset, false))
+                current = state::Failed;
+            offset = size;
+            break;
+
+        default:
+        {
+            // Line-oriented states: chunk size, the CRLF after chunk data, trailers.
+            char c = data[offset++];
+            if (c != '\n')
+            {
+                if (buffer.size() >= MAX_HEAD)
+                    current = state::Failed;
+                else
+                    buffer.push_back(c);
+                break;
+            }
+
+            std::string_view line = trim(buffer);
+            if (current == state::ChunkSize)
+            {
+                char *end = nullptr;
+                std::string size_text(line.substr(0, line.find(';')));
+                unsigned long long chunk_size = std::strtoull(size_text.c_str(), &end, 16);
+                if (size_text.empty() || end == size_text.c_str())
+                    current = state::Failed;
+                else if (chunk_size == 0)
+                    current = state::Trailer;
+                else
+                {
+                    remaining = chunk_size;
+                    current = state::ChunkData;
+                }
+            }
+            else if (current == state::ChunkDataEnd)
+                current = line.empty() ? state::ChunkSize : state::Failed;
+            else if (current == state::Trailer && line.empty())
+                current = session.sendData(stream_id, nullptr, 0, true) ? state::Done : state::Failed;
+            buffer.clear();
+            break;
+        }
+        }
+    }
+
+    return current != state::Failed;
+}
+
+bool H2ResponseTranslator::feed(const char *data, std::size_t size)
+{
+    if (current == state::Failed)
+        return false;
+    if (current == state::Done || size == 0)
+        return true;
+
+    started = true;
+    if (current != state::Head)
+        return feedBody(data, size);
+
+    buffer.append(data, size);
+    while (current == state::Head)
+    {
+        std::size_t head_end = buffer.find("\r\n\r\n");
+        if (head_end == std::string::npos)
+        {
+            if (buffer.size() > MAX_HEAD)
+                current = state::Failed;
+            return current != state::Failed;
+        }
+
+        bool interim = false;
+        if (!sendHead(std::string_view(buffer).substr(0, head_end + 4), interim))
+        {
+            current = state::Failed;
+            return false;
+        }
+        buffer.erase(0, head_end + 4);
+    }
+
+    std::string body;
+    body.swap(buffer);
+    return feedBody(body.data(), body.size());
+}
+
+void H2ResponseTranslator::finish()
+{
+    if (!started)
+    {
+        // The request was dropped without any answer (malformed or unroutable).
+        session.sendHeaders(stream_id, {{":status", "502"}}, true);
+        return;
+    }
+
+    if (current == state::UntilClose)
+        session.sendData(stream_id, nullptr, 0, true);
+    else if (current != state::Done)
+        session.resetStream(stream_id, H2Error::InternalError);
+}
+
+H2UpstreamSession::H2UpstreamSession(socket_t socket, std::string authority)
+    : H2Transport(socket), authority(std::move(authority)), decoder(H2_HEADER_TABLE_SIZE), peer_max_streams(H2_MAX_CONCURRENT_STREAMS)
+{
+}
+
+H2UpstreamSession::~H2UpstreamSession()
+{
+    // The reader is blocked in recv(); shutting the socket down is what ends it.
+#ifdef _WIN32
+    shutdown(socket, SD_BOTH);
+#else
+    shutdown(socket, SHUT_RDWR);
+#endif
+    if (reader.joinable())
+        reader.join();
+    closeSocket(socket);
+}
+
+bool H2UpstreamSession::start()
+{
+    std::string preface(H2_PREFACE);
+    appendFrameHeader(preface, 24, H2FrameType::Settings, 0, 0);
+    appendSetting(preface, SETTINGS_HEADER_TABLE_SIZE, H2_HEADER_TABLE_SIZE);
+    appendSetting(preface, SETTINGS_ENABLE_PUSH, 0);
+    appendSetting(preface, SETTINGS_INITIAL_WINDOW_SIZE, H2_RECEIVE_WINDOW);
+    appendSetting(preface, SETTINGS_MAX_HEADER_LIST_SIZE, H2_MAX_HEADER_LIST);
+    preface += windowUpdateFrame(0, H2_UPSTREAM_CONNECTION_WINDOW - H2_DEFAULT_WINDOW);
+
+    if (!writeFrame(preface, nullptr, 0))
+        return false;
+
+    try
+    {
+        reader = std::thread(&H2UpstreamSession::readLoop, this);
+    }
+    catch (const std::system_error &)
+    {
+        return false;
+    }
+
+    log<LogLevel::Info, LogSubsystem::Remote>("H2|Session to {} started.\n", authority);
+    return true;
+}
+
+bool H2UpstreamSession::usable()
+{
+    std::lock_guard<std::mutex> lock(state_mutex);
+    return !closed && !draining && next_stream_id <= H2_MAX_STREAM_ID;
+}
+
+std::size_t H2UpstreamSession::activeStreams()
+{
+    std::lock_guard<std::mutex> lock(state_mutex);
+    return streams.size();
+}
+
+std::uint64_t H2UpstreamSession::streamsOpened()
+{
+    std::lock_guard<std::mutex> lock(state_mutex);
+    return streams_opened;
+}
+
+void H2UpstreamSession::post(const std::shared_ptr<stream_state> &stream, event item)
+{
+    if (stream->ended)
+        return;
+    stream->ended = item.type == event::kind::End || item.type == event::kind::Reset;
+    stream->events.push_back(std::move(item));
+    state_changed.notify_all();
+}
+
+bool H2UpstreamSession::completeHeaders(std::uint32_t stream_id, bool end_stream, H2Error &error)
+{
+    // Every block is decoded, even for streams already given up on, to keep the table in sync.
+    HeaderList fields;
+    bool decoded = decoder.decode(reinterpret_cast<const std::uint8_t *>(header_block.data()), header_block.size(), fields, H2_MAX_HEADER_LIST);
+    std::string().swap(header_block);
+    if (!decoded)
+    {
+        error = H2Error::CompressionError;
+        return false;
+    }
+
+    auto it = streams.find(stream_id);
+    if (it == streams.end())
+        return true;
+    std::shared_ptr<stream_state> stream = it->second;
+
+    if (!stream->got_headers)
+    {
+        // 1xx responses are interim; the final response follows on the same stream.
+        bool interim = !fields.empty() && fields.front().first == ":status" && fields.front().second.starts_with('1');
+        if (interim)
+            return true;
+
+        stream->got_headers = true;
+        post(stream, event{event::kind::Headers, std::move(fields), {}});
+    }
+
+    // Trailers are dropped: the HTTP/1.1 side ends its chunked body without any.
+    if (end_stream)
+        post(stream, event{event::kind::End, {}, {}});
+    return true;
+}
+
+bool H2UpstreamSession::handleFrame(const H2FrameHeader &frame, const std::uint8_t *payload, H2Error &error)
+{
+    error = H2Error::ProtocolError;
+
+    if (continuation_stream != 0 && (frame.type != H2FrameType::Continuation || frame.stream_id != continuation_stream))
+        return false;
+
+    switch (frame.type)
+    {
+    case H2FrameType::Data:
+    {
+        if (frame.stream_id == 0)
+            return false;
+
+        const std::uint8_t *data = payload;
+        std::size_t size = frame.length;
+        if (frame.flags & FLAG_PADDED)
+        {
+            if (size < 1 || payload[0] >= size)
+                return false;
+            size -= 1 + payload[0];
+            ++data;
+        }
+
+        // The connection window is handed back at once, so a slow client only ever stalls
+        // its own stream; stream windows reopen as the fetching thread passes data on.
+        if (frame.length > 0)
+            queueControl(windowUpdateFrame(0, frame.length));
+
+        auto it = streams.find(frame.stream_id);
+        if (it == streams.end())
+            return true;
+
+        if (frame.length > size && !(frame.flags & FLAG_END_STREAM))
+            queueControl(windowUpdateFrame(frame.stream_id, static_cast<std::uint32_t>(frame.length - size)));
+        if (size > 0)
+            post(it->second, event{event::kind::Data, {}, std::string(reinterpret_cast<const char *>(data), size)});
+        if (frame.flags & FLAG_END_STREAM)
+            post(it->second, event{event::kind::End, {}, {}});
+        return true;
+    }
+
+    case H2FrameType::Headers:
+    {
+        if (frame.stream_id == 0 || frame.stream_id % 2 == 0 || frame.stream_id >= next_stream_id)
+            return false;
+
+        const std::uint8_t *block = payload;
+        std::size_t size = frame.length;
+        if (frame.flags & FLAG_PADDED)
+        {
+            if (size < 1 || payload[0] >= size)
+                return false;
+            size -= 1 + payload[0];
+            ++block;
+        }
+        if (frame.flags & FLAG_PRIORITY)
+        {
+            if (size < 5)
+                return false;
+            size -= 5;
+            block += 5;
+        }
+
+        header_block.assign(reinterpret_cast<const char *>(block), size);
+        header_end_stream = (frame.flags & FLAG_END_STREAM) != 0;
+
+        if (frame.flags & FLAG_END_HEADERS)
+            return completeHeaders(frame.stream_id, header_end_stream, error);
+
+        continuation_stream = frame.stream_id;
+        return true;
+    }
+
+    case H2FrameType::Continuation:
+    {
+        if (continuation_stream == 0)
+            return false;
+
+        header_block.append(reinterpret_cast<const char *>(payload), frame.length);
+        if (header_block.size() > H2_MAX_HEADER_LIST)
+        {
+            error = H2Error::EnhanceYourCalm;
+            return false;
+        }
+
+        if (!(frame.flags & FLAG_END_HEADERS))
+            return true;
+
+        continuation_stream = 0;
+        return completeHeaders(frame.stream_id, header_end_stream, error);
+    }
+
+    case H2FrameType::RstStream:
+    {
+        if (frame.length != 4)
+        {
+            error = H2Error::FrameSizeError;
+            return false;
+        }
+        if (frame.stream_id == 0)
+            return false;
+
+        auto it = streams.find(frame.stream_id);
+        if (it != streams.end())
+        {
+            event reset{event::kind::Reset, {}, {}};
+            reset.refused = static_cast<H2Error>(readBe32(payload)) == H2Error::RefusedStream;
+            post(it->second, std::move(reset));
+        }
+        return true;
+    }
+
+    case H2FrameType::Settings:
+    {
+        if (frame.stream_id != 0)
+            return false;
+        if (frame.flags & FLAG_ACK)
+        {
+            error = H2Error::FrameSizeError;
+            return frame.length == 0;
+        }
+        if (frame.length % 6 != 0)
+        {
+            error = H2Error::FrameSizeError;
+            return false;
+        }
+
+        for (std::size_t offset = 0; offset < frame.length; offset += 6)
+        {
+            std::uint16_t id = static_cast<std::uint16_t>((payload[offset] << 8) | payload[offset + 1]);
+            std::uint32_t value = readBe32(payload + offset + 2);
+
+            if (id == SETTINGS_INITIAL_WINDOW_SIZE)
+            {
+                if (value > H2_MAX_WINDOW)
+                {
+                    error = H2Error::FlowControlError;
+                    return false;
+                }
+                std::int64_t delta = static_cast<std::int64_t>(value) - peer_initial_window;
+                peer_initial_window = value;
+                for (auto &[stream_id, stream] : streams)
+                    stream->send_window += delta;
+            }
+            else if (id == SETTINGS_MAX_FRAME_SIZE)
+            {
+                if (value < 16384 || value > 16777215)
+                    return false;
+                peer_max_frame = value;
+            }
+            else if (id == SETTINGS_MAX_CONCURRENT_STREAMS)
+                peer_max_streams = std::min(value, H2_MAX_CONCURRENT_STREAMS);
+        }
+
+        std::string ack;
+        appendFrameHeader(ack, 0, H2FrameType::Settings, FLAG_ACK, 0);
+        queueControl(std::move(ack));
+        state_changed.notify_all();
+        return true;
+    }
+
+    case H2FrameType::Ping:
+    {
+        if (frame.length != 8)
+        {
+            error = H2Error::FrameSizeError;
+            return false;
+        }
+        if (frame.stream_id != 0)
+            return false;
+
+        if (!(frame.flags & FLAG_ACK))
+        {
+            std::string pong;
+            appendFrameHeader(pong, 8, H2FrameType::Ping, FLAG_ACK, 0);
+            pong.append(reinterpret_cast<const char *>(payload), 8);
+            queueControl(std::move(pong));
+        }
+        return true;
+    }
+
+    case H2FrameType::GoAway:
+    {
+        if (frame.length < 8 || frame.stream_id != 0)
+            return false;
+
+        // Streams above the last one the origin processed never ran and may be retried.
+        std::uint32_t last_processed = readBe32(payload) & 0x7fffffff;
+        draining = true;
+        for (auto &[stream_id, stream] : streams)
+        {
+            if (stream_id > last_processed)
+            {
+                event reset{event::kind::Reset, {}, {}};
+                reset.refused = true;
+                post(stream, std::move(reset));
+            }
+        }
+        log<LogLevel::Info, LogSubsystem::Remote>("H2|{} is going away after stream {}.\n", authority, last_processed);
+        state_changed.notify_all();
+        return true;
+    }
+
+    case H2FrameType::WindowUpdate:
+    {
+        if (frame.length != 4)
+        {
+            error = H2Error::FrameSizeError;
+            return false;
+        }
+
+        std::uint32_t increment = readBe32(payload) & 0x7fffffff;
+        if (frame.stream_id == 0)
+        {
+            if (increment == 0)
+                return false;
+            connection_send_window += increment;
+            if (connection_send_window > H2_MAX_WINDOW)
+            {
+                error = H2Error::FlowControlError;
+                return false;
+            }
+        }
+        else
+        {
+            auto it = streams.find(frame.stream_id);
+            if (it != streams.end())
+                it->second->send_window += increment;
+        }
+        state_changed.notify_all();
+        return true;
+    }
+
+    case H2FrameType::PushPromise:
+        // Push is disabled in our SETTINGS.
+        return false;
+
+    default:
+        return true;
+    }
+}
+
+void H2UpstreamSession::readLoop()
+{
+    bool timed_out = false;
+    H2Error error = H2Error::NoError;
+    bool failed = false;
+
+    while (!failed)
+    {
+        if (!readExact(H2_FRAME_HEADER_SIZE, timed_out))
+        {
+            std::lock_guard<std::mutex> lock(state_mutex);
+            // An idle session is retired; one with fetches in flight leaves timing out to them.
+            if (timed_out && !streams.empty())
+                continue;
+            if (timed_out)
+                queueControl(goAwayFrame(0, H2Error::NoError));
+            break;
+        }
+
+        H2FrameHeader frame = parseFrameHeader(reinterpret_cast<const std::uint8_t *>(pending.data()));
+        if (frame.length > H2_MAX_FRAME)
+        {
+            error = H2Error::FrameSizeError;
+            failed = true;
+            break;
+        }
+
+        if (!readExact(H2_FRAME_HEADER_SIZE + frame.length, timed_out))
+            break;
+
+        {
+            std::lock_guard<std::mutex> lock(state_mutex);
+            failed = !handleFrame(frame, reinterpret_cast<const std::uint8_t *>(pending.data()) + H2_FRAME_HEADER_SIZE, error);
+        }
+        pending.erase(pending.begin(), pending.begin() + H2_FRAME_HEADER_SIZE + frame.length);
+        flushControl();
+    }
+
+    if (failed)
+    {
+        log<LogLevel::Warn, LogSubsystem::Remote>("H2|Connection error {} from {}, sending GOAWAY.\n", static_cast<std::uint32_t>(error), authority);
+        queueControl(goAwayFrame(0, error));
+    }
+    flushControl();
+
+    std::lock_guard<std::mutex> lock(state_mutex);
+    closed = true;
+    for (auto &[stream_id, stream] : streams)
+        post(stream, event{event::kind::Reset, {}, {}});
+    state_changed.notify_all();
+
+    log<LogLevel::Info, LogSubsystem::Remote>("H2|Session to {} closed after {} stream(s).\n", authority, streams_opened);
+}
+
+std::uint32_t H2UpstreamSession::openStream(const HeaderList &headers, bool end_stream, std::shared_ptr<stream_state> &stream)
+{
+    {
+        std::unique_lock<std::mutex> lock(state_mutex);
+        bool ready = state_changed.wait_for(lock, H2_SEND_TIMEOUT, [this]()
+                                            { return closed || draining || streams.size() + opening < peer_max_streams; });
+        if (!ready || closed || draining)
+            return 0;
+        ++opening;
+    }
+
+    // Stream ids must reach the wire in increasing order, so the id is taken with the
+    // socket already held.
+    std::lock_guard<std::mutex> write_lock(write_mutex);
+    std::uint32_t stream_id = 0;
+    std::string frames;
+    {
+        std::lock_guard<std::mutex> lock(state_mutex);
+        --opening;
+        if (closed || draining || next_stream_id > H2_MAX_STREAM_ID)
+        {
+            draining = true;
+            state_changed.notify_all();
+            return 0;
+        }
+
+        stream_id = next_stream_id;
+        next_stream_id += 2;
+        ++streams_opened;
+
+        stream = std::make_shared<stream_state>();
+        stream->send_window = peer_initial_window;
+        streams.emplace(stream_id, stream);
+        frames = headerFrames(stream_id, headers, end_stream, peer_max_frame);
+    }
+
+    if (!sendSegments(socket, {Segment{frames.data(), frames.size()}}))
+    {
+        std::lock_guard<std::mutex> lock(state_mutex);
+        streams.erase(stream_id);
+        state_changed.notify_all();
+        return 0;
+    }
+    return stream_id;
+}
+
+bool H2UpstreamSession::sendBody(std::uint32_t stream_id, const std::shared_ptr<stream_state> &stream, const char *data, std::size_t size)
+{
+    std::size_t offset = 0;
+    while (offset < size)
+    {
+        std::size_t chunk = 0;
+        {
+            std::unique_lock<std::mutex> lock(state_mutex);
+            bool ready = state_changed.wait_for(lock, H2_SEND_TIMEOUT, [&]()
+                                                { return closed || stream->ended || (connection_send_window > 0 && stream->send_window > 0); });
+            // The origin may answer (say, 413) before taking the whole body.
+            if (!ready || closed || stream->ended)
+                return false;
+
+            chunk = std::min<std::size_t>({size - offset, peer_max_frame,
+                                           static_cast<std::size_t>(connection_send_window),
+                                           static_cast<std::size_t>(stream->send_window)});
+            connection_send_window -= static_cast<std::int64_t>(chunk);
+            stream->send_window -= static_cast<std::int64_t>(chunk);
+        }
+
+        std::string frame_header;
+        appendFrameHeader(frame_header, static_cast<std::uint32_t>(chunk), H2FrameType::Data, offset + chunk == size ? FLAG_END_STREAM : 0, stream_id);
+        if (!writeFrame(frame_header, data + offset, chunk))
+            return false;
+
+        offset += chunk;
+    }
+    return true;
+}
+
+H2UpstreamSession::FetchResult H2UpstreamSession::fetch(const HeaderList &headers, const char *body, std::size_t body_size, bool head_request, const Sink &sink)
+{
+    std::shared_ptr<stream_state> stream;
+    std::uint32_t stream_id = openStream(headers, body_size == 0, stream);
+    if (stream_id == 0)
+        return FetchResult::Unavailable;
+    flushControl();
+
+    if (body_size > 0)
+        sendBody(stream_id, stream, body, body_size);
+
+    FetchResult result = FetchResult::Broken;
+    bool delivered = false;
+    bool chunked = false;
+    bool peer_done = false;
+
+    while (true)
+    {
+        event item;
+        {
+            std::unique_lock<std::mutex> lock(state_mutex);
+            state_changed.wait_for(lock, H2_UPSTREAM_RESPONSE_TIMEOUT, [&]()
+                                   { return !stream->events.empty(); });
+            if (stream->events.empty())
+            {
+                log<LogLevel::Warn, LogSubsystem::Remote>("H2|Stream {} to {} timed out.\n", stream_id, authority);
+                break;
+            }
+            item = std::move(stream->events.front());
+            stream->events.pop_front();
+        }
+
+        if (item.type == event::kind::Reset)
+        {
+            peer_done = true;
+            if (item.refused && !delivered)
+                result = FetchResult::Unavailable;
+            break;
+        }
+
+        if (item.type == event::kind::End)
+        {
+            peer_done = true;
+            if (delivered && (!chunked || sink("0\r\n\r\n", 5)))
+                result = FetchResult::Complete;
+            break;
+        }
+
+        if (item.type == event::kind::Headers)
+        {
+            std::string_view status;
+            bool has_length = false;
+            std::string head;
+            for (const auto &[name, value] : item.headers)
+            {
+                if (name == ":status")
+                    status = value;
+                else if (!name.starts_with(':') && !isConnectionSpecific(name))
+                {
+                    has_length = has_length || name == "content-length";
+                    head.append(name).append(": ").append(value).append("\r\n");
+                }
+            }
+            if (status.size() != 3)
+                break;
+
+            chunked = !has_length && !head_request && status != "204" && status != "304";
+            std::string status_line = "HTTP/1.1 " + std::string(status) + " " + std::string(reasonPhrase(status)) + "\r\n";
+            head.insert(0, status_line);
+            if (chunked)
+                head += "Transfer-Encoding: chunked\r\n";
+            head += "\r\n";
+
+            delivered = true;
+            if (!sink(head.data(), head.size()))
+            {
+                result = FetchResult::SinkRefused;
+                break;
+            }
+            continue;
+        }
+
+        // DATA before HEADERS is a protocol violation by the origin; treat the stream as broken.
+        if (!delivered)
+            break;
+
+        bool sent;
+        if (chunked)
+        {
+            std::string framed = std::format("{:x}\r\n", item.data.size());
+            framed += item.data;
+            framed += "\r\n";
+            sent = sink(framed.data(), framed.size());
+        }
+        else
+            sent = sink(item.data.data(), item.data.size());
+
+        if (!sent)
+        {
+            result = FetchResult::SinkRefused;
+            break;
+        }
+
+        queueControl(windowUpdateFrame(stream_id, static_cast<std::uint32_t>(item.data.size())));
+        flushControl();
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(state_mutex);
+        streams.erase(stream_id);
+        // A stream we abandon has to be cancelled so the origin stops sending on it.
+        if (!peer_done && !closed)
+            queueControl(rstStreamFrame(stream_id, H2Error::Cancel));
+        state_changed.notify_all();
+    }
+    flushControl();
+    return result;
+}
+
+std::shared_ptr<H2UpstreamSession> H2UpstreamPool::acquire(const std::string &origin, const Dialer &dial)
+{
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        auto it = sessions.find(origin);
+        if (it != sessions.end() && it->second->usable())
+            return it->second;
+    }
+
+    socket_t remote = dial();
+    if (remote == INVALID_SOCKET)
+        return nullptr;
+
+    auto session = std::make_shared<H2UpstreamSession>(remote, origin);
+    if (!session->start())
+        return nullptr;
+
+    std::lock_guard<std::mutex> lock(mutex);
+    std::shared_ptr<H2UpstreamSession> &slot = sessions[origin];
+    if (slot && slot->usable())
+        return slot;
+    slot = session;
+    return session;
+}
+
+std::vector<H2UpstreamStats> H2UpstreamPool::stats()
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    std::vector<H2UpstreamStats> result;
+    for (const auto &[origin, session] : sessions)
+        result.push_back(H2UpstreamStats{origin, session->activeStreams(), session->streamsOpened()});
+    return result;
+}
@@ -0,0 +1,345 @@
+#pragma once
+
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <vector>
+
+#include "proxy_hpack.hpp"
+#include "proxy_utils.hpp"
+
+namespace proxy_http
+{
+
+    constexpr std::string_view H2_PREFACE = "PRI * HTTP/2.0\r\n\r\nSM\r\n\r\n";
+
+    enum class H2FrameType : std::uint8_t
+    {
+        Data = 0,
+        Headers = 1,
+        Priority = 2,
+        RstStream = 3,
+        Settings = 4,
+        PushPromise = 5,
+        Ping = 6,
+        GoAway = 7,
+        WindowUpdate = 8,
+        Continuation = 9
+    };
+
+    enum class H2Error : std::uint32_t
+    {
+        NoError = 0,
+        ProtocolError = 1,
+        InternalError = 2,
+        FlowControlError = 3,
+        StreamClosed = 5,
+        FrameSizeError = 6,
+        RefusedStream = 7,
+        Cancel = 8,
+        CompressionError = 9,
+        EnhanceYourCalm = 11
+    };
+
+    struct H2FrameHeader
+    {
+        std::uint32_t length;
+        H2FrameType type;
+        std::uint8_t flags;
+        std::uint32_t stream_id;
+    };
+
+    constexpr std::size_t H2_FRAME_HEADER_SIZE = 9;
+
+    H2FrameHeader parseFrameHeader(const std::uint8_t *data);
+    void appendFrameHeader(std::string &out, std::uint32_t length, H2FrameType type, std::uint8_t flags, std::uint32_t stream_id);
+
+    // A client stream once its headers and (whole) body have arrived.
+    struct H2Request
+    {
+        HeaderList headers;
+        std::vector<char> body;
+
+        // First value of the field (names are lowercase in HTTP/2), or empty.
+        std::string_view header(std::string_view name) const;
+    };
+
+    // The HTTP/1.1 absolute-form request the rest of the proxy serves, with the body
+    // appended under a Content-Length. False when pseudo-headers are missing or the
+    // scheme/method cannot be proxied (CONNECT, non-http schemes).
+    bool toHttp1Request(const H2Request &request, std::vector<char> &out);
+
+    // Adds the header lines of an HTTP/1.1 message head (its start line is skipped) to
+    // headers: names lowercased, connection-specific fields and Host left out.
+    void appendHttp1Fields(std::string_view head, HeaderList &headers);
+
+    // Socket plumbing shared by both ends of an HTTP/2 connection. Whole frames are written
+    // under write_mutex so they never interleave. The reading thread never waits for it:
+    // its frames go to the control queue and are flushed by whoever next holds the socket.
+    class H2Transport
+    {
+    protected:
+        socket_t socket;
+        std::vector<char> pending;
+
+        explicit H2Transport(socket_t socket) : socket(socket) {}
+
+        // Until pending holds size bytes; timed_out tells a receive timeout from a close.
+        bool readExact(std::size_t size, bool &timed_out);
+
+        // Any thread; the frames go out on the next flushControl().
+        void queueControl(std::string frames);
+        void flushControl();
+
+        // One frame (or a ready-made run of frames when size is 0), then queued control frames.
+        bool writeFrame(const std::string &frame_header, const char *payload, std::size_t size);
+
+        std::mutex write_mutex;
+
+        static std::string headerFrames(std::uint32_t stream_id, const HeaderList &headers, bool end_stream, std::uint32_t max_frame);
+        static std::string windowUpdateFrame(std::uint32_t stream_id, std::uint32_t increment);
+        static std::string rstStreamFrame(std::uint32_t stream_id, H2Error error);
+        static std::string goAwayFrame(std::uint32_t last_stream_id, H2Error error);
+
+    private:
+        std::mutex control_mutex;
+        std::string control_queue;
+    };
+
+    // One prior-knowledge h2c client connection. The calling thread reads and answers
+    // frames; each complete request stream is handed to the handler on its own thread and
+    // the handler answers through sendHeaders/sendData. Responses share the socket at frame
+    // granularity: DATA goes out in chunks of at most the peer's frame size, so one large
+    // body cannot hold the connection while other streams wait.
+    class Http2Session : private H2Transport
+    {
+    public:
+        using StreamHandler = std::function<void(Http2Session &session, std::uint32_t stream_id, const H2Request &request)>;
+
+    private:
+        struct stream_state
+        {
+            H2Request request;
+            std::string header_block;
+            std::int64_t send_window;
+            bool headers_done = false;
+            bool end_stream_pending = false;
+            bool request_done = false;
+            bool reset = false;
+            bool response_done = false;
+        };
+
+        int client_id;
+        StreamHandler handler;
+        HpackDecoder decoder;
+
+        // Guards everything below.
+        std::mutex state_mutex;
+        std::condition_variable state_changed;
+        std::map<std::uint32_t, std::shared_ptr<stream_state>> streams;
+        std::int64_t connection_send_window = 65535;
+        std::int64_t peer_initial_window = 65535;
+        std::uint32_t peer_max_frame = 16384;
+        std::uint32_t last_stream_id = 0;
+        std::uint32_t continuation_stream = 0;
+        std::size_t active_workers = 0;
+        std::uint64_t streams_served = 0;
+        bool going_away = false;
+        bool closed = false;
+
+        // Frame handling runs on the reader thread with state_mutex held. False is a
+        // connection error, reported with a GOAWAY carrying error.
+        bool handleFrame(const H2FrameHeader &frame, const std::uint8_t *payload, H2Error &error);
+        bool completeHeaders(std::uint32_t stream_id, H2Error &error);
+        void dispatch(std::uint32_t stream_id, std::shared_ptr<stream_state> stream);
+
+    public:
+        Http2Session(socket_t client_socket, int client_id, StreamHandler handler);
+
+        Http2Session(const Http2Session &) = delete;
+        Http2Session &operator=(const Http2Session &) = delete;
+
+        // initial holds bytes already received, starting with (part of) the preface. Returns
+        // once the client closes, the connection fails or sits idle, and every stream
+        // handler has finished.
+        void run(std::vector<char> initial);
+
+        bool sendHeaders(std::uint32_t stream_id, const HeaderList &headers, bool end_stream);
+
+        // Blocks while the connection or stream flow-control window is exhausted. False once
+        // the stream is reset or the connection is gone.
+        bool sendData(std::uint32_t stream_id, const char *data, std::size_t size, bool end_stream);
+
+        void resetStream(std::uint32_t stream_id, H2Error error);
+    };
+
+    // Turns the HTTP/1.1 response bytes the proxy produces for a stream into HEADERS and
+    // DATA frames: hop-by-hop headers are dropped, names lowercased and chunked bodies
+    // de-chunked.
+    class H2ResponseTranslator
+    {
+    private:
+        enum class state
+        {
+            Head,
+            Body,
+            ChunkSize,
+            ChunkData,
+            ChunkDataEnd,
+            Trailer,
+            UntilClose,
+            Done,
+            Failed
+        };
+
+        static constexpr std::size_t MAX_HEAD = 64 * 1024;
+
+        Http2Session &session;
+        std::uint32_t stream_id;
+        bool head_request;
+        state current = state::Head;
+        std::string buffer;
+        std::uint64_t remaining = 0;
+        bool started = false;
+
+        bool sendHead(std::string_view head, bool &interim);
+        bool feedBody(const char *data, std::size_t size);
+
+    public:
+        H2ResponseTranslator(Http2Session &session, std::uint32_t stream_id, bool head_request);
+
+        bool feed(const char *data, std::size_t size);
+
+        // The response is over: ends the stream, or resets it when the body was cut short.
+        void finish();
+    };
+
+    // A prior-knowledge h2c connection to an origin, shared by every proxy thread fetching
+    // from it: each fetch() is one stream, and a reader thread sorts incoming frames back to
+    // the fetches waiting on them. Responses come out as HTTP/1.1 bytes (chunked when the
+    // origin sends no content-length), so the cache and client paths see what they always do.
+    class H2UpstreamSession : private H2Transport
+    {
+    public:
+        enum class FetchResult
+        {
+            Unavailable, // the origin never processed the stream; safe to retry elsewhere
+            Complete,
+            Broken,     // failed after the request went out or part of the response was sent on
+            SinkRefused // the sink returned false
+        };
+
+        using Sink = std::function<bool(const char *data, std::size_t size)>;
+
+    private:
+        struct event
+        {
+            enum class kind
+            {
+                Headers,
+                Data,
+                End,
+                Reset
+            };
+
+            kind type;
+            HeaderList headers;
+            std::string data;
+            bool refused = false;
+        };
+
+        struct stream_state
+        {
+            std::deque<event> events;
+            std::int64_t send_window;
+            bool got_headers = false;
+            bool ended = false;
+        };
+
+        std::string authority;
+        HpackDecoder decoder;
+        std::thread reader;
+
+        // Guards everything below.
+        std::mutex state_mutex;
+        std::condition_variable state_changed;
+        std::map<std::uint32_t, std::shared_ptr<stream_state>> streams;
+        std::int64_t connection_send_window = 65535;
+        std::int64_t peer_initial_window = 65535;
+        std::uint32_t peer_max_frame = 16384;
+        std::uint32_t peer_max_streams;
+        std::uint32_t next_stream_id = 1;
+        std::uint32_t continuation_stream = 0;
+        std::string header_block;
+        bool header_end_stream = false;
+        std::size_t opening = 0;
+        std::uint64_t streams_opened = 0;
+        bool draining = false;
+        bool closed = false;
+
+        void readLoop();
+
+        // Reader thread, state_mutex held; false is a connection error.
+        bool handleFrame(const H2FrameHeader &frame, const std::uint8_t *payload, H2Error &error);
+        bool completeHeaders(std::uint32_t stream_id, bool end_stream, H2Error &error);
+        void post(const std::shared_ptr<stream_state> &stream, event item);
+
+        std::uint32_t openStream(const HeaderList &headers, bool end_stream, std::shared_ptr<stream_state> &stream);
+        bool sendBody(std::uint32_t stream_id, const std::shared_ptr<stream_state> &stream, const char *data, std::size_t size);
+
+    public:
+        // socket is connected and owned by the session from here on.
+        H2UpstreamSession(socket_t socket, std::string authority);
+        ~H2UpstreamSession();
+
+        H2UpstreamSession(const H2UpstreamSession &) = delete;
+        H2UpstreamSession &operator=(const H2UpstreamSession &) = delete;
+
+        // Sends the preface and SETTINGS and starts the reader thread.
+        bool start();
+
+        // Still open and accepting new streams.
+        bool usable();
+
+        std::size_t activeStreams();
+        std::uint64_t streamsOpened();
+        const std::string &origin() const { return authority; }
+
+        // One request/response exchange on a new stream. headers carry the pseudo-headers
+        // first; a non-empty body is sent as DATA. Blocks until the response has been handed
+        // to sink in full or the stream fails.
+        FetchResult fetch(const HeaderList &headers, const char *body, std::size_t body_size, bool head_request, const Sink &sink);
+    };
+
+    struct H2UpstreamStats
+    {
+        std::string origin;
+        std::size_t active_streams;
+        std::uint64_t streams;
+    };
+
+    // One shared session per origin "host:port", replaced once the origin closes or drains it.
+    class H2UpstreamPool
+    {
+    private:
+        std::mutex mutex;
+        std::map<std::string, std::shared_ptr<H2UpstreamSession>> sessions;
+
+    public:
+        // dial connects to the origin, returning INVALID_SOCKET on failure. Connects happen
+        // outside the pool lock; if two threads race, the loser's session is dropped.
+        using Dialer = std::function<socket_t()>;
+
+        std::shared_ptr<H2UpstreamSession> acquire(const std::string &origin, const Dialer &dial);
+
+        std::vector<H2UpstreamStats> stats();
+    };
+}
@@ -9,12 +9,25 @@
 
 #include "proxy_handler.hpp"
 #include "proxy_cache.hpp"
+#include "proxy_framing.hpp"
+#include "proxy_headers.hpp"
+#include "proxy_relay.hpp"
+#include "proxy_h2.hpp"
 #include "proxy_logger.hpp"
 
 constexpr size_t MAX_HEADER_SIZE = 8192;
-constexpr size_t HTTPS_RECV_BUFFER_SIZE = 8192;
 constexpr size_t HTTP_RECV_BUFFER_SIZE = 4096;
 
+constexpr auto TUNNEL_IDLE_TIMEOUT = std::chrono::seconds(100);
+
+// Request bodies for h2c pools are collected before the stream opens; larger ones get a 413.
+constexpr std::size_t H2_UPSTREAM_MAX_BODY = 16 * 1024 * 1024;
+
+constexpr std::string_view HTTP_CONTINUE = "HTTP/1.1 100 Continue\r\n\r\n";
+
+// client_id of prefetch requests in the log; real clients are numbered by socket.
+constexpr int PREFETCH_CLIENT_ID = -1;
+
 constexpr std::string_view HTTP_END = "\r\n";
 constexpr std::string_view HEADER_END = "\r\n\r\n";
 
@@ -44,7 +57,60 @@ void ProxyHandler::sendHttpError(const socket_t &client_socket, int status_code,
     }
 }
 
-std::string ProxyHandler::parseRequestTarget(const std::vector<char> &request)
+void ProxyHandler::sendHttpError(const proxy_cluster::ResponseWriter &writer, int status_code, const std::string &message)
+{
+    std::string body = "<html><body><h1>" + std::to_string(status_code) + " " + message + "</h1></body></html>";
+    std::string response = "HTTP/1.1 " + std::to_string(status_code) + " " + message + "\r\n" +
+                           "Content-Type: text/html\r\n" +
+                           "Content-Length: " + std::to_string(body.length()) + "\r\n" +
+                           "Connection: close\r\n\r\n" +
+                           body;
+
+    if (!writer.write(response.data(), response.size()))
+        log<LogLevel::Error, LogSubsystem::Client>("Failed to send error response: {}\n", getSocketError());
+}
+
+std::string_view ProxyHandler::parseRequestMethod(const std::vector<char> &request)
+{
+    auto first_space = std::find(request.begin(), request.end(), ' ');
+    if (first_space == request.end())
+        return {};
+    return std::string_view(request.data(), first_space - request.begin());
+}
+
+bool ProxyHandler::isForwardedMethod(std::string_view method)
+{
+    constexpr std::string_view METHODS[] = {"GET", "HEAD", "POST", "PUT", "PATCH", "DELETE", "OPTIONS", "TRACE"};
+    return std::find(std::begin(METHODS), std::end(METHODS), method) != std::end(METHODS);
+}
+
+bool ProxyHandler::isUnsafeMethod(std::string_view method)
+{
+    return method != "GET" && method != "HEAD" && method != "OPTIONS" && method != "TRACE";
+}
+
+std::size_t ProxyHandler::responseHeadSize(const std::vector<char> &response)
+{
+    auto header_end = std::search(response.begin(), response.end(), HEADER_END.begin(), HEADER_END.end());
+    if (header_end == response.end())
+        return response.size();
+    return header_end - response.begin() + HEADER_END.size();
+}
+
+bool ProxyHandler::sendAll(socket_t s, const char *data, std::size_t size)
+{
+    std::size_t sent = 0;
+    while (sent < size)
+    {
+        int n = send(s, data + sent, (int)(size - sent), 0);
+        if (n == SOCKET_ERROR || n == 0)
+            return false;
+        sent += n;
+    }
+    return true;
+}
+
+std::string_view ProxyHandler::parseRequestTarget(const std::vector<char> &request)
 {
     auto first_space = std::find(request.begin(), request.end(), ' ');
     if (first_space == request.end())
@@ -57,31 +123,31 @@ std::string ProxyHandler::parseRequestTarget(const std::vector<char> &request)
     auto target_end = std::find(target_start, request.end(), ' ');
     if (target_end == request.end())
         return {};
-    return std::string(target_start, target_end);
+    return std::string_view(&*target_start, target_end - target_start);
 }
 
-bool ProxyHandler::parseHttpUrl(const std::string &url, HttpRequestPart &request_Part)
+bool ProxyHandler::parseHttpUrl(std::string_view url, HttpRequestPart &request_Part)
 {
     if (url.empty())
     {
-        log("WARN|HTTP|Empty URL provided for parsing.\n");
+        log<LogLevel::Warn, LogSubsystem::Client>("Empty URL provided for parsing.\n");
         return false;
     }
 
-    std::string protocol_delimiter = "://";
+    std::string_view protocol_delimiter = "://";
     size_t protocol_pos = url.find(protocol_delimiter);
-    if (protocol_pos == std::string::npos)
+    if (protocol_pos == std::string_view::npos)
     {
-        log("WARN|HTTP|Malformed URL: Missing protocol delimiter.\n");
+        log<LogLevel::Warn, LogSubsystem::Client>("Malformed URL: Missing protocol delimiter.\n");
         return false;
     }
 
     size_t host_start = protocol_pos + protocol_delimiter.length();
     size_t path_start = url.find("/", host_start);
 
-    std::string authority_segment;
+    std::string_view authority_segment;
 
-    if (path_start == std::string::npos)
+    if (path_start == std::string_view::npos)
     {
         authority_segment = url.substr(host_start);
         request_Part.path = "/";
@@ -89,14 +155,14 @@ bool ProxyHandler::parseHttpUrl(const std::string &url, HttpRequestPart &request
     else
     {
         authority_segment = url.substr(host_start, path_start - host_start);
-        request_Part.path = url.substr(path_start);
+        request_Part.path = std::string(url.substr(path_start));
     }
 
     size_t port_pos = authority_segment.rfind(":");
-    if (port_pos != std::string::npos)
+    if (port_pos != std::string_view::npos)
     {
-        request_Part.host = authority_segment.substr(0, port_pos);
-        std::string port_str = authority_segment.substr(port_pos + 1);
+        request_Part.host = std::string(authority_segment.substr(0, port_pos));
+        std::string port_str = std::string(authority_segment.substr(port_pos + 1));
 
         if (port_str.empty())
             return false;
@@ -122,12 +188,39 @@ bool ProxyHandler::parseHttpUrl(const std::string &url, HttpRequestPart &request
     }
     else
     {
-        request_Part.host = authority_segment;
-        request_Part.port = "80";
+        request_Part.host = std::string(authority_segment);
+        request_Part.port = url.starts_with("https://") ? "443" : "80";
     }
     return true;
 }
 
+std::string_view ProxyHandler::findHeader(const std::vector<char> &request, std::string_view name)
+{
+    auto header_end = std::search(request.begin(), request.end(), HEADER_END.begin(), HEADER_END.end());
+    auto line_start = std::search(request.begin(), header_end, HTTP_END.begin(), HTTP_END.end());
+
+    while (line_start != header_end)
+    {
+        line_start += HTTP_END.size();
+        auto line_end = std::search(line_start, header_end, HTTP_END.begin(), HTTP_END.end());
+
+        std::string_view line(&*line_start, line_end - line_start);
+        if (line.size() > name.size() && line[name.size()] == ':' &&
+            std::equal(name.begin(), name.end(), line.begin(), [](char a, char b)
+                       { return std::tolower(static_cast<unsigned char>(a)) == std::tolower(static_cast<unsigned char>(b)); }))
+        {
+            std::string_view value = line.substr(name.size() + 1);
+            while (!value.empty() && (value.front() == ' ' || value.front() == '\t'))
+                value.remove_prefix(1);
+            while (!value.empty() && (value.back() == ' ' || value.back() == '\t'))
+                value.remove_suffix(1);
+            return value;
+        }
+        line_start = line_end;
+    }
+    return {};
+}
+
 bool ProxyHandler::isMethod(const std::vector<char> &request_buffer, const std::string &method)
 {
     const int method_length = method.length();
@@ -143,12 +236,77 @@ bool ProxyHandler::isMethod(const std::vector<char> &request_buffer, const std::
     return true;
 }
 
-socket_t ProxyHandler::connectToRemoteHost(const std::string &host, const std::string &port)
+int ProxyHandler::parseStatusCode(const std::vector<char> &response)
+{
+    // "HTTP/1.x NNN ..."
+    constexpr std::size_t STATUS_OFFSET = 9;
+    if (response.size() < STATUS_OFFSET + 3 || !isMethod(response, "HTTP/"))
+        return 0;
+
+    int status_code = 0;
+    for (std::size_t i = STATUS_OFFSET; i < STATUS_OFFSET + 3; ++i)
+    {
+        if (!isdigit(static_cast<unsigned char>(response[i])))
+            return 0;
+        status_code = status_code * 10 + (response[i] - '0');
+    }
+    return status_code;
+}
+
+bool ProxyHandler::hasCacheDirective(const std::vector<char> &message, std::string_view directive)
+{
+    // Only the Cache-Control value counts: the request line ("/only-if-cached.js") and other
+    // headers (a cookie saying "no-store") must not match.
+    return proxy_http::hasListToken(findHeader(message, "Cache-Control"), directive);
+}
+
+bool ProxyHandler::isUpgradeRequest(const std::vector<char> &request)
 {
+    if (findHeader(request, "Upgrade").empty())
+        return false;
+
+    std::string_view connection = findHeader(request, "Connection");
+    constexpr std::string_view token = "upgrade";
+    return std::search(connection.begin(), connection.end(), token.begin(), token.end(), [](char a, char b)
+                       { return std::tolower(static_cast<unsigned char>(a)) == b; }) != connection.end();
+}
+
+bool ProxyHandler::hasNoStore(const std::vector<char> &response)
+{
+    return hasCacheDirective(response, "no-store");
+}
+
+bool ProxyHandler::expectsContinue(const std::vector<char> &request)
+{
+    std::string_view expect = findHeader(request, "Expect");
+    return expect.size() == 12 && std::equal(expect.begin(), expect.end(), "100-continue", [](char a, char b)
+                                             { return std::tolower(static_cast<unsigned char>(a)) == b; });
+}
+
+std::string ProxyHandler::clientAddress(const proxy_cluster::ResponseWriter &writer)
+{
+    return writer.client_address.empty() ? proxy_http::peerAddress(writer.socket) : std::string(writer.client_address);
+}
+
+socket_t ProxyHandler::connectToRemoteHost(const std::string &host, const std::string &port, proxy_cache::NegativeCache &negative_cache, int &failure_status)
+{
+    std::string dns_key = proxy_cache::NegativeCache::hostKey(host);
+    std::string endpoint_key = proxy_cache::NegativeCache::endpointKey(host, port);
+
+    proxy_cache::NegativeEntry negative;
+    if (negative_cache.find(dns_key, negative) || negative_cache.find(endpoint_key, negative))
+    {
+        log<LogLevel::Info, LogSubsystem::Cache>("NEGATIVE_HIT|{}:{} recently failed, not retrying.\n", host, port);
+        failure_status = negative.status_code;
+        return INVALID_SOCKET;
+    }
+
+    failure_status = 502;
+
     socket_t remote_server_socket = socket(AF_INET, SOCK_STREAM, IPPROTO_TCP);
     if (remote_server_socket == INVALID_SOCKET)
     {
-        log("ERROR|REMOTE|Failed to create socket for remote host {}:{}\n", host, port);
+        log<LogLevel::Error, LogSubsystem::Remote>("Failed to create socket for remote host {}:{}\n", host, port);
         return INVALID_SOCKET;
     }
 
@@ -159,18 +317,34 @@ socket_t ProxyHandler::connectToRemoteHost(const std::string &host, const std::s
     hints.ai_socktype = SOCK_STREAM;
     hints.ai_protocol = IPPROTO_TCP;
 
-    if (getaddrinfo(host.c_str(), port.c_str(), &hints, &result) != 0)
+    int resolve_error = getaddrinfo(host.c_str(), port.c_str(), &hints, &result);
+    if (resolve_error != 0)
     {
-        log("ERROR|REMOTE|Failed to resolve host: {}\n", host);
+        log<LogLevel::Error, LogSubsystem::Remote>("Failed to resolve host: {}\n", host);
         closeSocket(remote_server_socket);
+
+        // Temporary resolver trouble (EAI_AGAIN) is not an answer about the name.
+        if (resolve_error != EAI_AGAIN)
+            negative_cache.store(dns_key, proxy_cache::NegativeEntry{proxy_cache::NegativeKind::DnsFailure, 502, {}});
         return INVALID_SOCKET;
     }
 
     if (connect(remote_server_socket, result->ai_addr, (int)result->ai_addrlen) == SOCKET_ERROR)
     {
-        log("ERROR|REMOTE|Failed to connect to remote host {}:{}\n", host, port);
+        int connect_error = getSocketError();
+#ifdef _WIN32
+        bool timed_out = connect_error == WSAETIMEDOUT;
+#else
+        // With SO_SNDTIMEO set, a connect that runs out of time reports EINPROGRESS.
+        bool timed_out = connect_error == ETIMEDOUT || connect_error == EINPROGRESS || connect_error == EAGAIN;
+#endif
+        failure_status = timed_out ? 504 : 502;
+
+        log<LogLevel::Error, LogSubsystem::Remote>("Failed to connect to remote host {}:{} ({})\n", host, port, connect_error);
         freeaddrinfo(result);
         closeSocket(remote_server_socket);
+
+        negative_cache.store(endpoint_key, proxy_cache::NegativeEntry{proxy_cache::NegativeKind::ConnectFailure, failure_status, {}});
         return INVALID_SOCKET;
     }
 
@@ -178,354 +352,949 @@ socket_t ProxyHandler::connectToRemoteHost(const std::string &host, const std::s
     return remote_server_socket;
 }
 
-void ProxyHandler::handleClient(const socket_t client_socket, proxy_cache::Cache &cache_system, std::counting_semaphore<INT_MAX> &connection_semaphore)
+socket_t ProxyHandler::connectViaParent(proxy_routing::ParentGroup &parent, const std::string &host, const std::string &port, proxy_cache::NegativeCache &negative_cache, int &failure_status, int client_id)
 {
-    SemaphoreGuard guard(connection_semaphore);
-    SocketGuard socket_guard(client_socket);
+    proxy_routing::BackendSet &servers = parent.backends();
+    const std::string authority = host + ":" + port;
+    const std::string connect_request = "CONNECT " + authority + " HTTP/1.1\r\nHost: " + authority + "\r\n\r\n";
+    std::uint64_t target_hash = proxy_cache::hashCacheKey(authority);
 
-    setSocketTimeout(client_socket, 30);
+    failure_status = 502;
+    std::size_t avoid = proxy_routing::BackendSet::NO_BACKEND;
 
-    const int client_id = (int)client_socket;
+    for (std::size_t attempt = 0; attempt < std::min<std::size_t>(servers.size(), 2); ++attempt)
+    {
+        proxy_routing::UpstreamLease lease = servers.acquire(target_hash, avoid);
+        const proxy_routing::Backend &server = lease.backend();
+        avoid = lease.backendIndex();
 
-    std::vector<char> request_buffer;
+        // An idle keep-alive link becomes the tunnel, saving the handshake to the parent. If
+        // it turns out to be stale, fall back to a fresh connection to the same parent.
+        socket_t s = parent.takeIdle(lease.backendIndex());
+        bool reused = s != INVALID_SOCKET;
+        std::vector<char> response;
+
+        for (int dial = 0; dial < 2 && response.empty(); ++dial)
+        {
+            if (s == INVALID_SOCKET)
+            {
+                reused = false;
+                s = connectToRemoteHost(server.host, server.port, negative_cache, failure_status);
+                if (s == INVALID_SOCKET)
+                    break;
+            }
+
+            if (send(s, connect_request.data(), connect_request.size(), 0) == SOCKET_ERROR || !readRequestHead(s, response, client_id))
+            {
+                closeSocket(s);
+                s = INVALID_SOCKET;
+                response.clear();
+                if (!reused)
+                    break;
+            }
+        }
+
+        if (s == INVALID_SOCKET)
+        {
+            lease.finish(false);
+            log<LogLevel::Warn, LogSubsystem::Remote>("{}|PARENT|Parent {}:{} unreachable for CONNECT {}\n", client_id, server.host, server.port, authority);
+            continue;
+        }
+
+        lease.firstByte();
+        int status_code = parseStatusCode(response);
+        if (status_code == 200)
+        {
+            lease.finish(true);
+            log<LogLevel::Info, LogSubsystem::Remote>("{}|PARENT|Tunnel to {} via {}:{}\n", client_id, authority, server.host, server.port);
+            return s;
+        }
+
+        // The parent answered, so it is healthy; the refusal is about this target.
+        lease.finish(status_code > 0 && status_code < 500);
+        closeSocket(s);
+        log<LogLevel::Warn, LogSubsystem::Remote>("{}|PARENT|Parent {}:{} refused CONNECT {} ({})\n", client_id, server.host, server.port, authority, status_code);
+        failure_status = status_code == 403 || status_code == 504 ? status_code : 502;
+        return INVALID_SOCKET;
+    }
+    return INVALID_SOCKET;
+}
+
+bool ProxyHandler::streamRequestBody(socket_t client_socket, socket_t remote_socket, const char *body_prefix, std::size_t prefix_size, proxy_http::MessageFramer &framer, bool expect_continue, int client_id)
+{
+    if (prefix_size > 0 && !sendAll(remote_socket, body_prefix, prefix_size))
+    {
+        log<LogLevel::Info, LogSubsystem::Remote>("{}|REMOTE|send() failed while forwarding the request body: {}\n", client_id, getSocketError());
+        return false;
+    }
+
+    // The client holds the body back until told to go ahead; the upstream already has the head.
+    if (expect_continue && !framer.complete() && !sendAll(client_socket, HTTP_CONTINUE.data(), HTTP_CONTINUE.size()))
+        return false;
+
+    std::size_t body_bytes = prefix_size;
     char temp_buffer[HTTP_RECV_BUFFER_SIZE];
 
-    int bytes_received = recv(client_socket, temp_buffer, HTTP_RECV_BUFFER_SIZE, 0);
+    while (!framer.complete())
+    {
+        int bytes_received = recv(client_socket, temp_buffer, HTTP_RECV_BUFFER_SIZE, 0);
+        if (bytes_received <= 0)
+        {
+            log<LogLevel::Info, LogSubsystem::Client>("{}|Client disconnected while sending the request body.\n", client_id);
+            return false;
+        }
 
-    if (bytes_received <= 0)
+        // Anything past the end of the body would be a pipelined request; it is not forwarded.
+        std::size_t used = framer.feed(temp_buffer, bytes_received);
+        if (framer.failed())
+        {
+            log<LogLevel::Warn, LogSubsystem::Client>("{}|HTTP|Malformed chunked request body.\n", client_id);
+            return false;
+        }
+
+        if (!sendAll(remote_socket, temp_buffer, used))
+        {
+            log<LogLevel::Info, LogSubsystem::Remote>("{}|REMOTE|send() failed while forwarding the request body: {}\n", client_id, getSocketError());
+            return false;
+        }
+        body_bytes += used;
+    }
+
+    log<LogLevel::Debug, LogSubsystem::Remote>("{}|REMOTE|Streamed {} request body bytes.\n", client_id, body_bytes);
+    return true;
+}
+
+bool ProxyHandler::readRequestHead(socket_t client_socket, std::vector<char> &request_buffer, int client_id)
+{
+    char temp_buffer[HTTP_RECV_BUFFER_SIZE];
+
+    while (true)
     {
-        log("INFO|CLIENT|{}|Client disconnected immediately or timed out.\n", client_id);
-        return;
+        auto it = std::search(request_buffer.begin(), request_buffer.end(), HEADER_END.begin(), HEADER_END.end());
+
+        if (it != request_buffer.end())
+            return true;
+
+        if (request_buffer.size() >= MAX_HEADER_SIZE)
+        {
+            log<LogLevel::Warn, LogSubsystem::Client>("{}|HTTP|Header too large.\n", client_id);
+            return false;
+        }
+
+        int bytes_received = recv(client_socket, temp_buffer, HTTP_RECV_BUFFER_SIZE, 0);
+
+        if (bytes_received <= 0)
+        {
+            log<LogLevel::Info, LogSubsystem::Client>("{}|Client disconnected while receiving HTTP headers.\n", client_id);
+            return false;
+        }
+        request_buffer.insert(request_buffer.end(), temp_buffer, temp_buffer + bytes_received);
     }
+}
 
-    request_buffer.insert(request_buffer.end(), temp_buffer, temp_buffer + bytes_received);
-    int total_bytes_received = bytes_received;
+void ProxyHandler::serveRequest(const proxy_cluster::ResponseWriter &writer, ProxyContext &context, const std::vector<char> &request_buffer, int client_id, bool allow_peer_forward)
+{
+    proxy_cache::Cache &cache_system = context.cache_system;
+    proxy_cache::NegativeCache &negative_cache = context.negative_cache;
 
-    if (isMethod(request_buffer, "CONNECT ")) // HTTPS CONNECT Section
+    const std::string_view method = parseRequestMethod(request_buffer);
+    const bool is_get = method == "GET";
+    const bool is_head = method == "HEAD";
+    // Peer links and HTTP/2 streams carry framed responses, so they cannot become a tunnel.
+    const bool is_upgrade = is_get && !writer.peer_framed && !writer.sink && isUpgradeRequest(request_buffer);
+    const bool from_cache = (is_get || is_head) && !is_upgrade;
+
+    // Absolute-form (forward proxy):  GET http://example.com:port/path HTTP/1.1
+    // Origin-form (reverse proxy):    GET /path HTTP/1.1 plus a Host header; the URL is
+    // rebuilt from Host so both forms share cache keys.
+
+    std::string_view target = parseRequestTarget(request_buffer);
+
+    if (target.empty())
     {
-        log("INFO|CLIENT|{}|HTTP CONNECT request received.\n", client_id);
+        log<LogLevel::Warn, LogSubsystem::Client>("{}|HTTP|Malformed HTTP request.\n", client_id);
+        return;
+    }
 
-        std::string host;
-        std::string port = "443";
+    const bool origin_form = target.front() == '/';
+    std::string_view url = target;
+    std::string_view host_header;
+    std::string origin_url;
 
-        std::string url = parseRequestTarget(request_buffer);
-        if (url.empty())
+    if (origin_form)
+    {
+        host_header = findHeader(request_buffer, "Host");
+        if (host_header.empty() || host_header.find_first_of("/@ \t") != std::string_view::npos)
         {
-            log("WARN|CLIENT|{}|HTTPS|Malformed HTTPS request.\n", client_id);
+            log<LogLevel::Warn, LogSubsystem::Client>("{}|HTTP|Origin-form request without a usable Host header.\n", client_id);
+            sendHttpError(writer, 400, "Bad Request");
             return;
         }
 
-        size_t port_pos = url.rfind(":");
-        if (port_pos != std::string::npos)
+        origin_url.reserve(7 + host_header.size() + target.size());
+        origin_url.append("http://").append(host_header).append(target);
+        url = origin_url;
+    }
+
+    log<LogLevel::Info, LogSubsystem::Client>("{}|HTTP|Request URL: {}\n", client_id, url);
+
+    // Canonical key: only allocates when the URL needs rewriting.
+    std::string key_scratch;
+    proxy_cache::CacheKey cache_key = proxy_cache::makeCacheKey(proxy_cache::normalizeCacheKey(url, cache_system.keyRules(), key_scratch));
+
+    // HEAD is answered from the stored response's head; other methods always go upstream.
+    std::vector<char> cached_response;
+    if (from_cache)
+        cached_response = cache_system.cacheFind(cache_key);
+
+    if (!cached_response.empty())
+    {
+        log<LogLevel::Info, LogSubsystem::Cache>("{}|CACHE_HIT|{} {}\n", client_id, method, url);
+        writer.write(cached_response.data(), is_head ? responseHeadSize(cached_response) : cached_response.size());
+    }
+    else
+    {
+        proxy_cache::NegativeEntry negative;
+        if (from_cache && negative_cache.find(cache_key.key, negative))
         {
-            host = url.substr(0, port_pos);
-            port = url.substr(port_pos + 1);
+            log<LogLevel::Info, LogSubsystem::Cache>("{}|NEGATIVE_HIT|{} ({})\n", client_id, url, negative.status_code);
+            writer.write(negative.response.data(), is_head ? responseHeadSize(negative.response) : negative.response.size());
+            return;
         }
-        else
-            host = url.substr(0);
 
-        log("INFO|CLIENT|{}|CONNECT|CONNECT target {}:{}\n", client_id, host, port);
+        if (from_cache)
+            log<LogLevel::Info, LogSubsystem::Cache>("{}|CACHE_MISS|{}\n", client_id, url);
 
-        socket_t remote_server_socket = connectToRemoteHost(host, port);
+        // Sibling fetches carry this, and clients may send it too: a miss must not reach origin.
+        if (from_cache && hasCacheDirective(request_buffer, "only-if-cached"))
+        {
+            sendHttpError(writer, 504, "Gateway Timeout");
+            return;
+        }
 
-        SocketGuard remote_socket_guard(remote_server_socket);
+        if (from_cache && is_get && allow_peer_forward && context.cluster.enabled())
+        {
+            if (context.cluster.mode() == proxy_cluster::ClusterMode::Siblings)
+            {
+                if (serveFromSibling(writer, context, request_buffer, cache_key, client_id))
+                    return;
+            }
+            else
+            {
+                std::size_t owner = context.cluster.ownerOf(cache_key.hash);
+                if (!context.cluster.isSelf(owner))
+                {
+                    if (context.cluster.forward(owner, request_buffer, writer, client_id))
+                        return;
+                    log<LogLevel::Info, LogSubsystem::Cache>("{}|CLUSTER|Owner {} unavailable, fetching locally.\n", client_id, context.cluster.peerAddress(owner));
+                }
+            }
+        }
 
-        if (remote_server_socket == INVALID_SOCKET)
+        // The request body is streamed from the client as it arrives, never buffered whole.
+        proxy_http::MessageFramer request_framer(proxy_http::MessageFramer::Kind::Request);
+        std::size_t request_consumed = request_framer.feed(request_buffer.data(), request_buffer.size());
+        const std::size_t head_end = std::search(request_buffer.begin(), request_buffer.end(), HEADER_END.begin(), HEADER_END.end()) - request_buffer.begin() + HEADER_END.size();
+        // A short body can arrive whole with the head; it still has to be sent on.
+        const bool has_body = !request_framer.complete() || request_consumed > head_end;
+
+        if (request_framer.failed())
         {
-            log("ERROR|CLIENT|{}|CONNECT|Failed to connect to {}\n", client_id, host);
+            log<LogLevel::Warn, LogSubsystem::Client>("{}|HTTP|Unparseable request framing.\n", client_id);
+            sendHttpError(writer, 400, "Bad Request");
             return;
         }
 
-        std::string rebuilt = "HTTP/1.1 200 OK \r\n\r\n";
+        HttpRequestPart request_Part;
 
-        int sent_rebuilt = 0;
-        while (sent_rebuilt < rebuilt.size())
+        if (!parseHttpUrl(url, request_Part))
         {
-            int len = send(client_socket, rebuilt.data() + sent_rebuilt, rebuilt.size() - sent_rebuilt, 0);
-            sent_rebuilt += len;
+            log<LogLevel::Warn, LogSubsystem::Client>("{}|HTTP|Failed to parse HTTP request.\n", client_id);
+            return;
         }
 
-        log("INFO|CLIENT|{}|CONNECT|Tunnel established to {}:{}\n", client_id, host, port);
+        // Host names are case-insensitive; route rules are stored lowercase.
+        std::transform(request_Part.host.begin(), request_Part.host.end(), request_Part.host.begin(), [](unsigned char c)
+                       { return static_cast<char>(std::tolower(c)); });
+        if (!origin_form)
+            host_header = request_Part.host;
 
-        fd_set read_fds;
+        // https:// URLs only come out of intercepted CONNECTs; the origin leg is TLS and
+        // bypasses routes and parents.
+        const bool https = url.starts_with("https://");
+        if (https && !context.interceptor.intercepts(request_Part.host))
+        {
+            log<LogLevel::Warn, LogSubsystem::Connect>("{}|TLS|{} is not an intercepted host, refusing {}\n", client_id, request_Part.host, url);
+            sendHttpError(writer, 403, "Forbidden");
+            return;
+        }
 
-        char tunnel_buffer[HTTPS_RECV_BUFFER_SIZE];
+        proxy_routing::Backend backend{request_Part.host, request_Part.port};
+        std::string_view pool_name;
+        proxy_routing::UpstreamLease lease;
+        proxy_routing::UpstreamProtocol protocol = proxy_routing::UpstreamProtocol::Http1;
+        proxy_routing::BackendSet *pool = https ? nullptr : context.router.route(request_Part.host, request_Part.path, pool_name, &protocol);
+        proxy_routing::ParentGroup *parent = nullptr;
 
-        size_t tunnel_bytes = 0;
-        while (true)
+        if (pool)
         {
-            struct timeval select_timeout;
-            select_timeout.tv_sec = 100;
-            select_timeout.tv_usec = 0;
+            // The cache key hash doubles as the consistent-hash key, so a URL sticks to one backend.
+            lease = pool->acquire(cache_key.hash);
+            backend = lease.backend();
+            log<LogLevel::Info, LogSubsystem::Remote>("{}|ROUTE|{}{} -> pool {} ({}:{})\n", client_id, request_Part.host, request_Part.path, pool_name, backend.host, backend.port);
 
-            FD_ZERO(&read_fds);
-
-            FD_SET(client_socket, &read_fds);
-            FD_SET(remote_server_socket, &read_fds);
+            // HTTP/2 has no Upgrade mechanism; those requests keep to HTTP/1.1.
+            if (protocol == proxy_routing::UpstreamProtocol::H2c && !is_upgrade)
+            {
+                serveOverH2(writer, context, request_buffer, head_end, request_consumed, request_framer, url, request_Part, host_header, cache_key, *pool, lease, client_id);
+                return;
+            }
+        }
+        else if (origin_form)
+        {
+            log<LogLevel::Warn, LogSubsystem::Remote>("{}|ROUTE|No route for {}{}\n", client_id, request_Part.host, request_Part.path);
+            sendHttpError(writer, 404, "Not Found");
+            return;
+        }
+        else if (!https && !context.router.forwardProxy())
+        {
+            log<LogLevel::Warn, LogSubsystem::Remote>("{}|ROUTE|Forward proxying disabled, refusing {}\n", client_id, url);
+            sendHttpError(writer, 403, "Forbidden");
+            return;
+        }
+        else if (!https && (parent = context.router.parentFor(request_Part.host)))
+        {
+            // Parents are picked like pool backends, so URL affinity and failover come for free.
+            pool = &parent->backends();
+            lease = pool->acquire(cache_key.hash);
+            backend = lease.backend();
+            log<LogLevel::Info, LogSubsystem::Remote>("{}|PARENT|{} -> parent {} ({}:{})\n", client_id, request_Part.host, parent->name(), backend.host, backend.port);
+        }
 
-            socket_t max_socket_descriptor = (client_socket > remote_server_socket) ? client_socket : remote_server_socket;
+        log<LogLevel::Debug, LogSubsystem::Remote>("{}|REMOTE|Connecting to {}:{}\n", client_id, backend.host, backend.port);
 
-            int activity = select(max_socket_descriptor + 1, &read_fds, NULL, NULL, &select_timeout);
-            if (activity == SOCKET_ERROR)
+        int failure_status = 0;
+        bool reused = false;
+        auto dial = [&]()
+        {
+            reused = false;
+            if (parent)
             {
-                log("ERROR|CLIENT|{}|CONNECT|select() failed {}\n", client_id, getSocketError());
-                break;
+                socket_t idle = parent->takeIdle(lease.backendIndex());
+                if (idle != INVALID_SOCKET)
+                {
+                    reused = true;
+                    return idle;
+                }
             }
-            else if (activity == 0)
+            return connectToRemoteHost(backend.host, backend.port, negative_cache, failure_status);
+        };
+
+        socket_t remote_server_socket = dial();
+
+        // Nothing has been sent yet, so a failed connect can safely move to another backend once.
+        if (remote_server_socket == INVALID_SOCKET && lease)
+        {
+            std::size_t failed_backend = lease.backendIndex();
+            lease.finish(false);
+
+            if (pool->size() > 1)
             {
-                log("INFO|CLIENT|{}|CONNECT|Tunnel timed out for {}:{}\n", client_id, host, port);
-                break;
+                lease = pool->acquire(cache_key.hash, failed_backend);
+                backend = lease.backend();
+                log<LogLevel::Info, LogSubsystem::Remote>("{}|REMOTE|Retrying on {}:{}\n", client_id, backend.host, backend.port);
+                remote_server_socket = dial();
             }
+        }
+
+        if (remote_server_socket == INVALID_SOCKET)
+        {
+            log<LogLevel::Error, LogSubsystem::Remote>("{}|REMOTE|Failed to connect to remote host.\n", client_id);
+            lease.finish(false);
+            sendHttpError(writer, failure_status, failure_status == 504 ? "Gateway Timeout" : "Bad Gateway");
+            return;
+        }
+
+        SocketGuard remote_socket_guard(remote_server_socket);
+
+        log<LogLevel::Debug, LogSubsystem::Remote>("{}|REMOTE|Connected to {}:{}{}\n", client_id, backend.host, backend.port, reused ? " (pooled)" : "");
 
-            if (FD_ISSET(client_socket, &read_fds))
+        // From here on the channel's plaintext socket stands in for the TCP one; it is
+        // destroyed (and close_notify sent) before the guard closes the TCP socket.
+        std::unique_ptr<proxy_tls::TlsChannel> origin_tls;
+        if (https)
+        {
+            origin_tls = context.interceptor.connectOrigin(remote_server_socket, request_Part.host, request_Part.port);
+            if (!origin_tls)
             {
-                int len = recv(client_socket, tunnel_buffer, HTTPS_RECV_BUFFER_SIZE, 0);
+                lease.finish(false);
+                sendHttpError(writer, 502, "Bad Gateway");
+                return;
+            }
+            log<LogLevel::Info, LogSubsystem::Connect>("{}|TLS|Origin link to {} {}.\n", client_id, request_Part.host, origin_tls->offloaded() ? "on kTLS" : "bridged");
+            remote_server_socket = origin_tls->socket();
+        }
 
-                if (len <= 0)
-                    break;
+        // A parent gets the absolute URL and a keep-alive link; origins get origin-form.
+        // Upgrade is hop-by-hop, so an upgrade request re-sends it explicitly for this hop.
+        std::string connection_lines = is_upgrade ? "Connection: Upgrade\r\nUpgrade: " + std::string(findHeader(request_buffer, "Upgrade")) + "\r\n"
+                                       : parent   ? "Connection: keep-alive\r\n"
+                                                  : "Connection: close\r\n";
+        std::string rebuilt = std::string(method) + " " + (parent ? std::string(url) : request_Part.path) + " HTTP/1.1\r\n" +
+                              "Host: " + std::string(host_header) + "\r\n" + connection_lines;
 
-                int total_sent = 0;
-                while (total_sent < len)
-                {
-                    int send_data = send(remote_server_socket, tunnel_buffer + total_sent, len - total_sent, 0);
+        // Kept header lines are sent straight out of request_buffer; only the rebuilt lines
+        // and the header rewrites are new bytes.
+        proxy_http::RequestHead upstream_head;
+        upstream_head.build(std::move(rebuilt), request_buffer, context.header_rules, clientAddress(writer));
 
-                    if (send_data == SOCKET_ERROR)
-                        return;
+        log<LogLevel::Debug, LogSubsystem::Remote>("{}|REMOTE|Forwarding: {} {}\n", client_id, method, request_Part.path);
 
-                    total_sent += send_data;
-                    tunnel_bytes += send_data;
-                }
+
+        auto send_request = [&]()
+        {
+            return proxy_http::sendSegments(remote_server_socket, upstream_head.segments());
+        };
+
+        // A pooled parent link the parent has since closed fails before any response byte;
+        // that is not the parent's fault, so redial once without a health verdict.
+        auto redial = [&]()
+        {
+            log<LogLevel::Info, LogSubsystem::Remote>("{}|PARENT|Pooled link to {}:{} went stale, redialling.\n", client_id, backend.host, backend.port);
+            closeSocket(remote_server_socket);
+            reused = false;
+            remote_server_socket = connectToRemoteHost(backend.host, backend.port, negative_cache, failure_status);
+            remote_socket_guard.a_socket = remote_server_socket;
+            return remote_server_socket != INVALID_SOCKET && send_request();
+        };
+
+        if (!send_request() && !(reused && redial()))
+        {
+            log<LogLevel::Info, LogSubsystem::Remote>("{}|REMOTE|send() failed: {}\n", client_id, getSocketError());
+            lease.finish(false);
+            return;
+        }
+
+        if (has_body)
+        {
+            if (!streamRequestBody(writer.socket, remote_server_socket, request_buffer.data() + head_end, request_consumed - head_end, request_framer, expectsContinue(request_buffer), client_id))
+            {
+                lease.finish(true);
+                return;
             }
+        }
+
+        log<LogLevel::Debug, LogSubsystem::Remote>("{}|REMOTE|Awaiting response from {}:{}\n", client_id, backend.host, backend.port);
+
+        std::vector<char> server_response_data;
+        proxy_http::MessageFramer framer(proxy_http::MessageFramer::Kind::Response, is_head);
+        bool trailing_bytes = false;
 
-            if (FD_ISSET(remote_server_socket, &read_fds))
+        int total_bytes_received = 0;
+        bool status_logged = false;
+
+        // Stop at the end of the message rather than waiting for the close, which a keep-alive
+        // parent never sends. Unparseable responses are relayed until the close as before.
+        while (!framer.complete())
+        {
+            char temp_buffer[HTTP_RECV_BUFFER_SIZE];
+            int bytes_received = recv(remote_server_socket, temp_buffer, HTTP_RECV_BUFFER_SIZE, 0);
+
+            if (bytes_received <= 0)
             {
-                int len = recv(remote_server_socket, tunnel_buffer, HTTPS_RECV_BUFFER_SIZE, 0);
+                // Replaying is only possible while no body has been taken from the client.
+                if (total_bytes_received == 0 && reused && !has_body && redial())
+                    continue;
+                framer.finishOnClose();
+                break;
+            }
 
-                if (len <= 0)
-                    break;
+            if (!status_logged)
+            {
+                lease.firstByte();
+                // A view, so nothing is copied when Debug is compiled out or filtered.
+                std::string_view response(temp_buffer, bytes_received);
 
-                int total_sent = 0;
-                while (total_sent < len)
+                std::size_t pos = response.find("\r\n");
+                if (pos != std::string_view::npos)
                 {
-                    int send_data = send(client_socket, tunnel_buffer + total_sent, len - total_sent, 0);
+                    log<LogLevel::Debug, LogSubsystem::Remote>("{}|REMOTE|Response: {}\n", client_id, response.substr(0, pos));
+                    status_logged = true;
+                }
+            }
 
-                    if (send_data == SOCKET_ERROR)
-                        return;
+            if (!framer.failed() && framer.feed(temp_buffer, bytes_received) < static_cast<std::size_t>(bytes_received))
+                trailing_bytes = true;
 
-                    total_sent += send_data;
-                    tunnel_bytes += send_data;
-                }
+            if (!writer.write(temp_buffer, bytes_received))
+            {
+                log<LogLevel::Info, LogSubsystem::Remote>("{}|REMOTE|send() failed: {}\n", client_id, getSocketError());
+                return;
             }
+
+            total_bytes_received += bytes_received;
+
+            if (total_bytes_received <= proxy_cache::MAX_CACHE_BYTES)
+                server_response_data.insert(server_response_data.end(), temp_buffer, temp_buffer + bytes_received);
         }
 
-        log("INFO|CLIENT|{}|CONNECT|Tunnel to {}:{} closed. {} bytes relayed.\n",
+        log<LogLevel::Debug, LogSubsystem::Remote>("{}|REMOTE|Forwarded {} bytes to client.\n",
             client_id,
-            host,
-            port,
-            tunnel_bytes);
+            total_bytes_received);
+
+        // 101: both sides now speak the upgraded protocol; relay it like a CONNECT tunnel.
+        if (is_upgrade && framer.complete() && framer.statusCode() == 101)
+        {
+            lease.finish(true);
+
+            // Anything the client sent after its request head already belongs to the new protocol.
+            if (request_consumed < request_buffer.size() &&
+                !sendAll(remote_server_socket, request_buffer.data() + request_consumed, request_buffer.size() - request_consumed))
+                return;
+
+            log<LogLevel::Info, LogSubsystem::Remote>("{}|UPGRADE|Switched protocols to {} with {}:{}\n", client_id, findHeader(request_buffer, "Upgrade"), backend.host, backend.port);
+            proxy_http::TunnelResult tunnel = proxy_http::relayTunnel(writer.socket, remote_server_socket, TUNNEL_IDLE_TIMEOUT);
+            log<LogLevel::Info, LogSubsystem::Remote>("{}|UPGRADE|Upgraded connection to {}:{} closed. {} bytes relayed{}.\n",
+                client_id, backend.host, backend.port, tunnel.bytes, tunnel.timed_out ? " (idle timeout)" : "");
+            return;
+        }
+
+        if (parent && framer.reusable() && !trailing_bytes)
+        {
+            parent->putIdle(lease.backendIndex(), remote_server_socket);
+            remote_socket_guard.a_socket = INVALID_SOCKET;
+        }
+
+        int status_code = parseStatusCode(server_response_data);
+
+        // Passive health: no response or a 5xx counts against the backend.
+        lease.finish(status_code > 0 && status_code < 500);
+
+        storeResponse(context, method, url, cache_key, server_response_data, status_code, framer.complete() && total_bytes_received <= proxy_cache::MAX_CACHE_BYTES, client_id);
+        log<LogLevel::Debug, LogSubsystem::Remote>("{}|REMOTE|Connection to {} closed.\n", client_id, backend.host);
+    }
+}
+
+void ProxyHandler::storeResponse(ProxyContext &context, std::string_view method, std::string_view url, const proxy_cache::CacheKey &cache_key, std::vector<char> &response, int status_code, bool complete, int client_id)
+{
+    const bool is_get = method == "GET";
+
+    // A successful unsafe method may have changed the resource; drop what we hold for it.
+    // Only GET responses are stored: HEAD has no body to keep.
+    if (isUnsafeMethod(method) && status_code >= 200 && status_code < 400)
+    {
+        context.cache_system.cacheRemove(cache_key);
+        context.negative_cache.erase(cache_key.key);
+        log<LogLevel::Info, LogSubsystem::Cache>("{}|CACHE_INVALIDATE|{} after {}\n", client_id, url, method);
     }
-    else if (isMethod(request_buffer, "GET ")) // HTTP GET Section
+    else if (is_get && proxy_cache::NegativeCache::isCacheableStatus(status_code) && !hasNoStore(response))
     {
-        log("INFO|CLIENT|{}|HTTP Get request received.\n", client_id);
+        context.negative_cache.store(cache_key.key, proxy_cache::NegativeEntry{proxy_cache::NegativeKind::ErrorStatus, status_code, std::move(response)});
+        log<LogLevel::Info, LogSubsystem::Cache>("{}|NEGATIVE_STORE|{} ({})\n", client_id, url, status_code);
+    }
+    else if (is_get && status_code > 0 && status_code < 400 && complete)
+    {
+        // Subresources of prefetched responses are not chased further.
+        if (client_id != PREFETCH_CLIENT_ID)
+            context.prefetcher.pageStored(url, response);
+        context.cache_system.cacheAdd(cache_key.key, response);
+        log<LogLevel::Info, LogSubsystem::Cache>("{}|CACHE_STORE|{} ({} bytes)\n",
+            client_id,
+            url,
+            response.size());
+    }
+}
+
+void ProxyHandler::serveOverH2(const proxy_cluster::ResponseWriter &writer, ProxyContext &context, const std::vector<char> &request_buffer, std::size_t head_end, std::size_t request_consumed, proxy_http::MessageFramer &request_framer, std::string_view url, const HttpRequestPart &request_Part, std::string_view host_header, const proxy_cache::CacheKey &cache_key, proxy_routing::BackendSet &pool, proxy_routing::UpstreamLease &lease, int client_id)
+{
+    std::string_view method = parseRequestMethod(request_buffer);
 
-        while (true)
+    // DATA frames carry the body without chunked coding, so only a Content-Length body
+    // can be sent on; it is collected whole before the stream opens.
+    std::vector<char> body(request_buffer.begin() + head_end, request_buffer.begin() + request_consumed);
+    if (!request_framer.complete())
+    {
+        if (!findHeader(request_buffer, "Transfer-Encoding").empty())
         {
-            auto it = std::search(request_buffer.begin(), request_buffer.end(), HEADER_END.begin(), HEADER_END.end());
+            log<LogLevel::Warn, LogSubsystem::Client>("{}|H2|Chunked request body cannot be sent to an h2c pool.\n", client_id);
+            lease.finish(true);
+            sendHttpError(writer, 411, "Length Required");
+            return;
+        }
 
-            if (it != request_buffer.end())
-                break;
+        if (expectsContinue(request_buffer) && !sendAll(writer.socket, HTTP_CONTINUE.data(), HTTP_CONTINUE.size()))
+            return;
 
-            if (total_bytes_received >= MAX_HEADER_SIZE)
+        char temp_buffer[HTTP_RECV_BUFFER_SIZE];
+        while (!request_framer.complete())
+        {
+            if (body.size() > H2_UPSTREAM_MAX_BODY)
             {
-                log("WARN|CLIENT|{}|HTTP|Header too large.\n", client_id);
+                log<LogLevel::Warn, LogSubsystem::Client>("{}|H2|Request body over {} bytes.\n", client_id, H2_UPSTREAM_MAX_BODY);
+                lease.finish(true);
+                sendHttpError(writer, 413, "Content Too Large");
                 return;
             }
 
-            bytes_received = recv(client_socket, temp_buffer, HTTP_RECV_BUFFER_SIZE, 0);
-
+            int bytes_received = recv(writer.socket, temp_buffer, HTTP_RECV_BUFFER_SIZE, 0);
             if (bytes_received <= 0)
             {
-                log("INFO|CLIENT|{}|Client disconnected while receiving HTTP headers.\n", client_id);
+                log<LogLevel::Info, LogSubsystem::Client>("{}|Client disconnected while sending the request body.\n", client_id);
+                lease.finish(true);
                 return;
             }
-            request_buffer.insert(request_buffer.end(), temp_buffer, temp_buffer + bytes_received);
-            total_bytes_received += bytes_received;
+            std::size_t used = request_framer.feed(temp_buffer, bytes_received);
+            body.insert(body.end(), temp_buffer, temp_buffer + used);
         }
+    }
 
-        // Absolute-form only
-        // E.g. GET http://example.com::port/path HTTP/1.1
+    // The header rewrites apply exactly as on the HTTP/1.1 path; the result is then re-keyed
+    // as HTTP/2 fields behind the pseudo-headers.
+    proxy_http::RequestHead upstream_head;
+    upstream_head.build(std::string(method) + " " + request_Part.path + " HTTP/1.1\r\n", request_buffer, context.header_rules, clientAddress(writer));
 
-        std::string url = parseRequestTarget(request_buffer);
+    std::string head_text;
+    head_text.reserve(upstream_head.size());
+    for (const proxy_http::Segment &segment : upstream_head.segments())
+        head_text.append(segment.data, segment.size);
 
-        if (url.empty())
+    proxy_http::HeaderList headers{{":method", std::string(method)}, {":scheme", "http"}, {":authority", std::string(host_header)}, {":path", request_Part.path}};
+    proxy_http::appendHttp1Fields(head_text, headers);
+
+    std::vector<char> server_response_data;
+    std::size_t total_bytes_received = 0;
+    bool status_logged = false;
+
+    auto sink = [&](const char *data, std::size_t size)
+    {
+        if (!status_logged)
         {
-            log("WARN|CLIENT|{}|HTTP|Malformed HTTP request.\n", client_id);
-            return;
+            lease.firstByte();
+            std::string_view response(data, size);
+            log<LogLevel::Debug, LogSubsystem::Remote>("{}|REMOTE|Response: {}\n", client_id, response.substr(0, response.find("\r\n")));
+            status_logged = true;
+        }
+
+        if (!writer.write(data, size))
+        {
+            log<LogLevel::Info, LogSubsystem::Remote>("{}|REMOTE|send() failed: {}\n", client_id, getSocketError());
+            return false;
         }
 
-        log("INFO|CLIENT|{}|HTTP|Request URL: {}\n", client_id, url);
+        total_bytes_received += size;
+        if (total_bytes_received <= proxy_cache::MAX_CACHE_BYTES)
+            server_response_data.insert(server_response_data.end(), data, data + size);
+        return true;
+    };
 
-        std::vector<char> cached_response = cache_system.cacheFind(url);
+    int failure_status = 502;
+    proxy_routing::Backend backend = lease.backend();
+    auto dial = [&]()
+    {
+        return connectToRemoteHost(backend.host, backend.port, context.negative_cache, failure_status);
+    };
+
+    using FetchResult = proxy_http::H2UpstreamSession::FetchResult;
+    FetchResult result = FetchResult::Unavailable;
 
-        if (!cached_response.empty())
+    // One retry: on another backend after a failed connect, or on a fresh stream after the
+    // origin refused this one without processing it.
+    for (int attempt = 0; attempt < 2 && result == FetchResult::Unavailable; ++attempt)
+    {
+        std::shared_ptr<proxy_http::H2UpstreamSession> session = context.h2_upstreams.acquire(backend.host + ":" + backend.port, dial);
+        if (!session)
         {
-            log("INFO|CLIENT|{}|CACHE_HIT|{}\n", client_id, url);
-            send(client_socket, cached_response.data(), cached_response.size(), 0);
+            std::size_t failed_backend = lease.backendIndex();
+            lease.finish(false);
+            if (attempt > 0 || pool.size() < 2)
+                break;
+
+            lease = pool.acquire(cache_key.hash, failed_backend);
+            backend = lease.backend();
+            log<LogLevel::Info, LogSubsystem::Remote>("{}|REMOTE|Retrying on {}:{}\n", client_id, backend.host, backend.port);
+            continue;
         }
-        else
+
+        log<LogLevel::Debug, LogSubsystem::Remote>("{}|H2|Forwarding: {} {} as stream on {} ({} active)\n", client_id, method, request_Part.path, session->origin(), session->activeStreams());
+        result = session->fetch(headers, body.data(), body.size(), method == "HEAD", sink);
+    }
+
+    if (!status_logged)
+    {
+        log<LogLevel::Error, LogSubsystem::Remote>("{}|H2|No response from {}:{}.\n", client_id, backend.host, backend.port);
+        lease.finish(false);
+        sendHttpError(writer, failure_status, failure_status == 504 ? "Gateway Timeout" : "Bad Gateway");
+        return;
+    }
+
+    log<LogLevel::Debug, LogSubsystem::Remote>("{}|REMOTE|Forwarded {} bytes to client.\n", client_id, total_bytes_received);
+    if (result == FetchResult::SinkRefused)
+        return;
+
+    int status_code = parseStatusCode(server_response_data);
+    lease.finish(status_code > 0 && status_code < 500 && result == FetchResult::Complete);
+    storeResponse(context, method, url, cache_key, server_response_data, status_code, result == FetchResult::Complete && total_bytes_received <= proxy_cache::MAX_CACHE_BYTES, client_id);
+}
+
+bool ProxyHandler::serveFromSibling(const proxy_cluster::ResponseWriter &writer, ProxyContext &context, const std::vector<char> &request_buffer, const proxy_cache::CacheKey &cache_key, int client_id)
+{
+    std::size_t sibling = 0;
+    if (!context.cluster.probe(cache_key.key, cache_key.hash, sibling))
+        return false;
+
+    auto request_line_end = std::search(request_buffer.begin(), request_buffer.end(), HTTP_END.begin(), HTTP_END.end());
+    if (request_line_end == request_buffer.end())
+        return false;
+
+    // The sibling may have evicted the object since it answered; only-if-cached makes it say
+    // 504 instead of going to origin on our behalf.
+    constexpr std::string_view ONLY_IF_CACHED = "Cache-Control: only-if-cached\r\n";
+    std::vector<char> sibling_request(request_buffer.begin(), request_line_end + HTTP_END.size());
+    sibling_request.insert(sibling_request.end(), ONLY_IF_CACHED.begin(), ONLY_IF_CACHED.end());
+    sibling_request.insert(sibling_request.end(), request_line_end + HTTP_END.size(), request_buffer.end());
+
+    std::vector<char> response;
+    if (!context.cluster.fetch(sibling, sibling_request, response, proxy_cache::MAX_CACHE_BYTES))
+    {
+        log<LogLevel::Info, LogSubsystem::Cache>("{}|SIBLING|Fetch from {} failed, going to origin.\n", client_id, context.cluster.peerAddress(sibling));
+        return false;
+    }
+
+    int status_code = parseStatusCode(response);
+    if (status_code < 200 || status_code >= 400)
+    {
+        log<LogLevel::Info, LogSubsystem::Cache>("{}|SIBLING|{} answered {}, going to origin.\n", client_id, context.cluster.peerAddress(sibling), status_code);
+        return false;
+    }
+
+    writer.write(response.data(), response.size());
+    context.cache_system.cacheAdd(cache_key.key, response);
+    log<LogLevel::Info, LogSubsystem::Cache>("{}|SIBLING_HIT|{} from {} ({} bytes)\n", client_id, cache_key.key, context.cluster.peerAddress(sibling), response.size());
+    return true;
+}
+
+void ProxyHandler::serveIntercepted(socket_t client_socket, ProxyContext &context, const std::string &host, const std::string &port, const std::string &client_address, int client_id)
+{
+    constexpr std::string_view ESTABLISHED = "HTTP/1.1 200 Connection Established\r\n\r\n";
+    if (!sendAll(client_socket, ESTABLISHED.data(), ESTABLISHED.size()))
+        return;
+
+    std::unique_ptr<proxy_tls::TlsChannel> channel = context.interceptor.acceptClient(client_socket, host);
+    if (!channel)
+        return;
+    log<LogLevel::Info, LogSubsystem::Connect>("{}|TLS|Intercepting {}:{} ({}).\n", client_id, host, port, channel->offloaded() ? "kTLS" : "bridged");
+
+    std::vector<char> request_buffer;
+    if (!readRequestHead(channel->socket(), request_buffer, client_id))
+        return;
+
+    std::string_view method = parseRequestMethod(request_buffer);
+    std::string_view target = parseRequestTarget(request_buffer);
+    if (!isForwardedMethod(method) || target.empty() || target.front() != '/')
+    {
+        sendHttpError(channel->socket(), 400, "Bad Request");
+        return;
+    }
+
+    // The request inside the tunnel is origin-form; the tunnel names the origin, so the
+    // target becomes an absolute https:// URL before the normal request path sees it.
+    std::string absolute = "https://" + host + (port == "443" ? "" : ":" + port);
+    std::size_t target_offset = target.data() - request_buffer.data();
+    request_buffer.insert(request_buffer.begin() + target_offset, absolute.begin(), absolute.end());
+
+    // Peers could not reach the origin over TLS, so intercepted requests stay on this node.
+    serveRequest(proxy_cluster::ResponseWriter{channel->socket(), false, nullptr, client_address}, context, request_buffer, client_id, false);
+}
+
+void ProxyHandler::servePeer(socket_t peer_socket, ProxyContext &context, std::vector<char> &pending, int client_id)
+{
+    proxy_cluster::setNoDelay(peer_socket);
+    proxy_cluster::ResponseWriter writer{peer_socket, true};
+
+    // One exchange at a time for as long as the peer keeps the link open. Requests that
+    // arrive here are never forwarded again, even if membership views disagree.
+    std::vector<char> request;
+    proxy_cluster::PeerRequestKind kind;
+    while (proxy_cluster::readPeerRequest(peer_socket, pending, request, kind))
+    {
+        if (kind == proxy_cluster::PeerRequestKind::Digest)
         {
-            log("INFO|CLIENT|{}|CACHE_MISS|{}\n", client_id, url);
+            std::vector<char> digest = proxy_cluster::CacheDigest(context.cache_system.keyHashes()).serialize();
+            writer.write(digest.data(), digest.size());
+        }
+        else
+            serveRequest(writer, context, request, client_id, false);
 
-            HttpRequestPart request_Part;
+        if (!writer.finish())
+            break;
+    }
 
-            if (!parseHttpUrl(url, request_Part))
-            {
-                log("WARN|CLIENT|{}|HTTP|Failed to parse HTTP request.\n", client_id);
-                return;
-            }
+    log<LogLevel::Info, LogSubsystem::Client>("{}|CLUSTER|Peer link closed.\n", client_id);
+}
 
-            log("INFO|CLIENT|{}|REMOTE|Connecting to {}:{}\n", client_id, request_Part.host, request_Part.port);
+void ProxyHandler::serveHttp2(socket_t client_socket, ProxyContext &context, std::vector<char> &pending, const std::string &client_address, int client_id)
+{
+    proxy_http::Http2Session session(client_socket, client_id, [&context, &client_address, client_socket, client_id](proxy_http::Http2Session &session, std::uint32_t stream_id, const proxy_http::H2Request &request)
+                                     {
+        std::vector<char> request_buffer;
+        if (!proxy_http::toHttp1Request(request, request_buffer))
+        {
+            log<LogLevel::Warn, LogSubsystem::Client>("{}|H2|Stream {} has an unusable request.\n", client_id, stream_id);
+            session.sendHeaders(stream_id, {{":status", "400"}}, true);
+            return;
+        }
 
-            socket_t remote_server_socket = connectToRemoteHost(request_Part.host, request_Part.port);
-            if (remote_server_socket == INVALID_SOCKET)
-            {
-                log("ERROR|CLIENT|{}|REMOTE|Failed to connect to remote host.\n", client_id);
-                sendHttpError(client_socket, 502, "Bad Gateway");
-                return;
-            }
+        log<LogLevel::Debug, LogSubsystem::Client>("{}|H2|Stream {}: {} {}{}\n", client_id, stream_id, request.header(":method"), request.header(":authority"), request.header(":path"));
 
-            SocketGuard remote_socket_guard(remote_server_socket);
+        // The stream goes through the same cache and upstream path as HTTP/1.1 clients; only
+        // the response bytes are re-framed.
+        proxy_http::H2ResponseTranslator translator(session, stream_id, request.header(":method") == "HEAD");
+        std::function<bool(const char *, std::size_t)> sink = [&translator](const char *data, std::size_t size)
+        { return translator.feed(data, size); };
 
-            log("INFO|CLIENT|{}|REMOTE|Connected to {}:{}\n", client_id, request_Part.host, request_Part.port);
+        serveRequest(proxy_cluster::ResponseWriter{client_socket, false, &sink, client_address}, context, request_buffer, client_id, true);
+        translator.finish(); });
 
-            std::vector<char> modified_request;
-            modified_request.reserve(request_buffer.size());
+    // Frames are already batched; Nagle would only hold back the tail of each window.
+    proxy_cluster::setNoDelay(client_socket);
+    session.run(std::move(pending));
+}
 
-            std::string rebuilt = "GET " + request_Part.path + " HTTP/1.1\r\n" +
-                                  "Host: " + request_Part.host + "\r\n" +
-                                  "Connection: close\r\n";
-            modified_request.insert(modified_request.end(), rebuilt.begin(), rebuilt.end());
+void ProxyHandler::prefetch(ProxyContext &context, const std::string &url)
+{
+    std::string head = "GET " + url + " HTTP/1.1\r\nAccept: */*\r\nConnection: close\r\n\r\n";
+    std::vector<char> request(head.begin(), head.end());
 
-            auto it_start = std::search(request_buffer.begin(), request_buffer.end(), HTTP_END.begin(), HTTP_END.end());
-            if (it_start == request_buffer.end())
-            {
-                return;
-            }
+    std::function<bool(const char *, std::size_t)> discard = [](const char *, std::size_t)
+    { return true; };
+    serveRequest(proxy_cluster::ResponseWriter{INVALID_SOCKET, false, &discard}, context, request, PREFETCH_CLIENT_ID, true);
+}
 
-            it_start += HTTP_END.size();
+void ProxyHandler::handleClient(const socket_t client_socket, proxy_http::ClientAddress peer, ProxyContext &context, std::counting_semaphore<INT_MAX> &connection_semaphore)
+{
+    proxy_cache::NegativeCache &negative_cache = context.negative_cache;
 
-            while (true)
-            {
-                auto it_end = std::search(it_start, request_buffer.end(), HTTP_END.begin(), HTTP_END.end());
-                if (it_end == request_buffer.end())
-                    break;
+    SemaphoreGuard guard(connection_semaphore);
+    SocketGuard socket_guard(client_socket);
 
-                if (it_end == it_start)
-                {
-                    modified_request.insert(modified_request.end(), HTTP_END.begin(), HTTP_END.end());
-                    break;
-                }
-                auto line_begin = it_start, line_end = it_end;
+    setSocketTimeout(client_socket, 30);
 
-                auto is_equals_prefix = [&](const char *h)
-                {
-                    auto it = line_begin;
-                    for (const char *p = h; *p && it != line_end; ++p, ++it)
-                    {
-                        if (std::tolower(*it) != std::tolower(*p))
-                            return false;
-                    }
-                    return *h && (line_begin + std::strlen(h) <= line_end);
-                };
-
-                if (is_equals_prefix("Host:") || is_equals_prefix("Connection:"))
-                {
-                    it_start = it_end + HTTP_END.size();
-                    continue;
-                }
+    const int client_id = (int)client_socket;
 
-                modified_request.insert(modified_request.end(), line_begin, line_end);
+    std::vector<char> request_buffer;
+    char temp_buffer[HTTP_RECV_BUFFER_SIZE];
 
-                modified_request.insert(modified_request.end(), HTTP_END.begin(), HTTP_END.end());
+    int bytes_received = recv(client_socket, temp_buffer, HTTP_RECV_BUFFER_SIZE, 0);
 
-                it_start = it_end + HTTP_END.size();
-            }
+    if (bytes_received <= 0)
+    {
+        log<LogLevel::Info, LogSubsystem::Client>("{}|Client disconnected immediately or timed out.\n", client_id);
+        return;
+    }
 
-            log("INFO|CLIENT|{}|REMOTE|Forwarding: GET {}\n", client_id, request_Part.path);
+    request_buffer.insert(request_buffer.end(), temp_buffer, temp_buffer + bytes_received);
 
-            if (send(remote_server_socket, modified_request.data(), modified_request.size(), 0) == SOCKET_ERROR)
-            {
-                log("INFO|CLIENT|{}|REMOTE|send() failed: {}\n", client_id, getSocketError());
-                return;
-            }
+    // Behind an L4 balancer the header names the real client; it is parsed out of the bytes
+    // already received, so most connections pay no extra read.
+    if (context.proxy_protocol.enabled() && !context.proxy_protocol.accept(client_socket, request_buffer, peer, client_id))
+        return;
 
-            log("INFO|CLIENT|{}|REMOTE|Awaiting response from {}:{}\n", client_id, request_Part.host, request_Part.port);
+    if (isMethod(request_buffer, "CONNECT ")) // HTTPS CONNECT Section
+    {
+        log<LogLevel::Debug, LogSubsystem::Connect>("{}|HTTP CONNECT request received.\n", client_id);
 
-            std::vector<char> server_response_data;
+        std::string host;
+        std::string port = "443";
 
-            int total_bytes_received = 0;
-            bool status_logged = false;
-            while (true)
-            {
-                char temp_buffer[HTTP_RECV_BUFFER_SIZE];
-                int bytes_received = recv(remote_server_socket, temp_buffer, HTTP_RECV_BUFFER_SIZE, 0);
+        std::string_view url = parseRequestTarget(request_buffer);
+        if (url.empty())
+        {
+            log<LogLevel::Warn, LogSubsystem::Connect>("{}|HTTPS|Malformed HTTPS request.\n", client_id);
+            return;
+        }
 
-                if (bytes_received <= 0)
-                    break;
+        size_t port_pos = url.rfind(":");
+        if (port_pos != std::string_view::npos)
+        {
+            host = std::string(url.substr(0, port_pos));
+            port = std::string(url.substr(port_pos + 1));
+        }
+        else
+            host = std::string(url);
 
-                if (!status_logged)
-                {
-                    std::string header(temp_buffer, bytes_received);
-
-                    size_t pos = header.find("\r\n");
-                    if (pos != std::string::npos)
-                    {
-                        std::string first_line = header.substr(0, pos);
-                        log("INFO|CLIENT|{}|REMOTE|Response: {}\n", client_id, first_line);
-                        status_logged = true;
-                    }
-                }
+        log<LogLevel::Info, LogSubsystem::Connect>("{}|CONNECT|CONNECT target {}:{}\n", client_id, host, port);
 
-                int bytes_sent = 0;
-                while (bytes_sent < bytes_received)
-                {
-                    int sent = send(client_socket, temp_buffer + bytes_sent, bytes_received - bytes_sent, 0);
-                    if (sent == SOCKET_ERROR)
-                    {
-                        log("INFO|CLIENT|{}|REMOTE|send() failed: {}\n", client_id, getSocketError());
-                        return;
-                    }
+        std::string lower_host = host;
+        std::transform(lower_host.begin(), lower_host.end(), lower_host.begin(), [](unsigned char c)
+                       { return static_cast<char>(std::tolower(c)); });
 
-                    if (sent == 0)
-                        break;
+        if (context.interceptor.intercepts(lower_host))
+        {
+            serveIntercepted(client_socket, context, lower_host, port, peer.host, client_id);
+            return;
+        }
 
-                    bytes_sent += sent;
-                }
+        int failure_status = 0;
+        proxy_routing::ParentGroup *parent = context.router.parentFor(lower_host);
+        socket_t remote_server_socket = parent ? connectViaParent(*parent, host, port, negative_cache, failure_status, client_id)
+                                               : connectToRemoteHost(host, port, negative_cache, failure_status);
 
-                total_bytes_received += bytes_received;
+        SocketGuard remote_socket_guard(remote_server_socket);
 
-                if (total_bytes_received <= proxy_cache::MAX_CACHE_BYTES)
-                    server_response_data.insert(server_response_data.end(), temp_buffer, temp_buffer + bytes_received);
-            }
+        if (remote_server_socket == INVALID_SOCKET)
+        {
+            log<LogLevel::Error, LogSubsystem::Connect>("{}|CONNECT|Failed to connect to {}\n", client_id, host);
+            sendHttpError(client_socket, failure_status,
+                          failure_status == 504 ? "Gateway Timeout" : failure_status == 403 ? "Forbidden" : "Bad Gateway");
+            return;
+        }
 
-            log("INFO|CLIENT|{}|REMOTE|Forwarded {} bytes to client.\n",
-                client_id,
-                total_bytes_received);
+        std::string rebuilt = "HTTP/1.1 200 OK \r\n\r\n";
 
-            if (total_bytes_received <= proxy_cache::MAX_CACHE_BYTES)
-            {
-                cache_system.cacheAdd(url, server_response_data);
-                log("INFO|CLIENT|{}|CACHE_STORE|{} ({} bytes)\n",
-                    client_id,
-                    url,
-                    server_response_data.size());
-            }
-            log("INFO|CLIENT|{}|REMOTE|Connection to {} closed.\n", client_id, request_Part.host);
+        int sent_rebuilt = 0;
+        while (sent_rebuilt < rebuilt.size())
+        {
+            int len = send(client_socket, rebuilt.data() + sent_rebuilt, rebuilt.size() - sent_rebuilt, 0);
+            sent_rebuilt += len;
         }
+
+        log<LogLevel::Info, LogSubsystem::Connect>("{}|CONNECT|Tunnel established to {}:{}\n", client_id, host, port);
+
+        proxy_http::TunnelResult tunnel = proxy_http::relayTunnel(client_socket, remote_server_socket, TUNNEL_IDLE_TIMEOUT);
+        if (tunnel.timed_out)
+            log<LogLevel::Info, LogSubsystem::Connect>("{}|CONNECT|Tunnel timed out for {}:{}\n", client_id, host, port);
+
+        log<LogLevel::Info, LogSubsystem::Connect>("{}|CONNECT|Tunnel to {}:{} closed. {} bytes relayed.\n",
+            client_id,
+            host,
+            port,
+            tunnel.bytes);
+    }
+    else if (isMethod(request_buffer, "PRI ")) // HTTP/2 prior knowledge (h2c)
+    {
+        log<LogLevel::Debug, LogSubsystem::Client>("{}|HTTP/2 connection preface received.\n", client_id);
+        serveHttp2(client_socket, context, request_buffer, peer.host, client_id);
+    }
+    else if (isForwardedMethod(parseRequestMethod(request_buffer))) // HTTP request Section
+    {
+        log<LogLevel::Debug, LogSubsystem::Client>("{}|HTTP {} request received.\n", client_id, parseRequestMethod(request_buffer));
+
+        if (!readRequestHead(client_socket, request_buffer, client_id))
+            return;
+
+        serveRequest(proxy_cluster::ResponseWriter{client_socket, false, nullptr, peer.host}, context, request_buffer, client_id, true);
+    }
+    else if ((isMethod(request_buffer, "PEERGET ") || isMethod(request_buffer, "PEERDIGEST ")) && context.cluster.enabled() &&
+             context.cluster.isPeerHost(peer.host)) // Cluster peer link
+    {
+        log<LogLevel::Info, LogSubsystem::Client>("{}|CLUSTER|Peer link opened.\n", client_id);
+        servePeer(client_socket, context, request_buffer, client_id);
     }
     else
     {
-        log("INFO|CLIENT|{}|Unsupported HTTP method.\n", client_id);
+        // Answer rather than drop the connection, so clients fail fast instead of retrying.
+        log<LogLevel::Info, LogSubsystem::Client>("{}|Unsupported HTTP method.\n", client_id);
+        sendHttpError(client_socket, 501, "Not Implemented");
     }
     return;
 }
\ No newline at end of file
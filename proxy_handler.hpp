@@ -4,9 +4,16 @@
 #include <semaphore>
 #include <vector>
 #include <string>
+#include <string_view>
+#include <climits>
 
 #include "proxy_utils.hpp"
 #include "proxy_cache.hpp"
+#include "proxy_negative_cache.hpp"
+#include "proxy_context.hpp"
+#include "proxy_cluster.hpp"
+#include "proxy_framing.hpp"
+#include "proxy_proxy_protocol.hpp"
 
 class ProxyHandler
 {
@@ -20,7 +27,7 @@ private:
 
     struct SocketGuard {
         socket_t a_socket;
-        SocketGuard(socket_t client_socket) : a_socket(a_socket) {}
+        SocketGuard(socket_t client_socket) : a_socket(client_socket) {}
         ~SocketGuard() {
             if (a_socket != INVALID_SOCKET)
                 closeSocket(a_socket);
@@ -36,16 +43,95 @@ private:
 
     static void sendHttpError(const socket_t& client_socket, int status_code, const std::string& message);
 
+    static void sendHttpError(const proxy_cluster::ResponseWriter &writer, int status_code, const std::string &message);
+
     static bool isMethod(const std::vector<char> &request_buffer, const std::string &method);
 
-    static std::string parseRequestTarget(const std::vector<char> &request);
+    static std::string_view parseRequestMethod(const std::vector<char> &request);
+
+    static std::string_view parseRequestTarget(const std::vector<char> &request);
+
+    // Methods relayed upstream; anything else is answered with 501.
+    static bool isForwardedMethod(std::string_view method);
+
+    // Methods that may change the target resource (RFC 9110 9.2.1); unknown methods count.
+    static bool isUnsafeMethod(std::string_view method);
+
+    // Bytes up to and including the blank line, or the whole buffer if it has none.
+    static std::size_t responseHeadSize(const std::vector<char> &response);
+
+    static bool sendAll(socket_t s, const char *data, std::size_t size);
+
+    static bool parseHttpUrl(std::string_view url, HttpRequestPart &requestPart);
+
+    // Value of the first header with this name (case-insensitive), trimmed; empty if absent.
+    static std::string_view findHeader(const std::vector<char> &request, std::string_view name);
+
+    static int parseStatusCode(const std::vector<char> &response);
+
+    // The first Cache-Control header lists this directive (case-insensitive, whole tokens).
+    static bool hasCacheDirective(const std::vector<char> &message, std::string_view directive);
+
+    // Connection lists "upgrade" and an Upgrade header names the protocol (RFC 9110 7.8).
+    static bool isUpgradeRequest(const std::vector<char> &request);
 
-    static bool parseHttpUrl(const std::string &url, HttpRequestPart &requestPart);
+    static bool hasNoStore(const std::vector<char> &response);
 
-    static socket_t connectToRemoteHost(const std::string& host, const std::string& port);
+    // The request carries "Expect: 100-continue".
+    static bool expectsContinue(const std::vector<char> &request);
+
+    // For X-Forwarded-For: the address the caller recorded, else the socket's peer.
+    static std::string clientAddress(const proxy_cluster::ResponseWriter &writer);
+
+    // Consults the negative cache before resolving/connecting and records failures in it.
+    // On failure, failure_status is the status to send the client (502, or 504 on timeout).
+    static socket_t connectToRemoteHost(const std::string& host, const std::string& port, proxy_cache::NegativeCache &negative_cache, int &failure_status);
+    // Opens a CONNECT tunnel through one of the group's parents, failing over to another
+    // parent when the first cannot be reached. The returned socket is past the parent's 200.
+    static socket_t connectViaParent(proxy_routing::ParentGroup &parent, const std::string &host, const std::string &port, proxy_cache::NegativeCache &negative_cache, int &failure_status, int client_id);
+    // Reads until the blank line ending the request head; false on disconnect or oversize.
+    static bool readRequestHead(socket_t client_socket, std::vector<char> &request_buffer, int client_id);
+
+    // Sends the rest of the request body (Content-Length or chunked) from client to upstream
+    // as it arrives. body_prefix holds body bytes that came in with the head.
+    static bool streamRequestBody(socket_t client_socket, socket_t remote_socket, const char *body_prefix, std::size_t prefix_size, proxy_http::MessageFramer &framer, bool expect_continue, int client_id);
+
+    // GET/HEAD: cache lookup, optional hand-off to a cluster peer, then origin fetch and store.
+    // Other methods are forwarded with their body streamed and invalidate the target URL.
+    // Responses go through writer, so the same path serves clients and peer links.
+    static void serveRequest(const proxy_cluster::ResponseWriter &writer, ProxyContext &context, const std::vector<char> &request_buffer, int client_id, bool allow_peer_forward);
+
+    // Cache-miss fetch from a pool with protocol = h2c: the request (its body collected
+    // first) becomes a stream on the backend's shared session and the response comes back
+    // as HTTP/1.1 bytes for writer and the cache.
+    static void serveOverH2(const proxy_cluster::ResponseWriter &writer, ProxyContext &context, const std::vector<char> &request_buffer, std::size_t head_end, std::size_t request_consumed, proxy_http::MessageFramer &request_framer, std::string_view url, const HttpRequestPart &request_Part, std::string_view host_header, const proxy_cache::CacheKey &cache_key, proxy_routing::BackendSet &pool, proxy_routing::UpstreamLease &lease, int client_id);
+
+    // After an origin fetch: a successful unsafe method invalidates the URL; otherwise a GET
+    // response goes to the negative cache or, when complete and small enough, the cache.
+    static void storeResponse(ProxyContext &context, std::string_view method, std::string_view url, const proxy_cache::CacheKey &cache_key, std::vector<char> &response, int status_code, bool complete, int client_id);
+
+    // Sibling mode: probes the other nodes and, on a HIT, fetches the object from that node,
+    // stores it locally and sends it to writer. False leaves the request to the origin path.
+    static bool serveFromSibling(const proxy_cluster::ResponseWriter &writer, ProxyContext &context, const std::vector<char> &request_buffer, const proxy_cache::CacheKey &cache_key, int client_id);
+
+    // Prior-knowledge h2c: every stream runs serveRequest on its own thread, with the
+    // HTTP/1.1 response re-framed as HEADERS/DATA on the shared connection.
+    static void serveHttp2(socket_t client_socket, ProxyContext &context, std::vector<char> &pending, const std::string &client_address, int client_id);
+
+    // CONNECT to an intercepted host: TLS is terminated with a certificate from the local CA
+    // and the request inside is served as an https:// URL through serveRequest, so it is
+    // cached like plain HTTP. The origin leg is a fresh TLS connection.
+    static void serveIntercepted(socket_t client_socket, ProxyContext &context, const std::string &host, const std::string &port, const std::string &client_address, int client_id);
+
+    static void servePeer(socket_t peer_socket, ProxyContext &context, std::vector<char> &pending, int client_id);
 public:
     ProxyHandler();
     ~ProxyHandler();
 
-    static void handleClient(const socket_t client_socket, proxy_cache::Cache &cache_system, std::counting_semaphore<INT_MAX> &connection_semaphore);
+    // Runs a GET for url through serveRequest with the response thrown away, so it lands in
+    // the cache. Called from the prefetcher's threads.
+    static void prefetch(ProxyContext &context, const std::string &url);
+
+    // peer: the accepted TCP peer; replaced by the PROXY protocol source when the listener expects one.
+    static void handleClient(const socket_t client_socket, proxy_http::ClientAddress peer, ProxyContext &context, std::counting_semaphore<INT_MAX> &connection_semaphore);
 };
\ No newline at end of file
@@ -0,0 +1,247 @@
+#include <algorithm>
+#include <cctype>
+
+#ifndef _WIN32
+#include <sys/uio.h>
+#include <climits>
+#endif
+
+#include "proxy_headers.hpp"
+
+using namespace proxy_http;
+
+constexpr std::string_view HTTP_END = "\r\n";
+constexpr std::string_view HEADER_END = "\r\n\r\n";
+
+// Never forwarded: they describe this hop only. Host and Connection are written by the
+// caller and Expect is answered by the proxy. Transfer-Encoding stays because the body is
+// relayed in its original coding.
+constexpr std::string_view HOP_BY_HOP[] = {"connection", "keep-alive", "proxy-connection", "proxy-authorization",
+                                           "te", "trailer", "upgrade", "host", "expect"};
+
+constexpr std::size_t MAX_SEGMENTS_PER_CALL = 64;
+
+namespace
+{
+    bool equalsIgnoreCase(std::string_view a, std::string_view b)
+    {
+        return a.size() == b.size() && std::equal(a.begin(), a.end(), b.begin(), [](char x, char y)
+                                                  { return std::tolower(static_cast<unsigned char>(x)) == std::tolower(static_cast<unsigned char>(y)); });
+    }
+
+    std::string_view trim(std::string_view value)
+    {
+        while (!value.empty() && (value.front() == ' ' || value.front() == '\t'))
+            value.remove_prefix(1);
+        while (!value.empty() && (value.back() == ' ' || value.back() == '\t'))
+            value.remove_suffix(1);
+        return value;
+    }
+
+    std::string_view lineName(std::string_view line)
+    {
+        std::size_t colon = line.find(':');
+        return colon == std::string_view::npos ? std::string_view() : trim(line.substr(0, colon));
+    }
+}
+
+void RequestHead::addSpan(const char *data, std::size_t size)
+{
+    if (size == 0)
+        return;
+
+    // Adjacent kept lines extend the previous span instead of adding a segment.
+    if (!pieces.empty() && pieces.back().data + pieces.back().size == data)
+        pieces.back().size += size;
+    else
+        pieces.push_back(Segment{data, size});
+    total += size;
+}
+
+void RequestHead::addInjected(std::string text)
+{
+    if (text.empty())
+        return;
+
+    injected.push_back(std::move(text));
+    pieces.push_back(Segment{injected.back().data(), injected.back().size()});
+    total += injected.back().size();
+}
+
+void RequestHead::build(std::string start_lines, const std::vector<char> &request, const HeaderRules &rules, std::string_view client_address)
+{
+    injected.clear();
+    pieces.clear();
+    total = 0;
+
+    addInjected(std::move(start_lines));
+
+    auto head_end = std::search(request.begin(), request.end(), HEADER_END.begin(), HEADER_END.end());
+    auto first_line_end = std::search(request.begin(), head_end, HTTP_END.begin(), HTTP_END.end());
+
+    std::vector<std::string_view> lines;
+    std::vector<std::string_view> connection_tokens;
+
+    if (first_line_end != head_end)
+    {
+        const char *cursor = &*first_line_end + HTTP_END.size();
+        const char *end = request.data() + (head_end - request.begin()) + HTTP_END.size();
+
+        while (cursor < end)
+        {
+            std::string_view rest(cursor, end - cursor);
+            std::size_t line_size = rest.find(HTTP_END);
+            if (line_size == std::string_view::npos)
+                break;
+
+            std::string_view line = rest.substr(0, line_size + HTTP_END.size());
+            lines.push_back(line);
+            cursor += line.size();
+
+            // Headers listed in Connection are hop-by-hop for this message too.
+            if (equalsIgnoreCase(lineName(line), "Connection"))
+            {
+                std::string_view value = line.substr(line.find(':') + 1, line_size - line.find(':') - 1);
+                while (!value.empty())
+                {
+                    std::size_t comma = value.find(',');
+                    std::string_view token = trim(value.substr(0, comma));
+                    if (!token.empty())
+                        connection_tokens.push_back(token);
+                    if (comma == std::string_view::npos)
+                        break;
+                    value.remove_prefix(comma + 1);
+                }
+            }
+        }
+    }
+
+    auto named_in = [](std::string_view name, const auto &names, auto project)
+    {
+        return std::any_of(std::begin(names), std::end(names), [&](const auto &entry)
+                           { return equalsIgnoreCase(name, project(entry)); });
+    };
+    auto as_is = [](std::string_view entry)
+    { return entry; };
+    auto line_name = [](const std::string &entry)
+    { return lineName(entry); };
+
+    bool via_done = false;
+    bool forwarded_done = false;
+
+    for (std::string_view line : lines)
+    {
+        std::string_view name = lineName(line);
+        std::string_view without_crlf = line.substr(0, line.size() - HTTP_END.size());
+
+        if (name.empty() || named_in(name, HOP_BY_HOP, as_is) || named_in(name, connection_tokens, as_is) ||
+            named_in(name, rules.remove, as_is) || named_in(name, rules.set, line_name))
+            continue;
+
+        // Extend list-valued headers in place: the existing value is sent from the buffer
+        // and only the appended element is injected.
+        if (rules.via && !via_done && equalsIgnoreCase(name, "Via"))
+        {
+            addSpan(without_crlf.data(), without_crlf.size());
+            addInjected(", 1.1 " + rules.via_name + "\r\n");
+            via_done = true;
+            continue;
+        }
+        if (rules.forwarded_for && !forwarded_done && !client_address.empty() && equalsIgnoreCase(name, "X-Forwarded-For"))
+        {
+            addSpan(without_crlf.data(), without_crlf.size());
+            addInjected(", " + std::string(client_address) + "\r\n");
+            forwarded_done = true;
+            continue;
+        }
+
+        addSpan(line.data(), line.size());
+    }
+
+    std::string tail;
+    for (const std::string &line : rules.set)
+        tail.append(line).append(HTTP_END);
+    for (const std::string &line : rules.add)
+        tail.append(line).append(HTTP_END);
+    if (rules.via && !via_done)
+        tail.append("Via: 1.1 ").append(rules.via_name).append(HTTP_END);
+    if (rules.forwarded_for && !forwarded_done && !client_address.empty())
+        tail.append("X-Forwarded-For: ").append(client_address).append(HTTP_END);
+    tail.append(HTTP_END);
+    addInjected(std::move(tail));
+}
+
+bool proxy_http::hasListToken(std::string_view value, std::string_view token)
+{
+    while (!value.empty())
+    {
+        std::size_t comma = value.find(',');
+        std::string_view entry = value.substr(0, comma);
+        if (equalsIgnoreCase(trim(entry.substr(0, entry.find('='))), token))
+            return true;
+        if (comma == std::string_view::npos)
+            break;
+        value.remove_prefix(comma + 1);
+    }
+    return false;
+}
+
+bool proxy_http::sendSegments(socket_t s, const std::vector<Segment> &segments)
+{
+    std::size_t index = 0;
+    std::size_t offset = 0;
+
+    while (index < segments.size())
+    {
+        std::size_t count = std::min(segments.size() - index, MAX_SEGMENTS_PER_CALL);
+
+#ifdef _WIN32
+        WSABUF buffers[MAX_SEGMENTS_PER_CALL];
+        for (std::size_t i = 0; i < count; ++i)
+        {
+            std::size_t skip = i == 0 ? offset : 0;
+            buffers[i].buf = const_cast<char *>(segments[index + i].data + skip);
+            buffers[i].len = static_cast<ULONG>(segments[index + i].size - skip);
+        }
+        DWORD sent_bytes = 0;
+        if (WSASend(s, buffers, static_cast<DWORD>(count), &sent_bytes, 0, nullptr, nullptr) == SOCKET_ERROR)
+            return false;
+        std::size_t sent = sent_bytes;
+#else
+        iovec buffers[MAX_SEGMENTS_PER_CALL];
+        for (std::size_t i = 0; i < count; ++i)
+        {
+            std::size_t skip = i == 0 ? offset : 0;
+            buffers[i].iov_base = const_cast<char *>(segments[index + i].data + skip);
+            buffers[i].iov_len = segments[index + i].size - skip;
+        }
+        ssize_t written = writev(s, buffers, static_cast<int>(count));
+        if (written <= 0)
+            return false;
+        std::size_t sent = static_cast<std::size_t>(written);
+#endif
+
+        // Skip whatever went out, possibly ending part-way through a segment.
+        while (index < segments.size() && sent >= segments[index].size - offset)
+        {
+            sent -= segments[index].size - offset;
+            offset = 0;
+            ++index;
+        }
+        offset += sent;
+    }
+    return true;
+}
+
+std::string proxy_http::peerAddress(socket_t s)
+{
+    sockaddr_in address{};
+    socklen_t length = sizeof(address);
+    if (getpeername(s, (sockaddr *)&address, &length) == SOCKET_ERROR || address.sin_family != AF_INET)
+        return {};
+
+    char text[INET_ADDRSTRLEN] = {};
+    if (!inet_ntop(AF_INET, &address.sin_addr, text, sizeof(text)))
+        return {};
+    return text;
+}
@@ -0,0 +1,68 @@
+#pragma once
+
+#include <cstddef>
+#include <deque>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "proxy_utils.hpp"
+
+namespace proxy_http
+{
+
+    // Header rewriting applied to every request sent upstream. Hop-by-hop headers (and any
+    // named in Connection) are always removed. Names are matched case-insensitively.
+    struct HeaderRules
+    {
+        bool via = true;
+        std::string via_name = "proxy_main";
+        bool forwarded_for = true;
+
+        std::vector<std::string> remove;
+        // Whole "Name: value" lines; set lines replace every header of that name.
+        std::vector<std::string> set;
+        std::vector<std::string> add;
+    };
+
+    // One contiguous piece of an outgoing message; maps onto iovec/WSABUF.
+    struct Segment
+    {
+        const char *data;
+        std::size_t size;
+    };
+
+    // The upstream request head as spans of the client's receive buffer plus small injected
+    // pieces. Untouched header lines are never copied: consecutive kept lines form one span.
+    // The request buffer must outlive the plan.
+    class RequestHead
+    {
+    private:
+        // deque: pushing more pieces never moves the ones segments already point at.
+        std::deque<std::string> injected;
+        std::vector<Segment> pieces;
+        std::size_t total = 0;
+
+        void addSpan(const char *data, std::size_t size);
+        void addInjected(std::string text);
+
+    public:
+        // start_lines: the rebuilt request line and any headers the caller owns (Host,
+        // Connection), each ending in CRLF. request: the client's head as received.
+        // client_address: appended to X-Forwarded-For; empty leaves it alone.
+        void build(std::string start_lines, const std::vector<char> &request, const HeaderRules &rules, std::string_view client_address);
+
+        const std::vector<Segment> &segments() const { return pieces; }
+        std::size_t size() const { return total; }
+    };
+
+    // Gathered send of every segment (writev/WSASend), resuming after partial writes.
+    bool sendSegments(socket_t s, const std::vector<Segment> &segments);
+
+    // A comma-separated header value (Connection, Cache-Control) lists this token, compared
+    // case-insensitively. Arguments such as "=60" after a listed name are ignored.
+    bool hasListToken(std::string_view value, std::string_view token);
+
+    // Numeric address of the connected peer, or empty.
+    std::string peerAddress(socket_t s);
+}
@@ -0,0 +1,420 @@
+#include <algorithm>
+#include <array>
+#include <memory>
+
+#include "proxy_hpack.hpp"
+
+using namespace proxy_http;
+
+namespace
+{
+    struct static_entry
+    {
+        std::string_view name;
+        std::string_view value;
+    };
+
+    // RFC 7541 Appendix A; index 1 is the first entry.
+    constexpr static_entry STATIC_TABLE[] = {
+        {":authority", ""}, {":method", "GET"}, {":method", "POST"}, {":path", "/"},
+        {":path", "/index.html"}, {":scheme", "http"}, {":scheme", "https"}, {":status", "200"},
+        {":status", "204"}, {":status", "206"}, {":status", "304"}, {":status", "400"},
+        {":status", "404"}, {":status", "500"}, {"accept-charset", ""}, {"accept-encoding", "gzip, deflate"},
+        {"accept-language", ""}, {"accept-ranges", ""}, {"accept", ""}, {"access-control-allow-origin", ""},
+        {"age", ""}, {"allow", ""}, {"authorization", ""}, {"cache-control", ""},
+        {"content-disposition", ""}, {"content-encoding", ""}, {"content-language", ""}, {"content-length", ""},
+        {"content-location", ""}, {"content-range", ""}, {"content-type", ""}, {"cookie", ""},
+        {"date", ""}, {"etag", ""}, {"expect", ""}, {"expires", ""},
+        {"from", ""}, {"host", ""}, {"if-match", ""}, {"if-modified-since", ""},
+        {"if-none-match", ""}, {"if-range", ""}, {"if-unmodified-since", ""}, {"last-modified", ""},
+        {"link", ""}, {"location", ""}, {"max-forwards", ""}, {"proxy-authenticate", ""},
+        {"proxy-authorization", ""}, {"range", ""}, {"referer", ""}, {"refresh", ""},
+        {"retry-after", ""}, {"server", ""}, {"set-cookie", ""}, {"strict-transport-security", ""},
+        {"transfer-encoding", ""}, {"user-agent", ""}, {"vary", ""}, {"via", ""},
+        {"www-authenticate", ""},
+    };
+    constexpr std::size_t STATIC_TABLE_SIZE = std::size(STATIC_TABLE);
+
+    // Per-entry overhead counted against the table size (RFC 7541 4.1).
+    constexpr std::size_t ENTRY_OVERHEAD = 32;
+
+    struct huffman_code
+    {
+        std::uint32_t code;
+        std::uint8_t bits;
+    };
+
+    // RFC 7541 Appendix B, symbols 0-255. EOS (30 ones) only ever appears as padding.
+    constexpr huffman_code HUFFMAN_CODES[256] = {
+        {0x1ff8, 13}, {0x7fffd8, 23}, {0xfffffe2, 28}, {0xfffffe3, 28},
+        {0xfffffe4, 28}, {0xfffffe5, 28}, {0xfffffe6, 28}, {0xfffffe7, 28},
+        {0xfffffe8, 28}, {0xffffea, 24}, {0x3ffffffc, 30}, {0xfffffe9, 28},
+        {0xfffffea, 28}, {0x3ffffffd, 30}, {0xfffffeb, 28}, {0xfffffec, 28},
+        {0xfffffed, 28}, {0xfffffee, 28}, {0xfffffef, 28}, {0xffffff0, 28},
+        {0xffffff1, 28}, {0xffffff2, 28}, {0x3ffffffe, 30}, {0xffffff3, 28},
+        {0xffffff4, 28}, {0xffffff5, 28}, {0xffffff6, 28}, {0xffffff7, 28},
+        {0xffffff8, 28}, {0xffffff9, 28}, {0xffffffa, 28}, {0xffffffb, 28},
+        {0x14, 6}, {0x3f8, 10}, {0x3f9, 10}, {0xffa, 12},
+        {0x1ff9, 13}, {0x15, 6}, {0xf8, 8}, {0x7fa, 11},
+        {0x3fa, 10}, {0x3fb, 10}, {0xf9, 8}, {0x7fb, 11},
+        {0xfa, 8}, {0x16, 6}, {0x17, 6}, {0x18, 6},
+        {0x0, 5}, {0x1, 5}, {0x2, 5}, {0x19, 6},
+        {0x1a, 6}, {0x1b, 6}, {0x1c, 6}, {0x1d, 6},
+        {0x1e, 6}, {0x1f, 6}, {0x5c, 7}, {0xfb, 8},
+        {0x7ffc, 15}, {0x20, 6}, {0xffb, 12}, {0x3fc, 10},
+        {0x1ffa, 13}, {0x21, 6}, {0x5d, 7}, {0x5e, 7},
+        {0x5f, 7}, {0x60, 7}, {0x61, 7}, {0x62, 7},
+        {0x63, 7}, {0x64, 7}, {0x65, 7}, {0x66, 7},
+        {0x67, 7}, {0x68, 7}, {0x69, 7}, {0x6a, 7},
+        {0x6b, 7}, {0x6c, 7}, {0x6d, 7}, {0x6e, 7},
+        {0x6f, 7}, {0x70, 7}, {0x71, 7}, {0x72, 7},
+        {0xfc, 8}, {0x73, 7}, {0xfd, 8}, {0x1ffb, 13},
+        {0x7fff0, 19}, {0x1ffc, 13}, {0x3ffc, 14}, {0x22, 6},
+        {0x7ffd, 15}, {0x3, 5}, {0x23, 6}, {0x4, 5},
+        {0x24, 6}, {0x5, 5}, {0x25, 6}, {0x26, 6},
+        {0x27, 6}, {0x6, 5}, {0x74, 7}, {0x75, 7},
+        {0x28, 6}, {0x29, 6}, {0x2a, 6}, {0x7, 5},
+        {0x2b, 6}, {0x76, 7}, {0x2c, 6}, {0x8, 5},
+        {0x9, 5}, {0x2d, 6}, {0x77, 7}, {0x78, 7},
+        {0x79, 7}, {0x7a, 7}, {0x7b, 7}, {0x7ffe, 15},
+        {0x7fc, 11}, {0x3ffd, 14}, {0x1ffd, 13}, {0xffffffc, 28},
+        {0xfffe6, 20}, {0x3fffd2, 22}, {0xfffe7, 20}, {0xfffe8, 20},
+        {0x3fffd3, 22}, {0x3fffd4, 22}, {0x3fffd5, 22}, {0x7fffd9, 23},
+        {0x3fffd6, 22}, {0x7fffda, 23}, {0x7fffdb, 23}, {0x7fffdc, 23},
+        {0x7fffdd, 23}, {0x7fffde, 23}, {0xffffeb, 24}, {0x7fffdf, 23},
+        {0xffffec, 24}, {0xffffed, 24}, {0x3fffd7, 22}, {0x7fffe0, 23},
+        {0xffffee, 24}, {0x7fffe1, 23}, {0x7fffe2, 23}, {0x7fffe3, 23},
+        {0x7fffe4, 23}, {0x1fffdc, 21}, {0x3fffd8, 22}, {0x7fffe5, 23},
+        {0x3fffd9, 22}, {0x7fffe6, 23}, {0x7fffe7, 23}, {0xffffef, 24},
+        {0x3fffda, 22}, {0x1fffdd, 21}, {0xfffe9, 20}, {0x3fffdb, 22},
+        {0x3fffdc, 22}, {0x7fffe8, 23}, {0x7fffe9, 23}, {0x1fffde, 21},
+        {0x7fffea, 23}, {0x3fffdd, 22}, {0x3fffde, 22}, {0xfffff0, 24},
+        {0x1fffdf, 21}, {0x3fffdf, 22}, {0x7fffeb, 23}, {0x7fffec, 23},
+        {0x1fffe0, 21}, {0x1fffe1, 21}, {0x3fffe0, 22}, {0x1fffe2, 21},
+        {0x7fffed, 23}, {0x3fffe1, 22}, {0x7fffee, 23}, {0x7fffef, 23},
+        {0xfffea, 20}, {0x3fffe2, 22}, {0x3fffe3, 22}, {0x3fffe4, 22},
+        {0x7ffff0, 23}, {0x3fffe5, 22}, {0x3fffe6, 22}, {0x7ffff1, 23},
+        {0x3ffffe0, 26}, {0x3ffffe1, 26}, {0xfffeb, 20}, {0x7fff1, 19},
+        {0x3fffe7, 22}, {0x7ffff2, 23}, {0x3fffe8, 22}, {0x1ffffec, 25},
+        {0x3ffffe2, 26}, {0x3ffffe3, 26}, {0x3ffffe4, 26}, {0x7ffffde, 27},
+        {0x7ffffdf, 27}, {0x3ffffe5, 26}, {0xfffff1, 24}, {0x1ffffed, 25},
+        {0x7fff2, 19}, {0x1fffe3, 21}, {0x3ffffe6, 26}, {0x7ffffe0, 27},
+        {0x7ffffe1, 27}, {0x3ffffe7, 26}, {0x7ffffe2, 27}, {0xfffff2, 24},
+        {0x1fffe4, 21}, {0x1fffe5, 21}, {0x3ffffe8, 26}, {0x3ffffe9, 26},
+        {0xffffffd, 28}, {0x7ffffe3, 27}, {0x7ffffe4, 27}, {0x7ffffe5, 27},
+        {0xfffec, 20}, {0xfffff3, 24}, {0xfffed, 20}, {0x1fffe6, 21},
+        {0x3fffe9, 22}, {0x1fffe7, 21}, {0x1fffe8, 21}, {0x7ffff3, 23},
+        {0x3fffea, 22}, {0x3fffeb, 22}, {0x1ffffee, 25}, {0x1ffffef, 25},
+        {0xfffff4, 24}, {0xfffff5, 24}, {0x3ffffea, 26}, {0x7ffff4, 23},
+        {0x3ffffeb, 26}, {0x7ffffe6, 27}, {0x3ffffec, 26}, {0x3ffffed, 26},
+        {0x7ffffe7, 27}, {0x7ffffe8, 27}, {0x7ffffe9, 27}, {0x7ffffea, 27},
+        {0x7ffffeb, 27}, {0xffffffe, 28}, {0x7ffffec, 27}, {0x7ffffed, 27},
+        {0x7ffffee, 27}, {0x7ffffef, 27}, {0x7fffff0, 27}, {0x3ffffee, 26},
+    };
+
+    // Binary decode tree built once from HUFFMAN_CODES; leaves carry the symbol.
+    struct huffman_tree
+    {
+        struct node
+        {
+            std::int16_t child[2] = {-1, -1};
+            std::int16_t symbol = -1;
+        };
+        std::vector<node> nodes;
+
+        huffman_tree()
+        {
+            nodes.reserve(512);
+            nodes.emplace_back();
+            for (int symbol = 0; symbol < 256; ++symbol)
+            {
+                std::size_t current = 0;
+                for (int bit = HUFFMAN_CODES[symbol].bits - 1; bit >= 0; --bit)
+                {
+                    int branch = (HUFFMAN_CODES[symbol].code >> bit) & 1;
+                    if (nodes[current].child[branch] < 0)
+                    {
+                        nodes[current].child[branch] = static_cast<std::int16_t>(nodes.size());
+                        nodes.emplace_back();
+                    }
+                    current = static_cast<std::size_t>(nodes[current].child[branch]);
+                }
+                nodes[current].symbol = static_cast<std::int16_t>(symbol);
+            }
+        }
+    };
+
+    const huffman_tree &huffmanTree()
+    {
+        static const huffman_tree tree;
+        return tree;
+    }
+
+    bool decodeInteger(const std::uint8_t *&p, const std::uint8_t *end, int prefix_bits, std::uint64_t &value)
+    {
+        if (p == end)
+            return false;
+
+        const std::uint8_t prefix_max = static_cast<std::uint8_t>((1u << prefix_bits) - 1);
+        value = *p++ & prefix_max;
+        if (value < prefix_max)
+            return true;
+
+        for (int shift = 0; shift <= 56; shift += 7)
+        {
+            if (p == end)
+                return false;
+            std::uint8_t byte = *p++;
+            value += static_cast<std::uint64_t>(byte & 0x7f) << shift;
+            if ((byte & 0x80) == 0)
+                return true;
+        }
+        return false;
+    }
+
+    void encodeInteger(std::string &out, std::uint8_t first_bits, int prefix_bits, std::uint64_t value)
+    {
+        const std::uint64_t prefix_max = (1u << prefix_bits) - 1;
+        if (value < prefix_max)
+        {
+            out.push_back(static_cast<char>(first_bits | value));
+            return;
+        }
+
+        out.push_back(static_cast<char>(first_bits | prefix_max));
+        value -= prefix_max;
+        while (value >= 0x80)
+        {
+            out.push_back(static_cast<char>((value & 0x7f) | 0x80));
+            value >>= 7;
+        }
+        out.push_back(static_cast<char>(value));
+    }
+
+    bool decodeString(const std::uint8_t *&p, const std::uint8_t *end, std::string &out)
+    {
+        if (p == end)
+            return false;
+
+        bool huffman = (*p & 0x80) != 0;
+        std::uint64_t length = 0;
+        if (!decodeInteger(p, end, 7, length) || length > static_cast<std::uint64_t>(end - p))
+            return false;
+
+        out.clear();
+        bool ok = huffman ? huffmanDecode(p, static_cast<std::size_t>(length), out)
+                          : (out.assign(reinterpret_cast<const char *>(p), static_cast<std::size_t>(length)), true);
+        p += length;
+        return ok;
+    }
+
+    void encodeString(std::string &out, std::string_view text)
+    {
+        std::size_t huffman_size = huffmanEncodedSize(text);
+        if (huffman_size < text.size())
+        {
+            encodeInteger(out, 0x80, 7, huffman_size);
+            huffmanEncode(text, out);
+        }
+        else
+        {
+            encodeInteger(out, 0x00, 7, text.size());
+            out.append(text);
+        }
+    }
+}
+
+bool proxy_http::huffmanDecode(const std::uint8_t *data, std::size_t size, std::string &out)
+{
+    const huffman_tree &tree = huffmanTree();
+    std::size_t current = 0;
+    int pending_bits = 0;
+    bool pending_all_ones = true;
+
+    for (std::size_t i = 0; i < size; ++i)
+    {
+        for (int bit = 7; bit >= 0; --bit)
+        {
+            int branch = (data[i] >> bit) & 1;
+            std::int16_t next = tree.nodes[current].child[branch];
+            if (next < 0)
+                return false;
+
+            current = static_cast<std::size_t>(next);
+            ++pending_bits;
+            pending_all_ones = pending_all_ones && branch == 1;
+
+            if (tree.nodes[current].symbol >= 0)
+            {
+                out.push_back(static_cast<char>(tree.nodes[current].symbol));
+                current = 0;
+                pending_bits = 0;
+                pending_all_ones = true;
+            }
+        }
+    }
+
+    // Padding is the most significant bits of EOS: at most 7 bits, all ones.
+    return pending_bits < 8 && pending_all_ones;
+}
+
+std::size_t proxy_http::huffmanEncodedSize(std::string_view text)
+{
+    std::size_t bits = 0;
+    for (unsigned char c : text)
+        bits += HUFFMAN_CODES[c].bits;
+    return (bits + 7) / 8;
+}
+
+void proxy_http::huffmanEncode(std::string_view text, std::string &out)
+{
+    std::uint64_t accumulator = 0;
+    int bits = 0;
+
+    for (unsigned char c : text)
+    {
+        accumulator = (accumulator << HUFFMAN_CODES[c].bits) | HUFFMAN_CODES[c].code;
+        bits += HUFFMAN_CODES[c].bits;
+        while (bits >= 8)
+        {
+            bits -= 8;
+            out.push_back(static_cast<char>(accumulator >> bits));
+        }
+    }
+
+    if (bits > 0)
+        out.push_back(static_cast<char>((accumulator << (8 - bits)) | (0xff >> bits)));
+}
+
+HpackDecoder::HpackDecoder(std::size_t max_table_size)
+    : max_table_size(max_table_size), settings_table_size(max_table_size)
+{
+}
+
+bool HpackDecoder::lookup(std::uint64_t index, std::pair<std::string, std::string> &entry) const
+{
+    if (index == 0)
+        return false;
+
+    if (index <= STATIC_TABLE_SIZE)
+    {
+        entry.first = STATIC_TABLE[index - 1].name;
+        entry.second = STATIC_TABLE[index - 1].value;
+        return true;
+    }
+
+    index -= STATIC_TABLE_SIZE + 1;
+    if (index >= dynamic_table.size())
+        return false;
+
+    entry = dynamic_table[static_cast<std::size_t>(index)];
+    return true;
+}
+
+void HpackDecoder::evictTo(std::size_t limit)
+{
+    while (table_size > limit && !dynamic_table.empty())
+    {
+        table_size -= dynamic_table.back().first.size() + dynamic_table.back().second.size() + ENTRY_OVERHEAD;
+        dynamic_table.pop_back();
+    }
+}
+
+void HpackDecoder::insert(std::pair<std::string, std::string> entry)
+{
+    std::size_t entry_size = entry.first.size() + entry.second.size() + ENTRY_OVERHEAD;
+
+    // An entry larger than the whole table empties it and is not added (RFC 7541 4.4).
+    evictTo(entry_size > max_table_size ? 0 : max_table_size - entry_size);
+    if (entry_size > max_table_size)
+        return;
+
+    dynamic_table.push_front(std::move(entry));
+    table_size += entry_size;
+}
+
+bool HpackDecoder::decode(const std::uint8_t *data, std::size_t size, HeaderList &headers, std::size_t max_list_size)
+{
+    const std::uint8_t *p = data;
+    const std::uint8_t *end = data + size;
+    std::size_t list_size = 0;
+    bool fields_seen = false;
+
+    while (p < end)
+    {
+        std::uint8_t first = *p;
+        std::pair<std::string, std::string> field;
+
+        if (first & 0x80)
+        {
+            // Indexed header field.
+            std::uint64_t index = 0;
+            if (!decodeInteger(p, end, 7, index) || !lookup(index, field))
+                return false;
+        }
+        else if ((first & 0xe0) == 0x20)
+        {
+            // Dynamic table size update; only allowed before the first field of a block.
+            std::uint64_t new_size = 0;
+            if (fields_seen || !decodeInteger(p, end, 5, new_size) || new_size > settings_table_size)
+                return false;
+            max_table_size = static_cast<std::size_t>(new_size);
+            evictTo(max_table_size);
+            continue;
+        }
+        else
+        {
+            // Literal: with incremental indexing (01), without indexing (0000) or never
+            // indexed (0001). A zero index means the name follows as a string.
+            bool indexing = (first & 0xc0) == 0x40;
+            std::uint64_t index = 0;
+            if (!decodeInteger(p, end, indexing ? 6 : 4, index))
+                return false;
+
+            if (index == 0 ? !decodeString(p, end, field.first) : !lookup(index, field))
+                return false;
+            if (!decodeString(p, end, field.second))
+                return false;
+
+            if (indexing)
+                insert(field);
+        }
+
+        fields_seen = true;
+        list_size += field.first.size() + field.second.size() + ENTRY_OVERHEAD;
+        if (list_size > max_list_size)
+            return false;
+        headers.push_back(std::move(field));
+    }
+    return true;
+}
+
+void proxy_http::hpackEncode(const HeaderList &headers, std::string &out)
+{
+    for (const auto &[name, value] : headers)
+    {
+        std::size_t name_index = 0;
+        std::size_t full_index = 0;
+        for (std::size_t i = 0; i < STATIC_TABLE_SIZE && full_index == 0; ++i)
+        {
+            if (STATIC_TABLE[i].name != name)
+                continue;
+            if (name_index == 0)
+                name_index = i + 1;
+            if (STATIC_TABLE[i].value == value)
+                full_index = i + 1;
+        }
+
+        if (full_index != 0)
+        {
+            encodeInteger(out, 0x80, 7, full_index);
+            continue;
+        }
+
+        // Literal without indexing, so the peer's dynamic table never changes.
+        encodeInteger(out, 0x00, 4, name_index);
+        if (name_index == 0)
+            encodeString(out, name);
+        encodeString(out, value);
+    }
+}
@@ -0,0 +1,50 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+namespace proxy_http
+{
+
+    using HeaderList = std::vector<std::pair<std::string, std::string>>;
+
+    // HPACK (RFC 7541) header block decoder. Holds the connection's dynamic table, so one
+    // decoder serves every header block a peer sends, in the order received.
+    class HpackDecoder
+    {
+    private:
+        std::deque<std::pair<std::string, std::string>> dynamic_table;
+        std::size_t table_size = 0;
+        std::size_t max_table_size;
+        // Ceiling announced in our SETTINGS_HEADER_TABLE_SIZE; size updates may not exceed it.
+        std::size_t settings_table_size;
+
+        bool lookup(std::uint64_t index, std::pair<std::string, std::string> &entry) const;
+        void insert(std::pair<std::string, std::string> entry);
+        void evictTo(std::size_t limit);
+
+    public:
+        explicit HpackDecoder(std::size_t max_table_size = 4096);
+
+        // Appends the block's fields to headers. False on a malformed block or once the
+        // decoded list exceeds max_list_size (name + value + 32 per field); the table is then
+        // out of sync and the connection must be closed.
+        bool decode(const std::uint8_t *data, std::size_t size, HeaderList &headers, std::size_t max_list_size);
+
+        std::size_t tableSize() const { return table_size; }
+    };
+
+    // Encodes without touching the peer's dynamic table: static-table indexes where they
+    // match, literals otherwise, Huffman-coded when that is shorter. Blocks are therefore
+    // independent and can be sent in any order.
+    void hpackEncode(const HeaderList &headers, std::string &out);
+
+    bool huffmanDecode(const std::uint8_t *data, std::size_t size, std::string &out);
+    void huffmanEncode(std::string_view text, std::string &out);
+    std::size_t huffmanEncodedSize(std::string_view text);
+}
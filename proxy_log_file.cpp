@@ -0,0 +1,323 @@
+#include <algorithm>
+#include <cctype>
+#include <filesystem>
+#include <format>
+
+#ifdef __linux__
+#include <fcntl.h>
+#endif
+
+#ifdef PROXY_LOG_ZLIB
+#include <zlib.h>
+#endif
+
+#include "proxy_log_file.hpp"
+
+using namespace proxy_log;
+
+// The writer wakes this often even when the buffer is far from full.
+constexpr std::chrono::milliseconds FLUSH_INTERVAL{100};
+
+constexpr std::size_t COMPRESS_CHUNK = 64 * 1024;
+
+namespace
+{
+    std::atomic<std::uint32_t> reopen_requests{0};
+
+    // <path>.<UTC timestamp>, with a counter when a segment of that second already exists.
+    std::string rotatedName(const std::string &path)
+    {
+        auto now = std::chrono::floor<std::chrono::seconds>(std::chrono::system_clock::now());
+        std::string name = std::format("{}.{:%Y%m%d-%H%M%S}", path, now);
+        std::error_code error;
+        std::string candidate = name;
+        for (int n = 1; std::filesystem::exists(candidate, error) || std::filesystem::exists(candidate + ".gz", error); ++n)
+            candidate = std::format("{}-{}", name, n);
+        return candidate;
+    }
+
+#ifdef PROXY_LOG_ZLIB
+    // name -> name.gz, via a temporary so a half-written archive never looks complete.
+    bool compressFile(const std::string &name)
+    {
+        std::FILE *in = std::fopen(name.c_str(), "rb");
+        if (!in)
+            return false;
+        std::string temporary = name + ".gz.tmp";
+        gzFile out = gzopen(temporary.c_str(), "wb6");
+        if (!out)
+        {
+            std::fclose(in);
+            return false;
+        }
+
+        std::vector<char> chunk(COMPRESS_CHUNK);
+        bool ok = true;
+        std::size_t n;
+        while (ok && (n = std::fread(chunk.data(), 1, chunk.size(), in)) > 0)
+            ok = gzwrite(out, chunk.data(), static_cast<unsigned>(n)) == static_cast<int>(n);
+        ok = !std::ferror(in) && ok;
+        std::fclose(in);
+        ok = gzclose(out) == Z_OK && ok;
+
+        std::error_code error;
+        if (!ok)
+        {
+            std::filesystem::remove(temporary, error);
+            return false;
+        }
+        std::filesystem::rename(temporary, name + ".gz", error);
+        if (error)
+            return false;
+        std::filesystem::remove(name, error);
+        return true;
+    }
+#endif
+}
+
+void proxy_log::requestReopen()
+{
+    reopen_requests.fetch_add(1, std::memory_order_relaxed);
+}
+
+LogFile::~LogFile()
+{
+    close();
+}
+
+bool LogFile::open(const std::string &path, std::size_t buffer_size, bool truncate, Prologue prologue, std::size_t preallocate, Tick tick)
+{
+    this->path = path;
+    this->prologue = std::move(prologue);
+    this->preallocate = preallocate;
+    this->tick = std::move(tick);
+    reopen_generation = reopen_requests.load(std::memory_order_relaxed);
+    if (!openSegment(truncate ? "wb" : "ab"))
+        return false;
+
+    this->buffer_size = buffer_size;
+    front.reserve(buffer_size);
+    back.reserve(buffer_size);
+    stopping = false;
+    maintenance_stopping = false;
+    writer = std::thread(&LogFile::run, this);
+    return true;
+}
+
+bool LogFile::openSegment(const char *mode)
+{
+    file = std::fopen(path.c_str(), mode);
+    if (!file)
+        return false;
+
+    std::fseek(file, 0, SEEK_END);
+    long size = std::ftell(file);
+    segment_size = size > 0 ? static_cast<std::size_t>(size) : 0;
+    segment_opened = std::chrono::steady_clock::now();
+
+    if (segment_size == 0 && prologue)
+    {
+        std::string bytes = prologue();
+        std::fwrite(bytes.data(), 1, bytes.size(), file);
+        std::fflush(file);
+        segment_size = bytes.size();
+        bytes_written.fetch_add(bytes.size(), std::memory_order_relaxed);
+    }
+    segment_base = segment_size;
+
+#ifdef __linux__
+    // Reserve the blocks now so appends do not allocate; the file size is left alone, so
+    // readers never see a zero-filled tail.
+    if (preallocate > 0)
+        fallocate(fileno(file), FALLOC_FL_KEEP_SIZE, 0, static_cast<off_t>(preallocate));
+#endif
+    return true;
+}
+
+void LogFile::close()
+{
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        stopping = true;
+    }
+    flush_needed.notify_one();
+    if (writer.joinable())
+        writer.join();
+
+    {
+        std::lock_guard<std::mutex> lock(maintenance_mutex);
+        maintenance_stopping = true;
+    }
+    maintenance_ready.notify_one();
+    if (maintainer.joinable())
+        maintainer.join();
+
+    if (file)
+    {
+        std::fclose(file);
+        file = nullptr;
+    }
+}
+
+void LogFile::setRotation(const RotationConfig &config)
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    rotation = config;
+}
+
+bool LogFile::append(const char *data, std::size_t length, bool forced)
+{
+    bool wake = false;
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        if (stopping || (!forced && front.size() + length > buffer_size))
+        {
+            dropped.fetch_add(1, std::memory_order_relaxed);
+            return false;
+        }
+        std::size_t before = front.size();
+        front.insert(front.end(), data, data + length);
+        wake = before < buffer_size / 2 && front.size() >= buffer_size / 2;
+    }
+    if (wake)
+        flush_needed.notify_one();
+    return true;
+}
+
+void LogFile::run()
+{
+    bool done = false;
+    while (!done)
+    {
+        // Whatever the tick appends goes out with this pass.
+        if (tick)
+            tick();
+
+        RotationConfig config;
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+            flush_needed.wait_for(lock, FLUSH_INTERVAL, [this]
+                                  { return stopping || front.size() >= buffer_size / 2; });
+            done = stopping;
+            front.swap(back);
+            config = rotation;
+        }
+
+        std::uint32_t requested = reopen_requests.load(std::memory_order_relaxed);
+        if (requested != reopen_generation)
+        {
+            reopen_generation = requested;
+            if (file)
+                std::fclose(file);
+            file = nullptr;
+            reopens.fetch_add(1, std::memory_order_relaxed);
+        }
+        // Also retries a path that could not be opened last time.
+        if (!file)
+            openSegment("ab");
+
+        if (!back.empty())
+        {
+            if (file)
+            {
+                std::fwrite(back.data(), 1, back.size(), file);
+                std::fflush(file);
+                segment_size += back.size();
+                bytes_written.fetch_add(back.size(), std::memory_order_relaxed);
+            }
+            else
+                dropped.fetch_add(1, std::memory_order_relaxed);
+            back.clear();
+        }
+
+        bool too_big = config.max_size > 0 && segment_size >= config.max_size;
+        bool too_old = config.interval.count() > 0 && std::chrono::steady_clock::now() - segment_opened >= config.interval;
+        if (file && !done && segment_size > segment_base && (too_big || too_old))
+            rotate(config);
+    }
+}
+
+void LogFile::rotate(const RotationConfig &config)
+{
+    std::fclose(file);
+    file = nullptr;
+
+    std::string name = rotatedName(path);
+    std::error_code error;
+    std::filesystem::rename(path, name, error);
+    openSegment("ab");
+    if (error)
+        return;
+    rotations.fetch_add(1, std::memory_order_relaxed);
+
+    if (!config.compress && config.keep == 0)
+        return;
+    {
+        std::lock_guard<std::mutex> lock(maintenance_mutex);
+        rotated.push_back(std::move(name));
+    }
+    if (!maintainer.joinable())
+        maintainer = std::thread(&LogFile::maintain, this);
+    maintenance_ready.notify_one();
+}
+
+void LogFile::maintain()
+{
+    while (true)
+    {
+        std::string name;
+        {
+            std::unique_lock<std::mutex> lock(maintenance_mutex);
+            maintenance_ready.wait(lock, [this]
+                                   { return maintenance_stopping || !rotated.empty(); });
+            if (rotated.empty())
+                return;
+            name = std::move(rotated.front());
+            rotated.pop_front();
+        }
+
+        RotationConfig config;
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            config = rotation;
+        }
+#ifdef PROXY_LOG_ZLIB
+        if (config.compress)
+            compressFile(name);
+#endif
+        prune(config.keep);
+    }
+}
+
+void LogFile::prune(std::size_t keep)
+{
+    if (keep == 0)
+        return;
+
+    std::filesystem::path base(path);
+    std::filesystem::path directory = base.has_parent_path() ? base.parent_path() : std::filesystem::path(".");
+    std::string prefix = base.filename().string() + ".";
+
+    // Rotated names start with a digit after the prefix; timestamps sort by name.
+    std::vector<std::filesystem::path> segments;
+    std::error_code error;
+    for (const auto &entry : std::filesystem::directory_iterator(directory, error))
+    {
+        std::string name = entry.path().filename().string();
+        if (name.size() > prefix.size() && name.starts_with(prefix) && std::isdigit(static_cast<unsigned char>(name[prefix.size()])) &&
+            !name.ends_with(".tmp"))
+            segments.push_back(entry.path());
+    }
+    if (segments.size() <= keep)
+        return;
+
+    std::sort(segments.begin(), segments.end());
+    for (std::size_t i = 0; i + keep < segments.size(); ++i)
+        std::filesystem::remove(segments[i], error);
+}
+
+LogFileStats LogFile::stats() const
+{
+    return {bytes_written.load(std::memory_order_relaxed), dropped.load(std::memory_order_relaxed),
+            rotations.load(std::memory_order_relaxed), reopens.load(std::memory_order_relaxed)};
+}
@@ -0,0 +1,111 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <cstdio>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace proxy_log
+{
+
+    struct RotationConfig
+    {
+        std::size_t max_size = 0;              // bytes per segment; 0: no size limit
+        std::chrono::milliseconds interval{0}; // segment age; 0: no time-based rotation
+        std::size_t keep = 0;                  // rotated segments kept; 0: all
+        bool compress = false;                 // gzip rotated segments (builds with zlib)
+    };
+
+    struct LogFileStats
+    {
+        std::uint64_t bytes_written;
+        std::uint64_t dropped; // appends refused because the buffer was full
+        std::uint64_t rotations;
+        std::uint64_t reopens;
+    };
+
+    // Asks every open LogFile to close and reopen its path on the next writer pass, for an
+    // external logrotate that has moved the file away. Only stores to an atomic, so it may
+    // be called from a signal handler.
+    void requestReopen();
+
+    // An append-only log file written by a background thread. Callers copy bytes into a
+    // buffer under a short lock; the writer thread swaps the buffer out, writes it, and is
+    // the only one to rename, reopen or rotate the file, so appends never wait on disk.
+    // Rotated segments are renamed to <path>.<UTC timestamp> and handed to a second thread
+    // that compresses and prunes them.
+    class LogFile
+    {
+    public:
+        // Bytes to start every new, empty segment with (a file header); may be empty.
+        using Prologue = std::function<std::string()>;
+        // Run by the writer thread at the start of every pass; it may append.
+        using Tick = std::function<void()>;
+
+    private:
+        std::string path;
+        std::FILE *file = nullptr;
+        std::size_t segment_size = 0;
+        std::size_t segment_base = 0; // size at open: a segment with nothing new is not rotated
+        std::chrono::steady_clock::time_point segment_opened;
+        std::size_t preallocate = 0;
+        Prologue prologue;
+        Tick tick;
+        std::uint32_t reopen_generation = 0;
+
+        std::mutex mutex;
+        std::condition_variable flush_needed;
+        std::vector<char> front;
+        std::vector<char> back;
+        std::size_t buffer_size = 0;
+        RotationConfig rotation;
+        bool stopping = false;
+        std::thread writer;
+
+        std::mutex maintenance_mutex;
+        std::condition_variable maintenance_ready;
+        std::deque<std::string> rotated;
+        bool maintenance_stopping = false;
+        std::thread maintainer;
+
+        std::atomic<std::uint64_t> bytes_written{0};
+        std::atomic<std::uint64_t> dropped{0};
+        std::atomic<std::uint64_t> rotations{0};
+        std::atomic<std::uint64_t> reopens{0};
+
+        bool openSegment(const char *mode);
+        void rotate(const RotationConfig &config);
+        void run();
+        void maintain();
+        void prune(std::size_t keep);
+
+    public:
+        LogFile() = default;
+        ~LogFile();
+
+        LogFile(const LogFile &) = delete;
+        LogFile &operator=(const LogFile &) = delete;
+
+        // Opens path (appending, or truncating it) and starts the writer thread.
+        bool open(const std::string &path, std::size_t buffer_size, bool truncate, Prologue prologue = {},
+                  std::size_t preallocate = 0, Tick tick = {});
+        // Writes what is buffered, waits for pending compression and closes the file.
+        void close();
+
+        // Takes effect from the next writer pass.
+        void setRotation(const RotationConfig &config);
+
+        // Copies data into the buffer; false (counted as dropped) when it is full. forced
+        // appends ignore the limit, for the few records a reader cannot do without.
+        bool append(const char *data, std::size_t length, bool forced = false);
+
+        LogFileStats stats() const;
+    };
+}
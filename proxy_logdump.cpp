@@ -0,0 +1,58 @@
+#include <iostream>
+#include <string>
+#include <string_view>
+
+#include "proxy_binlog.hpp"
+
+// Decodes a binary log written with [log] format = binary.
+//
+//   proxy_logdump [--json] proxy.blog
+//
+// Without --json the output is what proxy.log would have held, so log_analyzer.html and
+// existing greps keep working: proxy_logdump proxy.blog > proxy.log
+int main(int argc, char *argv[])
+{
+    bool json = false;
+    std::string path;
+    for (int i = 1; i < argc; ++i)
+    {
+        std::string_view arg = argv[i];
+        if (arg == "--json")
+            json = true;
+        else if (path.empty() && !arg.starts_with("--"))
+            path = arg;
+        else
+        {
+            path.clear();
+            break;
+        }
+    }
+    if (path.empty())
+    {
+        std::cerr << "usage: proxy_logdump [--json] <binary log>\n";
+        return 2;
+    }
+
+    proxy_log::BinaryLogReader reader;
+    if (!reader.open(path))
+    {
+        std::cerr << "proxy_logdump: " << path << " is not a readable binary log\n";
+        return 1;
+    }
+
+    proxy_log::LogEvent event;
+    while (reader.next(event))
+    {
+        if (json)
+            std::cout << proxy_log::formatJsonLine(event) << '\n';
+        else
+            std::cout << proxy_log::formatTextLine(event);
+    }
+
+    if (reader.wasTruncated())
+    {
+        std::cerr << "proxy_logdump: " << path << " ends inside a record; the rest was skipped\n";
+        return 1;
+    }
+    return 0;
+}
@@ -1,37 +1,281 @@
 #include "proxy_logger.hpp"
 #include <chrono>
+#include <unordered_map>
+#include <algorithm>
+#include <iterator>
+#include <utility>
 
 ProxyLogger& ProxyLogger::getInstance() {
     static ProxyLogger instance;
     return instance;
 }
 
-ProxyLogger::ProxyLogger() {
-    m_file = std::make_unique<std::ofstream>("proxy.log", std::ios::app);
-    
-    if (m_file->is_open()) {
-        *m_file << "[INFO]|SYSTEM|Logger initialized via unique_ptr.\n";
+namespace {
+    constexpr const char *TEXT_LOG_PATH = "proxy.log";
+    // Lines buffered between writer passes (every 100 ms); beyond this they are dropped.
+    constexpr std::size_t TEXT_BUFFER_SIZE = 1 << 20;
+
+    // Sampling compares a 32-bit random draw against rate * 2^32.
+    constexpr std::uint64_t SAMPLE_ALL = std::uint64_t(1) << 32;
+
+    std::atomic<std::uint64_t> sampling_seeds{0};
+
+    // splitmix64 over a counter: distinct, well-mixed, never zero in practice.
+    std::uint64_t nextSamplingSeed() {
+        std::uint64_t z = sampling_seeds.fetch_add(0x9E3779B97F4A7C15ULL, std::memory_order_relaxed) + 0x9E3779B97F4A7C15ULL;
+        z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+        z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+        return (z ^ (z >> 31)) | 1;
+    }
+
+    std::int64_t steadyMilliseconds() {
+        return std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+    }
+
+    // "LEVEL|SUBSYS|text {}\n" without the newline, for notices that quote a format.
+    std::string_view withoutNewline(std::string_view fmt) {
+        while (!fmt.empty() && (fmt.back() == '\n' || fmt.back() == '\r')) fmt.remove_suffix(1);
+        return fmt;
     }
+
+    using CallSite = std::pair<const char *, const char *>;
+
+    struct CallSiteHash {
+        std::size_t operator()(const CallSite &site) const {
+            return std::hash<const char *>{}(site.first) * 31 + std::hash<const char *>{}(site.second);
+        }
+    };
+
+    constexpr std::string_view LEVEL_NAMES[] = {"debug", "info", "warn", "error", "off"};
+    constexpr std::string_view SUBSYSTEM_NAMES[LOG_SUBSYSTEM_COUNT] = {"server", "client", "cache", "remote", "connect", "cluster", "config"};
+}
+
+std::string_view logLevelName(LogLevel level) {
+    return LEVEL_NAMES[static_cast<std::size_t>(level)];
+}
+
+bool parseLogLevel(std::string_view name, LogLevel &level) {
+    for (std::size_t i = 0; i < std::size(LEVEL_NAMES); ++i) {
+        if (LEVEL_NAMES[i] == name) {
+            level = static_cast<LogLevel>(i);
+            return true;
+        }
+    }
+    return false;
+}
+
+std::string_view logSubsystemName(LogSubsystem subsystem) {
+    return SUBSYSTEM_NAMES[static_cast<std::size_t>(subsystem)];
+}
+
+bool parseLogSubsystem(std::string_view name, LogSubsystem &subsystem) {
+    for (std::size_t i = 0; i < LOG_SUBSYSTEM_COUNT; ++i) {
+        if (SUBSYSTEM_NAMES[i] == name) {
+            subsystem = static_cast<LogSubsystem>(i);
+            return true;
+        }
+    }
+    return false;
+}
+
+ProxyLogger::ProxyLogger() {
+    for (auto &level : m_levels) level.store(LogLevel::Info, std::memory_order_relaxed);
+    for (auto &threshold : m_sample_thresholds) threshold.store(SAMPLE_ALL, std::memory_order_relaxed);
+
+    m_zone = std::chrono::current_zone();
+    m_text.open(TEXT_LOG_PATH, TEXT_BUFFER_SIZE, false, {}, 0, [this] { flush_suppressed(); });
+    constexpr std::string_view banner = "[INFO]|SYSTEM|Logger initialized.\n";
+    m_text.append(banner.data(), banner.size());
 }
 
 ProxyLogger::~ProxyLogger() {
-    if (m_file && m_file->is_open()) {
-        m_file->close();
+    m_binlog.close();
+    m_text.close();
+}
+
+void ProxyLogger::log_formatted(std::string_view prefix, std::string_view fmt, std::format_args args) {
+    thread_local proxy_log::TimestampFormatter timestamps(m_zone);
+
+    std::string line;
+    timestamps.append(line, std::chrono::system_clock::now());
+    line += prefix;
+    std::vformat_to(std::back_inserter(line), fmt, args);
+
+    // Only the buffer copy is serialized; the writer thread does the file I/O.
+    m_text.append(line.data(), line.size());
+}
+
+bool ProxyLogger::configure(const LogConfig &config) {
+    for (std::size_t i = 0; i < LOG_SUBSYSTEM_COUNT; ++i)
+        m_levels[i].store(config.levels[i], std::memory_order_relaxed);
+    for (std::size_t i = 0; i < LOG_SUBSYSTEM_COUNT; ++i)
+        set_sample_rate(static_cast<LogSubsystem>(i), config.sample_rates[i]);
+    m_rate_limit.store(config.rate_limit, std::memory_order_relaxed);
+    m_rate_interval_ms.store(config.rate_interval.count(), std::memory_order_relaxed);
+    m_error_budget.store(config.error_budget, std::memory_order_relaxed);
+    m_first_budget.store(config.first_budget, std::memory_order_relaxed);
+    m_text.setRotation(config.rotation);
+    m_binlog.setRotation(config.rotation);
+
+    if (!config.binary) return true;
+
+    if (!m_binlog.open(config.binary_log)) {
+        log("ERROR|SYSTEM|Cannot open binary log {}, staying with the text log.\n", config.binary_log.path);
+        return false;
     }
+    log("INFO|SYSTEM|Logging to binary log {}\n", config.binary_log.path);
+    m_binary = true;
+    return true;
+}
+
+std::uint32_t ProxyLogger::format_id(std::string_view prefix, std::string_view fmt) {
+    // Prefixes and format strings are static, so their addresses identify the call site
+    // (identical literals may be merged, hence the pair); the shared table behind
+    // formatId() is only consulted the first time a thread meets one.
+    thread_local std::unordered_map<CallSite, std::uint32_t, CallSiteHash> ids;
+    CallSite site{prefix.data(), fmt.data()};
+    auto it = ids.find(site);
+    if (it != ids.end()) return it->second;
+    return ids[site] = m_binlog.formatId(std::string(prefix) + std::string(fmt));
+}
+
+void ProxyLogger::set_sample_rate(LogSubsystem subsystem, double rate) {
+    rate = std::clamp(rate, 0.0, 1.0);
+    m_sample_thresholds[static_cast<std::size_t>(subsystem)].store(static_cast<std::uint64_t>(rate * double(SAMPLE_ALL)), std::memory_order_relaxed);
+}
+
+double ProxyLogger::sample_rate(LogSubsystem subsystem) const {
+    return double(m_sample_thresholds[static_cast<std::size_t>(subsystem)].load(std::memory_order_relaxed)) / double(SAMPLE_ALL);
+}
+
+bool ProxyLogger::sampled(LogSubsystem subsystem) {
+    std::uint64_t threshold = m_sample_thresholds[static_cast<std::size_t>(subsystem)].load(std::memory_order_relaxed);
+    if (threshold >= SAMPLE_ALL) return true;
+
+    // xorshift64 per thread; quality beyond "uncorrelated with the request" is not needed.
+    // Seeds come from a shared counter: client threads are short-lived and reuse addresses.
+    thread_local std::uint64_t state = nextSamplingSeed();
+    state ^= state << 13;
+    state ^= state >> 7;
+    state ^= state << 17;
+    if ((state >> 32) < threshold) return true;
+
+    m_sampled_out.fetch_add(1, std::memory_order_relaxed);
+    return false;
 }
 
-void ProxyLogger::log_formatted(std::string_view fmt, std::format_args args) {
-    if (!m_file || !m_file->is_open()) return;
+void ProxyLogger::roll_budget_second(std::int64_t now_ms) {
+    std::int64_t second = now_ms / 1000;
+    std::int64_t current = m_budget_second.load(std::memory_order_relaxed);
+    if (second == current || !m_budget_second.compare_exchange_strong(current, second, std::memory_order_relaxed)) return;
 
-    std::string message = std::vformat(fmt, args);
-    
-    const auto now = std::chrono::system_clock::now();
-    const auto local_time = std::chrono::zoned_time{std::chrono::current_zone(), now};
+    m_budget_used.store(0, std::memory_order_relaxed);
+    m_first_used.store(0, std::memory_order_relaxed);
+    std::uint64_t dropped = m_budget_pending.exchange(0, std::memory_order_relaxed);
+    if (dropped > 0)
+        internal_log("WARN|LOG|Dropped {} warning/error line(s) over the budget of {} per second\n", dropped,
+                     m_error_budget.load(std::memory_order_relaxed));
+}
+
+bool ProxyLogger::within_budget(std::int64_t now_ms, bool first) {
+    std::uint32_t budget = m_error_budget.load(std::memory_order_relaxed);
+    if (budget == 0) return true;
+
+    roll_budget_second(now_ms);
+    if (m_budget_used.fetch_add(1, std::memory_order_relaxed) < budget) return true;
+    // Keys colliding in a rate slot keep looking new, so first occurrences get a capped
+    // allowance of their own rather than a free pass.
+    if (first && m_first_used.fetch_add(1, std::memory_order_relaxed) < m_first_budget.load(std::memory_order_relaxed))
+        return true;
+    m_budget_pending.fetch_add(1, std::memory_order_relaxed);
+    m_over_budget.fetch_add(1, std::memory_order_relaxed);
+    return false;
+}
+
+void ProxyLogger::report_suppressed(std::uint64_t count, std::string_view prefix, std::string_view fmt) {
+    internal_log("WARN|LOG|Suppressed {} similar message(s): {}{}\n", count, prefix, withoutNewline(fmt));
+}
+
+bool ProxyLogger::admit(std::uint64_t key, std::string_view fmt, std::string_view prefix) {
+    const std::int64_t now = steadyMilliseconds();
+    RateSlot &slot = m_rate_slots[key % RATE_SLOTS];
 
-    std::lock_guard<std::mutex> lock(m_mutex);
+    std::uint64_t suppressed = 0;
+    std::uint64_t lost = 0;
+    std::string_view lost_fmt, lost_prefix;
+    bool first = false;
+    {
+        std::lock_guard<std::mutex> lock(slot.mutex);
+        if (slot.key != key) {
+            // First occurrence, or the slot's previous message went quiet and lost it; what
+            // that message still had suppressed is reported below, not forgotten.
+            lost = std::exchange(slot.suppressed, 0);
+            lost_fmt = slot.fmt;
+            lost_prefix = slot.prefix;
+            slot.key = key;
+            slot.fmt = fmt;
+            slot.prefix = prefix;
+            slot.window_start = now;
+            slot.count = 1;
+            first = true;
+        } else if (now - slot.window_start >= m_rate_interval_ms.load(std::memory_order_relaxed)) {
+            slot.window_start = now;
+            slot.count = 1;
+            suppressed = std::exchange(slot.suppressed, 0);
+        } else if (slot.count++ >= m_rate_limit.load(std::memory_order_relaxed)) {
+            ++slot.suppressed;
+            m_suppressed.fetch_add(1, std::memory_order_relaxed);
+            m_unreported.store(true, std::memory_order_relaxed);
+            return false;
+        }
+    }
+    if (lost > 0) report_suppressed(lost, lost_prefix, lost_fmt);
+
+    if (!within_budget(now, first)) {
+        if (suppressed > 0) {
+            // Report these with the next line that gets through, or from the writer's pass.
+            std::lock_guard<std::mutex> lock(slot.mutex);
+            if (slot.key == key) {
+                slot.suppressed += std::exchange(suppressed, 0);
+                m_unreported.store(true, std::memory_order_relaxed);
+            }
+        }
+        // Unless the slot has changed hands meanwhile.
+        if (suppressed > 0) report_suppressed(suppressed, prefix, fmt);
+        return false;
+    }
+    if (suppressed > 0) report_suppressed(suppressed, prefix, fmt);
+    return true;
+}
 
-    *m_file << std::format("[{:%Y-%m-%d %H:%M:%S}] ", local_time) 
-            << message;
+void ProxyLogger::flush_suppressed() {
+    const std::int64_t now = steadyMilliseconds();
+    roll_budget_second(now);
+    if (!m_unreported.exchange(false, std::memory_order_relaxed)) return;
+
+    // A slot is reported once its window is over, as a later line from it would have done.
+    const std::int64_t interval = m_rate_interval_ms.load(std::memory_order_relaxed);
+    bool waiting = false;
+    for (RateSlot &slot : m_rate_slots) {
+        std::uint64_t count = 0;
+        std::string_view fmt, prefix;
+        {
+            std::lock_guard<std::mutex> lock(slot.mutex);
+            if (slot.suppressed == 0) continue;
+            if (now - slot.window_start < interval) {
+                waiting = true;
+                continue;
+            }
+            count = std::exchange(slot.suppressed, 0);
+            fmt = slot.fmt;
+            prefix = slot.prefix;
+        }
+        report_suppressed(count, prefix, fmt);
+    }
+    if (waiting) m_unreported.store(true, std::memory_order_relaxed);
+}
 
-    m_file->flush();
+LogStats ProxyLogger::stats() const {
+    return {m_suppressed.load(std::memory_order_relaxed), m_over_budget.load(std::memory_order_relaxed),
+            m_sampled_out.load(std::memory_order_relaxed)};
 }
\ No newline at end of file
@@ -1,12 +1,142 @@
 #pragma once
 
 #include <string>
-#include <memory>
-#include <mutex>
-#include <fstream>
+#include <algorithm>
+#include <atomic>
 #include <format>
 #include <string_view>
+#include <array>
+#include <chrono>
+#include <cstdint>
+#include <functional>
+#include <mutex>
+#include <type_traits>
+
+#include "proxy_binlog.hpp"
+#include "proxy_log_file.hpp"
+
+enum class LogLevel : std::uint8_t
+{
+    Debug,
+    Info,
+    Warn,
+    Error,
+    Off
+};
+
+enum class LogSubsystem : std::uint8_t
+{
+    Server,  // startup, accept loop, shutdown
+    Client,  // request parsing and client-side I/O
+    Cache,   // hits, misses, stores, negative and sibling lookups
+    Remote,  // origin and parent connections, forwarding, upstream HTTP/2 sessions
+    Connect, // CONNECT tunnels and TLS interception
+    Cluster, // peer links, sibling probes and digests
+    Config   // configuration loading and validation
+};
+
+constexpr std::size_t LOG_SUBSYSTEM_COUNT = 7;
+
+// Levels below this are compiled out of log<Level, Subsystem>(); the build sets it
+// (PROXY_LOG_MIN_LEVEL=1 drops Debug).
+#ifndef PROXY_LOG_MIN_LEVEL
+#define PROXY_LOG_MIN_LEVEL 0
+#endif
+constexpr LogLevel LOG_COMPILED_LEVEL = static_cast<LogLevel>(PROXY_LOG_MIN_LEVEL);
+
+// Tags that log<Level, Subsystem>() writes in front of each line, so a line always names
+// the level and subsystem its filters act on.
+constexpr std::string_view LOG_LEVEL_TAGS[] = {"DEBUG", "INFO", "WARN", "ERROR"};
+constexpr std::string_view LOG_SUBSYSTEM_TAGS[LOG_SUBSYSTEM_COUNT] = {"SERVER", "CLIENT", "CACHE", "REMOTE", "CONNECT", "CLUSTER", "CONFIG"};
 
+// "LEVEL|SUBSYSTEM|" as one static string per instantiation; its address identifies it.
+template <LogLevel Level, LogSubsystem Subsystem>
+struct LogPrefix
+{
+    static constexpr std::string_view level = LOG_LEVEL_TAGS[static_cast<std::size_t>(Level)];
+    static constexpr std::string_view subsystem = LOG_SUBSYSTEM_TAGS[static_cast<std::size_t>(Subsystem)];
+    static constexpr std::array<char, level.size() + subsystem.size() + 2> text = [] {
+        std::array<char, level.size() + subsystem.size() + 2> out{};
+        auto end = std::copy(level.begin(), level.end(), out.begin());
+        *end++ = '|';
+        end = std::copy(subsystem.begin(), subsystem.end(), end);
+        *end = '|';
+        return out;
+    }();
+    static constexpr std::string_view value{text.data(), text.size()};
+};
+
+// Format string of a log<Level, Subsystem>() call: a literal holding what follows the
+// prefix. One that still starts with a level tag does not compile.
+struct LogFormat
+{
+    std::string_view text;
+
+    template <std::size_t N>
+    consteval LogFormat(const char (&literal)[N]) : text(literal, N - 1)
+    {
+        for (std::string_view tag : LOG_LEVEL_TAGS) {
+            if (text.starts_with(tag) && text.substr(tag.size()).starts_with('|'))
+                throw "log<Level, Subsystem>() writes the LEVEL|SUBSYSTEM| prefix itself";
+        }
+    }
+};
+
+std::string_view logLevelName(LogLevel level);
+bool parseLogLevel(std::string_view name, LogLevel &level);
+std::string_view logSubsystemName(LogSubsystem subsystem);
+bool parseLogSubsystem(std::string_view name, LogSubsystem &subsystem);
+
+struct LogConfig
+{
+    // format = binary: events go to binary_log instead of proxy.log; read them back with
+    // proxy_logdump.
+    bool binary = false;
+    proxy_log::BinaryLogConfig binary_log;
+
+    // Applies to proxy.log and the binary log alike.
+    proxy_log::RotationConfig rotation;
+
+    // Runtime threshold per subsystem, indexed by LogSubsystem.
+    std::array<LogLevel, LOG_SUBSYSTEM_COUNT> levels = {LogLevel::Info, LogLevel::Info, LogLevel::Info, LogLevel::Info,
+                                                        LogLevel::Info, LogLevel::Info, LogLevel::Info};
+
+    // Warn and Error lines: at most rate_limit similar ones (same call site and same text
+    // arguments) per rate_interval, and error_budget per second in all (0: no cap). Once
+    // the budget is spent, up to first_budget more lines per second may still go out if
+    // they are the first occurrence of their message, so a new failure shows up mid-storm.
+    std::uint32_t rate_limit = 10;
+    std::chrono::milliseconds rate_interval{std::chrono::seconds(1)};
+    std::uint32_t error_budget = 200;
+    std::uint32_t first_budget = 20;
+
+    // Share of Debug and Info lines written, per subsystem.
+    std::array<double, LOG_SUBSYSTEM_COUNT> sample_rates = {1.0, 1.0, 1.0, 1.0, 1.0, 1.0, 1.0};
+};
+
+struct LogStats
+{
+    std::uint64_t suppressed;     // over the per-message rate limit
+    std::uint64_t over_budget;    // over error_budget
+    std::uint64_t sampled_out;
+};
+
+// Identifies "similar" messages: the call site plus its text arguments. Numbers (client
+// ids, ports, byte counts, error codes) are left out so that a storm of one failure
+// against one host collapses to one key.
+template <typename... Args>
+std::uint64_t logSimilarityKey(std::string_view fmt, const Args &...args)
+{
+    std::uint64_t key = std::hash<const void *>{}(fmt.data());
+    [[maybe_unused]] auto mix = [&key](const auto &arg)
+    {
+        using T = std::remove_cvref_t<decltype(arg)>;
+        if constexpr (!std::is_arithmetic_v<T> && std::is_convertible_v<const T &, std::string_view>)
+            key = (key ^ std::hash<std::string_view>{}(std::string_view(arg))) * 0x100000001b3ULL;
+    };
+    (mix(args), ...);
+    return key;
+}
 
 class ProxyLogger
 {
@@ -16,24 +146,151 @@ public:
     template <typename... Args>
     void internal_log(std::string_view fmt, Args &&...args)
     {
-        log_formatted(fmt, std::make_format_args(args...));
+        internal_log_prefixed({}, fmt, std::forward<Args>(args)...);
+    }
+
+    // prefix is a LogPrefix value: a static string written ahead of the formatted text.
+    template <typename... Args>
+    void internal_log_prefixed(std::string_view prefix, std::string_view fmt, Args &&...args)
+    {
+        if (m_binary.load(std::memory_order_relaxed))
+            log_binary(prefix, fmt, args...);
+        else
+            log_formatted(prefix, fmt, std::make_format_args(args...));
     }
 
     ProxyLogger(const ProxyLogger &) = delete;
     ProxyLogger &operator=(const ProxyLogger &) = delete;
 
-    void log_formatted(std::string_view fmt, std::format_args args);
+    void log_formatted(std::string_view prefix, std::string_view fmt, std::format_args args);
+
+    // Switches to the binary log when config asks for it. Call before other threads log.
+    bool configure(const LogConfig &config);
+
+    bool binary() const { return m_binary.load(std::memory_order_relaxed); }
+
+    bool enabled(LogLevel level, LogSubsystem subsystem) const {
+        return level >= m_levels[static_cast<std::size_t>(subsystem)].load(std::memory_order_relaxed);
+    }
+    void set_level(LogSubsystem subsystem, LogLevel level) {
+        m_levels[static_cast<std::size_t>(subsystem)].store(level, std::memory_order_relaxed);
+    }
+    LogLevel level(LogSubsystem subsystem) const {
+        return m_levels[static_cast<std::size_t>(subsystem)].load(std::memory_order_relaxed);
+    }
+    proxy_log::BinaryLogStats binary_stats() const { return m_binlog.stats(); }
+    proxy_log::LogFileStats text_stats() const { return m_text.stats(); }
+
+    // Whether a Debug/Info line of subsystem survives sampling.
+    bool sampled(LogSubsystem subsystem);
+    // Whether a Warn/Error line with this similarity key may be written. Writes the
+    // "suppressed N similar messages" notice for it (quoting prefix and fmt) when its
+    // window rolls over, or when another key takes its slot. fmt and prefix are quoted
+    // later too, so they must be static strings.
+    bool admit(std::uint64_t key, std::string_view fmt, std::string_view prefix = {});
+    LogStats stats() const;
+    // Runtime sampling change, as from the admin listener; rate in [0, 1].
+    void set_sample_rate(LogSubsystem subsystem, double rate);
+    double sample_rate(LogSubsystem subsystem) const;
 
 private:
     ProxyLogger();
     ~ProxyLogger();
 
-    std::unique_ptr<std::ofstream> m_file;
-    std::mutex m_mutex;
+    // No formatting, time zone or file I/O here: the arguments are copied raw next to a
+    // format id and a steady clock reading, and the writer thread does the rest.
+    template <typename... Args>
+    void log_binary(std::string_view prefix, std::string_view fmt, const Args &...args)
+    {
+        char record[proxy_log::MAX_EVENT_SIZE];
+        proxy_log::EventEncoder encoder(record, sizeof(record));
+        encoder.begin(format_id(prefix, fmt), proxy_log::eventTimestamp());
+        (encoder.add(args), ...);
+        m_binlog.append(record, encoder.finish());
+    }
+
+    std::uint32_t format_id(std::string_view prefix, std::string_view fmt);
+    // Counts a Warn/Error line against error_budget; a first occurrence that finds it spent
+    // falls back on first_budget.
+    bool within_budget(std::int64_t now_ms, bool first);
+    // Starts a new budget second once now_ms is past the current one, reporting what the
+    // last one dropped.
+    void roll_budget_second(std::int64_t now_ms);
+    void report_suppressed(std::uint64_t count, std::string_view prefix, std::string_view fmt);
+    // Run from the text writer's pass: writes the notices a storm that stopped would
+    // otherwise never get, since no later line arrives to carry them.
+    void flush_suppressed();
+
+    proxy_log::LogFile m_text;
+    // Looked up once; every thread's timestamp formatter reuses it.
+    const std::chrono::time_zone *m_zone = nullptr;
+
+    std::atomic<LogLevel> m_levels[LOG_SUBSYSTEM_COUNT];
+
+    // One slot per similarity key (hashed, collisions take the slot over). The lock is only
+    // taken on the Warn/Error path, and rarely contended: keys spread over the slots.
+    struct RateSlot
+    {
+        std::mutex mutex;
+        std::uint64_t key = 0;
+        std::int64_t window_start = 0;
+        std::uint32_t count = 0;
+        std::uint64_t suppressed = 0;
+        // The owning message, quoted when its suppressed lines are reported.
+        std::string_view fmt;
+        std::string_view prefix;
+    };
+    static constexpr std::size_t RATE_SLOTS = 1024;
+    RateSlot m_rate_slots[RATE_SLOTS];
+    std::atomic<std::uint32_t> m_rate_limit{10};
+    std::atomic<std::int64_t> m_rate_interval_ms{1000};
+    std::atomic<bool> m_unreported{false}; // some slot holds suppressed lines
+
+    std::atomic<std::uint32_t> m_error_budget{200};
+    std::atomic<std::int64_t> m_budget_second{0};
+    std::atomic<std::uint32_t> m_budget_used{0};
+    std::atomic<std::uint32_t> m_first_budget{20};
+    std::atomic<std::uint32_t> m_first_used{0};
+    std::atomic<std::uint64_t> m_budget_pending{0}; // dropped this second, not yet reported
+
+    // Sampling threshold against a 32-bit random draw; 1 << 32 keeps everything.
+    std::atomic<std::uint64_t> m_sample_thresholds[LOG_SUBSYSTEM_COUNT];
+
+    std::atomic<std::uint64_t> m_suppressed{0};
+    std::atomic<std::uint64_t> m_over_budget{0};
+    std::atomic<std::uint64_t> m_sampled_out{0};
+    std::atomic<bool> m_binary{false};
+    proxy_log::BinaryLogWriter m_binlog;
 };
 
 template <typename... Args>
 void log(std::string_view fmt, Args &&...args)
 {
     ProxyLogger::getInstance().internal_log(fmt, std::forward<Args>(args)...);
+}
+
+// Filtered logging: Level and Subsystem are checked against the compiled minimum, so
+// disabled calls generate no code, and then against the subsystem's runtime level (one
+// relaxed load). They also make the line's "LEVEL|SUBSYSTEM|" prefix; fmt is the rest.
+// Pass plain values: the caller still evaluates the argument expressions, and only
+// side-effect-free ones disappear with the call. Debug and Info lines are then sampled;
+// Warn and Error lines are deduplicated and rate limited before anything is formatted.
+template <LogLevel Level, LogSubsystem Subsystem, typename... Args>
+void log(LogFormat fmt, Args &&...args)
+{
+    if constexpr (Level >= LOG_COMPILED_LEVEL)
+    {
+        constexpr std::string_view prefix = LogPrefix<Level, Subsystem>::value;
+        ProxyLogger &logger = ProxyLogger::getInstance();
+        if (!logger.enabled(Level, Subsystem))
+            return;
+        if constexpr (Level <= LogLevel::Info)
+        {
+            if (!logger.sampled(Subsystem))
+                return;
+        }
+        else if (!logger.admit(logSimilarityKey(fmt.text, args...), fmt.text, prefix))
+            return;
+        logger.internal_log_prefixed(prefix, fmt.text, std::forward<Args>(args)...);
+    }
 }
\ No newline at end of file
@@ -8,8 +8,11 @@
 
 #include "proxy_utils.hpp"
 #include "proxy_cache.hpp"
+#include "proxy_negative_cache.hpp"
 #include "proxy_logger.hpp"
 #include "proxy_handler.hpp"
+#include "proxy_config.hpp"
+#include "proxy_admin.hpp"
 
 constexpr int DEFAULT_PORT = 8080;
 constexpr int MAX_CONNECTIONS = 2000;
@@ -22,7 +25,7 @@ void console_handler(int signal)
 {
     if (signal == SIGINT || signal ==SIGTERM)
     {
-        log("INFO|SERVER|Signal for shutdown received...\n");
+        log<LogLevel::Info, LogSubsystem::Server>("Signal for shutdown received...\n");
         g_is_server_running = false;
         if (g_listen_socket != INVALID_SOCKET)
         {
@@ -32,14 +35,25 @@ void console_handler(int signal)
     }
 }
 
+#ifdef SIGUSR1
+// logrotate's postrotate hook: the logs are reopened at their configured paths.
+void reopen_handler(int)
+{
+    proxy_log::requestReopen();
+}
+#endif
+
 int main(int argc, char *argv[])
 {
     std::signal(SIGINT, console_handler);
     std::signal(SIGTERM, console_handler);
+#ifdef SIGUSR1
+    std::signal(SIGUSR1, reopen_handler);
+#endif
 
     if (!initSockets())
     {
-        log("ERROR|SERVER|Failed to init sockets: {}\n", getSocketError());
+        log<LogLevel::Error, LogSubsystem::Server>("Failed to init sockets: {}\n", getSocketError());
         return 1;
     }
 
@@ -51,27 +65,67 @@ int main(int argc, char *argv[])
             int port_no = std::stoi(argv[1]);
             if (port_no < 0 || port_no > 65535)
             {
-                log("INFO|SERVER|Invalid port. Using default port\n");
+                log<LogLevel::Info, LogSubsystem::Server>("Invalid port. Using default port\n");
             }
             else
                 server_port = port_no;
         }
         catch (...)
         {
-            log("INFO|SERVER|Invalid port format. Using default port\n");
+            log<LogLevel::Info, LogSubsystem::Server>("Invalid port format. Using default port\n");
         }
     }
-    log("INFO|SERVER|Using port {} for connections\n", server_port);
+    log<LogLevel::Info, LogSubsystem::Server>("Using port {} for connections\n", server_port);
+
+    proxy_config::ProxyConfig config;
+    if (argc > 2 && !proxy_config::loadConfig(argv[2], config))
+    {
+        cleanupSocket();
+        return 1;
+    }
+    ProxyLogger::getInstance().configure(config.logging);
+
+    proxy_cache::Cache cache_system(config.cache);
+    log<LogLevel::Info, LogSubsystem::Server>("Cache initialized with {} eviction and {} partition(s).\n",
+        proxy_cache::evictionPolicyName(cache_system.evictionPolicy()), config.cache.partitions.size() + 1);
+
+    proxy_cache::NegativeCache negative_cache(config.negative_cache);
+    proxy_routing::Router router(config.routing);
+    if (!router.empty())
+        log<LogLevel::Info, LogSubsystem::Server>("Reverse-proxy routing enabled with {} route(s); forward proxying {}.\n",
+            config.routing.routes.size(), router.forwardProxy() ? "on" : "off");
+
+    proxy_cluster::Cluster cluster(config.cluster);
+    if (cluster.enabled())
+        log<LogLevel::Info, LogSubsystem::Server>("Cluster mode ({}) as {} with {} node(s).\n", proxy_cluster::clusterModeName(cluster.mode()),
+            config.cluster.self, config.cluster.peers.size());
+
+    proxy_tls::Interceptor interceptor(config.intercept);
+    if (interceptor.enabled())
+        log<LogLevel::Info, LogSubsystem::Server>("TLS interception for {} host pattern(s); kTLS {}.\n", config.intercept.hosts.size(), config.intercept.ktls ? "on" : "off");
+
+    proxy_http::ProxyProtocol proxy_protocol(config.proxy_protocol);
+    if (proxy_protocol.enabled())
+        log<LogLevel::Info, LogSubsystem::Server>("Expecting PROXY protocol headers from {}.\n",
+            config.proxy_protocol.trusted.empty() ? std::string("every client") : std::format("{} balancer(s)", config.proxy_protocol.trusted.size()));
+
+    proxy_cache::Prefetcher prefetcher(config.prefetch, cache_system);
+
+    proxy_http::H2UpstreamPool h2_upstreams;
+    ProxyContext context{cache_system, negative_cache, router, cluster, config.headers, h2_upstreams, interceptor, proxy_protocol, prefetcher};
+
+    prefetcher.start([&context](const std::string &url)
+                     { ProxyHandler::prefetch(context, url); });
+    if (prefetcher.enabled())
+        log<LogLevel::Info, LogSubsystem::Server>("Prefetching HTML subresources on {} thread(s), {} per page.\n", config.prefetch.threads, config.prefetch.max_per_page);
 
-    proxy_cache::Cache cache_system;
-    log("INFO|SERVER|LRU Cache initialized.\n");
     std::counting_semaphore<INT_MAX> connection_semaphore(MAX_CONNECTIONS);
 
     g_listen_socket = socket(AF_INET, SOCK_STREAM, IPPROTO_TCP);
 
     if (g_listen_socket == INVALID_SOCKET)
     {
-        log("ERROR|SERVER|Socket creation failed: {}\n", getSocketError());
+        log<LogLevel::Error, LogSubsystem::Server>("Socket creation failed: {}\n", getSocketError());
         cleanupSocket();
         return 1;
     }
@@ -79,7 +133,7 @@ int main(int argc, char *argv[])
     int exclusive = 1;
     if (setsockopt(g_listen_socket, SOL_SOCKET, SO_REUSEADDR, (char *)&exclusive, sizeof(exclusive)) == SOCKET_ERROR)
     {
-        log("ERROR|SERVER|Set socket options failed: {}\n", getSocketError());
+        log<LogLevel::Error, LogSubsystem::Server>("Set socket options failed: {}\n", getSocketError());
         closeSocket(g_listen_socket);
         cleanupSocket();
         return 1;
@@ -92,22 +146,33 @@ int main(int argc, char *argv[])
 
     if (bind(g_listen_socket, (sockaddr *)&server_addr, sizeof(server_addr)) == SOCKET_ERROR)
     {
-        log("ERROR|SERVER|Binding failed: {}\n", getSocketError());
+        log<LogLevel::Error, LogSubsystem::Server>("Binding failed: {}\n", getSocketError());
         closeSocket(g_listen_socket);
         cleanupSocket();
         return 1;
     }
-    log("INFO|SERVER|Socket bound successfully to port {}.\n", server_port);
+    log<LogLevel::Info, LogSubsystem::Server>("Socket bound successfully to port {}.\n", server_port);
 
     if (listen(g_listen_socket, MAX_CONNECTIONS) == SOCKET_ERROR)
     {
-        log("ERROR|SERVER|Listen failed: {}\n", getSocketError());
+        log<LogLevel::Error, LogSubsystem::Server>("Listen failed: {}\n", getSocketError());
+        closeSocket(g_listen_socket);
+        cleanupSocket();
+        return 1;
+    }
+
+    log<LogLevel::Info, LogSubsystem::Server>("Listening on port {}.\n", server_port);
+
+    if (!cluster.start([&cache_system](std::string_view key)
+                       { return cache_system.cacheContains(proxy_cache::makeCacheKey(key)); }))
+    {
         closeSocket(g_listen_socket);
         cleanupSocket();
         return 1;
     }
 
-    log("INFO|SERVER|Listening on port {}.\n", server_port);
+    if (config.admin_port != 0)
+        ProxyAdmin::start(config.admin_port, context);
 
     while (g_is_server_running)
     {
@@ -124,7 +189,7 @@ int main(int argc, char *argv[])
                 connection_semaphore.release();
                 break;
             }
-            log("ERROR|SERVER|Accept failed: {}\n", getSocketError());
+            log<LogLevel::Error, LogSubsystem::Server>("Accept failed: {}\n", getSocketError());
             connection_semaphore.release();
             continue;
         }
@@ -136,32 +201,38 @@ int main(int argc, char *argv[])
             break;
         }
 
-        log("INFO|SERVER|Connection accepted from {}:{}\n", inet_ntoa(client_addr.sin_addr), ntohs(client_addr.sin_port));
+        proxy_http::ClientAddress peer{inet_ntoa(client_addr.sin_addr), ntohs(client_addr.sin_port)};
+        // With the PROXY protocol the client thread logs the real source once it has the header.
+        if (!proxy_protocol.enabled())
+            log<LogLevel::Info, LogSubsystem::Server>("Connection accepted from {}:{}\n", peer.host, peer.port);
 
         try
         {
-            std::thread client_thread(ProxyHandler::handleClient, client_socket, std::ref(cache_system), std::ref(connection_semaphore));
+            std::thread client_thread(ProxyHandler::handleClient, client_socket, std::move(peer), std::ref(context), std::ref(connection_semaphore));
             client_thread.detach();
         }
         catch (const std::system_error &e)
         {
-            log("ERROR|SERVER|Failed to create thread: {}\n", e.what());
+            log<LogLevel::Error, LogSubsystem::Server>("Failed to create thread: {}\n", e.what());
             closeSocket(client_socket);
             connection_semaphore.release();
             continue;
         }
     }
 
-    log("INFO|SERVER|Shutting down...\n");
+    log<LogLevel::Info, LogSubsystem::Server>("Shutting down...\n");
     if (g_listen_socket != INVALID_SOCKET)
         closeSocket(g_listen_socket);
 
-    log("INFO|SERVER|Waiting for active connections to finish...\n");
+    log<LogLevel::Info, LogSubsystem::Server>("Waiting for active connections to finish...\n");
     for (int i = 0; i < MAX_CONNECTIONS; i++)
     {
         connection_semaphore.acquire();
     }
 
-    log("INFO|SERVER|All connections finished.\n");
+    log<LogLevel::Info, LogSubsystem::Server>("All connections finished.\n");
+    ProxyAdmin::stop();
+    prefetcher.stop();
+    cluster.stop();
     cleanupSocket();
 }
\ No newline at end of file
@@ -0,0 +1,120 @@
+#include "proxy_negative_cache.hpp"
+
+using namespace proxy_cache;
+
+NegativeCache::NegativeCache() : NegativeCache(NegativeCacheConfig{}) {}
+
+NegativeCache::NegativeCache(NegativeCacheConfig config)
+    : config(config), current_bytes(0), hits(0), stores(0)
+{
+}
+
+std::string NegativeCache::hostKey(std::string_view host)
+{
+    std::string key = "dns:";
+    key += host;
+    return key;
+}
+
+std::string NegativeCache::endpointKey(std::string_view host, std::string_view port)
+{
+    std::string key = "connect:";
+    key += host;
+    key += ':';
+    key += port;
+    return key;
+}
+
+bool NegativeCache::isCacheableStatus(int status_code)
+{
+    switch (status_code)
+    {
+    case 404:
+    case 405:
+    case 410:
+    case 414:
+    case 501:
+        return true;
+    default:
+        return false;
+    }
+}
+
+std::chrono::milliseconds NegativeCache::ttlFor(NegativeKind kind) const
+{
+    switch (kind)
+    {
+    case NegativeKind::DnsFailure:
+        return config.dns_ttl;
+    case NegativeKind::ConnectFailure:
+        return config.connect_ttl;
+    default:
+        return config.status_ttl;
+    }
+}
+
+void NegativeCache::eraseUnlocked(std::unordered_map<std::string, negative_record, TransparentHash, std::equal_to<>>::iterator it)
+{
+    current_bytes -= it->second.entry.response.size();
+    insertion_order.erase(it->second.order);
+    records.erase(it);
+}
+
+bool NegativeCache::find(std::string_view key, NegativeEntry &out)
+{
+    std::lock_guard<std::mutex> lock(negative_mutex);
+
+    auto it = records.find(key);
+    if (it == records.end())
+        return false;
+
+    if (clock::now() >= it->second.expires_at)
+    {
+        eraseUnlocked(it);
+        return false;
+    }
+
+    ++hits;
+    out = it->second.entry;
+    return true;
+}
+
+void NegativeCache::store(std::string_view key, NegativeEntry entry)
+{
+    std::chrono::milliseconds ttl = ttlFor(entry.kind);
+    if (ttl.count() <= 0 || config.max_entries == 0 || entry.response.size() > config.max_response_bytes ||
+        entry.response.size() > config.max_bytes)
+        return;
+
+    std::lock_guard<std::mutex> lock(negative_mutex);
+
+    auto existing = records.find(key);
+    if (existing != records.end())
+        eraseUnlocked(existing);
+
+    while (!insertion_order.empty() &&
+           (records.size() >= config.max_entries || current_bytes + entry.response.size() > config.max_bytes))
+        eraseUnlocked(records.find(insertion_order.front()));
+
+    insertion_order.emplace_back(key);
+    current_bytes += entry.response.size();
+    ++stores;
+
+    negative_record record{std::move(entry), clock::now() + ttl, std::prev(insertion_order.end())};
+    records.emplace(insertion_order.back(), std::move(record));
+}
+
+void NegativeCache::erase(std::string_view key)
+{
+    std::lock_guard<std::mutex> lock(negative_mutex);
+
+    auto it = records.find(key);
+    if (it != records.end())
+        eraseUnlocked(it);
+}
+
+NegativeCacheStats NegativeCache::stats() const
+{
+    std::lock_guard<std::mutex> lock(negative_mutex);
+    return NegativeCacheStats{records.size(), current_bytes, hits, stores};
+}
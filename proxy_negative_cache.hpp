@@ -0,0 +1,101 @@
+#pragma once
+
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <list>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+namespace proxy_cache
+{
+
+    enum class NegativeKind
+    {
+        DnsFailure,     // keyed by host
+        ConnectFailure, // keyed by host:port
+        ErrorStatus     // keyed by cache key, holds the origin's error response
+    };
+
+    struct NegativeCacheConfig
+    {
+        std::size_t max_entries = 4096;
+        std::size_t max_bytes = 4 * 1024 * 1024;
+        std::size_t max_response_bytes = 64 * 1024;
+        std::chrono::milliseconds dns_ttl{std::chrono::seconds(30)};
+        std::chrono::milliseconds connect_ttl{std::chrono::seconds(10)};
+        std::chrono::milliseconds status_ttl{std::chrono::seconds(60)};
+    };
+
+    struct NegativeEntry
+    {
+        NegativeKind kind;
+        int status_code; // what the client gets: 502/504 for failures, the origin status otherwise
+        std::vector<char> response;
+    };
+
+    struct NegativeCacheStats
+    {
+        std::size_t entries;
+        std::size_t bytes;
+        std::uint64_t hits;
+        std::uint64_t stores;
+    };
+
+    // Short-TTL memory of upstream failures, kept apart from the response cache so a storm
+    // of failing lookups cannot evict good content. Bounded by entry count and stored bytes;
+    // when full the oldest entry goes first.
+    class NegativeCache
+    {
+    private:
+        using clock = std::chrono::steady_clock;
+
+        struct negative_record
+        {
+            NegativeEntry entry;
+            clock::time_point expires_at;
+            std::list<std::string>::iterator order;
+        };
+
+        struct TransparentHash
+        {
+            using is_transparent = void;
+            std::size_t operator()(std::string_view s) const { return std::hash<std::string_view>{}(s); }
+        };
+
+        NegativeCacheConfig config;
+
+        mutable std::mutex negative_mutex;
+        std::unordered_map<std::string, negative_record, TransparentHash, std::equal_to<>> records;
+        std::list<std::string> insertion_order;
+        std::size_t current_bytes;
+        std::uint64_t hits;
+        std::uint64_t stores;
+
+        void eraseUnlocked(std::unordered_map<std::string, negative_record, TransparentHash, std::equal_to<>>::iterator it);
+        std::chrono::milliseconds ttlFor(NegativeKind kind) const;
+
+    public:
+        NegativeCache();
+        explicit NegativeCache(NegativeCacheConfig config);
+
+        static std::string hostKey(std::string_view host);
+        static std::string endpointKey(std::string_view host, std::string_view port);
+
+        // Status codes worth remembering for a short while (RFC 9111 heuristically
+        // cacheable errors).
+        static bool isCacheableStatus(int status_code);
+
+        // Copies the entry out when a live record exists; expired records are dropped.
+        bool find(std::string_view key, NegativeEntry &out);
+
+        void store(std::string_view key, NegativeEntry entry);
+
+        void erase(std::string_view key);
+
+        NegativeCacheStats stats() const;
+    };
+}
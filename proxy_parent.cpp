@@ -0,0 +1,79 @@
+#include <algorithm>
+
+#include "proxy_parent.hpp"
+#include "proxy_cache_key.hpp"
+
+using namespace proxy_routing;
+
+// Below common proxy keep-alive timeouts, so a pooled link is dropped by us before the
+// parent can close it under a request.
+constexpr auto PARENT_IDLE_LIMIT = std::chrono::seconds(15);
+
+ParentGroup::ParentGroup(ParentRule rule)
+    : group_name(std::move(rule.name)), domains(std::move(rule.domains)),
+      servers(rule.servers, rule.balance, rule.health), max_idle(rule.max_idle_per_server)
+{
+    for (std::size_t i = 0; i < servers.size(); ++i)
+        pools.push_back(std::make_unique<server_pool>());
+}
+
+ParentGroup::~ParentGroup()
+{
+    for (auto &pool : pools)
+    {
+        for (idle_connection &idle : pool->idle)
+            closeSocket(idle.socket);
+    }
+}
+
+bool ParentGroup::matches(std::string_view host) const
+{
+    if (domains.empty())
+        return true;
+
+    return std::any_of(domains.begin(), domains.end(), [&](const std::string &pattern)
+                       { return proxy_cache::hostMatchesPattern(pattern, host); });
+}
+
+socket_t ParentGroup::takeIdle(std::size_t server)
+{
+    server_pool &pool = *pools[server];
+    std::lock_guard<std::mutex> lock(pool.mutex);
+    clock::time_point now = clock::now();
+
+    while (!pool.idle.empty())
+    {
+        idle_connection idle = pool.idle.back();
+        pool.idle.pop_back();
+
+        if (now - idle.since < PARENT_IDLE_LIMIT)
+        {
+            reused.fetch_add(1, std::memory_order_relaxed);
+            return idle.socket;
+        }
+        closeSocket(idle.socket);
+    }
+    return INVALID_SOCKET;
+}
+
+void ParentGroup::putIdle(std::size_t server, socket_t s)
+{
+    server_pool &pool = *pools[server];
+    std::lock_guard<std::mutex> lock(pool.mutex);
+
+    if (pool.idle.size() < max_idle)
+        pool.idle.push_back(idle_connection{s, clock::now()});
+    else
+        closeSocket(s);
+}
+
+ParentStats ParentGroup::stats() const
+{
+    ParentStats result{group_name, servers.balancePolicy(), servers.stats(), {}, reused.load(std::memory_order_relaxed)};
+    for (const auto &pool : pools)
+    {
+        std::lock_guard<std::mutex> lock(pool->mutex);
+        result.idle_connections.push_back(pool->idle.size());
+    }
+    return result;
+}
@@ -0,0 +1,87 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "proxy_balancer.hpp"
+#include "proxy_utils.hpp"
+
+namespace proxy_routing
+{
+
+    // Forward-proxy traffic for matching hosts egresses through one of these parent proxies
+    // instead of dialling the origin. Domain patterns follow hostMatchesPattern; an empty
+    // list matches every host. The default consistent-hash balance sends a URL to the same
+    // parent each time so the parents' caches stay effective.
+    struct ParentRule
+    {
+        std::string name;
+        std::vector<std::string> domains;
+        std::vector<Backend> servers;
+        BalancePolicy balance = BalancePolicy::ConsistentHash;
+        HealthConfig health;
+        std::size_t max_idle_per_server = 8;
+    };
+
+    struct ParentStats
+    {
+        std::string name;
+        BalancePolicy balance;
+        std::vector<BackendStats> servers;
+        std::vector<std::size_t> idle_connections;
+        std::uint64_t reused;
+    };
+
+    // A parent rule's servers plus a pool of idle keep-alive connections to each, so chained
+    // requests skip the TCP handshake to the parent.
+    class ParentGroup
+    {
+    private:
+        using clock = std::chrono::steady_clock;
+
+        struct idle_connection
+        {
+            socket_t socket;
+            clock::time_point since;
+        };
+
+        struct server_pool
+        {
+            std::mutex mutex;
+            std::vector<idle_connection> idle;
+        };
+
+        std::string group_name;
+        std::vector<std::string> domains;
+        BackendSet servers;
+        std::size_t max_idle;
+        std::vector<std::unique_ptr<server_pool>> pools;
+        std::atomic<std::uint64_t> reused{0};
+
+    public:
+        explicit ParentGroup(ParentRule rule);
+        ~ParentGroup();
+
+        ParentGroup(const ParentGroup &) = delete;
+        ParentGroup &operator=(const ParentGroup &) = delete;
+
+        const std::string &name() const { return group_name; }
+        bool matches(std::string_view host) const;
+        BackendSet &backends() { return servers; }
+
+        // A pooled connection to the server, or INVALID_SOCKET if none is idle. Links idle
+        // too long are dropped rather than risk the parent closing them mid-request.
+        socket_t takeIdle(std::size_t server);
+
+        // Returns a connection whose last response was fully read and allows reuse.
+        void putIdle(std::size_t server, socket_t s);
+
+        ParentStats stats() const;
+    };
+}
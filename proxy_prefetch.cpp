@@ -0,0 +1,465 @@
+#include <algorithm>
+#include <cctype>
+#include <cstring>
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <sys/resource.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+#include "proxy_prefetch.hpp"
+#include "proxy_logger.hpp"
+
+using namespace proxy_cache;
+
+constexpr std::string_view HEADER_END = "\r\n\r\n";
+
+// Nice value of the prefetch threads: they only ever compete with client traffic.
+constexpr int PREFETCH_NICE = 10;
+
+namespace
+{
+    bool equalsIgnoreCase(std::string_view a, std::string_view b)
+    {
+        return a.size() == b.size() && std::equal(a.begin(), a.end(), b.begin(), [](char x, char y)
+                                                  { return std::tolower(static_cast<unsigned char>(x)) == std::tolower(static_cast<unsigned char>(y)); });
+    }
+
+    bool startsWithIgnoreCase(std::string_view text, std::string_view prefix)
+    {
+        return text.size() >= prefix.size() && equalsIgnoreCase(text.substr(0, prefix.size()), prefix);
+    }
+
+    bool isSpace(char c)
+    {
+        return c == ' ' || c == '\t' || c == '\r' || c == '\n' || c == '\f';
+    }
+
+    // Value of the first header called name in an HTTP head, or empty.
+    std::string_view headerValue(std::string_view head, std::string_view name)
+    {
+        std::size_t line_start = head.find("\r\n");
+        while (line_start != std::string_view::npos && line_start + 2 < head.size())
+        {
+            line_start += 2;
+            std::size_t line_end = head.find("\r\n", line_start);
+            std::string_view line = head.substr(line_start, line_end == std::string_view::npos ? std::string_view::npos : line_end - line_start);
+            std::size_t colon = line.find(':');
+            if (colon != std::string_view::npos && equalsIgnoreCase(line.substr(0, colon), name))
+            {
+                std::string_view value = line.substr(colon + 1);
+                while (!value.empty() && isSpace(value.front()))
+                    value.remove_prefix(1);
+                while (!value.empty() && isSpace(value.back()))
+                    value.remove_suffix(1);
+                return value;
+            }
+            line_start = line_end;
+        }
+        return {};
+    }
+
+    // "a/./b/../c" -> "a/c" on the path part; the query is left alone.
+    std::string removeDotSegments(std::string_view path)
+    {
+        std::size_t query = path.find('?');
+        std::string_view tail = query == std::string_view::npos ? std::string_view{} : path.substr(query);
+        path = path.substr(0, query);
+
+        std::vector<std::string_view> segments;
+        std::size_t start = 1;
+        while (start <= path.size())
+        {
+            std::size_t slash = path.find('/', start);
+            std::string_view segment = path.substr(start, slash == std::string_view::npos ? std::string_view::npos : slash - start);
+            if (segment == "..")
+            {
+                if (!segments.empty())
+                    segments.pop_back();
+            }
+            else if (segment != ".")
+                segments.push_back(segment);
+            // A trailing "." or ".." still names a directory.
+            if (slash == std::string_view::npos)
+            {
+                if (segment == "." || segment == "..")
+                    segments.push_back({});
+                break;
+            }
+            start = slash + 1;
+        }
+
+        std::string out;
+        for (std::string_view segment : segments)
+            out.append("/").append(segment);
+        if (out.empty())
+            out = "/";
+        out.append(tail);
+        return out;
+    }
+
+    void lowerThreadPriority()
+    {
+#ifdef _WIN32
+        SetThreadPriority(GetCurrentThread(), THREAD_PRIORITY_BELOW_NORMAL);
+#else
+        // On Linux the nice value belongs to the thread, not the process.
+        setpriority(PRIO_PROCESS, static_cast<id_t>(syscall(SYS_gettid)), PREFETCH_NICE);
+#endif
+    }
+}
+
+void SubresourceScanner::feed(const char *data, std::size_t size)
+{
+    const char *end = data + size;
+    while (data < end && found.size() < limit)
+    {
+        if (current == state::Text)
+        {
+            const char *open = static_cast<const char *>(std::memchr(data, '<', end - data));
+            if (!open)
+                return;
+            data = open + 1;
+            tag.clear();
+            quote = '\0';
+            current = state::Tag;
+        }
+        else if (current == state::Tag)
+        {
+            // '>' inside a quoted attribute value does not end the tag; <!...> declarations
+            // and comments are not quoted.
+            const char *close = nullptr;
+            const bool declaration = (tag.empty() ? *data : tag.front()) == '!';
+            for (const char *at = data; at < end; ++at)
+            {
+                if (quote)
+                    quote = *at == quote ? '\0' : quote;
+                else if (*at == '>')
+                {
+                    close = at;
+                    break;
+                }
+                else if (!declaration && (*at == '"' || *at == '\''))
+                    quote = *at;
+            }
+            const char *stop = close ? close : end;
+            if (tag.size() + (stop - data) > MAX_TAG)
+            {
+                // Not a tag worth reading (or not a tag at all); resume at the next '<'.
+                current = state::Text;
+                quote = '\0';
+                data = stop;
+                continue;
+            }
+            tag.append(data, stop);
+
+            if (tag.starts_with("!--"))
+            {
+                // The '>' found may already close it ("<!-- x -->"); otherwise the rest is
+                // skipped in Comment state, counting the dashes seen so far.
+                std::size_t dashes = 0;
+                for (std::size_t i = 3; i < tag.size(); ++i)
+                    dashes = tag[i] == '-' ? dashes + 1 : 0;
+                if (close && dashes >= 2)
+                    current = state::Text;
+                else
+                {
+                    current = state::Comment;
+                    comment_dashes = close ? 0 : dashes;
+                }
+                data = close ? close + 1 : end;
+                continue;
+            }
+            if (!close)
+                return;
+
+            finishTag();
+            current = state::Text;
+            data = close + 1;
+        }
+        else
+        {
+            for (; data < end; ++data)
+            {
+                if (*data == '>' && comment_dashes >= 2)
+                {
+                    current = state::Text;
+                    ++data;
+                    break;
+                }
+                comment_dashes = *data == '-' ? comment_dashes + 1 : 0;
+            }
+        }
+    }
+}
+
+void SubresourceScanner::finishTag()
+{
+    std::string_view text = tag;
+    std::size_t name_end = 0;
+    while (name_end < text.size() && std::isalnum(static_cast<unsigned char>(text[name_end])))
+        ++name_end;
+    std::string_view name = text.substr(0, name_end);
+
+    const bool is_link = equalsIgnoreCase(name, "link");
+    std::string_view wanted;
+    if (is_link)
+        wanted = "href";
+    else if (equalsIgnoreCase(name, "script") || equalsIgnoreCase(name, "img"))
+        wanted = "src";
+    else
+        return;
+
+    std::string_view url;
+    bool fetchable_rel = !is_link;
+    text.remove_prefix(name_end);
+
+    while (!text.empty())
+    {
+        while (!text.empty() && (isSpace(text.front()) || text.front() == '/'))
+            text.remove_prefix(1);
+        std::size_t attribute_end = 0;
+        while (attribute_end < text.size() && !isSpace(text[attribute_end]) && text[attribute_end] != '=' && text[attribute_end] != '/')
+            ++attribute_end;
+        if (attribute_end == 0)
+            break;
+        std::string_view attribute = text.substr(0, attribute_end);
+        text.remove_prefix(attribute_end);
+        while (!text.empty() && isSpace(text.front()))
+            text.remove_prefix(1);
+
+        std::string_view value;
+        if (!text.empty() && text.front() == '=')
+        {
+            text.remove_prefix(1);
+            while (!text.empty() && isSpace(text.front()))
+                text.remove_prefix(1);
+            if (!text.empty() && (text.front() == '"' || text.front() == '\''))
+            {
+                char quote = text.front();
+                std::size_t closing = text.find(quote, 1);
+                value = text.substr(1, closing == std::string_view::npos ? std::string_view::npos : closing - 1);
+                text.remove_prefix(closing == std::string_view::npos ? text.size() : closing + 1);
+            }
+            else
+            {
+                std::size_t value_end = 0;
+                while (value_end < text.size() && !isSpace(text[value_end]))
+                    ++value_end;
+                value = text.substr(0, value_end);
+                text.remove_prefix(value_end);
+            }
+        }
+
+        if (equalsIgnoreCase(attribute, wanted))
+            url = value;
+        else if (is_link && equalsIgnoreCase(attribute, "rel"))
+        {
+            // rel is a token list: "stylesheet", "preload", "icon", "shortcut icon", ...
+            for (std::string_view token : {"stylesheet", "preload", "modulepreload", "icon"})
+            {
+                for (std::size_t at = 0; at + token.size() <= value.size(); ++at)
+                {
+                    if ((at == 0 || isSpace(value[at - 1])) && startsWithIgnoreCase(value.substr(at), token) &&
+                        (at + token.size() == value.size() || isSpace(value[at + token.size()])))
+                        fetchable_rel = true;
+                }
+            }
+        }
+    }
+
+    if (url.empty() || !fetchable_rel)
+        return;
+
+    std::string reference(url);
+    for (std::size_t at = reference.find("&amp;"); at != std::string::npos; at = reference.find("&amp;", at + 1))
+        reference.erase(at + 1, 4);
+    found.push_back(std::move(reference));
+}
+
+bool proxy_cache::resolveSameOrigin(std::string_view page_url, std::string_view reference, std::string &out)
+{
+    while (!reference.empty() && isSpace(reference.front()))
+        reference.remove_prefix(1);
+    while (!reference.empty() && isSpace(reference.back()))
+        reference.remove_suffix(1);
+    reference = reference.substr(0, reference.find('#'));
+    if (reference.empty())
+        return false;
+
+    std::size_t scheme_end = page_url.find("://");
+    if (scheme_end == std::string_view::npos)
+        return false;
+    std::size_t path_start = page_url.find('/', scheme_end + 3);
+    std::string_view origin = page_url.substr(0, path_start);
+    std::string_view page_path = path_start == std::string_view::npos ? "/" : page_url.substr(path_start);
+
+    std::string path;
+    if (reference.starts_with("//"))
+    {
+        // Scheme-relative: same origin only if the authority matches.
+        std::string_view authority = reference.substr(2, reference.find_first_of("/?", 2) - 2);
+        if (!equalsIgnoreCase(authority, origin.substr(scheme_end + 3)))
+            return false;
+        std::size_t rest = reference.find_first_of("/?", 2);
+        path = rest == std::string_view::npos ? "/" : std::string(reference.substr(rest));
+    }
+    else if (reference.front() == '/')
+        path = reference;
+    else
+    {
+        std::size_t colon = reference.find(':');
+        std::size_t delimiter = reference.find_first_of("/?");
+        if (colon != std::string_view::npos && (delimiter == std::string_view::npos || colon < delimiter))
+        {
+            // Absolute URL (or data:, javascript:, mailto:, ...): must start with the page origin.
+            if (!startsWithIgnoreCase(reference, origin) ||
+                (reference.size() > origin.size() && reference[origin.size()] != '/' && reference[origin.size()] != '?'))
+                return false;
+            path = reference.size() > origin.size() ? std::string(reference.substr(origin.size())) : "/";
+        }
+        else
+        {
+            std::string_view directory = page_path.substr(0, page_path.find('?'));
+            directory = directory.substr(0, directory.rfind('/') + 1);
+            path = std::string(directory).append(reference);
+        }
+    }
+
+    if (path.front() == '?')
+        path = std::string(page_path.substr(0, page_path.find('?'))).append(path);
+
+    out.assign(origin).append(removeDotSegments(path));
+    return out != page_url;
+}
+
+Prefetcher::Prefetcher(PrefetchConfig config, const Cache &cache) : config(std::move(config)), cache(cache) {}
+
+Prefetcher::~Prefetcher()
+{
+    stop();
+}
+
+void Prefetcher::start(Fetch fetch_url)
+{
+    if (!config.enabled || !workers.empty())
+        return;
+
+    fetch = std::move(fetch_url);
+    for (std::size_t i = 0; i < std::max<std::size_t>(config.threads, 1); ++i)
+        workers.emplace_back(&Prefetcher::work, this);
+}
+
+void Prefetcher::stop()
+{
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        stopping = true;
+        queue.clear();
+    }
+    work_ready.notify_all();
+    for (std::thread &worker : workers)
+        worker.join();
+    workers.clear();
+}
+
+bool Prefetcher::isCached(const std::string &url) const
+{
+    std::string scratch;
+    return cache.cacheContains(makeCacheKey(normalizeCacheKey(url, cache.keyRules(), scratch)));
+}
+
+void Prefetcher::pageStored(std::string_view page_url, const std::vector<char> &response)
+{
+    if (!config.enabled)
+        return;
+
+    std::string_view message(response.data(), response.size());
+    std::size_t head_end = message.find(HEADER_END);
+    if (head_end == std::string_view::npos)
+        return;
+    std::string_view head = message.substr(0, head_end);
+
+    std::string_view encoding = headerValue(head, "Content-Encoding");
+    if (!startsWithIgnoreCase(headerValue(head, "Content-Type"), "text/html") || (!encoding.empty() && !equalsIgnoreCase(encoding, "identity")))
+        return;
+
+    // A chunked body is scanned with its size lines in place; they only matter when one
+    // lands inside a tag.
+    SubresourceScanner scanner(config.max_per_page);
+    std::string_view body = message.substr(head_end + HEADER_END.size());
+    scanner.feed(body.data(), body.size());
+    pages.fetch_add(1, std::memory_order_relaxed);
+
+    std::string url;
+    std::size_t added = 0;
+    for (const std::string &reference : scanner.references())
+    {
+        if (!resolveSameOrigin(page_url, reference, url))
+            continue;
+        if (isCached(url))
+        {
+            already_cached.fetch_add(1, std::memory_order_relaxed);
+            continue;
+        }
+
+        std::lock_guard<std::mutex> lock(mutex);
+        if (stopping || pending.contains(url))
+            continue;
+        if (queue.size() >= config.max_queue)
+        {
+            dropped.fetch_add(1, std::memory_order_relaxed);
+            continue;
+        }
+        pending.insert(url);
+        queue.push_back(url);
+        queued.fetch_add(1, std::memory_order_relaxed);
+        ++added;
+    }
+
+    if (added > 0)
+    {
+        log<LogLevel::Info, LogSubsystem::Cache>("PREFETCH|{} subresource(s) of {} queued.\n", added, page_url);
+        work_ready.notify_all();
+    }
+}
+
+void Prefetcher::work()
+{
+    lowerThreadPriority();
+
+    while (true)
+    {
+        std::string url;
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+            work_ready.wait(lock, [&]() { return stopping || !queue.empty(); });
+            if (stopping)
+                return;
+            url = std::move(queue.front());
+            queue.pop_front();
+        }
+
+        // The page may have been followed by the browser already.
+        if (isCached(url))
+            already_cached.fetch_add(1, std::memory_order_relaxed);
+        else
+        {
+            fetch(url);
+            fetched.fetch_add(1, std::memory_order_relaxed);
+        }
+
+        std::lock_guard<std::mutex> lock(mutex);
+        pending.erase(url);
+    }
+}
+
+PrefetchStats Prefetcher::stats()
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    return {pages.load(std::memory_order_relaxed), queued.load(std::memory_order_relaxed), fetched.load(std::memory_order_relaxed),
+            already_cached.load(std::memory_order_relaxed), dropped.load(std::memory_order_relaxed), queue.size()};
+}
@@ -0,0 +1,131 @@
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <unordered_set>
+#include <vector>
+
+#include "proxy_cache.hpp"
+
+namespace proxy_cache
+{
+
+    // Finds subresource references in HTML as it is fed, chunk by chunk: <link href> for
+    // stylesheets, preloads and icons, <script src> and <img src>. Tags split across chunks
+    // are carried over; comments are skipped. Only tags are looked at, so it is a memchr
+    // walk over text and never builds a document.
+    class SubresourceScanner
+    {
+    private:
+        enum class state
+        {
+            Text,
+            Tag,
+            Comment
+        };
+
+        static constexpr std::size_t MAX_TAG = 4096;
+
+        state current = state::Text;
+        std::string tag;
+        char quote = '\0'; // inside a quoted attribute value of the current tag
+        // Dashes seen right before the current position, for spotting "-->" across chunks.
+        std::size_t comment_dashes = 0;
+        std::size_t limit;
+        std::vector<std::string> found;
+
+        void finishTag();
+
+    public:
+        // Stops collecting after limit references.
+        explicit SubresourceScanner(std::size_t limit) : limit(limit) {}
+
+        void feed(const char *data, std::size_t size);
+
+        // Attribute values as written (entities other than &amp; left alone).
+        const std::vector<std::string> &references() const { return found; }
+    };
+
+    // Resolves reference against the absolute page URL. False when it points at another
+    // origin (scheme, host or port differ), is not http(s) (data:, javascript:, ...) or is
+    // empty. Dot segments are removed and the fragment dropped.
+    bool resolveSameOrigin(std::string_view page_url, std::string_view reference, std::string &out);
+
+    struct PrefetchConfig
+    {
+        bool enabled = false;
+        std::size_t threads = 2;
+        // Budget: subresources taken from one page, and URLs waiting across all pages.
+        std::size_t max_per_page = 16;
+        std::size_t max_queue = 256;
+    };
+
+    struct PrefetchStats
+    {
+        std::uint64_t pages;     // HTML pages scanned
+        std::uint64_t queued;
+        std::uint64_t fetched;
+        std::uint64_t already_cached;
+        std::uint64_t dropped;   // over the queue budget
+        std::size_t waiting;
+    };
+
+    // Warms the cache with the subresources of HTML pages as they are stored, so the
+    // browser's follow-up requests are hits. Fetches go through the normal request path on a
+    // few below-normal-priority threads.
+    class Prefetcher
+    {
+    public:
+        // Fetches url (absolute) into the cache; the response itself is discarded.
+        using Fetch = std::function<void(const std::string &url)>;
+
+    private:
+        PrefetchConfig config;
+        const Cache &cache;
+        Fetch fetch;
+
+        std::mutex mutex;
+        std::condition_variable work_ready;
+        std::deque<std::string> queue;
+        // Queued or being fetched; a URL is never waiting twice.
+        std::unordered_set<std::string> pending;
+        std::vector<std::thread> workers;
+        bool stopping = false;
+
+        std::atomic<std::uint64_t> pages{0};
+        std::atomic<std::uint64_t> queued{0};
+        std::atomic<std::uint64_t> fetched{0};
+        std::atomic<std::uint64_t> already_cached{0};
+        std::atomic<std::uint64_t> dropped{0};
+
+        bool isCached(const std::string &url) const;
+        void work();
+
+    public:
+        Prefetcher(PrefetchConfig config, const Cache &cache);
+        ~Prefetcher();
+
+        Prefetcher(const Prefetcher &) = delete;
+        Prefetcher &operator=(const Prefetcher &) = delete;
+
+        // Starts the workers; nothing happens while disabled.
+        void start(Fetch fetch);
+        void stop();
+
+        bool enabled() const { return config.enabled; }
+
+        // A 2xx/3xx response for page_url is about to be cached. text/html bodies without a
+        // Content-Encoding are scanned and their uncached same-origin subresources queued.
+        void pageStored(std::string_view page_url, const std::vector<char> &response);
+
+        PrefetchStats stats();
+    };
+}
@@ -0,0 +1,210 @@
+#include <algorithm>
+#include <charconv>
+#include <cstring>
+#include <string_view>
+
+#include "proxy_proxy_protocol.hpp"
+#include "proxy_logger.hpp"
+
+using namespace proxy_http;
+
+constexpr std::string_view V1_PREFIX = "PROXY ";
+// "PROXY TCP6 " + two full IPv6 addresses + two ports + CRLF.
+constexpr std::size_t V1_MAX_LINE = 107;
+
+constexpr std::string_view V2_SIGNATURE{"\r\n\r\n\0\r\nQUIT\n", 12};
+constexpr std::size_t V2_FIXED_SIZE = 16;
+
+constexpr std::uint8_t V2_VERSION = 0x20;
+constexpr std::uint8_t V2_COMMAND_LOCAL = 0x0;
+constexpr std::uint8_t V2_COMMAND_PROXY = 0x1;
+constexpr std::uint8_t V2_TCP4 = 0x11;
+constexpr std::uint8_t V2_TCP6 = 0x21;
+
+constexpr std::size_t RECV_CHUNK = 4096;
+
+namespace
+{
+    // True while data could still turn out to start with prefix.
+    bool startsAsPrefix(const char *data, std::size_t size, std::string_view prefix)
+    {
+        return std::memcmp(data, prefix.data(), std::min(size, prefix.size())) == 0;
+    }
+
+    bool parsePort(std::string_view text, std::uint16_t &port)
+    {
+        if (text.empty() || text.size() > 5 || (text.size() > 1 && text.front() == '0'))
+            return false;
+        unsigned value = 0;
+        auto [ptr, ec] = std::from_chars(text.data(), text.data() + text.size(), value);
+        if (ec != std::errc() || ptr != text.data() + text.size() || value > 65535)
+            return false;
+        port = static_cast<std::uint16_t>(value);
+        return true;
+    }
+
+    std::string formatAddress(int family, const void *address)
+    {
+        char text[INET6_ADDRSTRLEN] = {};
+        if (!inet_ntop(family, address, text, sizeof(text)))
+            return {};
+        return text;
+    }
+
+    // "PROXY TCP4 <src> <dst> <sport> <dport>\r\n" or "PROXY UNKNOWN ...\r\n".
+    ProxyHeaderStatus parseV1(const char *data, std::size_t size, ClientAddress &source, std::size_t &consumed)
+    {
+        std::string_view available(data, std::min(size, V1_MAX_LINE));
+        std::size_t line_end = available.find("\r\n");
+        if (line_end == std::string_view::npos)
+            return size >= V1_MAX_LINE ? ProxyHeaderStatus::Invalid : ProxyHeaderStatus::Incomplete;
+
+        std::string_view line = available.substr(V1_PREFIX.size(), line_end - V1_PREFIX.size());
+        std::string_view fields[5];
+        std::size_t count = 0;
+        while (!line.empty() && count < 5)
+        {
+            std::size_t space = line.find(' ');
+            fields[count++] = line.substr(0, space);
+            line = space == std::string_view::npos ? std::string_view{} : line.substr(space + 1);
+        }
+
+        consumed = line_end + 2;
+        if (count >= 1 && fields[0] == "UNKNOWN")
+        {
+            source = {};
+            return ProxyHeaderStatus::Complete;
+        }
+        if (count != 5 || !line.empty() || (fields[0] != "TCP4" && fields[0] != "TCP6"))
+            return ProxyHeaderStatus::Invalid;
+
+        int family = fields[0] == "TCP4" ? AF_INET : AF_INET6;
+        unsigned char address[16];
+        std::string host(fields[1]);
+        std::uint16_t port = 0, destination_port = 0;
+        if (inet_pton(family, host.c_str(), address) != 1 || inet_pton(family, std::string(fields[2]).c_str(), address) != 1 ||
+            !parsePort(fields[3], port) || !parsePort(fields[4], destination_port))
+            return ProxyHeaderStatus::Invalid;
+
+        source.host = std::move(host);
+        source.port = port;
+        return ProxyHeaderStatus::Complete;
+    }
+
+    ProxyHeaderStatus parseV2(const unsigned char *data, std::size_t size, ClientAddress &source, std::size_t &consumed)
+    {
+        if (size < V2_FIXED_SIZE)
+            return ProxyHeaderStatus::Incomplete;
+
+        std::uint8_t version = data[12] & 0xf0;
+        std::uint8_t command = data[12] & 0x0f;
+        std::uint8_t family = data[13];
+        std::size_t length = (std::size_t(data[14]) << 8) | data[15];
+
+        if (version != V2_VERSION || (command != V2_COMMAND_LOCAL && command != V2_COMMAND_PROXY) ||
+            V2_FIXED_SIZE + length > MAX_PROXY_HEADER)
+            return ProxyHeaderStatus::Invalid;
+        if (size < V2_FIXED_SIZE + length)
+            return ProxyHeaderStatus::Incomplete;
+
+        consumed = V2_FIXED_SIZE + length;
+        source = {};
+        if (command == V2_COMMAND_LOCAL)
+            return ProxyHeaderStatus::Complete;
+
+        const unsigned char *block = data + V2_FIXED_SIZE;
+        if (family == V2_TCP4)
+        {
+            if (length < 12)
+                return ProxyHeaderStatus::Invalid;
+            source.host = formatAddress(AF_INET, block);
+            source.port = static_cast<std::uint16_t>((block[8] << 8) | block[9]);
+        }
+        else if (family == V2_TCP6)
+        {
+            if (length < 36)
+                return ProxyHeaderStatus::Invalid;
+            source.host = formatAddress(AF_INET6, block);
+            source.port = static_cast<std::uint16_t>((block[32] << 8) | block[33]);
+        }
+        // UNSPEC, UDP and unix-socket sources carry nothing a TCP client address can hold.
+        return ProxyHeaderStatus::Complete;
+    }
+}
+
+ProxyHeaderStatus proxy_http::parseProxyHeader(const char *data, std::size_t size, ClientAddress &source, std::size_t &consumed)
+{
+    if (size == 0)
+        return ProxyHeaderStatus::Incomplete;
+
+    if (startsAsPrefix(data, size, V2_SIGNATURE))
+        return size < V2_SIGNATURE.size() ? ProxyHeaderStatus::Incomplete
+                                          : parseV2(reinterpret_cast<const unsigned char *>(data), size, source, consumed);
+    if (startsAsPrefix(data, size, V1_PREFIX))
+        return size < V1_PREFIX.size() ? ProxyHeaderStatus::Incomplete : parseV1(data, size, source, consumed);
+    return ProxyHeaderStatus::Invalid;
+}
+
+ProxyProtocol::ProxyProtocol(ProxyProtocolConfig config) : config(std::move(config)) {}
+
+bool ProxyProtocol::accept(socket_t client_socket, std::vector<char> &buffer, ClientAddress &client, int client_id)
+{
+    if (!config.trusted.empty() && std::find(config.trusted.begin(), config.trusted.end(), client.host) == config.trusted.end())
+    {
+        direct.fetch_add(1, std::memory_order_relaxed);
+        log<LogLevel::Info, LogSubsystem::Server>("{}|PROXY|Connection accepted from {}:{} (not a trusted balancer)\n", client_id, client.host, client.port);
+        return true;
+    }
+
+    ClientAddress source;
+    std::size_t consumed = 0;
+    ProxyHeaderStatus status;
+    char chunk[RECV_CHUNK];
+
+    while ((status = parseProxyHeader(buffer.data(), buffer.size(), source, consumed)) == ProxyHeaderStatus::Incomplete)
+    {
+        int received = recv(client_socket, chunk, sizeof(chunk), 0);
+        if (received <= 0)
+        {
+            log<LogLevel::Info, LogSubsystem::Server>("{}|PROXY|{} closed before sending a complete PROXY header.\n", client_id, client.host);
+            return false;
+        }
+        buffer.insert(buffer.end(), chunk, chunk + received);
+    }
+
+    if (status == ProxyHeaderStatus::Invalid)
+    {
+        rejected.fetch_add(1, std::memory_order_relaxed);
+        log<LogLevel::Warn, LogSubsystem::Server>("{}|PROXY|Missing or malformed PROXY header from {}:{}, dropping.\n", client_id, client.host, client.port);
+        return false;
+    }
+
+    buffer.erase(buffer.begin(), buffer.begin() + consumed);
+    if (source.host.empty())
+    {
+        local.fetch_add(1, std::memory_order_relaxed);
+        log<LogLevel::Info, LogSubsystem::Server>("{}|PROXY|Connection accepted from {}:{} (LOCAL)\n", client_id, client.host, client.port);
+    }
+    else
+    {
+        headers.fetch_add(1, std::memory_order_relaxed);
+        log<LogLevel::Info, LogSubsystem::Server>("{}|PROXY|Connection accepted from {}:{} via {}:{}\n", client_id, source.host, source.port, client.host, client.port);
+        client = std::move(source);
+    }
+
+    // Balancers often send the header in a segment of its own.
+    if (buffer.empty())
+    {
+        int received = recv(client_socket, chunk, sizeof(chunk), 0);
+        if (received <= 0)
+            return false;
+        buffer.insert(buffer.end(), chunk, chunk + received);
+    }
+    return true;
+}
+
+ProxyProtocolStats ProxyProtocol::stats() const
+{
+    return {headers.load(std::memory_order_relaxed), local.load(std::memory_order_relaxed),
+            direct.load(std::memory_order_relaxed), rejected.load(std::memory_order_relaxed)};
+}
@@ -0,0 +1,78 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "proxy_utils.hpp"
+
+namespace proxy_http
+{
+
+    // Where a connection really comes from: the TCP peer, or the source a load balancer
+    // reported in a PROXY protocol header.
+    struct ClientAddress
+    {
+        std::string host; // numeric, IPv4 or IPv6
+        std::uint16_t port = 0;
+    };
+
+    enum class ProxyHeaderStatus
+    {
+        Complete,
+        Incomplete, // a valid prefix; more bytes are needed
+        Invalid
+    };
+
+    // Largest header accepted: a v1 line is at most 107 bytes; v2 headers with TLVs beyond
+    // this are refused rather than buffered.
+    constexpr std::size_t MAX_PROXY_HEADER = 4096;
+
+    // Parses a PROXY protocol v1 (text) or v2 (binary) header at the front of data. On
+    // Complete, consumed is the header's length and source holds the address it names; a
+    // v2 LOCAL or v1 UNKNOWN header (the balancer's own health checks) leaves source empty.
+    // TLVs are skipped.
+    ProxyHeaderStatus parseProxyHeader(const char *data, std::size_t size, ClientAddress &source, std::size_t &consumed);
+
+    struct ProxyProtocolConfig
+    {
+        bool enabled = false;
+        // Peers that must send the header; others are served as direct clients. Empty
+        // means every connection must start with one.
+        std::vector<std::string> trusted;
+    };
+
+    struct ProxyProtocolStats
+    {
+        std::uint64_t headers;  // carried a client address
+        std::uint64_t local;    // LOCAL / UNKNOWN: served under the balancer's address
+        std::uint64_t direct;   // from peers outside trusted
+        std::uint64_t rejected; // missing or malformed header, connection dropped
+    };
+
+    class ProxyProtocol
+    {
+    private:
+        ProxyProtocolConfig config;
+
+        std::atomic<std::uint64_t> headers{0};
+        std::atomic<std::uint64_t> local{0};
+        std::atomic<std::uint64_t> direct{0};
+        std::atomic<std::uint64_t> rejected{0};
+
+    public:
+        explicit ProxyProtocol(ProxyProtocolConfig config);
+
+        bool enabled() const { return config.enabled; }
+
+        // Takes the header off the front of a new connection. buffer holds the bytes of the
+        // first recv() and keeps whatever follows the header (at least one byte); client
+        // starts as the TCP peer and becomes the source the header names. Only when the
+        // header spans segments does this read more. False: drop the connection.
+        bool accept(socket_t client_socket, std::vector<char> &buffer, ClientAddress &client, int client_id);
+
+        ProxyProtocolStats stats() const;
+    };
+}
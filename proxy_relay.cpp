@@ -0,0 +1,156 @@
+#include "proxy_relay.hpp"
+
+#ifdef __linux__
+#include <fcntl.h>
+#endif
+
+using namespace proxy_http;
+
+constexpr std::size_t RELAY_BUFFER_SIZE = 16 * 1024;
+
+// Upper bound per splice(); the pipe buffer (64 KiB by default) caps it anyway.
+constexpr std::size_t SPLICE_CHUNK = 64 * 1024;
+
+namespace
+{
+    enum class step_result
+    {
+        Moved,
+        Nothing,
+        Closed,
+        Unsupported
+    };
+
+    bool sendAll(socket_t s, const char *data, std::size_t size)
+    {
+        while (size > 0)
+        {
+            int sent = send(s, data, static_cast<int>(size), 0);
+            if (sent == SOCKET_ERROR || sent == 0)
+                return false;
+            data += sent;
+            size -= static_cast<std::size_t>(sent);
+        }
+        return true;
+    }
+
+    step_result copyOnce(socket_t from, socket_t to, char *buffer, std::size_t &bytes)
+    {
+        int received = recv(from, buffer, static_cast<int>(RELAY_BUFFER_SIZE), 0);
+        if (received <= 0 || !sendAll(to, buffer, static_cast<std::size_t>(received)))
+            return step_result::Closed;
+
+        bytes += static_cast<std::size_t>(received);
+        return step_result::Moved;
+    }
+
+#ifdef __linux__
+    // One direction of a spliced tunnel: socket -> pipe -> socket.
+    struct splice_pipe
+    {
+        int fds[2] = {-1, -1};
+
+        bool open() { return pipe2(fds, O_CLOEXEC) == 0; }
+
+        ~splice_pipe()
+        {
+            if (fds[0] >= 0)
+                close(fds[0]);
+            if (fds[1] >= 0)
+                close(fds[1]);
+        }
+    };
+
+    step_result spliceOnce(socket_t from, socket_t to, splice_pipe &pipe, std::size_t &bytes)
+    {
+        ssize_t in = splice(from, nullptr, pipe.fds[1], nullptr, SPLICE_CHUNK, SPLICE_F_MOVE | SPLICE_F_NONBLOCK);
+        if (in == 0)
+            return step_result::Closed;
+        if (in < 0)
+        {
+            if (errno == EAGAIN || errno == EINTR)
+                return step_result::Nothing;
+            return errno == EINVAL || errno == ENOSYS ? step_result::Unsupported : step_result::Closed;
+        }
+
+        // Drain the pipe fully so it is empty whenever select() runs again.
+        std::size_t pending = static_cast<std::size_t>(in);
+        while (pending > 0)
+        {
+            ssize_t out = splice(pipe.fds[0], nullptr, to, nullptr, pending, SPLICE_F_MOVE);
+            if (out <= 0)
+            {
+                if (out < 0 && errno == EINTR)
+                    continue;
+                return step_result::Closed;
+            }
+            pending -= static_cast<std::size_t>(out);
+            bytes += static_cast<std::size_t>(out);
+        }
+        return step_result::Moved;
+    }
+#endif
+}
+
+TunnelResult proxy_http::relayTunnel(socket_t client, socket_t remote, std::chrono::seconds idle_timeout)
+{
+    TunnelResult result;
+    char buffer[RELAY_BUFFER_SIZE];
+
+#ifdef __linux__
+    splice_pipe upstream, downstream;
+    bool use_splice = upstream.open() && downstream.open();
+#endif
+
+    while (true)
+    {
+        fd_set read_fds;
+        FD_ZERO(&read_fds);
+        FD_SET(client, &read_fds);
+        FD_SET(remote, &read_fds);
+
+        timeval select_timeout;
+        select_timeout.tv_sec = static_cast<long>(idle_timeout.count());
+        select_timeout.tv_usec = 0;
+
+        socket_t max_socket_descriptor = client > remote ? client : remote;
+        int activity = select(static_cast<int>(max_socket_descriptor + 1), &read_fds, nullptr, nullptr, &select_timeout);
+        if (activity == SOCKET_ERROR)
+            break;
+        if (activity == 0)
+        {
+            result.timed_out = true;
+            break;
+        }
+
+        bool closed = false;
+        for (int side = 0; side < 2 && !closed; ++side)
+        {
+            socket_t from = side == 0 ? client : remote;
+            socket_t to = side == 0 ? remote : client;
+            if (!FD_ISSET(from, &read_fds))
+                continue;
+
+            step_result step = step_result::Unsupported;
+#ifdef __linux__
+            if (use_splice)
+            {
+                step = spliceOnce(from, to, side == 0 ? upstream : downstream, result.bytes);
+                if (step == step_result::Unsupported)
+                    use_splice = false;
+                else if (step == step_result::Moved)
+                    result.spliced = true;
+            }
+#endif
+            if (step == step_result::Unsupported)
+                step = copyOnce(from, to, buffer, result.bytes);
+
+            closed = step == step_result::Closed;
+        }
+
+        if (closed)
+            break;
+    }
+
+    return result;
+}
@@ -0,0 +1,24 @@
+#pragma once
+
+#include <chrono>
+#include <cstddef>
+
+#include "proxy_utils.hpp"
+
+namespace proxy_http
+{
+
+    struct TunnelResult
+    {
+        std::size_t bytes = 0;
+        bool timed_out = false;
+        // Bytes went socket -> pipe -> socket inside the kernel.
+        bool spliced = false;
+    };
+
+    // Pipes bytes both ways between two connected sockets until either side closes or
+    // nothing moves for idle_timeout. Used for CONNECT tunnels and upgraded (101) requests.
+    // On Linux the payload is moved with splice() and never enters user space; elsewhere,
+    // or when splice is refused, it falls back to recv/send through one buffer.
+    TunnelResult relayTunnel(socket_t client, socket_t remote, std::chrono::seconds idle_timeout);
+}
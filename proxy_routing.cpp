@@ -0,0 +1,146 @@
+#include <algorithm>
+#include <charconv>
+
+#include "proxy_routing.hpp"
+#include "proxy_cache_key.hpp"
+#include "proxy_logger.hpp"
+
+using namespace proxy_routing;
+
+const char *proxy_routing::upstreamProtocolName(UpstreamProtocol protocol)
+{
+    return protocol == UpstreamProtocol::H2c ? "h2c" : "http1";
+}
+
+bool proxy_routing::parseUpstreamProtocol(std::string_view name, UpstreamProtocol &out)
+{
+    for (UpstreamProtocol protocol : {UpstreamProtocol::Http1, UpstreamProtocol::H2c})
+    {
+        if (name == upstreamProtocolName(protocol))
+        {
+            out = protocol;
+            return true;
+        }
+    }
+    return false;
+}
+
+bool proxy_routing::parseBackend(std::string_view spec, Backend &out)
+{
+    if (spec.empty())
+        return false;
+
+    std::size_t port_pos = spec.rfind(':');
+    std::size_t bracket_pos = spec.rfind(']');
+    if (port_pos == std::string_view::npos || (bracket_pos != std::string_view::npos && bracket_pos > port_pos))
+    {
+        out.host = std::string(spec);
+        out.port = "80";
+        return true;
+    }
+
+    std::string_view port = spec.substr(port_pos + 1);
+    int port_num = 0;
+    auto [ptr, ec] = std::from_chars(port.data(), port.data() + port.size(), port_num);
+    if (ec != std::errc() || ptr != port.data() + port.size() || port_num <= 0 || port_num > 65535 || port_pos == 0)
+        return false;
+
+    out.host = std::string(spec.substr(0, port_pos));
+    out.port = std::string(port);
+    return true;
+}
+
+bool proxy_routing::validateRoutingConfig(const RoutingConfig &config)
+{
+    for (const BackendPool &pool : config.pools)
+    {
+        if (pool.backends.empty())
+        {
+            log<LogLevel::Error, LogSubsystem::Config>("Pool {} has no servers.\n", pool.name);
+            return false;
+        }
+    }
+
+    for (const ParentRule &parent : config.parents)
+    {
+        if (parent.servers.empty())
+        {
+            log<LogLevel::Error, LogSubsystem::Config>("Parent {} has no servers.\n", parent.name);
+            return false;
+        }
+    }
+
+    for (const RouteRule &rule : config.routes)
+    {
+        bool known = std::any_of(config.pools.begin(), config.pools.end(), [&](const BackendPool &pool)
+                                 { return pool.name == rule.pool; });
+        if (!known)
+        {
+            log<LogLevel::Error, LogSubsystem::Config>("Route {} names unknown pool '{}'.\n", rule.name, rule.pool);
+            return false;
+        }
+    }
+    return true;
+}
+
+Router::Router() : Router(RoutingConfig{}) {}
+
+Router::Router(RoutingConfig config) : forward_proxy(config.forward_proxy)
+{
+    for (BackendPool &pool : config.pools)
+        pools.push_back(std::make_unique<pool_state>(std::move(pool)));
+
+    for (RouteRule &rule : config.routes)
+    {
+        auto pool = std::find_if(pools.begin(), pools.end(), [&](const std::unique_ptr<pool_state> &p)
+                                 { return p->name == rule.pool; });
+        if (pool == pools.end())
+            continue;
+
+        routes.push_back(route_state{std::move(rule), pool->get()});
+    }
+
+    for (ParentRule &parent : config.parents)
+        parents.push_back(std::make_unique<ParentGroup>(std::move(parent)));
+}
+
+BackendSet *Router::route(std::string_view host, std::string_view path, std::string_view &pool_name, UpstreamProtocol *protocol) const
+{
+    for (const route_state &route : routes)
+    {
+        if (proxy_cache::hostMatchesPattern(route.rule.host_pattern, host) && path.starts_with(route.rule.path_prefix))
+        {
+            pool_name = route.pool->name;
+            if (protocol)
+                *protocol = route.pool->protocol;
+            return &route.pool->backends;
+        }
+    }
+    return nullptr;
+}
+
+ParentGroup *Router::parentFor(std::string_view host) const
+{
+    for (const auto &parent : parents)
+    {
+        if (parent->matches(host))
+            return parent.get();
+    }
+    return nullptr;
+}
+
+std::vector<PoolStats> Router::poolStats() const
+{
+    std::vector<PoolStats> stats;
+    for (const auto &pool : pools)
+        stats.push_back(PoolStats{pool->name, pool->backends.balancePolicy(), pool->protocol, pool->backends.stats()});
+    return stats;
+}
+
+std::vector<ParentStats> Router::parentStats() const
+{
+    std::vector<ParentStats> stats;
+    for (const auto &parent : parents)
+        stats.push_back(parent->stats());
+    return stats;
+}
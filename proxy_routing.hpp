@@ -0,0 +1,116 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "proxy_balancer.hpp"
+#include "proxy_parent.hpp"
+
+namespace proxy_routing
+{
+
+    // How requests reach a pool's backends: one HTTP/1.1 connection per request, or streams
+    // multiplexed onto one shared prior-knowledge h2c connection per backend.
+    enum class UpstreamProtocol
+    {
+        Http1,
+        H2c
+    };
+
+    const char *upstreamProtocolName(UpstreamProtocol protocol);
+    bool parseUpstreamProtocol(std::string_view name, UpstreamProtocol &out);
+
+    struct BackendPool
+    {
+        std::string name;
+        std::vector<Backend> backends;
+        BalancePolicy balance = BalancePolicy::RoundRobin;
+        HealthConfig health;
+        UpstreamProtocol protocol = UpstreamProtocol::Http1;
+    };
+
+    struct PoolStats
+    {
+        std::string name;
+        BalancePolicy balance;
+        UpstreamProtocol protocol;
+        std::vector<BackendStats> backends;
+    };
+
+    // Sends origin-form (and matching absolute-form) requests to a backend pool. Host
+    // patterns follow hostMatchesPattern; an empty path prefix matches every path.
+    struct RouteRule
+    {
+        std::string name;
+        std::string host_pattern = "*";
+        std::string path_prefix;
+        std::string pool;
+    };
+
+    struct RoutingConfig
+    {
+        // Whether absolute-form requests that match no route are proxied to the host they
+        // name. Turn off when running purely as an accelerator in front of known origins.
+        bool forward_proxy = true;
+        std::vector<BackendPool> pools;
+        std::vector<RouteRule> routes;
+
+        // Checked in order for forward-proxy requests (GET and CONNECT) that match no route.
+        std::vector<ParentRule> parents;
+    };
+
+    // "host[:port]", port defaulting to 80.
+    bool parseBackend(std::string_view spec, Backend &out);
+
+    class Router
+    {
+    private:
+        struct pool_state
+        {
+            pool_state(BackendPool pool) : name(std::move(pool.name)), protocol(pool.protocol), backends(std::move(pool.backends), pool.balance, pool.health) {}
+
+            std::string name;
+            UpstreamProtocol protocol;
+            BackendSet backends;
+        };
+
+        struct route_state
+        {
+            RouteRule rule;
+            pool_state *pool;
+        };
+
+        bool forward_proxy;
+        std::vector<std::unique_ptr<pool_state>> pools;
+        std::vector<route_state> routes;
+        std::vector<std::unique_ptr<ParentGroup>> parents;
+
+    public:
+        Router();
+        explicit Router(RoutingConfig config);
+
+        Router(const Router &) = delete;
+        Router &operator=(const Router &) = delete;
+
+        bool forwardProxy() const { return forward_proxy; }
+        bool empty() const { return routes.empty(); }
+
+        // First matching route wins; nullptr when none matches. The caller acquires a backend
+        // from the returned pool and reports the outcome through the lease. protocol, when
+        // given, receives how the pool's backends are spoken to.
+        BackendSet *route(std::string_view host, std::string_view path, std::string_view &pool_name, UpstreamProtocol *protocol = nullptr) const;
+
+        // First parent rule whose domains match the (lowercase) host; nullptr means go direct.
+        ParentGroup *parentFor(std::string_view host) const;
+
+        std::vector<PoolStats> poolStats() const;
+        std::vector<ParentStats> parentStats() const;
+    };
+
+    // Every route must name a configured pool and every pool and parent needs a server.
+    bool validateRoutingConfig(const RoutingConfig &config);
+}
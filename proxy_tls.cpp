@@ -0,0 +1,784 @@
+#include <algorithm>
+#include <cctype>
+#include <chrono>
+#include <condition_variable>
+#include <cstdio>
+#include <deque>
+#include <functional>
+#include <future>
+#include <map>
+#include <mutex>
+#include <system_error>
+
+#include "proxy_tls.hpp"
+#include "proxy_cache_key.hpp"
+#include "proxy_logger.hpp"
+
+#ifdef PROXY_TLS_INTERCEPT
+#include <fcntl.h>
+#include <poll.h>
+#include <openssl/err.h>
+#include <openssl/evp.h>
+#include <openssl/pem.h>
+#include <openssl/rand.h>
+#include <openssl/ssl.h>
+#include <openssl/x509v3.h>
+#endif
+
+using namespace proxy_tls;
+
+// A bridged connection with no traffic either way for this long is closed.
+constexpr auto BRIDGE_IDLE_TIMEOUT = std::chrono::seconds(100);
+constexpr std::size_t BRIDGE_BUFFER_SIZE = 16 * 1024;
+
+constexpr long CA_VALIDITY_DAYS = 3650;
+// Clients reject leaf certificates valid for more than 398 days.
+constexpr long LEAF_VALIDITY_DAYS = 365;
+// Minted certificates kept per host; the map is cleared when it fills up.
+constexpr std::size_t MAX_CACHED_CERTIFICATES = 1024;
+// Origins whose last session is kept for resumption; cleared like the certificates.
+constexpr std::size_t MAX_ORIGIN_SESSIONS = 1024;
+// Longest a handshake waits on its peer between two flights.
+constexpr auto HANDSHAKE_WAIT_TIMEOUT = std::chrono::seconds(10);
+
+TlsChannel::~TlsChannel()
+{
+    // Closing our end is the pump's signal to flush what is left and say goodbye.
+    if (!kernel && plain != INVALID_SOCKET)
+        closeSocket(plain);
+    if (pump.joinable())
+        pump.join();
+}
+
+void Interceptor::countHandshake(bool resumed, std::atomic<std::uint64_t> &resumed_counter)
+{
+    handshakes.fetch_add(1, std::memory_order_relaxed);
+    if (resumed)
+        resumed_counter.fetch_add(1, std::memory_order_relaxed);
+
+    // One bucket per second, reused every RATE_WINDOW seconds. A count racing the reset of
+    // its bucket can be lost; the rate is a gauge, not an account.
+    std::int64_t now = std::chrono::duration_cast<std::chrono::seconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+    std::size_t slot = static_cast<std::size_t>(now) % RATE_WINDOW;
+    std::int64_t seen = rate_second[slot].load(std::memory_order_relaxed);
+    if (seen != now && rate_second[slot].compare_exchange_strong(seen, now, std::memory_order_relaxed))
+        rate_count[slot].store(0, std::memory_order_relaxed);
+    rate_count[slot].fetch_add(1, std::memory_order_relaxed);
+}
+
+bool Interceptor::intercepts(std::string_view host) const
+{
+    if (!tls)
+        return false;
+    return std::any_of(hosts.begin(), hosts.end(), [&](const std::string &pattern)
+                       { return proxy_cache::hostMatchesPattern(pattern, host); });
+}
+
+#ifdef PROXY_TLS_INTERCEPT
+
+namespace
+{
+    using X509Ptr = std::unique_ptr<X509, decltype(&X509_free)>;
+    using KeyPtr = std::unique_ptr<EVP_PKEY, decltype(&EVP_PKEY_free)>;
+
+    std::string sslError()
+    {
+        char text[256];
+        ERR_error_string_n(ERR_get_error(), text, sizeof(text));
+        ERR_clear_error();
+        return text;
+    }
+
+    bool isIpLiteral(const std::string &host)
+    {
+        unsigned char address[16];
+        return inet_pton(AF_INET, host.c_str(), address) == 1 || inet_pton(AF_INET6, host.c_str(), address) == 1;
+    }
+
+    // The host goes into an extension string, so anything beyond name characters is refused.
+    bool isCertifiableHost(const std::string &host)
+    {
+        return !host.empty() && host.size() <= 253 && std::all_of(host.begin(), host.end(), [](unsigned char c)
+                                                                  { return std::isalnum(c) || c == '.' || c == '-' || c == '_' || c == ':'; });
+    }
+
+    bool addExtension(X509 *cert, X509 *issuer, int nid, const std::string &value)
+    {
+        X509V3_CTX ctx;
+        X509V3_set_ctx_nodb(&ctx);
+        X509V3_set_ctx(&ctx, issuer, cert, nullptr, nullptr, 0);
+
+        X509_EXTENSION *extension = X509V3_EXT_conf_nid(nullptr, &ctx, nid, value.c_str());
+        if (!extension)
+            return false;
+        bool added = X509_add_ext(cert, extension, -1) == 1;
+        X509_EXTENSION_free(extension);
+        return added;
+    }
+
+    X509Ptr newCertificate(EVP_PKEY *key, const std::string &common_name, long days)
+    {
+        X509Ptr cert(X509_new(), X509_free);
+        if (!cert)
+            return cert;
+
+        unsigned char serial[16];
+        if (RAND_bytes(serial, sizeof(serial)) != 1)
+            return X509Ptr(nullptr, X509_free);
+        serial[0] &= 0x7f;
+        BIGNUM *number = BN_bin2bn(serial, sizeof(serial), nullptr);
+        bool ok = number && BN_to_ASN1_INTEGER(number, X509_get_serialNumber(cert.get()));
+        BN_free(number);
+
+        // Backdated an hour so clients with a slightly slow clock accept it straight away.
+        ok = ok && X509_set_version(cert.get(), 2) == 1 &&
+             X509_gmtime_adj(X509_getm_notBefore(cert.get()), -3600) &&
+             X509_gmtime_adj(X509_getm_notAfter(cert.get()), days * 24 * 3600) &&
+             X509_set_pubkey(cert.get(), key) == 1 &&
+             X509_NAME_add_entry_by_txt(X509_get_subject_name(cert.get()), "CN", MBSTRING_UTF8,
+                                        reinterpret_cast<const unsigned char *>(common_name.c_str()), -1, -1, 0) == 1;
+        return ok ? std::move(cert) : X509Ptr(nullptr, X509_free);
+    }
+
+    int selectHttp11(SSL *, const unsigned char **out, unsigned char *out_size, const unsigned char *in, unsigned int in_size, void *)
+    {
+        // Intercepted connections are served as HTTP/1.1; h2 offers are declined.
+        for (unsigned int offset = 0; offset < in_size; offset += 1 + in[offset])
+        {
+            if (in[offset] == 8 && offset + 9 <= in_size && std::equal(in + offset + 1, in + offset + 9, "http/1.1"))
+            {
+                *out = in + offset + 1;
+                *out_size = 8;
+                return SSL_TLSEXT_ERR_OK;
+            }
+        }
+        return SSL_TLSEXT_ERR_NOACK;
+    }
+
+    bool sendAll(socket_t s, const char *data, std::size_t size)
+    {
+        while (size > 0)
+        {
+            int sent = send(s, data, static_cast<int>(size), 0);
+            if (sent <= 0)
+                return false;
+            data += sent;
+            size -= static_cast<std::size_t>(sent);
+        }
+        return true;
+    }
+
+    // Runs handshake steps for threads that only wait on sockets, so full handshakes (key
+    // exchange and signatures) take at most this many cores however many arrive at once.
+    class HandshakePool
+    {
+    private:
+        std::mutex mutex;
+        std::condition_variable work_ready;
+        std::deque<std::function<void()>> jobs;
+        std::vector<std::thread> workers;
+        bool stopping = false;
+
+        void work()
+        {
+            while (true)
+            {
+                std::function<void()> job;
+                {
+                    std::unique_lock<std::mutex> lock(mutex);
+                    work_ready.wait(lock, [&]() { return stopping || !jobs.empty(); });
+                    if (jobs.empty())
+                        return;
+                    job = std::move(jobs.front());
+                    jobs.pop_front();
+                }
+                job();
+            }
+        }
+
+    public:
+        explicit HandshakePool(std::size_t threads)
+        {
+            for (std::size_t i = 0; i < threads; ++i)
+                workers.emplace_back(&HandshakePool::work, this);
+        }
+
+        ~HandshakePool()
+        {
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                stopping = true;
+            }
+            work_ready.notify_all();
+            for (std::thread &worker : workers)
+                worker.join();
+        }
+
+        std::size_t size() const { return workers.size(); }
+
+        // Runs step on a pool thread and returns once it has finished.
+        void run(const std::function<void()> &step)
+        {
+            std::promise<void> finished;
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                jobs.emplace_back([&]()
+                                  {
+                                      step();
+                                      finished.set_value();
+                                  });
+            }
+            work_ready.notify_one();
+            finished.get_future().wait();
+        }
+    };
+
+    // Sessions are tied to the host they were made for, so a ticket issued under one minted
+    // certificate is never accepted for another. The context is at most 32 bytes, hence the hash.
+    bool setSessionContext(SSL *ssl, const std::string &host)
+    {
+        unsigned char digest[EVP_MAX_MD_SIZE];
+        unsigned int size = 0;
+        return EVP_Digest(host.data(), host.size(), digest, &size, EVP_sha256(), nullptr) == 1 &&
+               SSL_set_session_id_context(ssl, digest, size) == 1;
+    }
+
+    // SSL ex_data slot holding the "host:port" an origin link was opened for.
+    int originKeyIndex()
+    {
+        static const int index = SSL_get_ex_new_index(0, nullptr, nullptr, nullptr,
+                                                      [](void *, void *key, CRYPTO_EX_DATA *, int, long, void *)
+                                                      { delete static_cast<std::string *>(key); });
+        return index;
+    }
+
+    // The userspace record layer: decrypted bytes go to local, bytes from local are
+    // encrypted onto tls_socket. Ends when local closes (after a close_notify) or the peer
+    // goes away and local has drained.
+    void pumpRecords(SSL *ssl, socket_t tls_socket, socket_t local)
+    {
+        char buffer[BRIDGE_BUFFER_SIZE];
+        bool peer_open = true;
+
+        while (true)
+        {
+            bool peer_ready = peer_open && SSL_pending(ssl) > 0;
+            bool local_ready = false;
+
+            if (!peer_ready)
+            {
+                fd_set read_fds;
+                FD_ZERO(&read_fds);
+                FD_SET(local, &read_fds);
+                if (peer_open)
+                    FD_SET(tls_socket, &read_fds);
+
+                timeval select_timeout;
+                select_timeout.tv_sec = static_cast<long>(BRIDGE_IDLE_TIMEOUT.count());
+                select_timeout.tv_usec = 0;
+
+                int activity = select(std::max(local, tls_socket) + 1, &read_fds, nullptr, nullptr, &select_timeout);
+                if (activity <= 0)
+                    break;
+                peer_ready = peer_open && FD_ISSET(tls_socket, &read_fds);
+                local_ready = FD_ISSET(local, &read_fds);
+            }
+
+            if (local_ready)
+            {
+                int received = recv(local, buffer, static_cast<int>(sizeof(buffer)), 0);
+                if (received <= 0 || SSL_write(ssl, buffer, received) <= 0)
+                    break;
+            }
+
+            if (peer_ready)
+            {
+                int received = SSL_read(ssl, buffer, static_cast<int>(sizeof(buffer)));
+                if (received <= 0)
+                {
+                    if (SSL_get_error(ssl, received) == SSL_ERROR_WANT_READ)
+                        continue;
+                    // The proxy sees end-of-stream but may still be writing its answer.
+                    peer_open = false;
+                    shutdown(local, SHUT_WR);
+                }
+                else if (!sendAll(local, buffer, static_cast<std::size_t>(received)))
+                    break;
+            }
+        }
+
+        SSL_shutdown(ssl);
+        SSL_free(ssl);
+        closeSocket(local);
+    }
+}
+
+struct Interceptor::state
+{
+    SSL_CTX *server_ctx = nullptr;
+    SSL_CTX *client_ctx = nullptr;
+    X509Ptr ca_cert{nullptr, X509_free};
+    KeyPtr ca_key{nullptr, EVP_PKEY_free};
+    // One key serves every minted certificate; only the CA key needs to stay secret.
+    KeyPtr leaf_key{nullptr, EVP_PKEY_free};
+
+    std::mutex certificates_mutex;
+    std::map<std::string, X509Ptr> certificates;
+    std::atomic<std::uint64_t> issued{0};
+
+    std::unique_ptr<HandshakePool> crypto;
+
+    // Last session per origin "host:port", owned (one reference each).
+    std::mutex sessions_mutex;
+    std::map<std::string, SSL_SESSION *> origin_sessions;
+
+    ~state()
+    {
+        crypto.reset();
+        for (auto &[origin, session] : origin_sessions)
+            SSL_SESSION_free(session);
+        SSL_CTX_free(server_ctx);
+        SSL_CTX_free(client_ctx);
+    }
+
+    bool loadOrCreateCa(const InterceptConfig &config);
+
+    // A new reference to the certificate for host, minted on first use.
+    X509Ptr certificateFor(const std::string &host);
+
+    // Drives the handshake to completion: each step runs on the crypto pool, and between
+    // steps the calling thread polls the socket (non-blocking for the duration). failure
+    // says why when it returns false.
+    bool handshake(SSL *ssl, socket_t tcp_socket, std::string &failure);
+
+    // Offers the origin's last session; TLS 1.3 tickets are taken out, as they are meant
+    // for one use.
+    void resumeOrigin(SSL *ssl, const std::string &origin);
+    void forgetOrigin(const std::string &origin);
+
+    // SSL_CTX new-session callback of the client context: keeps the newest session per
+    // origin, including TLS 1.3 tickets that arrive after the handshake.
+    static int storeOriginSession(SSL *ssl, SSL_SESSION *session);
+};
+
+bool Interceptor::state::handshake(SSL *ssl, socket_t tcp_socket, std::string &failure)
+{
+    int flags = fcntl(tcp_socket, F_GETFL, 0);
+    if (flags < 0 || fcntl(tcp_socket, F_SETFL, flags | O_NONBLOCK) < 0)
+    {
+        failure = "cannot make the socket non-blocking";
+        return false;
+    }
+
+    bool done = false;
+    while (true)
+    {
+        int result = 0;
+        int error = SSL_ERROR_NONE;
+        // The error queue is per thread, so it is read where the step ran.
+        crypto->run([&]()
+                    {
+                        ERR_clear_error();
+                        result = SSL_do_handshake(ssl);
+                        error = SSL_get_error(ssl, result);
+                        if (result != 1 && error != SSL_ERROR_WANT_READ && error != SSL_ERROR_WANT_WRITE)
+                            failure = ERR_peek_error() ? sslError() : "connection closed during the handshake";
+                    });
+
+        if (result == 1)
+        {
+            done = true;
+            break;
+        }
+        if (error != SSL_ERROR_WANT_READ && error != SSL_ERROR_WANT_WRITE)
+            break;
+
+        pollfd wait{tcp_socket, static_cast<short>(error == SSL_ERROR_WANT_READ ? POLLIN : POLLOUT), 0};
+        int ready = poll(&wait, 1, static_cast<int>(std::chrono::milliseconds(HANDSHAKE_WAIT_TIMEOUT).count()));
+        if (ready <= 0)
+        {
+            failure = ready == 0 ? "timed out" : "poll failed";
+            break;
+        }
+    }
+
+    fcntl(tcp_socket, F_SETFL, flags);
+    return done;
+}
+
+void Interceptor::state::resumeOrigin(SSL *ssl, const std::string &origin)
+{
+    std::lock_guard<std::mutex> lock(sessions_mutex);
+    auto it = origin_sessions.find(origin);
+    if (it == origin_sessions.end())
+        return;
+
+    SSL_set_session(ssl, it->second);
+    if (SSL_SESSION_get_protocol_version(it->second) == TLS1_3_VERSION)
+    {
+        SSL_SESSION_free(it->second);
+        origin_sessions.erase(it);
+    }
+}
+
+void Interceptor::state::forgetOrigin(const std::string &origin)
+{
+    std::lock_guard<std::mutex> lock(sessions_mutex);
+    auto it = origin_sessions.find(origin);
+    if (it != origin_sessions.end())
+    {
+        SSL_SESSION_free(it->second);
+        origin_sessions.erase(it);
+    }
+}
+
+int Interceptor::state::storeOriginSession(SSL *ssl, SSL_SESSION *session)
+{
+    auto *self = static_cast<state *>(SSL_CTX_get_app_data(SSL_get_SSL_CTX(ssl)));
+    auto *origin = static_cast<std::string *>(SSL_get_ex_data(ssl, originKeyIndex()));
+    if (!self || !origin || !SSL_SESSION_is_resumable(session))
+        return 0;
+
+    std::lock_guard<std::mutex> lock(self->sessions_mutex);
+    auto [it, inserted] = self->origin_sessions.try_emplace(*origin, session);
+    if (!inserted)
+    {
+        SSL_SESSION_free(it->second);
+        it->second = session;
+    }
+    else if (self->origin_sessions.size() > MAX_ORIGIN_SESSIONS)
+    {
+        for (auto &[key, stored] : self->origin_sessions)
+            if (stored != session)
+                SSL_SESSION_free(stored);
+        self->origin_sessions.clear();
+        self->origin_sessions.emplace(*origin, session);
+    }
+    // 1: the reference OpenSSL handed over is now ours.
+    return 1;
+}
+
+bool Interceptor::state::loadOrCreateCa(const InterceptConfig &config)
+{
+    FILE *cert_file = std::fopen(config.ca_cert.c_str(), "r");
+    FILE *key_file = std::fopen(config.ca_key.c_str(), "r");
+
+    if (cert_file || key_file)
+    {
+        if (cert_file)
+        {
+            ca_cert.reset(PEM_read_X509(cert_file, nullptr, nullptr, nullptr));
+            std::fclose(cert_file);
+        }
+        if (key_file)
+        {
+            ca_key.reset(PEM_read_PrivateKey(key_file, nullptr, nullptr, nullptr));
+            std::fclose(key_file);
+        }
+
+        if (!ca_cert || !ca_key || X509_check_private_key(ca_cert.get(), ca_key.get()) != 1)
+        {
+            log<LogLevel::Error, LogSubsystem::Connect>("TLS|{} and {} do not hold a matching CA certificate and key.\n", config.ca_cert, config.ca_key);
+            return false;
+        }
+        log<LogLevel::Info, LogSubsystem::Connect>("TLS|Loaded interception CA from {}.\n", config.ca_cert);
+        return true;
+    }
+
+    ca_key.reset(EVP_EC_gen("P-256"));
+    if (!ca_key)
+        return false;
+
+    ca_cert = newCertificate(ca_key.get(), "proxy_main interception CA", CA_VALIDITY_DAYS);
+    if (!ca_cert ||
+        X509_set_issuer_name(ca_cert.get(), X509_get_subject_name(ca_cert.get())) != 1 ||
+        !addExtension(ca_cert.get(), ca_cert.get(), NID_basic_constraints, "critical,CA:TRUE,pathlen:0") ||
+        !addExtension(ca_cert.get(), ca_cert.get(), NID_key_usage, "critical,keyCertSign,cRLSign") ||
+        !addExtension(ca_cert.get(), ca_cert.get(), NID_subject_key_identifier, "hash") ||
+        X509_sign(ca_cert.get(), ca_key.get(), EVP_sha256()) == 0)
+        return false;
+
+    // The key file is created owner-only before anything is written to it.
+    int key_fd = open(config.ca_key.c_str(), O_WRONLY | O_CREAT | O_EXCL, 0600);
+    key_file = key_fd >= 0 ? fdopen(key_fd, "w") : nullptr;
+    bool written = key_file && PEM_write_PrivateKey(key_file, ca_key.get(), nullptr, nullptr, 0, nullptr, nullptr) == 1;
+    if (key_file)
+        std::fclose(key_file);
+    else if (key_fd >= 0)
+        close(key_fd);
+
+    cert_file = written ? std::fopen(config.ca_cert.c_str(), "w") : nullptr;
+    written = cert_file && PEM_write_X509(cert_file, ca_cert.get()) == 1;
+    if (cert_file)
+        std::fclose(cert_file);
+
+    if (!written)
+    {
+        log<LogLevel::Error, LogSubsystem::Connect>("TLS|Could not write the interception CA to {} / {}.\n", config.ca_cert, config.ca_key);
+        return false;
+    }
+    log<LogLevel::Info, LogSubsystem::Connect>("TLS|Generated interception CA in {}; clients must trust it for intercepted hosts.\n", config.ca_cert);
+    return true;
+}
+
+X509Ptr Interceptor::state::certificateFor(const std::string &host)
+{
+    std::lock_guard<std::mutex> lock(certificates_mutex);
+
+    auto it = certificates.find(host);
+    if (it == certificates.end())
+    {
+        X509Ptr cert = newCertificate(leaf_key.get(), host, LEAF_VALIDITY_DAYS);
+        std::string alt_name = (isIpLiteral(host) ? "IP:" : "DNS:") + host;
+        if (!cert ||
+            X509_set_issuer_name(cert.get(), X509_get_subject_name(ca_cert.get())) != 1 ||
+            !addExtension(cert.get(), ca_cert.get(), NID_basic_constraints, "critical,CA:FALSE") ||
+            !addExtension(cert.get(), ca_cert.get(), NID_key_usage, "critical,digitalSignature") ||
+            !addExtension(cert.get(), ca_cert.get(), NID_ext_key_usage, "serverAuth") ||
+            !addExtension(cert.get(), ca_cert.get(), NID_subject_alt_name, alt_name) ||
+            !addExtension(cert.get(), ca_cert.get(), NID_authority_key_identifier, "keyid:always") ||
+            X509_sign(cert.get(), ca_key.get(), EVP_sha256()) == 0)
+            return X509Ptr(nullptr, X509_free);
+
+        if (certificates.size() >= MAX_CACHED_CERTIFICATES)
+            certificates.clear();
+        it = certificates.emplace(host, std::move(cert)).first;
+        issued.fetch_add(1, std::memory_order_relaxed);
+    }
+
+    X509_up_ref(it->second.get());
+    return X509Ptr(it->second.get(), X509_free);
+}
+
+Interceptor::Interceptor(const InterceptConfig &config) : hosts(config.hosts)
+{
+    if (hosts.empty())
+        return;
+
+    auto setup = std::make_unique<state>();
+    setup->leaf_key.reset(EVP_EC_gen("P-256"));
+    setup->server_ctx = SSL_CTX_new(TLS_server_method());
+    setup->client_ctx = SSL_CTX_new(TLS_client_method());
+
+    if (!setup->leaf_key || !setup->server_ctx || !setup->client_ctx || !setup->loadOrCreateCa(config))
+    {
+        log<LogLevel::Error, LogSubsystem::Connect>("TLS|Interception disabled: {}\n", sslError());
+        return;
+    }
+
+    for (SSL_CTX *ctx : {setup->server_ctx, setup->client_ctx})
+    {
+        SSL_CTX_set_min_proto_version(ctx, TLS1_2_VERSION);
+        if (config.ktls)
+            SSL_CTX_set_options(ctx, SSL_OP_ENABLE_KTLS);
+    }
+
+    if (config.session_cache)
+    {
+        // Session IDs live in the server context's cache; tickets are sealed with its
+        // ticket key. Both are shared by every client thread. A TLS 1.3 server sends its
+        // ticket before SSL_accept returns, so nothing follows the handshake that a kTLS
+        // socket would have to take.
+        SSL_CTX_set_session_cache_mode(setup->server_ctx, SSL_SESS_CACHE_SERVER);
+        SSL_CTX_sess_set_cache_size(setup->server_ctx, static_cast<long>(config.session_cache_size));
+        SSL_CTX_set_timeout(setup->server_ctx, static_cast<long>(std::chrono::duration_cast<std::chrono::seconds>(config.session_lifetime).count()));
+        SSL_CTX_set_num_tickets(setup->server_ctx, 1);
+
+        SSL_CTX_set_session_cache_mode(setup->client_ctx, SSL_SESS_CACHE_CLIENT | SSL_SESS_CACHE_NO_INTERNAL_STORE);
+        SSL_CTX_sess_set_new_cb(setup->client_ctx, state::storeOriginSession);
+        SSL_CTX_set_app_data(setup->client_ctx, setup.get());
+    }
+    else
+    {
+        SSL_CTX_set_session_cache_mode(setup->server_ctx, SSL_SESS_CACHE_OFF);
+        SSL_CTX_set_options(setup->server_ctx, SSL_OP_NO_TICKET);
+        SSL_CTX_set_num_tickets(setup->server_ctx, 0);
+        SSL_CTX_set_session_cache_mode(setup->client_ctx, SSL_SESS_CACHE_OFF);
+    }
+    SSL_CTX_set_alpn_select_cb(setup->server_ctx, selectHttp11, nullptr);
+
+    static constexpr unsigned char ALPN_HTTP11[] = {8, 'h', 't', 't', 'p', '/', '1', '.', '1'};
+    SSL_CTX_set_alpn_protos(setup->client_ctx, ALPN_HTTP11, sizeof(ALPN_HTTP11));
+    if (config.verify_upstream)
+    {
+        SSL_CTX_set_default_verify_paths(setup->client_ctx);
+        SSL_CTX_set_verify(setup->client_ctx, SSL_VERIFY_PEER, nullptr);
+    }
+
+    std::size_t threads = config.handshake_threads ? config.handshake_threads : std::max(1u, std::thread::hardware_concurrency());
+    setup->crypto = std::make_unique<HandshakePool>(threads);
+    log<LogLevel::Info, LogSubsystem::Connect>("TLS|{} handshake thread(s), session resumption {}.\n", threads, config.session_cache ? "on" : "off");
+
+    tls = std::move(setup);
+}
+
+Interceptor::~Interceptor() = default;
+
+std::unique_ptr<TlsChannel> Interceptor::finishHandshake(SSL *ssl, socket_t tcp_socket, bool allow_offload)
+{
+    auto channel = std::make_unique<TlsChannel>();
+
+    // Both directions in the kernel: the SSL object is no longer needed (its socket BIO does
+    // not own the descriptor), and the socket carries plaintext from here on.
+    if (allow_offload && BIO_ctrl(SSL_get_wbio(ssl), BIO_CTRL_GET_KTLS_SEND, 0, nullptr) > 0 &&
+        BIO_ctrl(SSL_get_rbio(ssl), BIO_CTRL_GET_KTLS_RECV, 0, nullptr) > 0)
+    {
+        SSL_free(ssl);
+        channel->plain = tcp_socket;
+        channel->kernel = true;
+        offloaded.fetch_add(1, std::memory_order_relaxed);
+        return channel;
+    }
+
+    int pair[2];
+    if (socketpair(AF_UNIX, SOCK_STREAM, 0, pair) != 0)
+    {
+        SSL_free(ssl);
+        return nullptr;
+    }
+
+    // A session ticket or key update arriving on its own must not leave SSL_read blocked
+    // waiting for application data while the other direction has bytes to send.
+    SSL_clear_mode(ssl, SSL_MODE_AUTO_RETRY);
+
+    try
+    {
+        channel->pump = std::thread(pumpRecords, ssl, tcp_socket, pair[1]);
+    }
+    catch (const std::system_error &)
+    {
+        SSL_free(ssl);
+        closeSocket(pair[0]);
+        closeSocket(pair[1]);
+        return nullptr;
+    }
+
+    channel->plain = pair[0];
+    bridged.fetch_add(1, std::memory_order_relaxed);
+    return channel;
+}
+
+std::unique_ptr<TlsChannel> Interceptor::acceptClient(socket_t client_socket, const std::string &host)
+{
+    if (!tls || !isCertifiableHost(host))
+        return nullptr;
+    client_sessions.fetch_add(1, std::memory_order_relaxed);
+
+    X509Ptr cert = tls->certificateFor(host);
+    SSL *ssl = cert ? SSL_new(tls->server_ctx) : nullptr;
+    if (!ssl || SSL_use_certificate(ssl, cert.get()) != 1 || SSL_use_PrivateKey(ssl, tls->leaf_key.get()) != 1 ||
+        SSL_add1_chain_cert(ssl, tls->ca_cert.get()) != 1 || !setSessionContext(ssl, host) ||
+        SSL_set_fd(ssl, static_cast<int>(client_socket)) != 1)
+    {
+        log<LogLevel::Error, LogSubsystem::Connect>("TLS|Could not set up a certificate for {}: {}\n", host, sslError());
+        SSL_free(ssl);
+        handshake_failures.fetch_add(1, std::memory_order_relaxed);
+        return nullptr;
+    }
+
+    SSL_set_accept_state(ssl);
+    std::string failure;
+    if (!tls->handshake(ssl, client_socket, failure))
+    {
+        log<LogLevel::Warn, LogSubsystem::Connect>("TLS|Client handshake for {} failed: {}\n", host, failure);
+        SSL_free(ssl);
+        handshake_failures.fetch_add(1, std::memory_order_relaxed);
+        return nullptr;
+    }
+
+    countHandshake(SSL_session_reused(ssl) == 1, client_resumed);
+    return finishHandshake(ssl, client_socket, true);
+}
+
+std::unique_ptr<TlsChannel> Interceptor::connectOrigin(socket_t remote_socket, const std::string &host, const std::string &port)
+{
+    if (!tls)
+        return nullptr;
+    origin_sessions.fetch_add(1, std::memory_order_relaxed);
+
+    std::string origin = host + ":" + port;
+    SSL *ssl = SSL_new(tls->client_ctx);
+    bool ip = isIpLiteral(host);
+    if (!ssl || (!ip && SSL_set_tlsext_host_name(ssl, host.c_str()) != 1) ||
+        (ip ? X509_VERIFY_PARAM_set1_ip_asc(SSL_get0_param(ssl), host.c_str()) : SSL_set1_host(ssl, host.c_str())) != 1 ||
+        SSL_set_ex_data(ssl, originKeyIndex(), new std::string(origin)) != 1 ||
+        SSL_set_fd(ssl, static_cast<int>(remote_socket)) != 1)
+    {
+        SSL_free(ssl);
+        handshake_failures.fetch_add(1, std::memory_order_relaxed);
+        return nullptr;
+    }
+
+    tls->resumeOrigin(ssl, origin);
+    SSL_set_connect_state(ssl);
+    std::string failure;
+    if (!tls->handshake(ssl, remote_socket, failure))
+    {
+        long verify = SSL_get_verify_result(ssl);
+        log<LogLevel::Warn, LogSubsystem::Connect>("TLS|Origin handshake with {} failed: {}\n", host,
+            verify != X509_V_OK ? std::string(X509_verify_cert_error_string(verify)) : failure);
+        tls->forgetOrigin(origin);
+        SSL_free(ssl);
+        handshake_failures.fetch_add(1, std::memory_order_relaxed);
+        return nullptr;
+    }
+
+    countHandshake(SSL_session_reused(ssl) == 1, origin_resumed);
+
+    // TLS 1.3 origins send session tickets after the handshake, which raw recv() on a kTLS
+    // socket cannot take; only TLS 1.2 origin links are handed to the kernel.
+    return finishHandshake(ssl, remote_socket, SSL_version(ssl) == TLS1_2_VERSION);
+}
+
+#else
+
+struct Interceptor::state
+{
+    std::atomic<std::uint64_t> issued{0};
+};
+
+Interceptor::Interceptor(const InterceptConfig &config) : hosts(config.hosts)
+{
+    if (!hosts.empty())
+        log<LogLevel::Warn, LogSubsystem::Connect>("TLS|[intercept] hosts are set, but this build has no TLS support (PROXY_TLS_INTERCEPT); CONNECT stays a tunnel.\n");
+}
+
+Interceptor::~Interceptor() = default;
+
+std::unique_ptr<TlsChannel> Interceptor::finishHandshake(ssl_st *, socket_t, bool)
+{
+    return nullptr;
+}
+
+std::unique_ptr<TlsChannel> Interceptor::acceptClient(socket_t, const std::string &)
+{
+    return nullptr;
+}
+
+std::unique_ptr<TlsChannel> Interceptor::connectOrigin(socket_t, const std::string &, const std::string &)
+{
+    return nullptr;
+}
+
+#endif
+
+InterceptStats Interceptor::stats() const
+{
+    InterceptStats result{client_sessions.load(std::memory_order_relaxed), origin_sessions.load(std::memory_order_relaxed),
+                          offloaded.load(std::memory_order_relaxed), bridged.load(std::memory_order_relaxed),
+                          handshake_failures.load(std::memory_order_relaxed), 0,
+                          handshakes.load(std::memory_order_relaxed), client_resumed.load(std::memory_order_relaxed),
+                          origin_resumed.load(std::memory_order_relaxed), 0.0, 0.0};
+    if (tls)
+        result.certificates_issued = tls->issued.load(std::memory_order_relaxed);
+
+    std::int64_t now = std::chrono::duration_cast<std::chrono::seconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+    std::uint64_t recent = 0;
+    for (std::size_t slot = 0; slot < RATE_WINDOW; ++slot)
+        if (now - rate_second[slot].load(std::memory_order_relaxed) < static_cast<std::int64_t>(RATE_WINDOW))
+            recent += rate_count[slot].load(std::memory_order_relaxed);
+    result.handshake_rate = static_cast<double>(recent) / RATE_WINDOW;
+    if (result.handshakes > 0)
+        result.resumption_ratio = static_cast<double>(result.client_resumed + result.origin_resumed) / result.handshakes;
+    return result;
+}
@@ -0,0 +1,136 @@
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <vector>
+
+#include "proxy_utils.hpp"
+
+// OpenSSL's SSL, kept out of this header so builds without OpenSSL still compile it.
+struct ssl_st;
+
+namespace proxy_tls
+{
+
+    // Which CONNECT targets are terminated instead of tunnelled, and the CA their
+    // certificates are minted from. The CA files are created on first start when missing;
+    // clients must trust ca_cert for intercepted hosts.
+    struct InterceptConfig
+    {
+        std::vector<std::string> hosts; // hostMatchesPattern patterns, lowercase
+        std::string ca_cert = "proxy_ca.pem";
+        std::string ca_key = "proxy_ca.key";
+        // Hand the record layer to the kernel after the handshake when it supports it.
+        bool ktls = true;
+        bool verify_upstream = true;
+
+        // Resumption: session IDs and tickets for clients, the last session per origin for
+        // upstream links. Off means every handshake is a full one.
+        bool session_cache = true;
+        std::chrono::milliseconds session_lifetime = std::chrono::hours(2);
+        std::size_t session_cache_size = 20480;
+
+        // Threads that run the handshake crypto; 0 means one per core.
+        std::size_t handshake_threads = 0;
+    };
+
+    struct InterceptStats
+    {
+        std::uint64_t client_sessions;
+        std::uint64_t origin_sessions;
+        std::uint64_t offloaded; // both directions on kTLS
+        std::uint64_t bridged;   // userspace record layer behind a socket pair
+        std::uint64_t handshake_failures;
+        std::uint64_t certificates_issued;
+        std::uint64_t handshakes;      // completed, both sides
+        std::uint64_t client_resumed;  // of client_sessions, resumed from an ID or ticket
+        std::uint64_t origin_resumed;  // of origin_sessions, resumed from the cached session
+        double handshake_rate;         // completed per second over the last RATE_WINDOW seconds
+        double resumption_ratio;       // resumed / handshakes
+    };
+
+    constexpr std::size_t RATE_WINDOW = 10;
+
+    // The plaintext side of one TLS connection. With kTLS the kernel encrypts and decrypts
+    // on the TCP socket itself, so socket() is that socket and cache hits written to it never
+    // pass through user-space crypto. Otherwise a pump thread moves records between the TCP
+    // socket and one end of a local socket pair, and socket() is the other end. Either way
+    // the rest of the proxy reads and writes plain HTTP with send/recv. The TCP socket stays
+    // owned by the caller and must outlive the channel.
+    class TlsChannel
+    {
+    private:
+        friend class Interceptor;
+
+        socket_t plain = INVALID_SOCKET;
+        bool kernel = false;
+        std::thread pump;
+
+    public:
+        TlsChannel() = default;
+        TlsChannel(const TlsChannel &) = delete;
+        TlsChannel &operator=(const TlsChannel &) = delete;
+
+        // Closes the plaintext side and waits for the pump to flush and send close_notify.
+        ~TlsChannel();
+
+        socket_t socket() const { return plain; }
+        bool offloaded() const { return kernel; }
+    };
+
+    class Interceptor
+    {
+    private:
+        struct state;
+
+        std::vector<std::string> hosts;
+        std::unique_ptr<state> tls;
+
+        std::atomic<std::uint64_t> client_sessions{0};
+        std::atomic<std::uint64_t> origin_sessions{0};
+        std::atomic<std::uint64_t> offloaded{0};
+        std::atomic<std::uint64_t> bridged{0};
+        std::atomic<std::uint64_t> handshake_failures{0};
+        std::atomic<std::uint64_t> handshakes{0};
+        std::atomic<std::uint64_t> client_resumed{0};
+        std::atomic<std::uint64_t> origin_resumed{0};
+
+        // Completed handshakes per wall-clock second, for the last RATE_WINDOW seconds.
+        std::array<std::atomic<std::int64_t>, RATE_WINDOW> rate_second{};
+        std::array<std::atomic<std::uint64_t>, RATE_WINDOW> rate_count{};
+
+        void countHandshake(bool resumed, std::atomic<std::uint64_t> &resumed_counter);
+        std::unique_ptr<TlsChannel> finishHandshake(ssl_st *ssl, socket_t tcp_socket, bool allow_offload);
+
+    public:
+        // Loads or creates the CA. Interception stays off when no hosts are listed, the CA
+        // cannot be set up, or the proxy was built without PROXY_TLS_INTERCEPT.
+        explicit Interceptor(const InterceptConfig &config);
+        ~Interceptor();
+
+        Interceptor(const Interceptor &) = delete;
+        Interceptor &operator=(const Interceptor &) = delete;
+
+        bool enabled() const { return tls != nullptr; }
+
+        // host is lowercase, without the port.
+        bool intercepts(std::string_view host) const;
+
+        // Server-side handshake on a client that was just told the tunnel is open, presenting
+        // a certificate for host. The crypto runs on the handshake pool; the calling thread
+        // only waits for the socket. nullptr when the handshake fails.
+        std::unique_ptr<TlsChannel> acceptClient(socket_t client_socket, const std::string &host);
+
+        // Client-side handshake with an origin, verified against the system trust store
+        // unless verify_upstream is off. Resumes the last session seen for host:port.
+        std::unique_ptr<TlsChannel> connectOrigin(socket_t remote_socket, const std::string &host, const std::string &port);
+
+        InterceptStats stats() const;
+    };
+}